@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*
+ * Trace the execution recorded in a Spike or QEMU log (see
+ * commit-log-reader.h), using the reference trace-encoder, and report
+ * how much trace was generated, and how quickly the log was processed,
+ * as a single JSON object on stdout.
+ *
+ * With "--verify", the trace is also decoded, as it is generated, by the
+ * trace-decoder (with the instructions taken from the log itself), and
+ * every PC decoded is checked against the log, which is read once more,
+ * concurrently, on another thread (see decoder-verifier.h). So logs must
+ * be files, rather than stdin. For example, to build and run it:
+ *
+ *  cc -O2 -pthread -I<riscv-disassembler> -o commit-log-encode \
+ *      commit-log-encode.c commit-log-reader.c encoder-algorithm-public.c \
+ *      decoder-algorithm-public.c decoder-verifier.c decoder-batch-ring.c \
+ *      <riscv-disassembler>/riscv-disas.c
+ *
+ *  spike -l --log=boot.log pk hello
+ *  ./commit-log-encode --max-resync=1000 --verify boot.log
+ *
+ * Run with "--help" for the list of options.
+ */
+#include <assert.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include "commit-log-reader.h"
+#include "decoder-verifier.h"
+
+
+/*
+ * Initial number of slots in the instruction image (must be a power
+ * of 2). The image doubles in size whenever it becomes half full.
+ */
+#define IMAGE_BITS      (16)        /* 2^16 = 65536 instructions */
+
+
+/*
+ * The "user-data" passed to the trace-encoder and the trace-decoder.
+ */
+typedef struct
+{
+    te_decoder_state_t * decoder;   /* NULL == not verifying */
+    te_verifier_t verifier;
+
+    /*
+     * open-addressing hash table of the encoding of every instruction
+     * retired (by address), from which te_get_instruction() is served.
+     * A zero encoding (which can never retire) marks an unused slot.
+     */
+    te_address_t * image_pcs;
+    uint32_t * image_instructions;
+    size_t image_mask;              /* number of slots, minus one */
+    size_t image_count;             /* number of slots in use */
+
+    /* the logs, to be read again for the golden PCs */
+    const te_commit_log_params_t * params;
+    char * const * filenames;
+    int num_filenames;
+} session_t;
+
+
+/*
+ * Print some trace-encoding diagnostics (to stderr, so that
+ * they never corrupt the JSON written to stdout).
+ */
+extern void te_log_printf(
+    const char * const format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+
+/*
+ * The messages are counted (by the encoder), and decoded immediately
+ * if verifying, but they are never kept.
+ */
+static void decode_te_inst(
+    void * const user_data,
+    const te_inst_t * const te_inst)
+{
+    session_t * const session = user_data;
+
+    if (session->decoder)
+    {
+        te_process_te_inst(session->decoder, te_inst);
+    }
+}
+
+static void decode_te_support(
+    void * const user_data,
+    const te_support_t * const te_support)
+{
+    session_t * const session = user_data;
+
+    if (session->decoder)
+    {
+        te_process_te_support(session->decoder, te_support);
+    }
+}
+
+
+/*
+ * Return the slot in the instruction image for "pc", which
+ * is either the one holding it, or the unused one it belongs in.
+ */
+static size_t image_slot(
+    const session_t * const session,
+    const te_address_t pc)
+{
+    size_t slot = (size_t)((pc >> 1) * 0x9e3779b97f4a7c15ull >> 17) & session->image_mask;
+
+    while ( (session->image_instructions[slot]) &&
+            (session->image_pcs[slot] != pc) )
+    {
+        slot = (slot + 1u) & session->image_mask;
+    }
+
+    return slot;
+}
+
+
+/*
+ * Add each instruction retired to the instruction image, before
+ * the trace-encoder (and hence trace-decoder) sees it.
+ */
+static void record_instruction(
+    void * const user_data,
+    const te_address_t pc,
+    const uint32_t instruction)
+{
+    session_t * const session = user_data;
+    te_address_t * const old_pcs = session->image_pcs;
+    uint32_t * const old_instructions = session->image_instructions;
+    const size_t old_size = session->image_mask + 1u;
+    size_t slot = image_slot(session, pc);
+    size_t i;
+
+    if (session->image_instructions[slot])
+    {
+        session->image_instructions[slot] = instruction;    /* may be modified */
+        return;
+    }
+
+    session->image_pcs[slot] = pc;
+    session->image_instructions[slot] = instruction;
+    session->image_count++;
+
+    if (2u * session->image_count > old_size)
+    {
+        session->image_mask = 2u * old_size - 1u;
+        session->image_pcs = calloc(2u * old_size, sizeof(te_address_t));
+        session->image_instructions = calloc(2u * old_size, sizeof(uint32_t));
+        assert(session->image_pcs);
+        assert(session->image_instructions);
+        for (i = 0; i < old_size; i++)
+        {
+            if (old_instructions[i])
+            {
+                slot = image_slot(session, old_pcs[i]);
+                session->image_pcs[slot] = old_pcs[i];
+                session->image_instructions[slot] = old_instructions[i];
+            }
+        }
+        free(old_pcs);
+        free(old_instructions);
+    }
+}
+
+
+/*
+ * Retrieve an instruction from the instruction image.
+ */
+extern unsigned te_get_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const session_t * const session = user_data;
+    const size_t slot = image_slot(session, address);
+
+    *instruction = session->image_instructions[slot];
+    if (0 == *instruction)
+    {
+        return 0;   /* never retired */
+    }
+
+    return (3u == (*instruction & 3u)) ? 4u : 2u;
+}
+
+
+/*
+ * Check each PC decoded against the log.
+ */
+extern void te_advance_decoded_pc(
+    void * const user_data,
+    const te_address_t old_pc,
+    const te_address_t new_pc,
+    const te_decoded_instruction_t * const new_instruction)
+{
+    session_t * const session = user_data;
+
+    (void)old_pc;
+    (void)new_instruction;
+
+    te_verify_decoded_pc(&session->verifier, new_pc);
+}
+
+
+/*
+ * Report the first divergence (to stderr, so as not to corrupt the JSON).
+ */
+static void report_divergence(
+    void * const user_data,
+    const te_divergence_t * const divergence)
+{
+    (void)user_data;
+
+    te_log_printf("DIVERGENCE after %lu instructions (last PC 0x%08lx), te_inst %lu:"
+        " expected 0x%08lx%s, decoded 0x%08lx%s\n",
+        divergence->instruction_count,
+        divergence->last_pc,
+        divergence->te_inst_index,
+        divergence->golden_pc,
+        divergence->golden_ended ? " (none)" : "",
+        divergence->decoded_pc,
+        divergence->decoded_ended ? " (none)" : "");
+}
+
+
+/*
+ * Read all the logs again (on the golden thread), for the golden PCs.
+ */
+static void push_golden_pc(
+    void * const user_data,
+    const te_address_t pc,
+    const uint32_t instruction)
+{
+    (void)instruction;
+
+    te_push_golden_pc(user_data, pc);
+}
+
+static void produce_golden_pcs(
+    te_verifier_t * const verifier,
+    void * const data)
+{
+    const session_t * const session = data;
+    te_commit_log_reader_t reader;
+    int i;
+
+    te_open_commit_log_reader(&reader, session->params, NULL);
+    te_set_commit_log_retire_handler(&reader, push_golden_pc, verifier);
+
+    for (i = 0; i < session->num_filenames; i++)
+    {
+        if (0 != te_read_commit_log(&reader, session->filenames[i]))
+        {
+            break;  /* the main thread will report it */
+        }
+    }
+    te_close_commit_log_reader(&reader);
+}
+
+
+/*
+ * Return the current time, in seconds.
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+static void usage(
+    const char * const program)
+{
+    fprintf(stderr,
+        "usage: %s [options] <log>...   (\"-\" for stdin)\n"
+        "  --format=F           spike, qemu or auto (auto)\n"
+        "  --hart=N             core/vCPU to trace (0)\n"
+        "  --xlen=N             32 or 64 (64)\n"
+        "  --priv=N             privilege level, if not logged (3)\n"
+        "  --max-resync=N       instructions between encoder resyncs (0)\n"
+        "  --verify             decode the trace, and check it against the log\n",
+        program);
+}
+
+
+int main(
+    int argc,
+    char * argv[])
+{
+    static const struct option options[] =
+    {
+        { "format",         required_argument, NULL, 'F' },
+        { "hart",           required_argument, NULL, 'H' },
+        { "xlen",           required_argument, NULL, 'x' },
+        { "priv",           required_argument, NULL, 'p' },
+        { "max-resync",     required_argument, NULL, 'm' },
+        { "verify",         no_argument,       NULL, 'V' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    te_commit_log_params_t params;
+    te_encoder_params_t encoder_params;
+    te_encoder_state_t * encoder;
+    te_commit_log_reader_t * reader;
+    session_t session;
+    bool verify = false;
+    bool verified = true;
+    double start, elapsed;
+    int option;
+    int i;
+
+    te_commit_log_default_params(&params);
+    te_encoder_default_params(&encoder_params);
+
+    while (-1 != (option = getopt_long(argc, argv, "h", options, NULL)))
+    {
+        switch (option)
+        {
+            case 'F':
+                if (0 == strcmp(optarg, "spike"))
+                {
+                    params.format = TE_COMMIT_LOG_SPIKE;
+                }
+                else if (0 == strcmp(optarg, "qemu"))
+                {
+                    params.format = TE_COMMIT_LOG_QEMU;
+                }
+                else
+                {
+                    params.format = TE_COMMIT_LOG_AUTO;
+                }
+                break;
+            case 'H': params.hart = strtoul(optarg, NULL, 0); break;
+            case 'x': params.xlen = strtoul(optarg, NULL, 0); break;
+            case 'p': params.priv = strtoul(optarg, NULL, 0); break;
+            case 'm': encoder_params.max_resync = strtoul(optarg, NULL, 0); break;
+            case 'V': verify = true; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if ( (optind >= argc) ||
+         ( (32 != params.xlen) && (64 != params.xlen) ) )
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (i = optind; (verify) && (i < argc); i++)
+    {
+        if (0 == strcmp(argv[i], "-"))
+        {
+            usage(argv[0]);     /* stdin can not be read twice */
+            return EXIT_FAILURE;
+        }
+    }
+    encoder_params.iaddress_width_p = params.xlen;
+
+    memset(&session, 0, sizeof(session));
+    encoder = te_open_trace_encoder(NULL, &encoder_params,
+        decode_te_inst, decode_te_support, &session);
+    reader = te_open_commit_log_reader(NULL, &params, encoder);
+
+    start = now();
+    if (verify)
+    {
+        session.params = &params;
+        session.filenames = &argv[optind];
+        session.num_filenames = argc - optind;
+        session.image_mask = (1u << IMAGE_BITS) - 1u;
+        session.image_pcs = calloc(session.image_mask + 1u, sizeof(te_address_t));
+        session.image_instructions = calloc(session.image_mask + 1u, sizeof(uint32_t));
+        assert(session.image_pcs);
+        assert(session.image_instructions);
+        te_set_commit_log_retire_handler(reader, record_instruction, &session);
+
+        session.decoder = te_open_trace_decoder(NULL, NULL, &session,
+            (32 == params.xlen) ? rv32 : rv64);
+        te_open_verifier(&session.verifier, session.decoder, report_divergence, NULL);
+        if (0 != te_start_golden_thread(&session.verifier, produce_golden_pcs, &session))
+        {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = optind; i < argc; i++)
+    {
+        if (0 != te_read_commit_log(reader, argv[i]))
+        {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    te_close_commit_log_reader(reader);
+    te_flush_trace_encoder(encoder);
+    if (verify)
+    {
+        verified = te_finish_verifier(&session.verifier);
+    }
+    elapsed = now() - start;
+
+    printf("{\n");
+    printf("  \"format\": \"%s\",\n",
+        (TE_COMMIT_LOG_SPIKE == reader->params.format) ? "spike" :
+        (TE_COMMIT_LOG_QEMU == reader->params.format) ? "qemu" : "unknown");
+    printf("  \"bytes\": %llu,\n", reader->num_bytes);
+    printf("  \"lines\": %llu,\n", reader->num_lines);
+    printf("  \"ignored_lines\": %llu,\n", reader->num_ignored);
+    printf("  \"other_hart_lines\": %llu,\n", reader->num_other_harts);
+    printf("  \"instructions\": %llu,\n", reader->num_instructions);
+    printf("  \"traps\": %lu,\n", reader->num_traps);
+    printf("  \"inferred_traps\": %lu,\n", reader->num_inferred_traps);
+    printf("  \"te_inst\": %lu,\n", encoder->num_te_inst);
+    printf("  \"te_inst_formats\": [%lu, %lu, %lu, %lu],\n",
+        encoder->num_format[0], encoder->num_format[1],
+        encoder->num_format[2], encoder->num_format[3]);
+    printf("  \"te_support\": %lu,\n", encoder->num_te_support);
+    printf("  \"payload_bytes\": %llu,\n", encoder->num_payload_bytes);
+    printf("  \"bits_per_instruction\": %.4f,\n",
+        reader->num_instructions ? 8.0 * encoder->num_payload_bytes / reader->num_instructions : 0.0);
+    printf("  \"instructions_per_te_inst\": %.3f,\n",
+        encoder->num_te_inst ? (double)reader->num_instructions / encoder->num_te_inst : 0.0);
+    printf("  \"seconds\": %.6f,\n", elapsed);
+    printf("  \"gigabytes_per_second\": %.3f,\n", (double)reader->num_bytes / elapsed * 1e-9);
+    if (verify)
+    {
+        printf("  \"verify\": {\n");
+        printf("    \"decoded\": %lu,\n", session.decoder->instruction_count);
+        printf("    \"matched\": %lu,\n", session.verifier.num_verified);
+        printf("    \"lost_windows\": %lu,\n", session.decoder->num_lost_windows);
+        printf("    \"stalls\": %lu,\n", session.verifier.ring.num_stalls);
+        printf("    \"verified\": %s\n", verified ? "true" : "false");
+        printf("  },\n");
+        te_close_verifier(&session.verifier);
+        te_close_trace_decoder(session.decoder);
+        free(session.decoder);
+        free(session.image_pcs);
+        free(session.image_instructions);
+    }
+    printf("  \"instructions_per_second\": %.0f\n", (double)reader->num_instructions / elapsed);
+    printf("}\n");
+
+    free(reader);
+    free(encoder);
+
+    return verified ? EXIT_SUCCESS : EXIT_FAILURE;
+}
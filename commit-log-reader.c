@@ -0,0 +1,1293 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#endif  /* __SSE2__ */
+#include "commit-log-reader.h"
+
+
+/*
+ * Size of the buffer used for logs that can not be memory-mapped (e.g. pipes).
+ */
+#define READ_BUFFER_SIZE    (1u<<20)    /* 1 MiB */
+
+
+/*
+ * Size of the window (at the start of each line) in which the fields of
+ * a line are found 16 bytes at a time. This is one bit per byte of the
+ * masks of window_t, and covers the fields of any usual instruction line.
+ */
+#define WINDOW_SIZE         (64u)
+
+
+/*
+ * Some instruction encodings that can not be identified by opcode alone.
+ */
+#define INSTRUCTION_ECALL       (0x00000073u)
+#define INSTRUCTION_EBREAK      (0x00100073u)
+#define INSTRUCTION_C_EBREAK    (0x9002u)
+#define INSTRUCTION_URET        (0x00200073u)
+#define INSTRUCTION_SRET        (0x10200073u)
+#define INSTRUCTION_MRET        (0x30200073u)
+#define INSTRUCTION_DRET        (0x7b200073u)
+
+
+/*
+ * The names used by Spike for each exception, indexed by cause.
+ */
+static const char * const trap_names[] =
+{
+    "trap_instruction_address_misaligned",
+    "trap_instruction_access_fault",
+    "trap_illegal_instruction",
+    "trap_breakpoint",
+    "trap_load_address_misaligned",
+    "trap_load_access_fault",
+    "trap_store_address_misaligned",
+    "trap_store_access_fault",
+    "trap_user_ecall",
+    "trap_supervisor_ecall",
+    "trap_virtual_supervisor_ecall",
+    "trap_machine_ecall",
+    "trap_instruction_page_fault",
+    "trap_load_page_fault",
+    NULL,
+    "trap_store_page_fault",
+};
+
+
+/*
+ * Return the first character at or after "p" that is not a space.
+ */
+static const char * skip_spaces(
+    const char * p,
+    const char * const end)
+{
+    while ( (p < end) && (' ' == *p) )
+    {
+        p++;
+    }
+
+    return p;
+}
+
+
+/*
+ * The value of each hexadecimal digit, plus 1 (so 0 is not a digit).
+ */
+static const uint8_t hex_digits[256] =
+{
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,
+    ['5'] = 6,  ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+
+/*
+ * Parse a hexadecimal number, prefixed by "0x" (after any spaces),
+ * advancing "*p" past it. Returns false (without advancing) if there
+ * is no such number at "*p".
+ */
+static bool parse_hex(
+    const char ** const p,
+    const char * const end,
+    uint64_t * const value)
+{
+    const char * s = skip_spaces(*p, end);
+    uint64_t result = 0;
+    unsigned digit;
+
+    if ( (end - s < 3) || ('0' != s[0]) || ('x' != s[1]) || (0 == hex_digits[(uint8_t)s[2]]) )
+    {
+        return false;
+    }
+
+    for (s += 2; (s < end) && (0 != (digit = hex_digits[(uint8_t)*s])); s++)
+    {
+        result = (result << 4) | (digit - 1u);
+    }
+    *value = result;
+    *p = s;
+
+    return true;
+}
+
+
+/*
+ * Parse an unsigned decimal number (after any spaces), advancing "*p"
+ * past it. Returns false (without advancing) if there is no such number.
+ */
+static bool parse_decimal(
+    const char ** const p,
+    const char * const end,
+    unsigned * const value)
+{
+    const char * s = skip_spaces(*p, end);
+
+    if ( (s >= end) || (*s < '0') || (*s > '9') )
+    {
+        return false;
+    }
+
+    *value = 0;
+    for (; (s < end) && (*s >= '0') && (*s <= '9'); s++)
+    {
+        *value = 10u * *value + (unsigned)(*s - '0');
+    }
+    *p = s;
+
+    return true;
+}
+
+
+/*
+ * Return the length of "word" if the text at "p" starts with it, or 0 if
+ * it does not. The words are all short, and this is called several times
+ * for every line, so they are compared a character at a time, rather than
+ * with strlen() and memcmp() (which are not inlined, for non-constants).
+ */
+static size_t match_word(
+    const char * const p,
+    const char * const end,
+    const char * const word)
+{
+    size_t length;
+
+    for (length = 0; word[length]; length++)
+    {
+        if ( (p + length >= end) || (p[length] != word[length]) )
+        {
+            return 0;
+        }
+    }
+
+    return length;
+}
+
+
+/*
+ * Determine if the text at "p" starts with "word".
+ */
+static bool starts_with(
+    const char * const p,
+    const char * const end,
+    const char * const word)
+{
+    return 0 != match_word(p, end, word);
+}
+
+
+/*
+ * Advance "*p" past any spaces, and then past "word" if it is there.
+ * Returns false if "word" is not there.
+ */
+static bool skip_word(
+    const char ** const p,
+    const char * const end,
+    const char * const word)
+{
+    size_t length;
+
+    *p = skip_spaces(*p, end);
+    length = match_word(*p, end, word);
+    *p += length;
+
+    return 0 != length;
+}
+
+
+/*
+ * Return the address of the next newline at or after "p", or "end" if
+ * there is none, comparing 16 bytes at a time where possible. This is
+ * only needed for lines longer than a window (see scan_window), or at
+ * the end of the text.
+ */
+static const char * find_newline(
+    const char * p,
+    const char * const end)
+{
+    const char * newline;
+
+#if defined(__SSE2__)
+    const __m128i pattern = _mm_set1_epi8('\n');
+
+    for (; end - p >= 16; p += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        const unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern));
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif  /* __SSE2__ */
+
+    newline = memchr(p, '\n', (size_t)(end - p));
+
+    return newline ? newline : end;
+}
+
+
+#if defined(__SSE2__)
+/*
+ * Masks of the window at the start of a line, with one bit per byte
+ * (bit 0 being the first byte): of its spaces, and of its newlines.
+ */
+typedef struct
+{
+    uint64_t spaces;
+    uint64_t newlines;
+} window_t;
+
+
+/*
+ * Find the spaces and newlines in the WINDOW_SIZE bytes at "p" (all of
+ * which must be readable), 16 bytes at a time.
+ */
+static void scan_window(
+    const char * const p,
+    window_t * const window)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    unsigned i;
+
+    window->spaces = 0;
+    window->newlines = 0;
+
+    for (i = 0; i < WINDOW_SIZE; i += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+
+        window->spaces |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, space)) << i;
+        window->newlines |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)) << i;
+    }
+}
+
+
+/*
+ * Return the first byte at or after byte "i" of a window that is not a
+ * space, or WINDOW_SIZE if there is none.
+ */
+static unsigned window_skip_spaces(
+    const window_t * const window,
+    const unsigned i)
+{
+    const uint64_t rest = (i < WINDOW_SIZE) ? ~window->spaces & (~(uint64_t)0 << i) : 0;
+
+    return rest ? (unsigned)__builtin_ctzll(rest) : WINDOW_SIZE;
+}
+
+
+/*
+ * The window version of parse_hex(): parse a hexadecimal number, prefixed
+ * by "0x" (after any spaces), at byte "*i" of the window at "line", and
+ * advance "*i" past it. Its (up to 16) digits are found, and converted,
+ * all at once: each byte that is a digit becomes its value, and then the
+ * pairs of values are packed into bytes, most significant first. So the
+ * digits, and the byte after them, must be in the window. Returns false
+ * (without advancing) if there is no such number, or it is longer.
+ */
+static bool window_hex(
+    const char * const line,
+    const window_t * const window,
+    unsigned * const i,
+    uint64_t * const value)
+{
+    const unsigned first = window_skip_spaces(window, *i) + 2u;
+    __m128i chunk;
+    __m128i letter;
+    __m128i digits;
+    __m128i values;
+    unsigned length;
+    uint64_t packed;
+
+    if ( (first + 16u >= WINDOW_SIZE) ||
+         ('0' != line[first - 2u]) ||
+         ('x' != line[first - 1u]) )
+    {
+        return false;
+    }
+
+    /* only ASCII digits are positive, so signed comparisons will do */
+    chunk = _mm_loadu_si128((const __m128i *)(line + first));
+    letter = _mm_and_si128(
+        _mm_cmpgt_epi8(_mm_or_si128(chunk, _mm_set1_epi8(0x20)), _mm_set1_epi8('a' - 1)),
+        _mm_cmplt_epi8(_mm_or_si128(chunk, _mm_set1_epi8(0x20)), _mm_set1_epi8('f' + 1)));
+    digits = _mm_or_si128(letter, _mm_and_si128(
+        _mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)),
+        _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1))));
+    length = (unsigned)__builtin_ctz(~(unsigned)_mm_movemask_epi8(digits));
+    if ( (0 == length) ||
+         ( (16u == length) && (hex_digits[(uint8_t)line[first + 16u]]) ) )
+    {
+        return false;
+    }
+
+    values = _mm_and_si128(
+        _mm_add_epi8(chunk, _mm_and_si128(letter, _mm_set1_epi8(9))),
+        _mm_set1_epi8(0x0f));
+    values = _mm_or_si128(
+        _mm_and_si128(_mm_slli_epi16(values, 4), _mm_set1_epi16(0xf0)),
+        _mm_srli_epi16(values, 8));
+    _mm_storel_epi64((__m128i *)&packed, _mm_packus_epi16(values, values));
+    *value = __builtin_bswap64(packed) >> (4u * (16u - length));
+    *i = first + length;
+
+    return true;
+}
+
+
+/*
+ * The window version of parse_decimal(): parse an unsigned decimal number
+ * (after any spaces) of at most 9 digits, at byte "*i" of the window at
+ * "line", and advance "*i" past it. Returns false if there is no such
+ * number.
+ */
+static bool window_decimal(
+    const char * const line,
+    const window_t * const window,
+    unsigned * const i,
+    unsigned * const value)
+{
+    unsigned j = window_skip_spaces(window, *i);
+    const unsigned first = j;
+
+    *value = 0;
+    for (; (j < WINDOW_SIZE) && (line[j] >= '0') && (line[j] <= '9'); j++)
+    {
+        *value = 10u * *value + (unsigned)(line[j] - '0');
+    }
+    if ( (j == first) || (j - first > 9u) )
+    {
+        return false;
+    }
+    *i = j;
+
+    return true;
+}
+#endif  /* __SSE2__ */
+
+
+/*
+ * Return the size of an instruction, in bytes.
+ */
+static unsigned instruction_size(
+    const uint32_t instruction)
+{
+    return (3u == (instruction & 3u)) ? 4u : 2u;
+}
+
+
+/*
+ * Classify an instruction by its encoding, with the same definitions as
+ * the trace-decoder's predicates: is_branch(), is_inferrable_jump(),
+ * is_uninferrable_jump(), is_uninferrable_discon(), is_call() and
+ * is_return(). So, as in those (and the pseudo-code in decoder.tex), only
+ * x1 is a link register: a jump linking through x5 (the alternate link
+ * register of "Jump Classification") is an ordinary jump or tail-call, and
+ * "jalr x1, x1" is a call, not a co-routine swap. Otherwise, the encoder's
+ * implicit returns would not match the trace-decoder's return stack.
+ * "taken" only matters for branches. Returns TE_ITYPE_NONE for all other
+ * instructions (including ecall and ebreak, which are reported as
+ * exceptions).
+ */
+extern te_itype_t te_instruction_itype(
+    const uint32_t instruction,
+    const unsigned xlen,
+    const bool taken)
+{
+    const unsigned rd = (instruction >> 7) & 0x1f;
+
+    if (3u == (instruction & 3u))
+    {
+        const unsigned rs1 = (instruction >> 15) & 0x1f;
+
+        switch (instruction & 0x7f)
+        {
+            case 0x63:      /* beq, bne, blt, bge, bltu, bgeu */
+                if ( (2 == ((instruction >> 12) & 7)) || (3 == ((instruction >> 12) & 7)) )
+                {
+                    return TE_ITYPE_NONE;
+                }
+                return taken ? TE_ITYPE_TAKEN_BRANCH : TE_ITYPE_NONTAKEN_BRANCH;
+
+            case 0x6f:      /* jal */
+                return (1 == rd) ? TE_ITYPE_INFERABLE_CALL : TE_ITYPE_INFERABLE_JUMP;
+
+            case 0x67:      /* jalr */
+                if (1 == rd)
+                {
+                    return rs1 ? TE_ITYPE_UNINFERABLE_CALL : TE_ITYPE_INFERABLE_CALL;
+                }
+                if (0 == rd)
+                {
+                    if (1 == rs1)
+                    {
+                        return TE_ITYPE_UNINFERABLE_RETURN;
+                    }
+                    return rs1 ? TE_ITYPE_UNINFERABLE_TAIL_CALL : TE_ITYPE_INFERABLE_TAIL_CALL;
+                }
+                return rs1 ? TE_ITYPE_UNINFERABLE_JUMP : TE_ITYPE_INFERABLE_JUMP;
+
+            case 0x73:      /* system */
+                if ( (INSTRUCTION_URET == instruction) ||
+                     (INSTRUCTION_SRET == instruction) ||
+                     (INSTRUCTION_MRET == instruction) ||
+                     (INSTRUCTION_DRET == instruction) )
+                {
+                    return TE_ITYPE_EXCEPTION_RETURN;
+                }
+                return TE_ITYPE_NONE;
+
+            default:
+                return TE_ITYPE_NONE;
+        }
+    }
+    else
+    {
+        const unsigned quadrant = instruction & 3u;
+        const unsigned funct3 = (instruction >> 13) & 7u;
+
+        if (1 == quadrant)
+        {
+            switch (funct3)
+            {
+                case 1:     /* c.jal (RV32 only, c.addiw otherwise) */
+                    return (32 == xlen) ? TE_ITYPE_INFERABLE_CALL : TE_ITYPE_NONE;
+                case 5:     /* c.j */
+                    return TE_ITYPE_INFERABLE_JUMP;
+                case 6:     /* c.beqz */
+                case 7:     /* c.bnez */
+                    return taken ? TE_ITYPE_TAKEN_BRANCH : TE_ITYPE_NONTAKEN_BRANCH;
+                default:
+                    return TE_ITYPE_NONE;
+            }
+        }
+
+        if ( (2 == quadrant) &&
+             (4 == funct3) &&
+             (0 != rd) &&
+             (0 == ((instruction >> 2) & 0x1f)) )
+        {
+            if (instruction & (1u << 12))   /* c.jalr */
+            {
+                return TE_ITYPE_UNINFERABLE_CALL;
+            }
+            /* c.jr */
+            return (1 == rd) ? TE_ITYPE_UNINFERABLE_RETURN : TE_ITYPE_UNINFERABLE_TAIL_CALL;
+        }
+
+        return TE_ITYPE_NONE;
+    }
+}
+
+
+/*
+ * Present an instruction retired (or an exception or interrupt) to the
+ * encoder, if there is one, and to the user's ingress handler (if any).
+ * Each instruction retired is first passed to the user's retire handler
+ * (if any).
+ */
+static void present(
+    te_commit_log_reader_t * const reader,
+    const te_ingress_t * const ingress,
+    const uint32_t instruction)
+{
+    assert(reader);
+    assert(ingress);
+
+    if (ingress->iretire)
+    {
+        reader->num_instructions++;
+        if (reader->retire_handler)
+        {
+            reader->retire_handler(reader->user_data, ingress->iaddr, instruction);
+        }
+    }
+
+    if (reader->encoder)
+    {
+        te_encode_ingress(reader->encoder, ingress);
+    }
+
+    if (reader->ingress_handler)
+    {
+        reader->ingress_handler(reader->ingress_data, ingress);
+    }
+}
+
+
+/*
+ * Present the pending instruction to the encoder, now that the address
+ * of the next instruction executed is known. If execution did not go
+ * where the instruction would have taken it, and no exception or interrupt
+ * was logged, then one is inferred: an ecall or ebreak is taken not to
+ * have retired (as it raised an exception), otherwise an interrupt is
+ * taken to have followed the instruction.
+ */
+static void present_pending(
+    te_commit_log_reader_t * const reader,
+    const te_address_t next_pc,
+    const bool trap_logged)
+{
+    te_ingress_t * const ingress = &reader->ingress;
+    const uint32_t instruction = reader->instruction;
+    const bool sequential = (next_pc == ingress->iaddr + instruction_size(instruction));
+    te_ingress_t trap;
+
+    assert(reader);
+
+    if (!reader->pending)
+    {
+        return;
+    }
+    reader->pending = false;
+
+    ingress->itype = te_instruction_itype(instruction, reader->params.xlen, !sequential);
+
+    if ( (!sequential) && (!trap_logged) && (TE_ITYPE_NONE == ingress->itype) )
+    {
+        reader->num_inferred_traps++;
+        trap = *ingress;
+        trap.iretire = 0;
+        trap.tval = 0;
+        if ( (INSTRUCTION_ECALL == instruction) ||
+             (INSTRUCTION_EBREAK == instruction) ||
+             (INSTRUCTION_C_EBREAK == instruction) )
+        {
+            trap.itype = TE_ITYPE_EXCEPTION;
+            trap.cause = (INSTRUCTION_ECALL == instruction) ? 8u + ingress->priv : 3u;
+        }
+        else
+        {
+            present(reader, ingress, instruction);
+            trap.itype = TE_ITYPE_INTERRUPT;
+            trap.cause = 0;     /* not known */
+        }
+        present(reader, &trap, instruction);
+        return;
+    }
+
+    present(reader, ingress, instruction);
+}
+
+
+/*
+ * Present a logged exception or interrupt, once its "tval" is known.
+ */
+static void present_trap(
+    te_commit_log_reader_t * const reader)
+{
+    assert(reader);
+
+    if (reader->pending_trap)
+    {
+        reader->pending_trap = false;
+        present(reader, &reader->trap, 0);
+    }
+}
+
+
+/*
+ * Handle an instruction executed, at "pc".
+ */
+static void add_instruction(
+    te_commit_log_reader_t * const reader,
+    const te_address_t pc,
+    const uint32_t instruction,
+    const unsigned priv)
+{
+    assert(reader);
+
+    present_pending(reader, pc, false);
+    present_trap(reader);
+
+    reader->pending = true;
+    reader->instruction = instruction;
+    reader->ingress.iaddr = pc;
+    reader->ingress.ilastsize = (4u == instruction_size(instruction)) ? 1u : 0u;
+    reader->ingress.priv = priv;
+}
+
+
+/*
+ * Handle a logged exception or interrupt. If the pending instruction is
+ * the one that raised the exception, then it did not retire.
+ */
+static void add_trap(
+    te_commit_log_reader_t * const reader,
+    const te_address_t epc,
+    const unsigned cause,
+    const bool interrupt)
+{
+    assert(reader);
+
+    present_trap(reader);
+    if ( (reader->pending) && (!interrupt) && (epc == reader->ingress.iaddr) )
+    {
+        reader->pending = false;
+    }
+    present_pending(reader, epc, true);
+
+    reader->num_traps++;
+    reader->pending_trap = true;
+    reader->trap = reader->ingress;
+    reader->trap.iretire = 0;
+    reader->trap.itype = interrupt ? TE_ITYPE_INTERRUPT : TE_ITYPE_EXCEPTION;
+    reader->trap.cause = cause;
+    reader->trap.tval = 0;
+}
+
+
+/*
+ * Parse the rest of a Spike exception line, after "exception".
+ * Returns false if it is not recognised.
+ */
+static bool parse_spike_trap(
+    te_commit_log_reader_t * const reader,
+    const char * p,
+    const char * const end)
+{
+    const char * const name = p;
+    uint64_t epc;
+    unsigned cause = 0;
+    bool interrupt = false;
+    unsigned i;
+
+    while ( (p < end) && (',' != *p) )
+    {
+        p++;
+    }
+
+    if (starts_with(name, p, "interrupt #"))
+    {
+        const char * number = name + strlen("interrupt #");
+        interrupt = true;
+        (void)parse_decimal(&number, p, &cause);
+    }
+    else if (starts_with(name, p, "trap #"))
+    {
+        const char * number = name + strlen("trap #");
+        (void)parse_decimal(&number, p, &cause);
+    }
+    else
+    {
+        for (i = 0; i < sizeof(trap_names) / sizeof(trap_names[0]); i++)
+        {
+            if ( (trap_names[i]) &&
+                 (strlen(trap_names[i]) == (size_t)(p - name)) &&
+                 (starts_with(name, p, trap_names[i])) )
+            {
+                cause = i;
+                break;
+            }
+        }
+    }
+
+    if ( (!skip_word(&p, end, ",")) ||
+         (!skip_word(&p, end, "epc")) ||
+         (!parse_hex(&p, end, &epc)) )
+    {
+        return false;
+    }
+
+    add_trap(reader, epc, cause, interrupt);
+
+    return true;
+}
+
+
+/*
+ * Parse a line from a Spike log, starting with "core".
+ * Returns false if it is not recognised.
+ */
+static bool parse_spike_line(
+    te_commit_log_reader_t * const reader,
+    const char * p,
+    const char * const end)
+{
+    unsigned hart;
+    unsigned priv = reader->params.priv;
+    uint64_t pc;
+    uint64_t instruction;
+    uint64_t tval;
+
+    if ( (!skip_word(&p, end, "core")) ||
+         (!parse_decimal(&p, end, &hart)) ||
+         (!skip_word(&p, end, ":")) )
+    {
+        return false;
+    }
+
+    if (hart != reader->params.hart)
+    {
+        reader->num_other_harts++;
+        return true;
+    }
+
+    p = skip_spaces(p, end);
+    if ( (end - p >= 2) && (p[0] >= '0') && (p[0] <= '3') && (' ' == p[1]) )
+    {
+        priv = (unsigned)(p[0] - '0');  /* --log-commits */
+        p += 2;
+    }
+
+    if (parse_hex(&p, end, &pc))
+    {
+        if ( (!skip_word(&p, end, "(")) ||
+             (!parse_hex(&p, end, &instruction)) )
+        {
+            return false;
+        }
+        add_instruction(reader, pc, (uint32_t)instruction, priv);
+        return true;
+    }
+
+    if (skip_word(&p, end, "exception "))
+    {
+        return parse_spike_trap(reader, skip_spaces(p, end), end);
+    }
+
+    if (skip_word(&p, end, "tval"))
+    {
+        if (!parse_hex(&p, end, &tval))
+        {
+            return false;
+        }
+        if (reader->pending_trap)
+        {
+            reader->trap.tval = tval;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Parse a line from a QEMU execlog plugin log, starting with a digit.
+ * Returns false if it is not recognised.
+ */
+static bool parse_qemu_line(
+    te_commit_log_reader_t * const reader,
+    const char * p,
+    const char * const end)
+{
+    unsigned hart;
+    uint64_t pc;
+    uint64_t instruction;
+
+    if ( (!parse_decimal(&p, end, &hart)) ||
+         (!skip_word(&p, end, ",")) ||
+         (!parse_hex(&p, end, &pc)) ||
+         (!skip_word(&p, end, ",")) ||
+         (!parse_hex(&p, end, &instruction)) )
+    {
+        return false;
+    }
+
+    if (hart != reader->params.hart)
+    {
+        reader->num_other_harts++;
+        return true;
+    }
+
+    add_instruction(reader, pc, (uint32_t)instruction, reader->params.priv);
+
+    return true;
+}
+
+
+#if defined(__SSE2__)
+/*
+ * The window version of parse_spike_line(), for an instruction line (of
+ * either Spike format), or a "tval" line, whose fields are all in the
+ * window at "line". Returns false (having done nothing) for any other
+ * line (e.g. an exception), which is then left to parse_spike_line().
+ */
+static bool window_spike_line(
+    te_commit_log_reader_t * const reader,
+    const char * const line,
+    const window_t * const window)
+{
+    unsigned i = 4;
+    unsigned hart;
+    unsigned priv = reader->params.priv;
+    uint64_t pc;
+    uint64_t instruction;
+    uint64_t tval;
+
+    if ( (0 != memcmp(line, "core", 4)) ||
+         (!window_decimal(line, window, &i, &hart)) ||
+         (':' != line[i]) )
+    {
+        return false;
+    }
+
+    if (hart != reader->params.hart)
+    {
+        reader->num_other_harts++;
+        return true;
+    }
+
+    i = window_skip_spaces(window, i + 1u);
+    if ( (i + 1u < WINDOW_SIZE) &&
+         (line[i] >= '0') && (line[i] <= '3') && (' ' == line[i + 1u]) )
+    {
+        priv = (unsigned)(line[i] - '0');  /* --log-commits */
+        i += 2;
+    }
+
+    if (window_hex(line, window, &i, &pc))
+    {
+        if ( ('(' != line[i = window_skip_spaces(window, i)]) ||
+             (i++, !window_hex(line, window, &i, &instruction)) )
+        {
+            return false;
+        }
+        add_instruction(reader, pc, (uint32_t)instruction, priv);
+        return true;
+    }
+
+    if ( (i + 4u < WINDOW_SIZE) && (0 == memcmp(line + i, "tval", 4)) )
+    {
+        i += 4;
+        if (!window_hex(line, window, &i, &tval))
+        {
+            return false;
+        }
+        if (reader->pending_trap)
+        {
+            reader->trap.tval = tval;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * The window version of parse_qemu_line(). Returns false (having done
+ * nothing) for any line it can not parse, which is then left to
+ * parse_qemu_line().
+ */
+static bool window_qemu_line(
+    te_commit_log_reader_t * const reader,
+    const char * const line,
+    const window_t * const window)
+{
+    unsigned i = 0;
+    unsigned hart;
+    uint64_t pc;
+    uint64_t instruction;
+
+    if ( (!window_decimal(line, window, &i, &hart)) ||
+         (',' != line[i = window_skip_spaces(window, i)]) ||
+         (i++, !window_hex(line, window, &i, &pc)) ||
+         (',' != line[i = window_skip_spaces(window, i)]) ||
+         (i++, !window_hex(line, window, &i, &instruction)) )
+    {
+        return false;
+    }
+
+    if (hart != reader->params.hart)
+    {
+        reader->num_other_harts++;
+        return true;
+    }
+
+    add_instruction(reader, pc, (uint32_t)instruction, reader->params.priv);
+
+    return true;
+}
+
+
+/*
+ * Parse a line, whose fields have been found in the window at "line".
+ * Returns false (having done nothing) if it is not an instruction line,
+ * which is then left to parse_line().
+ */
+static bool parse_window_line(
+    te_commit_log_reader_t * const reader,
+    const char * const line,
+    const window_t * const window)
+{
+    te_commit_log_format_t format = reader->params.format;
+    bool parsed;
+
+    if (TE_COMMIT_LOG_AUTO == format)
+    {
+        format = ('c' == line[0]) ? TE_COMMIT_LOG_SPIKE : TE_COMMIT_LOG_QEMU;
+    }
+
+    switch (format)
+    {
+        case TE_COMMIT_LOG_SPIKE:
+            parsed = window_spike_line(reader, line, window);
+            break;
+        case TE_COMMIT_LOG_QEMU:
+            parsed = window_qemu_line(reader, line, window);
+            break;
+        default:
+            parsed = false;
+            break;
+    }
+
+    if ( (parsed) && (TE_COMMIT_LOG_AUTO == reader->params.format) )
+    {
+        reader->params.format = format;     /* now decided */
+    }
+
+    return parsed;
+}
+#endif  /* __SSE2__ */
+
+
+/*
+ * Parse a single line (excluding its newline).
+ */
+static void parse_line(
+    te_commit_log_reader_t * const reader,
+    const char * const line,
+    const char * const end)
+{
+    te_commit_log_format_t format = reader->params.format;
+    bool recognised = false;
+
+    if (line == end)
+    {
+        return;
+    }
+
+    if (TE_COMMIT_LOG_AUTO == format)
+    {
+        format = ('c' == line[0]) ? TE_COMMIT_LOG_SPIKE : TE_COMMIT_LOG_QEMU;
+    }
+
+    switch (format)
+    {
+        case TE_COMMIT_LOG_SPIKE:
+            recognised = parse_spike_line(reader, line, end);
+            break;
+        case TE_COMMIT_LOG_QEMU:
+            recognised = parse_qemu_line(reader, line, end);
+            break;
+        default:
+            break;
+    }
+
+    if (!recognised)
+    {
+        reader->num_ignored++;
+    }
+    else if (TE_COMMIT_LOG_AUTO == reader->params.format)
+    {
+        reader->params.format = format;     /* now decided */
+    }
+}
+
+
+/*
+ * Fill in the default parameters: a Spike or QEMU log (whichever
+ * is found), of hart 0 of an RV64 core, running in machine mode.
+ */
+extern void te_commit_log_default_params(
+    te_commit_log_params_t * const params)
+{
+    assert(params);
+
+    memset(params, 0, sizeof(te_commit_log_params_t));
+    params->format = TE_COMMIT_LOG_AUTO;
+    params->hart = 0;
+    params->xlen = 64;
+    params->priv = 3;
+}
+
+
+/*
+ * Initialize a new instance of a commit-log reader, which presents each
+ * instruction to "encoder" (which must already be open, or may be NULL
+ * if the instructions are only needed by a retire or ingress handler).
+ * If "reader" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ */
+extern te_commit_log_reader_t * te_open_commit_log_reader(
+    te_commit_log_reader_t * reader,
+    const te_commit_log_params_t * const params,
+    te_encoder_state_t * const encoder)
+{
+    assert(params);
+    assert( (32 == params->xlen) || (64 == params->xlen) );
+
+    if (reader)
+    {
+        memset(reader, 0, sizeof(te_commit_log_reader_t));
+    }
+    else
+    {
+        reader = calloc(1, sizeof(te_commit_log_reader_t));
+        assert(reader);
+    }
+
+    reader->params = *params;
+    reader->encoder = encoder;
+
+    reader->ingress.iretire = 1;
+    reader->ingress.qualified = true;
+    reader->ingress.context_type = TE_CONTEXT_DISCONTINUITY;
+
+    return reader;
+}
+
+
+/*
+ * Set the function to be called with the address (and encoding) of each
+ * instruction retired, in order, just before it is presented to the
+ * encoder. If "retire_handler" is NULL, then nothing is called.
+ */
+extern void te_set_commit_log_retire_handler(
+    te_commit_log_reader_t * const reader,
+    const te_commit_log_retire_handler_t retire_handler,
+    void * const user_data)
+{
+    assert(reader);
+
+    reader->retire_handler = retire_handler;
+    reader->user_data = user_data;
+}
+
+
+/*
+ * Set the function to be called with each ingress block, as it is
+ * presented to the encoder (if any). If "ingress_handler" is NULL,
+ * then nothing is called.
+ */
+extern void te_set_commit_log_ingress_handler(
+    te_commit_log_reader_t * const reader,
+    const te_ingress_handler_t ingress_handler,
+    void * const user_data)
+{
+    assert(reader);
+
+    reader->ingress_handler = ingress_handler;
+    reader->ingress_data = user_data;
+}
+
+
+/*
+ * Parse as many complete lines as there are in "text", returning the
+ * number of bytes consumed. Any incomplete final line is not consumed,
+ * and should be passed again, when the rest of it is available.
+ * Where a whole window follows the start of a line, its newline is found,
+ * and it is split into its fields, with the masks of that window, rather
+ * than a byte at a time. Only other lines are parsed by parse_line().
+ */
+extern size_t te_parse_commit_log(
+    te_commit_log_reader_t * const reader,
+    const char * const text,
+    const size_t size)
+{
+    const char * const end = text + size;
+    const char * line = text;
+    const char * newline;
+#if defined(__SSE2__)
+    window_t window;
+#endif  /* __SSE2__ */
+
+    assert(reader);
+    assert(text || !size);
+
+    while (line < end)
+    {
+#if defined(__SSE2__)
+        if ((size_t)(end - line) >= WINDOW_SIZE)
+        {
+            scan_window(line, &window);
+            newline = window.newlines ?
+                line + __builtin_ctzll(window.newlines) :
+                find_newline(line + WINDOW_SIZE, end);
+            if (newline == end)
+            {
+                break;
+            }
+            reader->num_lines++;
+            if (!parse_window_line(reader, line, &window))
+            {
+                parse_line(reader, line, newline);
+            }
+            line = newline + 1;
+            continue;
+        }
+#endif  /* __SSE2__ */
+        newline = find_newline(line, end);
+        if (newline == end)
+        {
+            break;
+        }
+        reader->num_lines++;
+        parse_line(reader, line, newline);
+        line = newline + 1;
+    }
+
+    reader->num_bytes += (size_t)(line - text);
+
+    return (size_t)(line - text);
+}
+
+
+/*
+ * Read, and parse, a whole log file. If possible, the file is memory-
+ * mapped, so it is never copied, otherwise (e.g. for a pipe, or if
+ * "filename" is "-" for stdin) it is read in large blocks.
+ * Returns 0 on success, or -1 (with errno set) on failure.
+ */
+extern int te_read_commit_log(
+    te_commit_log_reader_t * const reader,
+    const char * const filename)
+{
+    const int fd = (0 == strcmp(filename, "-")) ? STDIN_FILENO : open(filename, O_RDONLY);
+    struct stat status;
+    char * buffer;
+    size_t used = 0;
+    size_t consumed;
+    ssize_t length;
+
+    assert(reader);
+    assert(filename);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if ( (0 == fstat(fd, &status)) &&
+         (S_ISREG(status.st_mode)) &&
+         (status.st_size > 0) )
+    {
+        const size_t size = (size_t)status.st_size;
+        const char * const text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (MAP_FAILED != text)
+        {
+            (void)madvise((void *)text, size, MADV_SEQUENTIAL);
+            consumed = te_parse_commit_log(reader, text, size);
+            if (consumed < size)
+            {
+                /* the last line has no newline */
+                reader->num_lines++;
+                reader->num_bytes += size - consumed;
+                parse_line(reader, text + consumed, text + size);
+            }
+            munmap((void *)text, size);
+            if (STDIN_FILENO != fd)
+            {
+                close(fd);
+            }
+            return 0;
+        }
+    }
+
+    buffer = malloc(READ_BUFFER_SIZE);
+    if (!buffer)
+    {
+        if (STDIN_FILENO != fd)
+        {
+            close(fd);
+        }
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while (0 != (length = read(fd, buffer + used, READ_BUFFER_SIZE - used)))
+    {
+        if (length < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            break;
+        }
+        used += (size_t)length;
+        consumed = te_parse_commit_log(reader, buffer, used);
+        if ( (0 == consumed) && (READ_BUFFER_SIZE == used) )
+        {
+            consumed = used;    /* line too long to be useful, so skip it */
+            reader->num_ignored++;
+        }
+        used -= consumed;
+        memmove(buffer, buffer + consumed, used);
+    }
+
+    if ( (length >= 0) && (used) )
+    {
+        reader->num_lines++;
+        reader->num_bytes += used;
+        parse_line(reader, buffer, buffer + used);
+    }
+
+    free(buffer);
+    if (STDIN_FILENO != fd)
+    {
+        close(fd);
+    }
+
+    return (length < 0) ? -1 : 0;
+}
+
+
+/*
+ * Present the final instruction (and any exception) to the encoder.
+ * As nothing follows it, a final branch is taken not to have been taken.
+ * The encoder itself is not flushed, so more logs may follow.
+ */
+extern void te_close_commit_log_reader(
+    te_commit_log_reader_t * const reader)
+{
+    assert(reader);
+
+    if (reader->pending)
+    {
+        present_pending(reader,
+            reader->ingress.iaddr + instruction_size(reader->instruction),
+            reader->pending_trap);
+    }
+    present_trap(reader);
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_COMMIT_LOG_READER_H
+#define TE_COMMIT_LOG_READER_H
+
+
+/*
+ * A reader of the instruction execution logs written by the Spike and
+ * QEMU simulators, which presents each instruction retired to the
+ * encoder's ingress port (see encoder-algorithm-public.h), so that real
+ * workloads may be traced, without the cost of simulating a trace-encoder.
+ *
+ * The following log formats are recognised:
+ *
+ *  Spike "-l" (or "--log"):
+ *      core   0: 0x0000000080000000 (0x00000297) auipc   t0, 0x0
+ *  Spike "--log-commits" (the digit is the privilege level):
+ *      core   0: 3 0x0000000080000000 (0x00000297) x5  0x0000000080000000
+ *  Spike exceptions, and interrupts (in either of the above):
+ *      core   0: exception trap_illegal_instruction, epc 0x0000000080000004
+ *      core   0:           tval 0x0000000000000000
+ *  QEMU "-plugin libexeclog.so -d plugin":
+ *      0, 0x80000000, 0x00000297, "auipc t0,0"
+ *
+ * Any other lines are counted and ignored. The "itype" of each instruction
+ * is derived from its encoding (with the same definitions as the predicates
+ * in the trace-decoder, e.g. is_branch(), is_call(), so only x1 is a link
+ * register), and from the address of the next instruction, so each one is
+ * presented to the encoder as soon as the following line has been read.
+ */
+#include "encoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * The log formats that may be read.
+ */
+typedef enum
+{
+    TE_COMMIT_LOG_AUTO = 0,     /* decided by the first recognised line */
+    TE_COMMIT_LOG_SPIKE = 1,
+    TE_COMMIT_LOG_QEMU = 2,
+} te_commit_log_format_t;
+
+
+/*
+ * The parameters of a commit-log reader.
+ */
+typedef struct
+{
+    te_commit_log_format_t format;
+    unsigned hart;          /* only trace this core (or vCPU) */
+    unsigned xlen;          /* 32 or 64 (c.jal only exists in RV32) */
+    unsigned priv;          /* privilege level, if not in the log */
+} te_commit_log_params_t;
+
+
+/*
+ * Type of function called for each instruction retired, in order
+ * (see te_set_commit_log_retire_handler).
+ */
+typedef void (*te_commit_log_retire_handler_t)(
+    void * const user_data,
+    const te_address_t pc,
+    const uint32_t instruction);
+
+
+/*
+ * The state of one commit-log reader. Each log line is parsed in turn,
+ * and the instruction it describes is held back until the next line
+ * shows where execution went next.
+ */
+typedef struct
+{
+    te_commit_log_params_t params;
+    te_encoder_state_t * encoder;   /* where each instruction is sent */
+    te_commit_log_retire_handler_t retire_handler;  /* NULL == none */
+    void * user_data;               /* passed to retire_handler */
+    te_ingress_handler_t ingress_handler;   /* NULL == none */
+    void * ingress_data;            /* passed to ingress_handler */
+
+    /* the previous instruction, not yet presented to the encoder */
+    bool pending;
+    te_ingress_t ingress;
+    uint32_t instruction;           /* its encoding */
+
+    /* an exception or interrupt, waiting for its "tval" line */
+    bool pending_trap;
+    te_ingress_t trap;
+
+    /* maintain a few statistics */
+    unsigned long long num_bytes;
+    unsigned long long num_lines;
+    unsigned long long num_instructions;    /* presented to the encoder */
+    unsigned long num_traps;                /* logged exceptions and interrupts */
+    unsigned long num_inferred_traps;       /* unexplained discontinuities */
+    unsigned long long num_ignored;         /* lines not recognised */
+    unsigned long long num_other_harts;     /* lines for other harts */
+} te_commit_log_reader_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern void te_commit_log_default_params(
+    te_commit_log_params_t * const params);
+
+extern te_itype_t te_instruction_itype(
+    const uint32_t instruction,
+    const unsigned xlen,
+    const bool taken);
+
+extern te_commit_log_reader_t * te_open_commit_log_reader(
+    te_commit_log_reader_t * reader,
+    const te_commit_log_params_t * const params,
+    te_encoder_state_t * const encoder);
+
+extern void te_set_commit_log_retire_handler(
+    te_commit_log_reader_t * const reader,
+    const te_commit_log_retire_handler_t retire_handler,
+    void * const user_data);
+
+extern void te_set_commit_log_ingress_handler(
+    te_commit_log_reader_t * const reader,
+    const te_ingress_handler_t ingress_handler,
+    void * const user_data);
+
+extern size_t te_parse_commit_log(
+    te_commit_log_reader_t * const reader,
+    const char * const text,
+    const size_t size);
+
+extern int te_read_commit_log(
+    te_commit_log_reader_t * const reader,
+    const char * const filename);
+
+extern void te_close_commit_log_reader(
+    te_commit_log_reader_t * const reader);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_COMMIT_LOG_READER_H */
@@ -0,0 +1,1745 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * The core of the trace-decoder: the reconstruction of the execution path
+ * from te_inst and te_support messages, and everything it does for each
+ * instruction. This is shared by decoder-algorithm-public.c, which includes
+ * it once, at file scope, and by the C++ front-end (decoder-algorithm-public.hpp),
+ * which includes it in the body of a class template, so that each of these
+ * functions becomes a static member function, specialized for one set of
+ * modes and one sink. So it is written in the common subset of C and C++,
+ * and it has no include guard.
+ *
+ * Before including this, define the following:
+ *
+ *  TE_CORE_DEBUG                   enable additional debugging
+ *  TE_CORE_FULL_ADDRESS            as TE_FULL_ADDRESS
+ *  TE_CORE_IMPLICIT_RETURN         as TE_IMPLICIT_RETURN
+ *  TE_CORE_IADDRESS_LSB            as TE_IADDRESS_LSB
+ *  TE_CORE_ISA(decoder)            the rv_isa to disassemble (XLEN)
+ *  TE_CORE_GET_INSTRUCTION(decoder, address, instruction)
+ *  TE_CORE_ADVANCE_DECODED_PC(decoder, old_pc, new_pc, instruction)
+ *  TE_CORE_HAS_LOG(decoder)        true if there is somewhere to log to
+ *  TE_CORE_LOG(decoder, format, args)
+ *
+ * The last four have the semantics of the te_decoder_callbacks_t members.
+ */
+
+
+/*
+ * Extract the most-significant bit of an integer.
+ */
+#define MSB(x)  (((x)>>(8*(sizeof(x))-1)) & 0x1)
+
+
+/*
+ * Initialize the PC to a known "bad address".
+ * Detect if we ever try and use this address!
+ */
+#define SENTINEL_BAD_ADDRESS    0xbadadd
+
+
+/*
+ * Discard all the state of the current reconstruction, including any
+ * pending branches, calls, data transfers and cycle counts, and re-arm
+ * "start_of_trace", so that decoding will restart from the next format 3.
+ * The PC itself is retained, as it is the last known PC.
+ */
+static void discard_reconstruction(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+
+    decoder->start_of_trace = true;
+    decoder->branches = 0;
+    decoder->branch_map = 0;
+    decoder->stop_at_last_branch = false;
+    decoder->inferred_address = false;
+    decoder->call_counter = 0;
+    decoder->data.num_pending = 0;
+    decoder->cycles.num_pending = 0;
+}
+
+
+/*
+ * Print some trace-decoding diagnostics, via the decoder's log callback
+ * (if it has one).
+ */
+__attribute__ ((format (printf, 2, 3)))
+static void log_printf(
+    const te_decoder_state_t * const decoder,
+    const char * const format, ...)
+{
+    va_list args;
+
+    if (TE_CORE_HAS_LOG(decoder))
+    {
+        va_start(args, format);
+        TE_CORE_LOG(decoder, format, args);
+        va_end(args);
+    }
+}
+
+
+/*
+ * Process an error detected with the trace-decoder's algorithm.
+ * This is indicative of a corrupted trace (e.g. lost packets), or a
+ * serious malfunction - this should never happen with a good trace!
+ *
+ * The error is passed to the user's error handler (if one has been set),
+ * otherwise a diagnostic is printed. If the parameter "instr" is not NULL,
+ * then the diagnostic will also include the disassembly line of the
+ * instruction ("instr") passed in.
+ *
+ * The decoder then discards all the state of the current reconstruction,
+ * and waits for the next format 3 te_inst message to resynchronize.
+ * NOTE: this function DOES return to its caller, which must then return
+ * without disseminating any more PCs (i.e. check "waiting_for_sync").
+ */
+static void report_error(
+    te_decoder_state_t * const decoder,
+    const te_error_code_t code,
+    const te_decoded_instruction_t * const instr,
+    const char * const message)
+{
+    assert(decoder);
+    assert(message);
+
+    te_error_t error;
+
+    memset(&error, 0, sizeof(error));
+    error.code = code;
+    error.message = message;
+    error.pc = decoder->pc;
+    error.instruction_count = decoder->instruction_count;
+    error.te_inst_index = decoder->num_te_inst;
+    error.instr = instr;
+
+    if (decoder->error_handler)
+    {
+        decoder->error_handler(decoder->user_data, &error);
+    }
+    else
+    {
+        printf("ERROR: %s\n", message);
+
+        if (instr)
+        {
+            printf("Whilst processing the following instruction:\n");
+            printf("%12lx:\t%s\n", instr->decode.pc, instr->line);
+        }
+    }
+
+    /* discard the current reconstruction, and wait for a format 3 */
+    discard_reconstruction(decoder);
+    decoder->waiting_for_sync = true;
+    decoder->num_lost_windows++;    /* update statistics */
+}
+
+
+/*
+ * The states of each entry in a te_shared_cache_t.
+ */
+#define SHARED_EMPTY    0u
+#define SHARED_FILLING  1u
+#define SHARED_READY    2u
+
+
+/*
+ * Return the first entry to probe for (address_space, address).
+ */
+static size_t shared_slot(
+    const te_shared_cache_t * const cache,
+    const uint32_t address_space,
+    const te_address_t address)
+{
+    const uint64_t hash = ((address >> 1) ^ ((uint64_t)address_space * 0x9e3779b97f4a7c15ull)) *
+                          0x9e3779b97f4a7c15ull;
+
+    return (hash ^ (hash >> 29)) & cache->mask;
+}
+
+
+/*
+ * Copy the decoded instruction at (address_space, address) from a shared
+ * cache into "instr", only reading the cache. As entries are never removed,
+ * the search stops at the first empty entry. Returns false if absent.
+ */
+static bool find_shared(
+    const te_shared_cache_t * const cache,
+    const uint32_t address_space,
+    const te_address_t address,
+    te_decoded_instruction_t * const instr)
+{
+    size_t slot = shared_slot(cache, address_space, address);
+    unsigned i;
+
+    for (i = 0; i < TE_SHARED_CACHE_PROBES; i++)
+    {
+        const te_shared_entry_t * const entry = &cache->entries[slot];
+        const uint32_t state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+
+        if (SHARED_EMPTY == state)
+        {
+            break;
+        }
+        if ( (SHARED_READY == state) &&
+             (entry->instr.decode.pc == address) &&
+             (entry->address_space == address_space) )
+        {
+            *instr = entry->instr;
+            return true;
+        }
+        slot = (slot + 1u) & cache->mask;
+    }
+
+    return false;
+}
+
+
+/*
+ * Add a decoded instruction (at instr->decode.pc) to a shared cache,
+ * claiming an empty entry, filling it, and only then publishing it.
+ * Returns false if not added, as it is already present, or there was
+ * no empty entry among those probed.
+ */
+static bool fill_shared(
+    te_shared_cache_t * const cache,
+    const uint32_t address_space,
+    const te_decoded_instruction_t * const instr)
+{
+    const te_address_t address = instr->decode.pc;
+    size_t slot = shared_slot(cache, address_space, address);
+    unsigned i;
+
+    for (i = 0; i < TE_SHARED_CACHE_PROBES; i++)
+    {
+        te_shared_entry_t * const entry = &cache->entries[slot];
+        uint32_t state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+
+        if ( (SHARED_EMPTY == state) &&
+             (__atomic_compare_exchange_n(&entry->state, &state, SHARED_FILLING,
+                false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) )
+        {
+            entry->address_space = address_space;
+            entry->instr = *instr;
+            __atomic_store_n(&entry->state, SHARED_READY, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&cache->num_used, 1u, __ATOMIC_RELAXED);
+            return true;
+        }
+        if ( (SHARED_READY == state) &&
+             (entry->instr.decode.pc == address) &&
+             (entry->address_space == address_space) )
+        {
+            return false;   /* just added by another trace-decoder */
+        }
+        slot = (slot + 1u) & cache->mask;
+    }
+
+    __atomic_fetch_add(&cache->num_full, 1u, __ATOMIC_RELAXED);
+    return false;
+}
+
+
+/*
+ * Return the image mapped at "address" in the current context (if any),
+ * trying the image of the last instruction first.
+ */
+static const te_image_map_t * find_image(
+    te_decoder_state_t * const decoder,
+    const te_address_t address)
+{
+    const te_context_t * const current = decoder->contexts.current;
+    const te_image_map_t * image = decoder->contexts.image;
+    size_t i;
+
+    if ( (image) &&
+         (address >= image->base) &&
+         (address - image->base + 2u <= image->size) )
+    {
+        return image;
+    }
+
+    for (i = 0; (current) && (i < current->num_images); i++)
+    {
+        image = &current->images[i];
+        if ( (address >= image->base) &&
+             (address - image->base + 2u <= image->size) )
+        {
+            decoder->contexts.image = image;
+            return image;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Read the raw binary instruction (little-endian), and return its length,
+ * at an address in an image, or 0 if it is truncated by the image's end.
+ */
+static unsigned read_image_instruction(
+    const te_image_map_t * const image,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const size_t offset = (size_t)(address - image->base);
+    const uint8_t * const code = &image->code[offset];
+
+    *instruction = (rv_inst)code[0] | ((rv_inst)code[1] << 8);
+    if (3u != (code[0] & 3u))
+    {
+        return 2;   /* a compressed instruction */
+    }
+    if (offset + 4u > image->size)
+    {
+        return 0;
+    }
+    *instruction |= ((rv_inst)code[2] << 16) | ((rv_inst)code[3] << 24);
+
+    return 4;
+}
+
+
+/*
+ * for the address given, find the raw binary value of the instruction at
+ * that address (using the external function te_get_instruction), and then use
+ * the open-source riscv-disassembler library to decode, and then cache it.
+ */
+static te_decoded_instruction_t * get_instr(
+    te_decoder_state_t * const decoder,
+    const te_address_t address,
+    te_decoded_instruction_t * const instr)
+{
+    const size_t slot = TE_SLOT_NUMBER(address, decoder->decoded_cache_mask);
+    const te_image_map_t * image;
+    uint32_t address_space;
+    rv_inst instruction;
+    unsigned length;
+
+    assert(decoder);
+    assert(instr);
+    assert(SENTINEL_BAD_ADDRESS != address);
+
+    decoder->num_gets++;        /* update statistics */
+
+    /*
+     * if the address matches the decoded one passed in ...
+     * ... then just return it! Nothing to do this time!
+     */
+    if ( (instr->decode.pc == address) )
+    {
+        decoder->num_same++;        /* update statistics */
+        return instr;       /* referenced data is unchanged */
+    }
+
+    /* is "address" currently in our decoded cache ? */
+    if (decoder->decoded_cache[slot].decode.pc == address)
+    {
+        decoder->num_hits++;        /* update statistics */
+        /* copy, and return the cached decode */
+        *instr = decoder->decoded_cache[slot];
+        return instr;       /* referenced data is updated */
+    }
+
+    /* which image (and address space) of the current context is it in ? */
+    image = find_image(decoder, address);
+    address_space = image ? image->address_space :
+                    decoder->contexts.current ? decoder->contexts.current->address_space :
+                    decoder->shared.address_space;
+
+    /* has another trace-decoder already decoded it ? */
+    if ( (decoder->shared.cache) &&
+         (find_shared(decoder->shared.cache, address_space, address, instr)) )
+    {
+        decoder->shared.num_hits++;     /* update statistics */
+        decoder->decoded_cache[slot] = *instr;
+        return instr;       /* referenced data is updated */
+    }
+
+    /* otherwise, we need to do a bit of disassembly work ... */
+
+    /* first, get the raw instruction (and its length), from its address */
+    if (image)
+    {
+        length = read_image_instruction(image, address, &instruction);
+    }
+    else
+    {
+        length = TE_CORE_GET_INSTRUCTION(decoder, address, &instruction);
+    }
+
+    if ( (4 != length) &&
+         (2 != length) )
+    {
+        /*
+         * return an illegal instruction (which is not cached), so that
+         * the caller can continue safely, until it checks for the error.
+         */
+        memset(instr, 0, sizeof(te_decoded_instruction_t));
+        instr->decode.pc = SENTINEL_BAD_ADDRESS;
+        instr->decode.op = rv_op_illegal;
+        instr->length = 2;
+        report_error(decoder, TE_ERROR_BAD_INSTRUCTION, NULL,
+            "unable to retrieve the instruction at the reconstructed PC!");
+        return instr;
+    }
+
+    /* cache the length of the instruction, for instruction_size() */
+    instr->length = length;
+
+    /*
+     * Use the modified riscv-disassembler open-source library to decode
+     * the instruction. This repository is available from:
+     *
+     * https://github.com/ultrasoc/riscv-disassembler/tree/ultrasoc
+     *
+     * Note: predicates in this code assumes that pseudo-instructions
+     * are not lifted e.g. decode is not "ret", but "jalr x0,0(x1)".
+     */
+    (void)disasm_inst_adv(
+        &instr->decode,
+        instr->line,
+        sizeof(instr->line) - 1,
+        TE_CORE_ISA(decoder),
+        address,
+        instruction,
+        false);     /* false: do not lift pseudo-instructions */
+
+    /* save the freshly decoded instruction in the decoded cache(s) */
+    decoder->decoded_cache[slot] = *instr;
+    if ( (decoder->shared.cache) &&
+         (fill_shared(decoder->shared.cache, address_space, instr)) )
+    {
+        decoder->shared.num_fills++;    /* update statistics */
+    }
+
+    /*
+     * finally, return the pointer to te_decoded_instruction_t passed in, whose
+     * referenced data will have been updated (in situ), and
+     * added to the decoded_cache[] cache.
+     */
+    return instr;
+}
+
+
+/*
+ * Returns the size of the instruction in bytes
+ * Only safe to be called after get_instr() with instr
+ */
+static unsigned instruction_size(
+    const te_decoded_instruction_t * const instr)
+{
+    assert(instr);
+
+    return instr->length;
+}
+
+
+/*
+ * Determine if instruction is a load (reads data memory)
+ */
+static bool is_load(
+    const te_decoded_instruction_t * const instr)
+{
+    bool predicate = false;
+
+    assert(instr);
+
+    switch (instr->decode.op)
+    {
+        case rv_op_lb:      case rv_op_lh:      case rv_op_lw:
+        case rv_op_ld:      case rv_op_lbu:     case rv_op_lhu:
+        case rv_op_lwu:     case rv_op_flw:     case rv_op_fld:
+        case rv_op_lr_w:    case rv_op_lr_d:
+        case rv_op_c_lw:    case rv_op_c_ld:    case rv_op_c_flw:
+        case rv_op_c_fld:   case rv_op_c_lwsp:  case rv_op_c_ldsp:
+        case rv_op_c_flwsp: case rv_op_c_fldsp:
+            predicate = true;
+            break;
+        default:
+            break;
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Determine if instruction is a store (writes data memory)
+ */
+static bool is_store(
+    const te_decoded_instruction_t * const instr)
+{
+    bool predicate = false;
+
+    assert(instr);
+
+    switch (instr->decode.op)
+    {
+        case rv_op_sb:      case rv_op_sh:      case rv_op_sw:
+        case rv_op_sd:      case rv_op_fsw:     case rv_op_fsd:
+        case rv_op_sc_w:    case rv_op_sc_d:
+        case rv_op_c_sw:    case rv_op_c_sd:    case rv_op_c_fsw:
+        case rv_op_c_fsd:   case rv_op_c_swsp:  case rv_op_c_sdsp:
+        case rv_op_c_fswsp: case rv_op_c_fsdsp:
+            predicate = true;
+            break;
+        default:
+            break;
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Correlate the oldest pending data transfer in the same direction (load
+ * or store) as the instruction "instr" which has just been reconstructed,
+ * and append the resulting row to the user's columns (if any are attached).
+ *
+ * Any older pending transfers in the other direction are for instructions
+ * still to come, so they remain queued, in order. If there is no pending
+ * transfer in this direction, then we assume that the transfer for this
+ * instruction was not traced (e.g. it was filtered out). So a transfer
+ * never blocks the queue, even if its own instruction is never reached.
+ */
+static void correlate_data_transfer(
+    te_decoder_state_t * const decoder,
+    const te_decoded_instruction_t * const instr)
+{
+    assert(decoder);
+    assert(instr);
+    assert(decoder->data.num_pending);
+
+    te_data_columns_t * const columns = decoder->data.columns;
+    te_data_transfer_t * const pending = decoder->data.pending;
+    const size_t head = decoder->data.head;
+    const bool store = is_store(instr);
+    te_data_transfer_t transfer;
+    size_t slot = head;
+    size_t i;
+
+    for (i = 0; i < decoder->data.num_pending; i++)
+    {
+        slot = (head + i) & (TE_MAX_PENDING_DATA - 1u);
+        if ( (!!(pending[slot].flags & TE_DATA_FLAG_STORE)) == store )
+        {
+            break;
+        }
+    }
+
+    if (i == decoder->data.num_pending)
+    {
+        decoder->data.num_unmatched++;  /* update statistics */
+        return;
+    }
+
+    /* remove it, moving the older transfers (if any) up into its slot */
+    transfer = pending[slot];
+    for (; i > 0; i--)
+    {
+        pending[(head + i) & (TE_MAX_PENDING_DATA - 1u)] =
+            pending[(head + i - 1u) & (TE_MAX_PENDING_DATA - 1u)];
+    }
+    decoder->data.head = (head + 1u) & (TE_MAX_PENDING_DATA - 1u);
+    decoder->data.num_pending--;
+
+    if (columns)
+    {
+        assert(columns->count < columns->capacity);
+        columns->pc[columns->count]      = instr->decode.pc;
+        columns->address[columns->count] = transfer.address;
+        columns->value[columns->count]   = transfer.value;
+        columns->flags[columns->count]   = transfer.flags;
+        columns->count++;
+        if (columns->count == columns->capacity)
+        {
+            columns->flush(decoder->user_data, columns);
+            columns->count = 0;
+        }
+    }
+
+    decoder->data.num_transfers++;  /* update statistics */
+}
+
+
+/*
+ * Attribute the oldest pending inter-instruction cycle count to the
+ * instruction at the current PC, which has just been reconstructed.
+ * If there is an attached profile, then accumulate it into its
+ * histogram, and into the slots of both the PC and its basic block.
+ */
+static void attribute_cycles(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+    assert(decoder->cycles.num_pending);
+
+    te_cycle_profile_t * const profile = decoder->cycles.profile;
+    const uint32_t cycles = decoder->cycles.pending[decoder->cycles.head];
+
+    decoder->cycles.head = (decoder->cycles.head + 1u) & (TE_MAX_PENDING_CYCLES - 1u);
+    decoder->cycles.num_pending--;
+
+    if (profile)
+    {
+        /* note: unsigned arithmetic, so both bounds are checked at once */
+        const size_t slot = (decoder->pc - profile->base) >> 1;
+        const size_t block = (decoder->block_start - profile->base) >> 1;
+        unsigned bucket = 0;
+
+        while ( (bucket < TE_CYCLE_HISTOGRAM_BUCKETS - 1u) &&
+                (cycles >> bucket) )
+        {
+            bucket++;
+        }
+        profile->histogram[bucket]++;
+
+        if (slot < profile->num_slots)
+        {
+            profile->pc_cycles[slot] += cycles;
+            profile->pc_retired[slot]++;
+        }
+        else
+        {
+            profile->outside_cycles += cycles;
+        }
+        if (block < profile->num_slots)
+        {
+            profile->block_cycles[block] += cycles;
+            if (decoder->pc == decoder->block_start)
+            {
+                profile->block_entries[block]++;
+            }
+        }
+    }
+}
+
+
+/*
+ * End the current (dynamic) basic block in the attached execution profile,
+ * if its entry was counted there. The block ends just before the PC that
+ * would have been next, had there not been a discontinuity.
+ */
+static void close_exec_block(
+    te_decoder_state_t * const decoder)
+{
+    te_exec_profile_t * const profile = decoder->exec.profile;
+
+    if (decoder->exec.block_open)
+    {
+        size_t slot = (decoder->next_sequential_pc - profile->base) >> 1;
+
+        /* blocks running off the end of the range end in the extra slot */
+        if (slot > profile->num_slots)
+        {
+            slot = profile->num_slots;
+        }
+        profile->block_exits[slot]++;
+        decoder->exec.block_open = false;
+    }
+}
+
+
+/*
+ * A new (dynamic) basic block starts at the current PC, so close the
+ * previous block, and count the entry to this one, in the attached
+ * execution profile. Nothing is done per instruction.
+ */
+static void count_exec_block(
+    te_decoder_state_t * const decoder)
+{
+    te_exec_profile_t * const profile = decoder->exec.profile;
+    /* note: unsigned arithmetic, so both bounds are checked at once */
+    const size_t slot = (decoder->pc - profile->base) >> 1;
+
+    close_exec_block(decoder);
+
+    if (slot < profile->num_slots)
+    {
+        profile->block_entries[slot]++;
+        profile->num_blocks++;
+        decoder->exec.block_open = true;
+    }
+    else
+    {
+        profile->outside_blocks++;
+    }
+}
+
+
+/*
+ * Find the entry for the key ("from","to") in an open-addressing hash
+ * table, inserting it (with zero counts) if it is not already present.
+ * Returns NULL if the key is absent, and the table is already full.
+ */
+static te_edge_t * find_edge(
+    te_edge_table_t * const table,
+    const te_address_t from,
+    const te_address_t to)
+{
+    uint64_t hash = (from ^ (to * 0x9e3779b97f4a7c15ull)) * 0x9e3779b97f4a7c15ull;
+    size_t slot = (hash ^ (hash >> 29)) & table->mask;
+
+    while (true)
+    {
+        te_edge_t * const edge = &table->entries[slot];
+
+        if ( (0 == edge->count[0]) && (0 == edge->count[1]) )
+        {
+            /* an unused slot: so the key is absent */
+            if (table->num_used >= ((table->mask + 1u) >> 2) * 3u)
+            {
+                return NULL;
+            }
+            edge->from = from;
+            edge->to = to;
+            table->num_used++;
+            return edge;
+        }
+        if ( (edge->from == from) && (edge->to == to) )
+        {
+            return edge;
+        }
+        slot = (slot + 1u) & table->mask;
+    }
+}
+
+
+/*
+ * Increment one of the counts of the key ("from","to") in a hash table.
+ */
+static void count_edge(
+    te_edge_table_t * const table,
+    const te_address_t from,
+    const te_address_t to,
+    const unsigned which)
+{
+    te_edge_t * const edge = find_edge(table, from, to);
+
+    if (edge)
+    {
+        edge->count[which]++;
+    }
+    else
+    {
+        table->num_dropped++;
+    }
+}
+
+
+/*
+ * Count the current (dynamic) basic block as an address range in the
+ * attached edge profile, if it was open when the block started.
+ */
+static void close_edge_range(
+    te_decoder_state_t * const decoder)
+{
+    if (decoder->edges.block_open)
+    {
+        count_edge(&decoder->edges.profile->ranges,
+            decoder->block_start, decoder->next_sequential_pc, 0);
+        decoder->edges.block_open = false;
+    }
+}
+
+
+/*
+ * Set the bits [first, end) in a bitmap, using whole-word masked ORs.
+ */
+static void set_bits(
+    uint64_t * const words,
+    const size_t first,
+    const size_t end)
+{
+    const size_t first_word = first >> 6;
+    const size_t last_word = (end - 1u) >> 6;
+    const uint64_t head = ~0ull << (first & 63u);
+    const uint64_t tail = ~0ull >> (63u - ((end - 1u) & 63u));
+    size_t word;
+
+    assert(first < end);
+
+    if (first_word == last_word)
+    {
+        words[first_word] |= head & tail;
+        return;
+    }
+    words[first_word] |= head;
+    for (word = first_word + 1u; word < last_word; word++)
+    {
+        words[word] = ~0ull;
+    }
+    words[last_word] |= tail;
+}
+
+
+/*
+ * Record the part of the current (dynamic) basic block that lies inside
+ * the range being covered, in the attached coverage bitmap. The block runs
+ * from its first PC up to the PC that would have been next, had there
+ * not been a discontinuity, so it may start below the range, or end
+ * above it.
+ */
+static void close_coverage_block(
+    te_decoder_state_t * const decoder)
+{
+    const te_coverage_t * const coverage = decoder->coverage.map;
+
+    if (decoder->coverage.block_open)
+    {
+        const size_t first = (decoder->block_start > coverage->base) ?
+            (decoder->block_start - coverage->base) >> 1 : 0;
+        size_t end = (decoder->next_sequential_pc > coverage->base) ?
+            (decoder->next_sequential_pc - coverage->base + 1u) >> 1 : 0;
+
+        if (end > coverage->num_slots)
+        {
+            end = coverage->num_slots;
+        }
+        if (first < end)
+        {
+            set_bits(coverage->executed, first, end);
+        }
+        decoder->coverage.block_open = false;
+    }
+}
+
+
+/*
+ * Note, this function does not calculate nor even update the PC.
+ * It is merely a single control point that should be called
+ * each time the PC is updated, so we can inspect, check and record
+ * each and every transition of the PC in a consistent manner.
+ * This helps with checking the correctness of the decoder.
+ *
+ * Ultimately, the main purpose of this function is to call the external
+ * function te_advance_decoded_pc() to disseminate the new value of the PC.
+ */
+static void disseminate_pc(
+    te_decoder_state_t * const decoder)
+{
+    te_decoded_instruction_t instr;
+
+    assert(decoder);
+
+    instr.decode.pc = SENTINEL_BAD_ADDRESS;
+
+    if (TE_CORE_DEBUG)
+    {
+        /* optionally show the transition of the PC */
+        log_printf(decoder, "    set_pc 0x%08lx -> 0x%08lx\t%lu\n",
+            decoder->last_pc, decoder->pc, decoder->instruction_count);
+    }
+
+    /* do some sanity checks ... just in case! */
+    assert(SENTINEL_BAD_ADDRESS != decoder->pc);
+    if (decoder->instruction_count)
+    {
+        /* it is NOT the first transition */
+        assert(SENTINEL_BAD_ADDRESS != decoder->last_pc);
+        /* and the PC may only be unchanged when (re)starting a trace */
+        assert( (decoder->last_pc != decoder->pc) ||
+                (decoder->start_of_trace) );
+    }
+    else
+    {
+        /* it is the FIRST transition */
+        assert(SENTINEL_BAD_ADDRESS == decoder->last_pc);
+    }
+
+    /* decode & disassemble the instruction at the new PC */
+    (void)get_instr(decoder, decoder->pc, &instr);
+    if (decoder->waiting_for_sync)
+    {
+        return;     /* unable to retrieve the instruction at the new PC */
+    }
+
+    if (TE_CORE_DEBUG)
+    {
+        /* optionally show the transition & instruction at the new PC */
+        log_printf(decoder, "%s\t%8lx -> %8lx:\t%s\n",
+            (decoder->pc == decoder->address) ? "---->" : "",
+            decoder->last_pc,
+            decoder->pc,
+            instr.line);
+    }
+
+    /* track the start of each (dynamic) basic block */
+    if (decoder->pc != decoder->next_sequential_pc)
+    {
+        if (decoder->edges.profile)
+        {
+            close_edge_range(decoder);
+            decoder->edges.block_open = true;
+        }
+        if (decoder->coverage.map)
+        {
+            close_coverage_block(decoder);
+            decoder->coverage.block_open = true;
+        }
+        decoder->block_start = decoder->pc;
+        if (decoder->exec.profile)
+        {
+            count_exec_block(decoder);
+        }
+    }
+    decoder->next_sequential_pc = decoder->pc + instruction_size(&instr);
+
+    /* if there are any cycle counts waiting, then attribute the next one */
+    if (decoder->cycles.num_pending)
+    {
+        attribute_cycles(decoder);
+    }
+
+    /* if there is any data trace waiting, then try and match it up */
+    if ( (decoder->data.num_pending) &&
+         (is_load(&instr) || is_store(&instr)) )
+    {
+        correlate_data_transfer(decoder, &instr);
+    }
+
+    /* notify the user that the PC has been updated */
+    TE_CORE_ADVANCE_DECODED_PC(decoder, decoder->last_pc, decoder->pc, &instr);
+
+    /* advance the count of PC transitions */
+    decoder->instruction_count++;
+}
+
+
+/*
+ * Determine if current instruction is a branch
+ */
+static bool is_branch(
+    const te_decoded_instruction_t * const instr)
+{
+    bool predicate = false;
+
+    assert(instr);
+
+    if ( (instr->decode.op == rv_op_beq)    ||
+         (instr->decode.op == rv_op_bne)    ||
+         (instr->decode.op == rv_op_blt)    ||
+         (instr->decode.op == rv_op_bge)    ||
+         (instr->decode.op == rv_op_bltu)   ||
+         (instr->decode.op == rv_op_bgeu)   ||
+         (instr->decode.op == rv_op_c_beqz) ||
+         (instr->decode.op == rv_op_c_bnez) )
+    {
+        predicate = true;
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Determine if current instruction is a branch, adjust the branch
+ * count/map, and return the "taken" status
+ */
+static bool is_taken_branch(
+    te_decoder_state_t * const decoder,
+    const te_decoded_instruction_t * const instr)
+{
+    bool taken = false;     /* assume branch not taken */
+
+    assert(decoder);
+    assert(instr);
+
+    if (!is_branch(instr))
+    {
+        return false;
+    }
+
+    if (0 == decoder->branches)
+    {
+        report_error(decoder, TE_ERROR_BRANCH_MAP_DEPLETED, instr,
+            "cannot resolve branch (branch-map depleted)!");
+    }
+    else
+    {
+        taken = !(decoder->branch_map & 1);  /* bit [0] */
+        decoder->branches--;
+        decoder->branch_map >>= 1;   /* right-shift one bit */
+
+        if (decoder->edges.profile)
+        {
+            count_edge(&decoder->edges.profile->branches,
+                instr->decode.pc, 0, taken ? 0 : 1);
+        }
+        if (decoder->coverage.map)
+        {
+            const te_coverage_t * const coverage = decoder->coverage.map;
+            const size_t slot = (instr->decode.pc - coverage->base) >> 1;
+            if (slot < coverage->num_slots)
+            {
+                uint64_t * const bits = taken ? coverage->taken : coverage->not_taken;
+                bits[slot >> 6] |= 1ull << (slot & 63u);
+            }
+        }
+    }
+
+    return taken;
+}
+
+
+/*
+ * Determine if instruction is an inferrable jump
+ */
+static bool is_inferrable_jump(
+    const te_decoded_instruction_t * const instr)
+{
+    bool predicate = false;
+
+    assert(instr);
+
+    if ( (instr->decode.op == rv_op_jal)    ||
+         (instr->decode.op == rv_op_c_jal)  ||
+         (instr->decode.op == rv_op_c_j)    ||
+         ( (instr->decode.op == rv_op_jalr) &&
+           (0 == instr->decode.rs1) ) )
+    {
+        predicate = true;
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Determine if instruction is an uninferrable jump
+ */
+static bool is_uninferrable_jump(
+    const te_decoded_instruction_t * const instr)
+{
+    bool predicate = false;
+
+    assert(instr);
+
+    if ( ( (instr->decode.op == rv_op_jalr) &&
+           (0 != instr->decode.rs1) )       ||
+         (instr->decode.op == rv_op_c_jalr) ||
+         (instr->decode.op == rv_op_c_jr) )
+    {
+        predicate = true;
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Determine if instruction is an uninferrable discontinuity
+ */
+static bool is_uninferrable_discon(
+    const te_decoded_instruction_t * const instr)
+{
+    bool predicate = false;
+
+    assert(instr);
+
+    /*
+     * Note: The exception reporting mechanism means it is not necessary
+     * to include ECALL, EBREAK or C.EBREAK in this predicate
+     */
+    if ( is_uninferrable_jump(instr)        ||
+         (instr->decode.op == rv_op_uret)   ||
+         (instr->decode.op == rv_op_sret)   ||
+         (instr->decode.op == rv_op_mret)   ||
+         (instr->decode.op == rv_op_dret) )
+    {
+        predicate = true;
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Determine if instruction is a sequentially inferrable jump
+ */
+static bool is_sequential_jump(
+    te_decoder_state_t * const decoder,
+    const te_decoded_instruction_t * const instr,
+    const te_address_t prev_addr)
+{
+    te_decoded_instruction_t prev_instr;
+    bool predicate = false;
+
+    assert(decoder);
+    assert(instr);
+
+    if (!is_uninferrable_jump(instr))
+    {
+        return false;
+    }
+
+    prev_instr.decode.pc = SENTINEL_BAD_ADDRESS;
+    (void)get_instr(decoder, prev_addr, &prev_instr);
+
+    if ( (prev_instr.decode.op == rv_op_auipc) ||
+         (prev_instr.decode.op == rv_op_lui)   ||
+         (prev_instr.decode.op == rv_op_c_lui) )
+    {
+        predicate = (instr->decode.rs1 == prev_instr.decode.rd);
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Find the target of a sequentially inferrable jump
+ */
+static te_address_t sequential_jump_target(
+    te_decoder_state_t * const decoder,
+    const te_address_t addr,
+    const te_address_t prev_addr)
+{
+    te_decoded_instruction_t instr;
+    te_decoded_instruction_t prev_instr;
+    te_address_t target = 0;
+
+    assert(decoder);
+
+    instr.decode.pc = SENTINEL_BAD_ADDRESS;
+    prev_instr.decode.pc = SENTINEL_BAD_ADDRESS;
+    (void)get_instr(decoder, addr, &instr);
+    (void)get_instr(decoder, prev_addr, &prev_instr);
+
+    if (prev_instr.decode.op == rv_op_auipc)
+    {
+        target = prev_addr;
+    }
+
+    target += prev_instr.decode.imm;
+
+    if (instr.decode.op == rv_op_jalr)
+    {
+        target += instr.decode.imm;
+    }
+
+    return target;
+}
+
+
+/*
+ * Determine if instruction is a call
+ * - excludes tail calls as they do not push an address onto the return stack
+ */
+static bool is_call(
+    const te_decoded_instruction_t * const instr)
+{
+    bool predicate = false;
+
+    assert(instr);
+
+    if ( ( (instr->decode.op == rv_op_jalr) &&
+           (1 == instr->decode.rd) )        ||
+         (instr->decode.op == rv_op_c_jalr) ||
+         ( (instr->decode.op == rv_op_jal)  &&
+           (1 == instr->decode.rd) )        ||
+         (instr->decode.op == rv_op_c_jal) )
+    {
+        predicate = true;
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Determine if instruction is a function return, i.e. "jalr x0, 0(x1)",
+ * or its compressed equivalent "c.jr x1"
+ */
+static bool is_return(
+    const te_decoded_instruction_t * const instr)
+{
+    bool predicate = false;
+
+    assert(instr);
+
+    if ( ( (instr->decode.op == rv_op_jalr) &&
+           (1 == instr->decode.rs1)         &&
+           (0 == instr->decode.rd) )        ||
+         ( (instr->decode.op == rv_op_c_jr) &&
+           (1 == instr->decode.rs1) ) )
+    {
+        predicate = true;
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Determine if instruction return address can be implicitly inferred
+ */
+static bool is_implicit_return(
+    const te_decoder_state_t * const decoder,
+    const te_decoded_instruction_t * const instr)
+{
+    bool predicate = false;
+    assert(decoder);
+    assert(instr);
+
+    if (!TE_CORE_IMPLICIT_RETURN)
+    {
+        return false;   /* Implicit return mode is disabled */
+    }
+
+    if (is_return(instr))
+    {
+        predicate = (decoder->call_counter > 0);
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Push address onto return stack
+ * The stack is only ever popped in implicit return mode, so it is
+ * not allocated (nor pushed) otherwise.
+ */
+static void push_return_stack(
+    te_decoder_state_t * const decoder,
+    const te_address_t address)
+{
+    const size_t call_counter_max = decoder->return_stack_size;
+    te_decoded_instruction_t instr;
+    te_address_t link = address;
+    size_t i;
+
+    assert(decoder);
+
+    if (0 == call_counter_max)
+    {
+        return;     /* Implicit return mode is disabled */
+    }
+
+    assert(decoder->call_counter <= call_counter_max);
+    assert(call_counter_max <= TE_MAX_CALL_DEPTH);
+
+    if (call_counter_max == decoder->call_counter)
+    {
+        /* Delete oldest entry from stack to make room for new entry added below */
+        decoder->call_counter--;
+        for (i = 0; i < decoder->call_counter; i++)
+        {
+            decoder->return_stack[i] = decoder->return_stack[i+1];
+        }
+    }
+
+    /* link register is address of next spatial instruction */
+    instr.decode.pc = SENTINEL_BAD_ADDRESS;
+    (void)get_instr(decoder, address, &instr);
+    link += instruction_size(&instr);
+
+    /* push link register to top of the stack */
+    decoder->return_stack[decoder->call_counter] = link;
+    decoder->call_counter++;
+}
+
+
+/*
+ * Pop address from return stack
+ */
+static te_address_t pop_return_stack(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+
+    /*
+     * Note: this function is not called if call_counter is 0,
+     * so no need to check for underflow
+     */
+    decoder->call_counter--;
+
+    return decoder->return_stack[decoder->call_counter];
+}
+
+
+/*
+ * Compute the next PC, returning true if it was predicted by an implicit
+ * return (i.e. popped from the return stack, rather than "address").
+ */
+static bool next_pc(
+    te_decoder_state_t * const decoder,
+    const te_address_t address)
+{
+    assert(decoder);
+
+    const te_address_t this_pc = decoder->pc;
+    te_decoded_instruction_t instr;
+    bool implicit_return = false;
+
+    instr.decode.pc = SENTINEL_BAD_ADDRESS;
+    (void)get_instr(decoder, decoder->pc, &instr);
+
+    if (is_inferrable_jump(&instr))
+    {
+        decoder->pc += instr.decode.imm;
+    }
+    else if (is_sequential_jump(decoder, &instr, decoder->last_pc))
+    {
+        /* lui/auipc followed by jump using same register */
+        decoder->pc = sequential_jump_target(decoder, decoder->pc, decoder->last_pc);
+    }
+    else if (is_implicit_return(decoder, &instr))
+    {
+        decoder->pc = pop_return_stack(decoder);
+        implicit_return = true;
+    }
+    else if (is_uninferrable_discon(&instr))
+    {
+        if (decoder->stop_at_last_branch)
+        {
+            report_error(decoder, TE_ERROR_UNEXPECTED_DISCON, &instr,
+                "unexpected uninferrable discontinuity");
+        }
+        else
+        {
+          decoder->pc = address;
+        }
+    }
+    else if (is_taken_branch(decoder, &instr))
+    {
+        decoder->pc += instr.decode.imm;
+    }
+    else
+    {
+        decoder->pc += instruction_size(&instr);
+    }
+
+    if (decoder->waiting_for_sync)
+    {
+        /* an error was reported, so abandon this PC */
+        decoder->pc = this_pc;
+        return false;
+    }
+
+    if ( (decoder->edges.profile) &&
+         (decoder->pc != this_pc + instruction_size(&instr)) )
+    {
+        count_edge(&decoder->edges.profile->jumps, this_pc, decoder->pc, 0);
+    }
+
+    if (is_call(&instr))
+    {
+        push_return_stack(decoder, this_pc);
+    }
+
+    if ( (decoder->contexts.switch_pending) &&
+         (decoder->pc == address) &&
+         ( (0 == decoder->branches) || (is_uninferrable_discon(&instr)) ) )
+    {
+        /*
+         * Reached the address of a format 3 te_inst, which is in its
+         * context, so switch now, and then add its branch (if any).
+         */
+        decoder->contexts.switch_pending = false;
+        te_set_context(decoder, decoder->contexts.next_context);
+        instr.decode.pc = SENTINEL_BAD_ADDRESS;
+        if (is_branch(get_instr(decoder, decoder->pc, &instr)))
+        {
+            decoder->branch_map |= decoder->contexts.sync_branch << decoder->branches;
+            decoder->branches++;
+        }
+        if (decoder->waiting_for_sync)
+        {
+            decoder->pc = this_pc;
+            return false;   /* unable to retrieve the instruction at address */
+        }
+    }
+
+    decoder->last_pc = this_pc;
+    disseminate_pc(decoder);
+
+    return implicit_return;
+}
+
+
+/*
+ * Follow execution path to reported address
+ */
+static void follow_execution_path(
+    te_decoder_state_t * const decoder,
+    const te_address_t address,
+    const te_inst_t * const te_inst)
+{
+    assert(decoder);
+
+    te_address_t previous_address = decoder->pc;
+    te_decoded_instruction_t instr;
+    te_decoded_instruction_t last_instr;
+    unsigned long steps = 0;
+
+    assert(te_inst);
+    assert( (!decoder->stop_at_last_branch)  ||
+            (1==decoder->branches)           ||
+            (2==decoder->branches)           ||
+            (31==decoder->branches)          ||
+            (32==decoder->branches) );
+
+    instr.decode.pc = SENTINEL_BAD_ADDRESS;
+    last_instr.decode.pc = SENTINEL_BAD_ADDRESS;
+    (void)get_instr(decoder, decoder->pc, &instr);
+
+    if (TE_CORE_DEBUG)
+    {
+        log_printf(decoder, "entered %s() with format = %u, pc = 0x%lx, and address = 0x%lx\n",
+            __func__, te_inst->format, decoder->pc, address);
+    }
+
+    while (true)
+    {
+        if ( (decoder->stop_at_last_branch) &&
+             (0 == decoder->branches) )
+        {
+            report_error(decoder, TE_ERROR_NO_BRANCHES, &instr,
+                "follow_execution_path() has stop_at_last_branch=true and branches=0");
+            return;
+        }
+
+        if (TE_MAX_FOLLOW_STEPS < ++steps)
+        {
+            report_error(decoder, TE_ERROR_RUNAWAY, &instr,
+                "follow_execution_path() did not reach the reported address");
+            return;
+        }
+
+        if (decoder->inferred_address)
+        {
+            /*
+             * iterate again from previously reported address to find second occurrence
+             */
+            (void)next_pc(decoder, previous_address);
+            if (decoder->waiting_for_sync)
+            {
+                return;     /* an error was reported */
+            }
+            (void)get_instr(decoder, decoder->pc, &instr);
+            if (decoder->pc == previous_address)
+            {
+                decoder->inferred_address = false;
+            }
+        }
+        else
+        {
+            const bool implicit_return = next_pc(decoder, address);
+            if (decoder->waiting_for_sync)
+            {
+                return;     /* an error was reported */
+            }
+            (void)get_instr(decoder, decoder->pc, &instr);
+            if ( (1 == decoder->branches)                             &&
+                 (is_branch(get_instr(decoder, decoder->pc, &instr))) &&
+                 (decoder->stop_at_last_branch) )
+            {
+                /*
+                 * Reached final branch - stop here (do not follow to next instruction
+                 * as we do not yet know whether it retires)
+                 */
+                decoder->stop_at_last_branch = false;
+                return;
+            }
+            if ( (decoder->pc == address) &&
+                 (!implicit_return) &&
+                 is_uninferrable_discon(get_instr(decoder, decoder->last_pc, &last_instr)) )
+            {
+                /*
+                 * Reached reported address following an uninferrable discontinuity - stop here.
+                 * The target of an implicit return was predicted, so is not reported (and
+                 * there may be more branches, e.g. if it is the start of a loop).
+                 */
+                if (decoder->branches > (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0))
+                {
+                    /*
+                     * Check all branches processed (except 1 if this instruction is a branch)
+                     */
+                    report_error(decoder, TE_ERROR_UNPROCESSED_BRANCHES, &instr,
+                        "unprocessed branches");
+                }
+                return;
+            }
+            if ( (3 != te_inst->format)                         &&
+                 (decoder->pc == address)                       &&
+                 (te_inst->updiscon == MSB(te_inst->address))   &&
+                 (decoder->branches == (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0)) )
+            {
+                /*
+                 * All branches processed, and reached reported address, but not as an
+                 * uninferrable jump target. Stop here for now, though flag indicates
+                 * this may not be final retired instruction
+                 */
+                decoder->inferred_address = true;
+                return;
+            }
+            if ( (3 == te_inst->format)     &&
+                 (decoder->pc == address)   &&
+                 (decoder->branches == (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0)) )
+            {
+                /* All branches processed, and reached reported address */
+                return;
+            }
+        }
+    }
+}
+
+
+/*
+ * Process a single te_inst message (see te_process_te_inst).
+ */
+static void process_te_inst(
+    te_decoder_state_t * const decoder,
+    const te_inst_t * const te_inst)
+{
+    te_decoded_instruction_t instr;
+
+    assert(decoder);
+    assert(te_inst);
+
+    instr.decode.pc = SENTINEL_BAD_ADDRESS;
+    decoder->num_te_inst++;     /* update statistics */
+
+    if (decoder->waiting_for_sync)
+    {
+        if (3 != te_inst->format)
+        {
+            /* still waiting for a format 3 ... discard this message */
+            decoder->num_discarded++;
+            return;
+        }
+        /* resynchronize (start_of_trace is already true) */
+        decoder->waiting_for_sync = false;
+    }
+
+    if ( (0 == te_inst->format) ||
+         ( (1 == te_inst->format) && (0 != te_inst->branch_fmt) ) )
+    {
+        /* the encoder's jump target cache and branch predictor are not modelled */
+        report_error(decoder, TE_ERROR_UNSUPPORTED, NULL,
+            "te_inst needs a jump target cache or branch predictor");
+        return;
+    }
+
+    if ( (3 == te_inst->format) &&
+         (decoder->contexts.map) &&
+         (te_inst->context != decoder->contexts.context) )
+    {
+        if ( (0 == te_inst->subformat) &&
+             (!decoder->start_of_trace) )
+        {
+            /*
+             * The path up to the reported address is in the old context,
+             * so only switch on reaching it (see next_pc).
+             */
+            decoder->contexts.switch_pending = true;
+            decoder->contexts.sync_branch = te_inst->branch;
+            decoder->contexts.next_context = te_inst->context;
+        }
+        else
+        {
+            /* this is just a pointer swap, unless the context is new */
+            te_set_context(decoder, te_inst->context);
+        }
+    }
+
+    if ( (3 == te_inst->format) &&
+         (1 < te_inst->subformat) )
+    {
+        return;     /* context or support only, so no address to follow */
+    }
+
+    if (3 == te_inst->format)
+    {
+        decoder->inferred_address = false;
+        decoder->address = (te_inst->address << TE_CORE_IADDRESS_LSB);
+
+        if ( (1 == te_inst->subformat) ||
+             (decoder->start_of_trace) )
+        {
+            /* expunge any pending branches */
+            decoder->branches   = 0;
+            decoder->branch_map = 0;
+        }
+        if ( (!decoder->contexts.switch_pending) &&
+             (is_branch(get_instr(decoder, decoder->address, &instr))) )
+        {
+            /* 1 unprocessed branch if this instruction is a branch */
+            decoder->branch_map |= te_inst->branch << decoder->branches;
+            decoder->branches++;
+        }
+        if (decoder->waiting_for_sync)
+        {
+            return;     /* unable to retrieve the instruction at address */
+        }
+
+        if ( (0 == te_inst->subformat) &&
+             (!decoder->start_of_trace) )
+        {
+            follow_execution_path(decoder, decoder->address, te_inst);
+            if (decoder->contexts.switch_pending)
+            {
+                /* the address was not reached (an error was reported) */
+                decoder->contexts.switch_pending = false;
+                te_set_context(decoder, decoder->contexts.next_context);
+            }
+        }
+        else
+        {
+            /*
+             * Firstly, update "last_pc" to be the current PC.
+             * This is essentially so that the diagnostics emitted from disseminate_pc() looks right!
+             * After we return from disseminate_pc(), we will update it again!
+             */
+            decoder->last_pc = decoder->pc;
+            decoder->pc = decoder->address;
+            disseminate_pc(decoder);
+            /*
+             * To avoid the (unlikely, but not impossible) possibility that the
+             * instructions currently at "last_pc" and "pc" happen to satisfy
+             * the constraints in is_sequential_jump(), we need to guarantee
+             * that does not happen, when we next call follow_execution_path().
+             * Thus we update "last_pc" to a "spurious" value ... that is a
+             * value which will always cause is_sequential_jump() to be false.
+             * We choose "pc" as such a spurious value to write to "last_pc".
+             * Thus the predicate is_sequential_jump(pc,pc) will never be true.
+             * Ensure is_sequential_jump() deterministically returns
+             * false immediately after the first format 3 message,
+             * even though the previous PC is not known.
+             */
+            decoder->last_pc = decoder->pc;
+        }
+        decoder->start_of_trace = false;
+        decoder->call_counter = 0;
+    }
+    else
+    {
+        if (decoder->start_of_trace)
+        {
+            /* This should not be possible! */
+            report_error(decoder, TE_ERROR_NO_START_SYNC, NULL,
+                "Expecting trace to start with a format 3 message");
+            return;
+        }
+        if ( (2 == te_inst->format) ||
+             (0 != te_inst->branches) )
+        {
+            decoder->stop_at_last_branch = false;
+            if (TE_CORE_FULL_ADDRESS)
+            {
+                decoder->address  = (te_inst->address << TE_CORE_IADDRESS_LSB);
+            }
+            else
+            {
+                decoder->address += (te_inst->address << TE_CORE_IADDRESS_LSB);
+            }
+        }
+        if (1 == te_inst->format)
+        {
+            decoder->stop_at_last_branch = (te_inst->branches == 0);
+            /*
+             * Branch map will contain <= 1 branch
+             * (1 if last reported instruction was a branch)
+             */
+            if ( (decoder->branches > 1) ||
+                 ( (0==decoder->branches) && (0!=decoder->branch_map) ) ||
+                 ( (1==decoder->branches) && (0!=(decoder->branch_map&(~1))) ) )
+            {
+                report_error(decoder, TE_ERROR_BAD_BRANCH_MAP, NULL,
+                    "more than 1 unprocessed branch before a format 1 message");
+                return;
+            }
+            decoder->branch_map |= te_inst->branch_map << decoder->branches;
+            if (0 == te_inst->branches)
+            {
+                decoder->branches += 31;
+            }
+            else
+            {
+                decoder->branches += te_inst->branches;
+            }
+        }
+        follow_execution_path(decoder, decoder->address, te_inst);
+    }
+}
+
+
+/*
+ * Process a single te_support message (see te_process_te_support).
+ */
+static void process_te_support(
+    te_decoder_state_t * const decoder,
+    const te_support_t * const te_support)
+{
+    assert(decoder);
+    assert(te_support);
+
+    if (0 == te_support->support_type)
+    {
+        if (QUAL_STATUS_PACKET_LOST == te_support->qual_status)
+        {
+            /* The encoder lost packets, so this is a gap in the trace */
+            te_process_gap(decoder);
+            return;
+        }
+        if ( (QUAL_STATUS_ENDED_NTR == te_support->qual_status) ||
+             (QUAL_STATUS_ENDED_REP == te_support->qual_status) )
+        {
+            /* Trace ended, so get ready to start again */
+            decoder->start_of_trace = true;
+        }
+        if ( (QUAL_STATUS_ENDED_NTR == te_support->qual_status) &&
+             (decoder->inferred_address) )
+        {
+            const te_address_t previous_address = decoder->pc;
+            unsigned long steps = 0;
+            decoder->inferred_address = false;
+            while (true)
+            {
+                if (TE_MAX_FOLLOW_STEPS < ++steps)
+                {
+                    report_error(decoder, TE_ERROR_RUNAWAY, NULL,
+                        "did not reach the previously reported address");
+                    return;
+                }
+                (void)next_pc(decoder, previous_address);
+                if ( (decoder->waiting_for_sync) ||
+                     (decoder->pc == previous_address) )
+                {
+                    return;
+                }
+            }
+        }
+    }
+}
@@ -27,7 +27,12 @@
 
 
 #include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#endif  /* __SSE2__ */
 #include "decoder-algorithm-public.h"
 
 
@@ -37,22 +42,10 @@
 #endif  /* DEBUG */
 
 
-/*
- * Extract the most-significant bit of an integer.
- */
-#define MSB(x)  (((x)>>(8*(sizeof(x))-1)) & 0x1)
-
-
-/*
- * Initialize the PC to a known "bad address".
- * Detect if we ever try and use this address!
- */
-#define SENTINEL_BAD_ADDRESS    0xbadadd
-
-
 /*
  * Fake up some values that would be obtained through
  * "discovery", or means other than "te_inst" messages.
+ * These are compile-time constants (see TE_FULL_ADDRESS, etc.).
  */
 static const struct
 {
@@ -60,819 +53,1488 @@ static const struct
     unsigned int iaddress_lsb;          /* 2-bits */
 } discovery_response =
 {
-    .call_counter_width = 7,    /* maximum of 512 calls on return_stack[] */
-    .iaddress_lsb = 1,          /* 1 == compressed instructions supported */
+    .call_counter_width = TE_CALL_COUNTER_WIDTH,
+    .iaddress_lsb = TE_IADDRESS_LSB,
 };
 
 static const te_support_t te_support =
 {
-    .full_address = 0,          /* use differential addresses */
-    .implicit_return = 0,       /* disable using return_stack[] */
+    .full_address = TE_FULL_ADDRESS,
+    .implicit_return = TE_IMPLICIT_RETURN,
 };
 
+#if (1u << (TE_CALL_COUNTER_WIDTH + 2)) > TE_MAX_CALL_DEPTH
+#   error "TE_MAX_CALL_DEPTH is too small for TE_CALL_COUNTER_WIDTH"
+#endif
+
 
 /*
- * Process an unrecoverable error with the trace-decoder's algorithm.
- * This is indicative of a serious malfunction - this should never happen!
- * This function prints a diagnostic, and it will call exit() to terminate.
- * If the parameter "instr" is not NULL, then it will also print the
- * disassembly line of the instruction ("instr") passed in.
- * NOTE: this function will never return to its caller!
- * However, any functions registered with atexit() will be called.
+ * The core of the trace-decoder, for the modes it is compiled for, calling
+ * the callbacks of each instance (see decoder-algorithm-core.h).
  */
-static void unrecoverable_error(
-    const te_decoded_instruction_t * const instr,
-    const char * const message)
-{
-    assert(message);
+#define TE_CORE_DEBUG                   DEBUG
+#define TE_CORE_FULL_ADDRESS            te_support.full_address
+#define TE_CORE_IMPLICIT_RETURN         te_support.implicit_return
+#define TE_CORE_IADDRESS_LSB            discovery_response.iaddress_lsb
+#define TE_CORE_ISA(decoder)            ((decoder)->isa)
+#define TE_CORE_GET_INSTRUCTION(decoder, address, instruction) \
+    ((decoder)->callbacks.get_instruction((decoder)->user_data, (address), (instruction)))
+#define TE_CORE_ADVANCE_DECODED_PC(decoder, old_pc, new_pc, instruction) \
+    ((decoder)->callbacks.advance_decoded_pc((decoder)->user_data, (old_pc), (new_pc), (instruction)))
+#define TE_CORE_HAS_LOG(decoder)        (NULL != (decoder)->callbacks.log)
+#define TE_CORE_LOG(decoder, format, args) \
+    ((decoder)->callbacks.log((decoder)->user_data, (format), (args)))
+
+#include "decoder-algorithm-core.h"
 
-    printf("ERROR: %s\n", message);
 
-    if (instr)
-    {
-        printf("Whilst processing the following instruction:\n");
-        printf("%12lx:\t%s\n", instr->decode.pc, instr->line);
-    }
+/*
+ * Process a single te_inst message.
+ * Called each time a te_inst message is received.
+ */
+extern void te_process_te_inst(
+    te_decoder_state_t * const decoder,
+    const te_inst_t * const te_inst)
+{
+    process_te_inst(decoder, te_inst);
+}
+
 
-    exit(1);    /* do not return ... bye bye */
+/*
+ * Process a single te_support message.
+ * Called each time a te_support message is received.
+ */
+extern void te_process_te_support(
+    te_decoder_state_t * const decoder,
+    const te_support_t * const te_support)
+{
+    process_te_support(decoder, te_support);
 }
 
 
 /*
- * for the address given, find the raw binary value of the instruction at
- * that address (using the external function te_get_instruction), and then use
- * the open-source riscv-disassembler library to decode, and then cache it.
+ * Process a single data trace message (load or store).
+ * Called each time a data trace message is received.
+ *
+ * The absolute address (and value, if present) of the transfer is
+ * reconstructed using the registers holding the previous transfer of the
+ * same size. The reconstructed transfer is then queued, until the
+ * instruction-trace reconstruction reaches its load or store instruction,
+ * at which point it is correlated with that instruction's PC, and written
+ * to the attached te_data_columns_t (see correlate_data_transfer()).
+ * Until te_attach_data_columns() is first called, the data-trace stage
+ * has no queue, so these messages are just discarded. If the queue is
+ * full, then the transfer is dropped (and counted), as losing some data
+ * trace is no reason to discard the instruction-trace reconstruction.
  */
-static te_decoded_instruction_t * get_instr(
+extern void te_process_te_data(
     te_decoder_state_t * const decoder,
-    const te_address_t address,
-    te_decoded_instruction_t * const instr)
+    const te_data_t * const te_data)
 {
-    const size_t slot = TE_SLOT_NUMBER(address);
-    rv_inst instruction;
-    unsigned length;
+    const unsigned size = te_data->size;
+    const uint64_t mask = (3u == size) ? ~(uint64_t)0 :
+                                         ((uint64_t)1 << (8u << size)) - 1u;
+    te_data_transfer_t * transfer;
+    size_t tail;
 
     assert(decoder);
-    assert(instr);
-    assert(SENTINEL_BAD_ADDRESS != address);
-
-    decoder->num_gets++;        /* update statistics */
+    assert(te_data);
+    assert(size < TE_DATA_SIZES);
 
-    /*
-     * if the address matches the decoded one passed in ...
-     * ... then just return it! Nothing to do this time!
-     */
-    if ( (instr->decode.pc == address) )
+    if ( (decoder->waiting_for_sync) || (!decoder->data.pending) )
     {
-        decoder->num_same++;        /* update statistics */
-        return instr;       /* referenced data is unchanged */
+        /* the instructions will never be reconstructed ... discard it */
+        decoder->num_discarded++;
+        return;
     }
 
-    /* is "address" currently in our decoded cache ? */
-    if (decoder->decoded_cache[slot].decode.pc == address)
+    if (TE_MAX_PENDING_DATA == decoder->data.num_pending)
     {
-        decoder->num_hits++;        /* update statistics */
-        /* copy, and return the cached decode */
-        *instr = decoder->decoded_cache[slot];
-        return instr;       /* referenced data is updated */
+        /* no room to queue it ... drop it, but keep on decoding */
+        decoder->data.num_dropped++;    /* update statistics */
+        return;
     }
 
-    /* otherwise, we need to do a bit of disassembly work ... */
+    /* reconstruct the absolute address */
+    if (te_data->diff_address)
+    {
+        decoder->data.last_address[size] += te_data->address;
+    }
+    else
+    {
+        decoder->data.last_address[size] = te_data->address;
+    }
 
-    /* first, get the raw instruction (and its length), from its address */
-    length = te_get_instruction(
-        decoder->user_data,
-        address,
-        &instruction);
+    /* reconstruct the absolute value (if present) */
+    if (te_data->has_value)
+    {
+        if (te_data->diff_value)
+        {
+            decoder->data.last_value[size] += te_data->value;
+        }
+        else
+        {
+            decoder->data.last_value[size] = te_data->value;
+        }
+        decoder->data.last_value[size] &= mask;
+    }
 
-    assert( (4 == length) ||
-            (2 == length) );
+    /* append it to the queue of transfers waiting for their PC */
+    tail = (decoder->data.head + decoder->data.num_pending) &
+           (TE_MAX_PENDING_DATA - 1u);
+    transfer = &decoder->data.pending[tail];
+    transfer->address = decoder->data.last_address[size];
+    transfer->value = te_data->has_value ? decoder->data.last_value[size] : 0;
+    transfer->flags = size |
+        (te_data->store     ? TE_DATA_FLAG_STORE : 0) |
+        (te_data->has_value ? TE_DATA_FLAG_VALUE : 0);
+    decoder->data.num_pending++;
+}
 
-    /* cache the length of the instruction, for instruction_size() */
-    instr->length = length;
 
-    /*
-     * Use the modified riscv-disassembler open-source library to decode
-     * the instruction. This repository is available from:
-     *
-     * https://github.com/ultrasoc/riscv-disassembler/tree/ultrasoc
-     *
-     * Note: predicates in this code assumes that pseudo-instructions
-     * are not lifted e.g. decode is not "ret", but "jalr x0,0(x1)".
-     */
-    (void)disasm_inst_adv(
-        &instr->decode,
-        instr->line,
-        sizeof(instr->line) - 1,
-        decoder->isa,
-        address,
-        instruction,
-        false);     /* false: do not lift pseudo-instructions */
-
-    /* save the freshly decoded instruction in the decoded cache */
-    decoder->decoded_cache[slot] = *instr;
+/*
+ * Attach the (user-owned) columns to which correlated data transfers
+ * are to be written. If "columns" is NULL, then data trace messages are
+ * still processed, but the correlated transfers are just counted.
+ * The first call also allocates the queue of pending transfers (which is
+ * released by te_close_trace_decoder), enabling the data-trace stage.
+ */
+extern void te_attach_data_columns(
+    te_decoder_state_t * const decoder,
+    te_data_columns_t * const columns)
+{
+    assert(decoder);
+    assert( (!columns) ||
+            ( (columns->capacity) && (columns->flush) ) );
 
-    /*
-     * finally, return the pointer to te_decoded_instruction_t passed in, whose
-     * referenced data will have been updated (in situ), and
-     * added to the decoded_cache[] cache.
-     */
-    return instr;
+    if (!decoder->data.pending)
+    {
+        decoder->data.pending = malloc(TE_MAX_PENDING_DATA * sizeof(te_data_transfer_t));
+        assert(decoder->data.pending);
+    }
+    decoder->data.columns = columns;
 }
 
 
 /*
- * Returns the size of the instruction in bytes
- * Only safe to be called after get_instr() with instr
+ * Flush any rows in the attached data columns to the user.
+ * Typically called once the final te_inst message has been processed.
  */
-static unsigned instruction_size(
-    const te_decoded_instruction_t * const instr)
+extern void te_flush_data_trace(
+    te_decoder_state_t * const decoder)
 {
-    assert(instr);
+    assert(decoder);
 
-    return instr->length;
+    te_data_columns_t * const columns = decoder->data.columns;
+
+    if ( (columns) && (columns->count) )
+    {
+        columns->flush(decoder->user_data, columns);
+        columns->count = 0;
+    }
 }
 
 
 /*
- * Note, this function does not calculate nor even update the PC.
- * It is merely a single control point that should be called
- * each time the PC is updated, so we can inspect, check and record
- * each and every transition of the PC in a consistent manner.
- * This helps with checking the correctness of the decoder.
+ * Process a single inter-instruction cycle count message.
+ * Called each time a cycle count message is received.
  *
- * Ultimately, the main purpose of this function is to call the external
- * function te_advance_decoded_pc() to disseminate the new value of the PC.
+ * Each count describes the next instruction to retire, so it is queued
+ * until the instruction-trace reconstruction reaches that instruction,
+ * at which point it is attributed to its PC (see attribute_cycles()).
+ * Until te_attach_cycle_profile() is first called, the cycle count stage
+ * has no queue, so these messages are just discarded. If the queue is
+ * full, then the count is dropped (and counted), and the reconstruction
+ * carries on regardless.
  */
-static void disseminate_pc(
-    te_decoder_state_t * const decoder)
+extern void te_process_te_cycles(
+    te_decoder_state_t * const decoder,
+    const te_cycles_t * const te_cycles)
 {
-    te_decoded_instruction_t instr = { .decode.pc = SENTINEL_BAD_ADDRESS };
+    size_t tail;
 
     assert(decoder);
+    assert(te_cycles);
 
-    if (DEBUG)
+    if ( (decoder->waiting_for_sync) || (!decoder->cycles.pending) )
     {
-        /* optionally show the transition of the PC */
-        te_log_printf("    set_pc 0x%08lx -> 0x%08lx\t%lu\n",
-            decoder->last_pc, decoder->pc, decoder->instruction_count);
+        /* the instructions will never be reconstructed ... discard it */
+        decoder->num_discarded++;
+        return;
     }
 
-    /* do some sanity checks ... just in case! */
-    assert(SENTINEL_BAD_ADDRESS != decoder->pc);
-    assert(decoder->last_pc != decoder->pc);
-    if (decoder->instruction_count)
+    if (TE_MAX_PENDING_CYCLES == decoder->cycles.num_pending)
     {
-        /* it is NOT the first transition */
-        assert(SENTINEL_BAD_ADDRESS != decoder->last_pc);
-    }
-    else
-    {
-        /* it is the FIRST transition */
-        assert(SENTINEL_BAD_ADDRESS == decoder->last_pc);
+        /* no room to queue it ... drop it, but keep on decoding */
+        decoder->cycles.num_dropped++;  /* update statistics */
+        return;
     }
 
-    /* decode & disassemble the instruction at the new PC */
-    (void)get_instr(decoder, decoder->pc, &instr);
+    tail = (decoder->cycles.head + decoder->cycles.num_pending) &
+           (TE_MAX_PENDING_CYCLES - 1u);
+    decoder->cycles.pending[tail] = te_cycles->cycles;
+    decoder->cycles.num_pending++;
+}
+
 
-    if (DEBUG)
+/*
+ * Initialize a new cycle profile, covering "size" bytes of code starting
+ * at address "base". If "profile" is NULL on entry, then memory will be
+ * dynamically allocated for it, otherwise it must point to a pre-allocated
+ * te_cycle_profile_t. In both cases, the flat arrays are allocated here.
+ *
+ * The arrays should be released by calling te_close_cycle_profile(), and
+ * if this function allocated "profile", that should then be free()'d.
+ */
+extern te_cycle_profile_t * te_open_cycle_profile(
+    te_cycle_profile_t * profile,
+    const te_address_t base,
+    const size_t size)
+{
+    if (profile)
     {
-        /* optionally show the transition & instruction at the new PC */
-        te_log_printf("%s\t%8lx -> %8lx:\t%s\n",
-            (decoder->pc == decoder->address) ? "---->" : "",
-            decoder->last_pc,
-            decoder->pc,
-            instr.line);
+        memset(profile, 0, sizeof(te_cycle_profile_t));
+    }
+    else
+    {
+        profile = calloc(1, sizeof(te_cycle_profile_t));
+        assert(profile);
     }
 
-    /* notify the user that the PC has been updated */
-    te_advance_decoded_pc(
-        decoder->user_data,
-        decoder->last_pc,
-        decoder->pc,
-        &instr);
-
-    /* advance the count of PC transitions */
-    decoder->instruction_count++;
+    profile->base = base;
+    profile->num_slots = (size + 1u) >> 1;
+    profile->pc_cycles    = calloc(profile->num_slots, sizeof(uint64_t));
+    profile->pc_retired   = calloc(profile->num_slots, sizeof(uint64_t));
+    profile->block_cycles = calloc(profile->num_slots, sizeof(uint64_t));
+    profile->block_entries = calloc(profile->num_slots, sizeof(uint64_t));
+    assert(profile->pc_cycles);
+    assert(profile->pc_retired);
+    assert(profile->block_cycles);
+    assert(profile->block_entries);
+
+    return profile;
 }
 
 
 /*
- * Determine if current instruction is a branch
+ * Release the flat arrays allocated by te_open_cycle_profile().
  */
-static bool is_branch(
-    const te_decoded_instruction_t * const instr)
+extern void te_close_cycle_profile(
+    te_cycle_profile_t * const profile)
 {
-    bool predicate = false;
+    assert(profile);
+
+    free(profile->pc_cycles);
+    free(profile->pc_retired);
+    free(profile->block_cycles);
+    free(profile->block_entries);
+    profile->pc_cycles = NULL;
+    profile->pc_retired = NULL;
+    profile->block_cycles = NULL;
+    profile->block_entries = NULL;
+    profile->num_slots = 0;
+}
 
-    assert(instr);
 
-    if ( (instr->decode.op == rv_op_beq)    ||
-         (instr->decode.op == rv_op_bne)    ||
-         (instr->decode.op == rv_op_blt)    ||
-         (instr->decode.op == rv_op_bge)    ||
-         (instr->decode.op == rv_op_bltu)   ||
-         (instr->decode.op == rv_op_bgeu)   ||
-         (instr->decode.op == rv_op_c_beqz) ||
-         (instr->decode.op == rv_op_c_bnez) )
+/*
+ * Attach a cycle profile, into which all subsequent cycle counts will be
+ * accumulated. If "profile" is NULL, then cycle count messages are still
+ * processed (and consumed), but they are not accumulated anywhere.
+ * The first call also allocates the queue of pending counts (which is
+ * released by te_close_trace_decoder), enabling the cycle count stage.
+ */
+extern void te_attach_cycle_profile(
+    te_decoder_state_t * const decoder,
+    te_cycle_profile_t * const profile)
+{
+    assert(decoder);
+
+    if (!decoder->cycles.pending)
     {
-        predicate = true;
+        decoder->cycles.pending = malloc(TE_MAX_PENDING_CYCLES * sizeof(uint32_t));
+        assert(decoder->cycles.pending);
     }
-
-    return predicate;
+    decoder->cycles.profile = profile;
 }
 
 
 /*
- * Determine if current instruction is a branch, adjust the branch
- * count/map, and return the "taken" status
+ * print out the histogram of inter-instruction cycle counts, followed by
+ * the basic blocks with any cycles attributed to them, with the number of
+ * cycles, and the number of cycles per retirement of the block's first PC.
  */
-static bool is_taken_branch(
-    te_decoder_state_t * const decoder,
-    const te_decoded_instruction_t * const instr)
+extern void te_print_cycle_profile(
+    const te_cycle_profile_t * const profile)
 {
-    bool taken = false;     /* assume branch not taken */
+    size_t slot;
+    unsigned bucket;
 
-    assert(decoder);
-    assert(instr);
+    assert(profile);
+
+    printf("cycle-histogram:\n");
+    for (bucket = 0; bucket < TE_CYCLE_HISTOGRAM_BUCKETS; bucket++)
+    {
+        if (profile->histogram[bucket])
+        {
+            printf("  %6lu%s cycles: %lu\n",
+                bucket ? (1ul << (bucket - 1u)) : 0ul,
+                (bucket == TE_CYCLE_HISTOGRAM_BUCKETS - 1u) ? "+" : " ",
+                (unsigned long)profile->histogram[bucket]);
+        }
+    }
+
+    printf("block-cycles:\n");
+    for (slot = 0; slot < profile->num_slots; slot++)
+    {
+        if (profile->block_cycles[slot])
+        {
+            printf("  %12lx: %10lu cycles, %10lu entries\n",
+                profile->base + (slot << 1),
+                (unsigned long)profile->block_cycles[slot],
+                (unsigned long)profile->block_entries[slot]);
+        }
+    }
 
-    if (!is_branch(instr))
+    if (profile->outside_cycles)
     {
-        return false;
+        printf("  (outside): %10lu cycles\n",
+            (unsigned long)profile->outside_cycles);
     }
+}
+
 
-    if (0 == decoder->branches)
+/*
+ * Open an execution count profile for the "size" bytes of code starting
+ * at address "base". If "profile" is NULL on entry, then memory will be
+ * dynamically allocated for it, otherwise it must point to a pre-allocated
+ * te_exec_profile_t. In both cases, the flat arrays are allocated here.
+ *
+ * The arrays should be released by calling te_close_exec_profile(), and
+ * if this function allocated "profile", that should then be free()'d.
+ */
+extern te_exec_profile_t * te_open_exec_profile(
+    te_exec_profile_t * profile,
+    const te_address_t base,
+    const size_t size)
+{
+    if (profile)
     {
-        unrecoverable_error(instr,
-            "cannot resolve branch (branch-map depleted)!");
+        memset(profile, 0, sizeof(te_exec_profile_t));
     }
     else
     {
-        taken = !(decoder->branch_map & 1);  /* bit [0] */
-        decoder->branches--;
-        decoder->branch_map >>= 1;   /* right-shift one bit */
+        profile = calloc(1, sizeof(te_exec_profile_t));
+        assert(profile);
     }
 
-    return taken;
+    profile->base = base;
+    profile->num_slots = (size + 1u) >> 1;
+    profile->block_entries = calloc(profile->num_slots, sizeof(uint64_t));
+    /* one extra slot, for blocks ending beyond the range */
+    profile->block_exits = calloc(profile->num_slots + 1u, sizeof(uint64_t));
+    assert(profile->block_entries);
+    assert(profile->block_exits);
+
+    return profile;
 }
 
 
 /*
- * Determine if instruction is an inferrable jump
+ * Release the flat arrays allocated by te_open_exec_profile(),
+ * and by te_expand_exec_profile().
  */
-static bool is_inferrable_jump(
-    const te_decoded_instruction_t * const instr)
+extern void te_close_exec_profile(
+    te_exec_profile_t * const profile)
 {
-    bool predicate = false;
+    assert(profile);
+
+    free(profile->block_entries);
+    free(profile->block_exits);
+    free(profile->pc_executed);
+    profile->block_entries = NULL;
+    profile->block_exits = NULL;
+    profile->pc_executed = NULL;
+    profile->num_slots = 0;
+}
 
-    assert(instr);
 
-    if ( (instr->decode.op == rv_op_jal)    ||
-         (instr->decode.op == rv_op_c_jal)  ||
-         (instr->decode.op == rv_op_c_j)    ||
-         ( (instr->decode.op == rv_op_jalr) &&
-           (0 == instr->decode.rs1) ) )
-    {
-        predicate = true;
-    }
+/*
+ * Attach an execution count profile, in which all subsequent (dynamic)
+ * basic blocks will be counted. Any block still open in the previously
+ * attached profile is first ended, so after the last PC has been decoded,
+ * call this with a NULL "profile" to count the final block, before
+ * expanding or merging the profile. The block that is current when a
+ * profile is attached is not counted in it.
+ */
+extern void te_attach_exec_profile(
+    te_decoder_state_t * const decoder,
+    te_exec_profile_t * const profile)
+{
+    assert(decoder);
+
+    close_exec_block(decoder);
 
-    return predicate;
+    decoder->exec.profile = profile;
+    decoder->exec.block_open = false;
 }
 
 
 /*
- * Determine if instruction is an uninferrable jump
+ * Accumulate the block counts in "other" into "profile", e.g. to combine
+ * the profiles from several decoders, each of which may have run in its
+ * own thread. Both must cover the same range of addresses, and neither may
+ * still be attached to a decoder. Any previous expansion of "profile" is
+ * discarded, as it is now stale.
  */
-static bool is_uninferrable_jump(
-    const te_decoded_instruction_t * const instr)
+extern void te_merge_exec_profile(
+    te_exec_profile_t * const profile,
+    const te_exec_profile_t * const other)
 {
-    bool predicate = false;
+    size_t slot;
 
-    assert(instr);
+    assert(profile);
+    assert(other);
+    assert(profile->base == other->base);
+    assert(profile->num_slots == other->num_slots);
 
-    if ( ( (instr->decode.op == rv_op_jalr) &&
-           (0 != instr->decode.rs1) )       ||
-         (instr->decode.op == rv_op_c_jalr) ||
-         (instr->decode.op == rv_op_c_jr) )
+    for (slot = 0; slot < profile->num_slots; slot++)
     {
-        predicate = true;
+        profile->block_entries[slot] += other->block_entries[slot];
+        profile->block_exits[slot] += other->block_exits[slot];
     }
+    profile->block_exits[slot] += other->block_exits[slot];
+    profile->num_blocks += other->num_blocks;
+    profile->outside_blocks += other->outside_blocks;
 
-    return predicate;
+    free(profile->pc_executed);
+    profile->pc_executed = NULL;
 }
 
 
 /*
- * Determine if instruction is an uninferrable discontinuity
+ * Expand the block counts into the number of times each PC was executed,
+ * returning the per-PC array (indexed as the block counts). Only slots
+ * holding the first half-word of an executed instruction are non-zero.
+ *
+ * Every block is a run of sequential instructions, so the number of blocks
+ * covering each PC is the running sum of the entries minus the exits, in
+ * ascending address order. The instructions are walked (using their lengths,
+ * from the decoder's get_instruction callback) from each block entry, until
+ * no blocks remain.
  */
-static bool is_uninferrable_discon(
-    const te_decoded_instruction_t * const instr)
+extern const uint64_t * te_expand_exec_profile(
+    te_exec_profile_t * const profile,
+    const te_decoder_state_t * const decoder)
 {
-    bool predicate = false;
+    uint64_t running = 0;
+    size_t next = 0;    /* slot of the next instruction */
+    size_t slot;
+    rv_inst instruction;
+    unsigned length;
 
-    assert(instr);
+    assert(profile);
 
-    /*
-     * Note: The exception reporting mechanism means it is not necessary
-     * to include ECALL, EBREAK or C.EBREAK in this predicate
-     */
-    if ( is_uninferrable_jump(instr)        ||
-         (instr->decode.op == rv_op_uret)   ||
-         (instr->decode.op == rv_op_sret)   ||
-         (instr->decode.op == rv_op_mret)   ||
-         (instr->decode.op == rv_op_dret) )
+    if (profile->pc_executed)
+    {
+        return profile->pc_executed;    /* already expanded */
+    }
+    profile->pc_executed = calloc(profile->num_slots, sizeof(uint64_t));
+    assert(profile->pc_executed);
+
+    for (slot = 0; slot < profile->num_slots; slot++)
     {
-        predicate = true;
+        running -= profile->block_exits[slot];
+        if (profile->block_entries[slot])
+        {
+            /* a block starts here, so this is an instruction */
+            running += profile->block_entries[slot];
+            next = slot;
+        }
+        if ( (running) && (slot == next) )
+        {
+            profile->pc_executed[slot] = running;
+            length = te_decoder_get_instruction(decoder,
+                profile->base + (slot << 1), &instruction);
+            /* a bad length is treated as a half-word, to keep walking */
+            next = slot + ((length >= 2u) ? (length >> 1) : 1u);
+        }
     }
 
-    return predicate;
+    return profile->pc_executed;
 }
 
 
 /*
- * Determine if instruction is a sequentially inferrable jump
+ * print out the number of times each executed PC was executed,
+ * expanding the profile first, if that has not already been done.
  */
-static bool is_sequential_jump(
-    te_decoder_state_t * const decoder,
-    const te_decoded_instruction_t * const instr,
-    const te_address_t prev_addr)
+extern void te_print_exec_profile(
+    te_exec_profile_t * const profile,
+    const te_decoder_state_t * const decoder)
 {
-    te_decoded_instruction_t prev_instr = { .decode.pc = SENTINEL_BAD_ADDRESS };
-    bool predicate = false;
+    const uint64_t * const pc_executed =
+        te_expand_exec_profile(profile, decoder);
+    size_t slot;
 
-    assert(decoder);
-    assert(instr);
+    printf("pc-executed:\n");
+    for (slot = 0; slot < profile->num_slots; slot++)
+    {
+        if (pc_executed[slot])
+        {
+            printf("  %12lx: %10lu\n",
+                profile->base + (slot << 1),
+                (unsigned long)pc_executed[slot]);
+        }
+    }
 
-    if (!is_uninferrable_jump(instr))
+    printf("  (blocks): %10lu\n", (unsigned long)profile->num_blocks);
+    if (profile->outside_blocks)
     {
-        return false;
+        printf("  (outside): %10lu blocks\n",
+            (unsigned long)profile->outside_blocks);
     }
+}
 
-    (void)get_instr(decoder, prev_addr, &prev_instr);
 
-    if ( (prev_instr.decode.op == rv_op_auipc) ||
-         (prev_instr.decode.op == rv_op_lui)   ||
-         (prev_instr.decode.op == rv_op_c_lui) )
+/*
+ * Open coverage bitmaps for the "size" bytes of code starting at address
+ * "base". If "coverage" is NULL on entry, then memory will be dynamically
+ * allocated for it, otherwise it must point to a pre-allocated
+ * te_coverage_t. In both cases, the bitmaps are allocated here.
+ *
+ * The bitmaps should be released by calling te_close_coverage(), and
+ * if this function allocated "coverage", that should then be free()'d.
+ */
+extern te_coverage_t * te_open_coverage(
+    te_coverage_t * coverage,
+    const te_address_t base,
+    const size_t size)
+{
+    if (coverage)
+    {
+        memset(coverage, 0, sizeof(te_coverage_t));
+    }
+    else
     {
-        predicate = (instr->decode.rs1 == prev_instr.decode.rd);
+        coverage = calloc(1, sizeof(te_coverage_t));
+        assert(coverage);
     }
 
-    return predicate;
+    coverage->base = base;
+    coverage->num_slots = (size + 1u) >> 1;
+    coverage->num_words = (coverage->num_slots + 63u) >> 6;
+    coverage->executed  = calloc(coverage->num_words, sizeof(uint64_t));
+    coverage->taken     = calloc(coverage->num_words, sizeof(uint64_t));
+    coverage->not_taken = calloc(coverage->num_words, sizeof(uint64_t));
+    assert(coverage->executed);
+    assert(coverage->taken);
+    assert(coverage->not_taken);
+
+    return coverage;
 }
 
 
 /*
- * Find the target of a sequentially inferrable jump
+ * Release the bitmaps allocated by te_open_coverage().
  */
-static te_address_t sequential_jump_target(
-    te_decoder_state_t * const decoder,
-    const te_address_t addr,
-    const te_address_t prev_addr)
+extern void te_close_coverage(
+    te_coverage_t * const coverage)
 {
-    te_decoded_instruction_t instr      = { .decode.pc = SENTINEL_BAD_ADDRESS };
-    te_decoded_instruction_t prev_instr = { .decode.pc = SENTINEL_BAD_ADDRESS };
-    te_address_t target = 0;
+    assert(coverage);
+
+    free(coverage->executed);
+    free(coverage->taken);
+    free(coverage->not_taken);
+    coverage->executed = NULL;
+    coverage->taken = NULL;
+    coverage->not_taken = NULL;
+    coverage->num_slots = 0;
+    coverage->num_words = 0;
+}
+
 
+/*
+ * Attach coverage bitmaps, in which all subsequent (dynamic) basic blocks
+ * and branches will be recorded. As for te_attach_exec_profile(), any block
+ * still open in the previously attached bitmaps is first recorded, so after
+ * the last PC has been decoded, call this with a NULL "coverage".
+ */
+extern void te_attach_coverage(
+    te_decoder_state_t * const decoder,
+    te_coverage_t * const coverage)
+{
     assert(decoder);
 
-    (void)get_instr(decoder, addr, &instr);
-    (void)get_instr(decoder, prev_addr, &prev_instr);
+    close_coverage_block(decoder);
 
-    if (prev_instr.decode.op == rv_op_auipc)
+    decoder->coverage.map = coverage;
+    decoder->coverage.block_open = false;
+}
+
+
+/*
+ * OR "count" words of "other" into "words", 128 bits at a time with SSE2
+ * (if available), as the bitmaps may be large.
+ */
+static void or_words(
+    uint64_t * const words,
+    const uint64_t * const other,
+    const size_t count)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 2u <= count; i += 2u)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i *)&words[i]);
+        const __m128i b = _mm_loadu_si128((const __m128i *)&other[i]);
+        _mm_storeu_si128((__m128i *)&words[i], _mm_or_si128(a, b));
+    }
+#endif  /* __SSE2__ */
+    for (; i < count; i++)
     {
-        target = prev_addr;
+        words[i] |= other[i];
     }
+}
+
+
+/*
+ * Merge the coverage in "other" into "coverage", e.g. to combine the
+ * bitmaps from several decoders, each of which may have run in its own
+ * thread. Both must cover the same range of addresses, and neither may
+ * still be attached to a decoder.
+ */
+extern void te_merge_coverage(
+    te_coverage_t * const coverage,
+    const te_coverage_t * const other)
+{
+    assert(coverage);
+    assert(other);
+    assert(coverage->base == other->base);
+    assert(coverage->num_slots == other->num_slots);
+
+    or_words(coverage->executed, other->executed, coverage->num_words);
+    or_words(coverage->taken, other->taken, coverage->num_words);
+    or_words(coverage->not_taken, other->not_taken, coverage->num_words);
+}
+
+
+/*
+ * Identifies a file written by te_write_coverage().
+ */
+#define COVERAGE_MAGIC      (0x31564f4365747672ull)     /* "rvteCOV1" */
+
+
+/*
+ * Write the coverage bitmaps to a (binary) file, so that those from
+ * several runs may later be merged by te_read_coverage(). The file holds
+ * a header (the magic number, base address and number of slots), followed
+ * by each of the three bitmaps, all in the host's byte order.
+ * Returns 0 on success, or -1 on a write error.
+ */
+extern int te_write_coverage(
+    const te_coverage_t * const coverage,
+    FILE * const file)
+{
+    uint64_t header[3];
+
+    assert(coverage);
+    assert(file);
 
-    target += prev_instr.decode.imm;
+    header[0] = COVERAGE_MAGIC;
+    header[1] = coverage->base;
+    header[2] = coverage->num_slots;
 
-    if (instr.decode.op == rv_op_jalr)
+    if ( (3u != fwrite(header, sizeof(uint64_t), 3u, file)) ||
+         (coverage->num_words != fwrite(coverage->executed, sizeof(uint64_t), coverage->num_words, file)) ||
+         (coverage->num_words != fwrite(coverage->taken, sizeof(uint64_t), coverage->num_words, file)) ||
+         (coverage->num_words != fwrite(coverage->not_taken, sizeof(uint64_t), coverage->num_words, file)) )
     {
-        target += instr.decode.imm;
+        return -1;
     }
 
-    return target;
+    return 0;
 }
 
 
 /*
- * Determine if instruction is a call
- * - excludes tail calls as they do not push an address onto the return stack
+ * Read one bitmap from a file written by te_write_coverage(),
+ * OR'ing it into "words", a block at a time.
  */
-static bool is_call(
-    const te_decoded_instruction_t * const instr)
+static int read_bitmap(
+    uint64_t * const words,
+    const size_t num_words,
+    FILE * const file)
 {
-    bool predicate = false;
-
-    assert(instr);
+    uint64_t block[1024];
+    size_t done = 0;
 
-    if ( ( (instr->decode.op == rv_op_jalr) &&
-           (1 == instr->decode.rd) )        ||
-         (instr->decode.op == rv_op_c_jalr) ||
-         ( (instr->decode.op == rv_op_jal)  &&
-           (1 == instr->decode.rd) )        ||
-         (instr->decode.op == rv_op_c_jal) )
+    while (done < num_words)
     {
-        predicate = true;
+        const size_t count = (num_words - done < 1024u) ? (num_words - done) : 1024u;
+        if (count != fread(block, sizeof(uint64_t), count, file))
+        {
+            return -1;
+        }
+        or_words(&words[done], block, count);
+        done += count;
     }
 
-    return predicate;
+    return 0;
 }
 
 
 /*
- * Determine if instruction return address can be implicitly inferred
+ * Merge the coverage in a file written by te_write_coverage() into
+ * "coverage", which must cover the same range of addresses, e.g. to
+ * accumulate the coverage over many runs.
+ * Returns 0 on success, or -1 if the file could not be read, or does
+ * not match (in which case "coverage" may have been partially merged).
  */
-static bool is_implicit_return(
-    const te_decoder_state_t * const decoder,
-    const te_decoded_instruction_t * const instr)
+extern int te_read_coverage(
+    te_coverage_t * const coverage,
+    FILE * const file)
 {
-    bool predicate = false;
-    assert(decoder);
-    assert(instr);
+    uint64_t header[3];
+
+    assert(coverage);
+    assert(file);
 
-    if (te_support.implicit_return == 0)
+    if ( (3u != fread(header, sizeof(uint64_t), 3u, file)) ||
+         (COVERAGE_MAGIC != header[0]) ||
+         (coverage->base != header[1]) ||
+         (coverage->num_slots != header[2]) )
     {
-        return false;   /* Implicit return mode is disabled */
+        return -1;
     }
 
-    if ( ( (instr->decode.op == rv_op_jalr) &&
-           (1 == instr->decode.rs1)         &&
-           (0 == instr->decode.rd) )        ||
-         ( (instr->decode.op == rv_op_c_jr) &&
-           (1 == instr->decode.rs1) ) )
+    if ( (0 != read_bitmap(coverage->executed, coverage->num_words, file)) ||
+         (0 != read_bitmap(coverage->taken, coverage->num_words, file)) ||
+         (0 != read_bitmap(coverage->not_taken, coverage->num_words, file)) )
     {
-        predicate = (decoder->call_counter > 0);
+        return -1;
     }
 
-    return predicate;
+    return 0;
 }
 
 
 /*
- * Push address onto return stack
+ * Open a shared store of decoded instructions, with 2^"bits" entries.
+ * If "cache" is NULL on entry, then memory will be dynamically allocated
+ * for it, otherwise it must point to a pre-allocated te_shared_cache_t.
+ * In both cases, the entries are allocated here, and never grow.
+ *
+ * It may then be attached to any number of trace-decoders (which may run
+ * concurrently), with te_attach_shared_cache(). The entries should be
+ * released by calling te_close_shared_cache(), once none are using it,
+ * and if this function allocated "cache", that should then be free()'d.
  */
-static void push_return_stack(
-    te_decoder_state_t * const decoder,
-    const te_address_t address)
+extern te_shared_cache_t * te_open_shared_cache(
+    te_shared_cache_t * cache,
+    const unsigned bits)
 {
-    const size_t call_counter_max = 1u << (discovery_response.call_counter_width + 2);
-    te_decoded_instruction_t instr = { .decode.pc = SENTINEL_BAD_ADDRESS };
-    te_address_t link = address;
-    size_t i;
-
-    assert(decoder);
-    assert(decoder->call_counter <= call_counter_max);
-    assert(call_counter_max <= TE_MAX_CALL_DEPTH);
+    assert(bits < 8 * sizeof(size_t));
 
-    if (call_counter_max == decoder->call_counter)
+    if (cache)
     {
-        /* Delete oldest entry from stack to make room for new entry added below */
-        decoder->call_counter--;
-        for (i = 0; i < decoder->call_counter; i++)
-        {
-            decoder->return_stack[i] = decoder->return_stack[i+1];
-        }
+        memset(cache, 0, sizeof(te_shared_cache_t));
+    }
+    else
+    {
+        cache = calloc(1, sizeof(te_shared_cache_t));
+        assert(cache);
     }
 
-    /* link register is address of next spatial instruction */
-    (void)get_instr(decoder, address, &instr);
-    link += instruction_size(&instr);
+    cache->mask = ((size_t)1u << bits) - 1u;
+    cache->entries = calloc(cache->mask + 1u, sizeof(te_shared_entry_t));
+    assert(cache->entries);
 
-    /* push link register to top of the stack */
-    decoder->return_stack[decoder->call_counter] = link;
-    decoder->call_counter++;
+    return cache;
 }
 
 
 /*
- * Pop address from return stack
+ * Release the entries allocated by te_open_shared_cache().
  */
-static te_address_t pop_return_stack(
-    te_decoder_state_t * const decoder)
+extern void te_close_shared_cache(
+    te_shared_cache_t * const cache)
 {
-    assert(decoder);
+    assert(cache);
 
-    const te_address_t link = decoder->return_stack[decoder->call_counter];
-
-    /*
-     * Note: this function is not called if call_counter is 0,
-     * so no need to check for underflow
-     */
-    decoder->call_counter--;
-
-    return link;
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->mask = 0;
 }
 
 
 /*
- * Compute the next PC
+ * Attach a shared store of decoded instructions (or NULL to detach it),
+ * in which the instructions of "address_space" are found (and added) on
+ * each miss in the decoder's own decoded cache. All the trace-decoders
+ * tracing the same code (e.g. the same kernel) should use the same
+ * address space, and those tracing different code, different ones.
  */
-static void next_pc(
+extern void te_attach_shared_cache(
     te_decoder_state_t * const decoder,
-    const te_address_t address)
+    te_shared_cache_t * const cache,
+    const uint32_t address_space)
 {
     assert(decoder);
 
-    const te_address_t this_pc = decoder->pc;
-    te_decoded_instruction_t instr = { .decode.pc = SENTINEL_BAD_ADDRESS };
+    decoder->shared.cache = cache;
+    decoder->shared.address_space = address_space;
+}
 
-    (void)get_instr(decoder, decoder->pc, &instr);
 
-    if (is_inferrable_jump(&instr))
-    {
-        decoder->pc += instr.decode.imm;
-    }
-    else if (is_sequential_jump(decoder, &instr, decoder->last_pc))
-    {
-        /* lui/auipc followed by jump using same register */
-        decoder->pc = sequential_jump_target(decoder, decoder->pc, decoder->last_pc);
-    }
-    else if (is_implicit_return(decoder, &instr))
-    {
-        decoder->pc = pop_return_stack(decoder);
-    }
-    else if (is_uninferrable_discon(&instr))
+/*
+ * Return the entry for "context" in a context map, or NULL if it is
+ * absent (or there is no map). Also returns (via "index") where it is,
+ * or else where it should be inserted.
+ */
+static te_context_t * find_context(
+    const te_context_map_t * const map,
+    const uint64_t context,
+    size_t * const index)
+{
+    size_t low = 0;
+    size_t high = map ? map->num_contexts : 0;
+
+    while (low < high)
     {
-        if (decoder->stop_at_last_branch)
+        const size_t middle = low + (high - low) / 2u;
+
+        if (map->contexts[middle]->context < context)
         {
-            unrecoverable_error(&instr,
-                "unexpected uninferrable discontinuity");
+            low = middle + 1u;
         }
         else
         {
-          decoder->pc = address;
+            high = middle;
         }
     }
-    else if (is_taken_branch(decoder, &instr))
+    if (index)
     {
-        decoder->pc += instr.decode.imm;
+        *index = low;
     }
-    else
+
+    return ( (map) && (low < map->num_contexts) &&
+             (map->contexts[low]->context == context) ) ? map->contexts[low] : NULL;
+}
+
+
+/*
+ * Open an (initially empty) map of the contexts of a traced system.
+ * If "map" is NULL on entry, then memory will be dynamically allocated
+ * for it, otherwise it must point to a pre-allocated te_context_map_t.
+ *
+ * Contexts are added with te_add_context(), and their images with
+ * te_add_image_map(), which must not be done whilst any trace-decoder
+ * that it is attached to (see te_attach_context_map) is running.
+ * Everything should be released by calling te_close_context_map(),
+ * and if this function allocated "map", that should then be free()'d.
+ */
+extern te_context_map_t * te_open_context_map(
+    te_context_map_t * map)
+{
+    if (map)
     {
-        decoder->pc += instruction_size(&instr);
+        memset(map, 0, sizeof(te_context_map_t));
     }
-
-    if (is_call(&instr))
+    else
     {
-        push_return_stack(decoder, this_pc);
+        map = calloc(1, sizeof(te_context_map_t));
+        assert(map);
     }
 
-    decoder->last_pc = this_pc;
-    disseminate_pc(decoder);
+    return map;
 }
 
 
 /*
- * Follow execution path to reported address
+ * Release the contexts (and the arrays of their images) of a context map,
+ * but not the code of the images themselves.
  */
-static void follow_execution_path(
-    te_decoder_state_t * const decoder,
-    const te_address_t address,
-    const te_inst_t * const te_inst)
+extern void te_close_context_map(
+    te_context_map_t * const map)
 {
-    assert(decoder);
-
-    te_address_t previous_address = decoder->pc;
-    te_decoded_instruction_t instr      = { .decode.pc = SENTINEL_BAD_ADDRESS };
-    te_decoded_instruction_t last_instr = { .decode.pc = SENTINEL_BAD_ADDRESS };
-
-    assert(te_inst);
-    assert( (!decoder->stop_at_last_branch)  ||
-            (1==decoder->branches)           ||
-            (2==decoder->branches)           ||
-            (31==decoder->branches)          ||
-            (32==decoder->branches) );
+    size_t i;
 
-    (void)get_instr(decoder, decoder->pc, &instr);
+    assert(map);
 
-    if (DEBUG)
+    for (i = 0; i < map->num_contexts; i++)
     {
-        te_log_printf("entered %s() with format = %u, pc = 0x%lx, and address = 0x%lx\n",
-            __func__, te_inst->format, decoder->pc, address);
+        free(map->contexts[i]->images);
+        free(map->contexts[i]);
     }
+    free(map->contexts);
+    map->contexts = NULL;
+    map->num_contexts = 0;
+    map->capacity = 0;
+}
 
-    while (true)
-    {
-        if ( (decoder->stop_at_last_branch) &&
-             (0 == decoder->branches) )
-        {
-            unrecoverable_error(&instr,
-                "follow_execution_path() has stop_at_last_branch=true and branches=0");
-        }
 
-        if (decoder->inferred_address)
-        {
-            /*
-             * iterate again from previously reported address to find second occurrence
-             */
-            next_pc(decoder, previous_address);
-            (void)get_instr(decoder, decoder->pc, &instr);
-            if (decoder->pc == previous_address)
-            {
-                decoder->inferred_address = false;
-            }
-        }
-        else
-        {
-            next_pc(decoder, address);
-            (void)get_instr(decoder, decoder->pc, &instr);
-            if ( (1 == decoder->branches)                             &&
-                 (is_branch(get_instr(decoder, decoder->pc, &instr))) &&
-                 (decoder->stop_at_last_branch) )
-            {
-                /*
-                 * Reached final branch - stop here (do not follow to next instruction
-                 * as we do not yet know whether it retires)
-                 */
-                decoder->stop_at_last_branch = false;
-                return;
-            }
-            if ( (decoder->pc == address) &&
-                 is_uninferrable_discon(get_instr(decoder, decoder->last_pc, &last_instr)) )
-            {
-                /*
-                 * Reached reported address following an uninferrable discontinuity - stop here
-                 */
-                if (decoder->branches > (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0))
-                {
-                    /*
-                     * Check all branches processed (except 1 if this instruction is a branch)
-                     */
-                    unrecoverable_error(&instr,
-                        "unprocessed branches");
-                }
-                return;
-            }
-            if ( (3 != te_inst->format)                         &&
-                 (decoder->pc == address)                       &&
-                 (te_inst->updiscon == MSB(te_inst->address))   &&
-                 (decoder->branches == (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0)) )
-            {
-                /*
-                 * All branches processed, and reached reported address, but not as an
-                 * uninferrable jump target. Stop here for now, though flag indicates
-                 * this may not be final retired instruction
-                 */
-                decoder->inferred_address = true;
-                return;
-            }
-            if ( (3 == te_inst->format)     &&
-                 (decoder->pc == address)   &&
-                 (decoder->branches == (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0)) )
-            {
-                /* All branches processed, and reached reported address */
-                return;
-            }
-        }
+/*
+ * Add a context (e.g. a process) to a context map, whose instructions
+ * outside all of its images are in "address_space" (see te_shared_cache_t),
+ * returning it (so that images may be added to it). If the context is
+ * already present, then that entry is returned instead.
+ */
+extern te_context_t * te_add_context(
+    te_context_map_t * const map,
+    const uint64_t context,
+    const uint32_t address_space)
+{
+    te_context_t * entry;
+    size_t index;
+
+    assert(map);
+
+    entry = find_context(map, context, &index);
+    if (entry)
+    {
+        return entry;
     }
+
+    if (map->num_contexts == map->capacity)
+    {
+        map->capacity = map->capacity ? (map->capacity << 1) : 16u;
+        map->contexts = realloc(map->contexts, map->capacity * sizeof(te_context_t *));
+        assert(map->contexts);
+    }
+
+    entry = calloc(1, sizeof(te_context_t));
+    assert(entry);
+    entry->context = context;
+    entry->address_space = address_space;
+
+    memmove(&map->contexts[index + 1u], &map->contexts[index],
+        (map->num_contexts - index) * sizeof(te_context_t *));
+    map->contexts[index] = entry;
+    map->num_contexts++;
+
+    return entry;
 }
 
 
 /*
- * Process a single te_inst message.
- * Called each time a te_inst message is received.
+ * Map an image (i.e. "size" bytes of code, at "base") into a context,
+ * whose instructions are in "address_space" (see te_image_map_t).
+ * The code is not copied, so it must outlive the context map.
+ * See te_open_elf_image() to map the code segments of an ELF file.
  */
-extern void te_process_te_inst(
+extern void te_add_image_map(
+    te_context_t * const context,
+    const te_address_t base,
+    const size_t size,
+    const uint8_t * const code,
+    const uint32_t address_space)
+{
+    te_image_map_t * image;
+
+    assert(context);
+    assert(code);
+
+    context->images = realloc(context->images,
+        (context->num_images + 1u) * sizeof(te_image_map_t));
+    assert(context->images);
+
+    image = &context->images[context->num_images++];
+    image->base = base;
+    image->size = size;
+    image->code = code;
+    image->address_space = address_space;
+}
+
+
+/*
+ * Attach a context map (or NULL to detach it), after which the context
+ * is switched (see te_set_context) by each format 3 te_inst message.
+ */
+extern void te_attach_context_map(
     te_decoder_state_t * const decoder,
-    const te_inst_t * const te_inst)
+    const te_context_map_t * const map)
 {
-    te_decoded_instruction_t instr = { .decode.pc = SENTINEL_BAD_ADDRESS };
+    assert(decoder);
+
+    decoder->contexts.map = map;
+    decoder->contexts.current = find_context(map, decoder->contexts.context, NULL);
+    decoder->contexts.image = NULL;
+}
+
+
+/*
+ * Switch a trace-decoder to a new context (which need not be in its
+ * context map). Each of the last TE_MAX_CONTEXT_CACHES contexts keeps its
+ * own decoded cache, so switching between them is just a pointer swap.
+ * Otherwise, the cache of the least recently used context is emptied,
+ * and re-used for this one. The get_instruction callback may read the
+ * current context (in decoder->contexts.context).
+ */
+extern void te_set_context(
+    te_decoder_state_t * const decoder,
+    const uint64_t context)
+{
+    size_t slot = TE_MAX_CONTEXT_CACHES;
+    size_t i;
 
     assert(decoder);
-    assert(te_inst);
 
-    if (3 == te_inst->format)
+    if (context == decoder->contexts.context)
     {
-        decoder->inferred_address = false;
-        decoder->address = (te_inst->address << discovery_response.iaddress_lsb);
+        return;
+    }
+
+    decoder->contexts.num_switches++;   /* update statistics */
+    decoder->contexts.context = context;
+    decoder->contexts.current = find_context(decoder->contexts.map, context, NULL);
+    decoder->contexts.image = NULL;
 
-        if ( (1 == te_inst->subformat) ||
-             (decoder->start_of_trace) )
+    for (i = 0; i < TE_MAX_CONTEXT_CACHES; i++)
+    {
+        if ( (decoder->contexts.caches[i].decoded_cache) &&
+             (decoder->contexts.caches[i].context == context) )
         {
-            /* expunge any pending branches */
-            decoder->branches   = 0;
-            decoder->branch_map = 0;
+            slot = i;
+            break;
         }
-        if (is_branch(get_instr(decoder, decoder->address, &instr)))
+    }
+
+    if (TE_MAX_CONTEXT_CACHES == slot)
+    {
+        /* use an unused cache, else the least recently used one */
+        slot = 0;
+        for (i = 0; i < TE_MAX_CONTEXT_CACHES; i++)
         {
-            /* 1 unprocessed branch if this instruction is a branch */
-            decoder->branch_map |= te_inst->branch << decoder->branches;
-            decoder->branches++;
+            if (!decoder->contexts.caches[i].decoded_cache)
+            {
+                slot = i;
+                break;
+            }
+            if (decoder->contexts.caches[i].last_used <
+                decoder->contexts.caches[slot].last_used)
+            {
+                slot = i;
+            }
         }
 
-        if ( (0 == te_inst->subformat) &&
-             (!decoder->start_of_trace) )
+        if (decoder->contexts.caches[slot].decoded_cache)
         {
-            follow_execution_path(decoder, decoder->address, te_inst);
+            decoder->contexts.num_evictions++;  /* update statistics */
+            memset(decoder->contexts.caches[slot].decoded_cache, 0,
+                (decoder->decoded_cache_mask + 1u) * sizeof(te_decoded_instruction_t));
         }
         else
         {
-            /*
-             * Firstly, update "last_pc" to be the current PC.
-             * This is essentially so that the diagnostics emitted from disseminate_pc() looks right!
-             * After we return from disseminate_pc(), we will update it again!
-             */
-            decoder->last_pc = decoder->pc;
-            decoder->pc = decoder->address;
-            disseminate_pc(decoder);
-            /*
-             * To avoid the (unlikely, but not impossible) possibility that the
-             * instructions currently at "last_pc" and "pc" happen to satisfy
-             * the constraints in is_sequential_jump(), we need to guarantee
-             * that does not happen, when we next call follow_execution_path().
-             * Thus we update "last_pc" to a "spurious" value ... that is a
-             * value which will always cause is_sequential_jump() to be false.
-             * We choose "pc" as such a spurious value to write to "last_pc".
-             * Thus the predicate is_sequential_jump(pc,pc) will never be true.
-             * Ensure is_sequential_jump() deterministically returns
-             * false immediately after the first format 3 message,
-             * even though the previous PC is not known.
-             */
-            decoder->last_pc = decoder->pc;
+            decoder->contexts.caches[slot].decoded_cache =
+                calloc(decoder->decoded_cache_mask + 1u, sizeof(te_decoded_instruction_t));
+            assert(decoder->contexts.caches[slot].decoded_cache);
         }
-        decoder->start_of_trace = false;
-        decoder->call_counter = 0;
+        decoder->contexts.caches[slot].context = context;
+    }
+
+    decoder->contexts.caches[slot].last_used = decoder->contexts.num_switches;
+    decoder->decoded_cache = decoder->contexts.caches[slot].decoded_cache;
+}
+
+
+/*
+ * Allocate the slots of one of the hash tables of an edge profile.
+ */
+static void open_edge_table(
+    te_edge_table_t * const table,
+    const unsigned table_bits)
+{
+    table->mask = ((size_t)1u << table_bits) - 1u;
+    table->entries = calloc(table->mask + 1u, sizeof(te_edge_t));
+    assert(table->entries);
+}
+
+
+/*
+ * Open a control-flow edge profile, each of whose hash tables has
+ * 2^"table_bits" slots (or 2^TE_EDGE_TABLE_BITS, if "table_bits" is zero).
+ * If "profile" is NULL on entry, then memory will be dynamically allocated
+ * for it, otherwise it must point to a pre-allocated te_edge_profile_t.
+ * In both cases, the hash tables are allocated here, and never grow.
+ *
+ * The tables should be released by calling te_close_edge_profile(), and
+ * if this function allocated "profile", that should then be free()'d.
+ */
+extern te_edge_profile_t * te_open_edge_profile(
+    te_edge_profile_t * profile,
+    const unsigned table_bits)
+{
+    const unsigned bits = table_bits ? table_bits : TE_EDGE_TABLE_BITS;
+
+    assert(bits >= 2u);
+
+    if (profile)
+    {
+        memset(profile, 0, sizeof(te_edge_profile_t));
     }
     else
     {
-        if (decoder->start_of_trace)
+        profile = calloc(1, sizeof(te_edge_profile_t));
+        assert(profile);
+    }
+
+    open_edge_table(&profile->branches, bits);
+    open_edge_table(&profile->jumps, bits);
+    open_edge_table(&profile->ranges, bits);
+
+    return profile;
+}
+
+
+/*
+ * Release the hash tables allocated by te_open_edge_profile().
+ */
+extern void te_close_edge_profile(
+    te_edge_profile_t * const profile)
+{
+    assert(profile);
+
+    free(profile->branches.entries);
+    free(profile->jumps.entries);
+    free(profile->ranges.entries);
+    memset(profile, 0, sizeof(te_edge_profile_t));
+}
+
+
+/*
+ * Attach an edge profile, in which all subsequent branches, jumps and
+ * (dynamic) basic blocks will be counted. As for te_attach_exec_profile(),
+ * any block still open in the previously attached profile is first counted,
+ * so after the last PC has been decoded, call this with a NULL "profile".
+ */
+extern void te_attach_edge_profile(
+    te_decoder_state_t * const decoder,
+    te_edge_profile_t * const profile)
+{
+    assert(decoder);
+
+    close_edge_range(decoder);
+
+    decoder->edges.profile = profile;
+    decoder->edges.block_open = false;
+}
+
+
+/*
+ * Accumulate every entry of the hash table "other" into "table".
+ */
+static void merge_edge_table(
+    te_edge_table_t * const table,
+    const te_edge_table_t * const other)
+{
+    size_t slot;
+
+    for (slot = 0; slot <= other->mask; slot++)
+    {
+        const te_edge_t * const from = &other->entries[slot];
+        te_edge_t * to;
+
+        if ( (0 == from->count[0]) && (0 == from->count[1]) )
         {
-            /* This should not be possible! */
-            unrecoverable_error(NULL,
-                "Expecting trace to start with a format 3 message");
+            continue;   /* unused slot */
         }
-        if ( (2 == te_inst->format) ||
-             (0 != te_inst->branches) )
+        to = find_edge(table, from->from, from->to);
+        if (to)
         {
-            decoder->stop_at_last_branch = false;
-            if (te_support.full_address)
-            {
-                decoder->address  = (te_inst->address << discovery_response.iaddress_lsb);
-            }
-            else
-            {
-                decoder->address += (te_inst->address << discovery_response.iaddress_lsb);
-            }
+            to->count[0] += from->count[0];
+            to->count[1] += from->count[1];
         }
-        if (1 == te_inst->format)
+        else
         {
-            decoder->stop_at_last_branch = (te_inst->branches == 0);
-            /*
-             * Branch map will contain <= 1 branch
-             * (1 if last reported instruction was a branch)
-             */
-            assert(decoder->branches <= 1);
-            assert( ( (0==decoder->branches) && (0==decoder->branch_map) ) ||
-                    ( (1==decoder->branches) && (0==(decoder->branch_map&(~1))) ) );
-            decoder->branch_map |= te_inst->branch_map << decoder->branches;
-            if (0 == te_inst->branches)
-            {
-                decoder->branches += 31;
-            }
-            else
-            {
-                decoder->branches += te_inst->branches;
-            }
+            table->num_dropped += from->count[0] + from->count[1];
         }
-        follow_execution_path(decoder, decoder->address, te_inst);
     }
+    table->num_dropped += other->num_dropped;
 }
 
 
 /*
- * Process a single te_support message.
- * Called each time a te_support message is received.
+ * Accumulate the counts in "other" into "profile", e.g. to combine the
+ * profiles from several decoders, each of which may have run in its own
+ * thread. The tables need not be the same size. Neither profile may still
+ * be attached to a decoder.
  */
-extern void te_process_te_support(
-    te_decoder_state_t * const decoder,
-    const te_support_t * const te_support)
+extern void te_merge_edge_profile(
+    te_edge_profile_t * const profile,
+    const te_edge_profile_t * const other)
 {
-    assert(decoder);
-    assert(te_support);
+    assert(profile);
+    assert(other);
+
+    merge_edge_table(&profile->branches, &other->branches);
+    merge_edge_table(&profile->jumps, &other->jumps);
+    merge_edge_table(&profile->ranges, &other->ranges);
+}
+
+
+/*
+ * Write out the edge profile in the text format read by AutoFDO
+ * (create_llvm_prof --format=text) and by llvm-profgen (with the option
+ * --unsymbolized-profile), i.e. the number of address ranges, followed by
+ * each "first-last:count" (where "last" is the address of the range's
+ * last instruction), then the number of sampled addresses (always zero),
+ * then the number of branches, followed by each "source->target:count".
+ * All addresses are in hexadecimal, without a "0x" prefix.
+ *
+ * As ranges are held as the PC after their last instruction, the length of
+ * each instruction is retrieved with the decoder's get_instruction callback,
+ * to find its last.
+ */
+extern void te_write_edge_profile(
+    const te_edge_profile_t * const profile,
+    FILE * const file,
+    const te_decoder_state_t * const decoder)
+{
+    const te_edge_table_t * const ranges = &profile->ranges;
+    const te_edge_table_t * const jumps = &profile->jumps;
+    rv_inst instruction;
+    size_t slot;
 
-    if (0 == te_support->support_type)
+    assert(profile);
+    assert(file);
+
+    fprintf(file, "%lu\n", (unsigned long)ranges->num_used);
+    for (slot = 0; slot <= ranges->mask; slot++)
     {
-        if ( (QUAL_STATUS_ENDED_NTR == te_support->qual_status) ||
-             (QUAL_STATUS_ENDED_REP == te_support->qual_status) )
+        const te_edge_t * const range = &ranges->entries[slot];
+        te_address_t last = range->from;
+        te_address_t address = range->from;
+
+        if (0 == range->count[0])
         {
-            /* Trace ended, so get ready to start again */
-            decoder->start_of_trace = true;
+            continue;   /* unused slot */
         }
-        if ( (QUAL_STATUS_ENDED_NTR == te_support->qual_status) &&
-             (decoder->inferred_address) )
+        while (address < range->to)
         {
-            const te_address_t previous_address = decoder->pc;
-            decoder->inferred_address = false;
-            while (true)
-            {
-                next_pc(decoder, previous_address);
-                if (decoder->pc == previous_address)
-                {
-                    return;
-                }
-            }
+            const unsigned length = te_decoder_get_instruction(decoder, address, &instruction);
+            last = address;
+            address += (length >= 2u) ? length : 2u;
+        }
+        fprintf(file, "%lx-%lx:%lu\n",
+            range->from, last, (unsigned long)range->count[0]);
+    }
+
+    fprintf(file, "0\n");
+
+    fprintf(file, "%lu\n", (unsigned long)jumps->num_used);
+    for (slot = 0; slot <= jumps->mask; slot++)
+    {
+        const te_edge_t * const jump = &jumps->entries[slot];
+
+        if (jump->count[0])
+        {
+            fprintf(file, "%lx->%lx:%lu\n",
+                jump->from, jump->to, (unsigned long)jump->count[0]);
         }
     }
+
+    if ( (profile->branches.num_dropped) ||
+         (jumps->num_dropped) ||
+         (ranges->num_dropped) )
+    {
+        log_printf(decoder, "WARNING: edge profile tables full, "
+            "dropped %lu branches, %lu jumps and %lu ranges\n",
+            (unsigned long)profile->branches.num_dropped,
+            (unsigned long)jumps->num_dropped,
+            (unsigned long)ranges->num_dropped);
+    }
+}
+
+
+/*
+ * Write the taken and not-taken counts of every conditional branch in the
+ * profile to "file", as the number of branches, followed by each
+ * "address:taken:not-taken" (the address in hexadecimal, without a "0x"
+ * prefix). The AutoFDO format written by te_write_edge_profile() only has
+ * the taken branches (as jumps), whereas this gives the bias of each one,
+ * e.g. to check static branch predictions, or for block layout.
+ */
+extern void te_write_branch_profile(
+    const te_edge_profile_t * const profile,
+    FILE * const file)
+{
+    const te_edge_table_t * const branches = &profile->branches;
+    size_t slot;
+
+    assert(profile);
+    assert(file);
+
+    fprintf(file, "%lu\n", (unsigned long)branches->num_used);
+    for (slot = 0; slot <= branches->mask; slot++)
+    {
+        const te_edge_t * const branch = &branches->entries[slot];
+
+        if ( (branch->count[0]) || (branch->count[1]) )
+        {
+            fprintf(file, "%lx:%lu:%lu\n", branch->from,
+                (unsigned long)branch->count[0], (unsigned long)branch->count[1]);
+        }
+    }
+}
+
+
+/*
+ * Classify the transfer of control (if any) performed by an instruction,
+ * using the same predicates as the decoder itself. This lets a consumer
+ * of the decoded PCs (see te_advance_decoded_pc) track calls and returns,
+ * e.g. to maintain a shadow call-stack, without having to decode again.
+ */
+extern te_transfer_t te_classify_transfer(
+    const te_decoded_instruction_t * const instr)
+{
+    assert(instr);
+
+    if (is_call(instr))
+    {
+        return TE_TRANSFER_CALL;
+    }
+    else if (is_return(instr))
+    {
+        return TE_TRANSFER_RETURN;
+    }
+    else if ( (instr->decode.op == rv_op_uret)  ||
+              (instr->decode.op == rv_op_sret)  ||
+              (instr->decode.op == rv_op_mret)  ||
+              (instr->decode.op == rv_op_dret) )
+    {
+        return TE_TRANSFER_TRAP_RETURN;
+    }
+    else if ( is_branch(instr)              ||
+              is_inferrable_jump(instr)     ||
+              is_uninferrable_jump(instr) )
+    {
+        return TE_TRANSFER_JUMP;
+    }
+
+    return TE_TRANSFER_NONE;
+}
+
+
+/*
+ * Process a gap in the trace, i.e. where trace data is known to have been
+ * lost (e.g. the on-chip trace buffer overflowed). Called each time the
+ * transport reports a gap, and also for a te_support message reporting
+ * that packets were lost.
+ *
+ * This cleanly ends the current reconstruction window: whatever follows
+ * the last reconstructed PC can no longer be reconstructed, so anything
+ * still pending is discarded. The user's gap handler (if any) is called
+ * with the last known PC, and decoding resumes at the next format 3.
+ * Any other messages before then are stragglers from the lost window, so
+ * they are silently discarded (and counted as such). Unlike errors, gaps
+ * are expected, so they are not counted as lost windows.
+ */
+extern void te_process_gap(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+
+    const te_gap_t gap =
+    {
+        .last_pc = decoder->pc,
+        .instruction_count = decoder->instruction_count,
+        .te_inst_index = decoder->num_te_inst,
+        .gap_index = decoder->num_gaps,
+    };
+
+    if (DEBUG)
+    {
+        log_printf(decoder, "gap after 0x%08lx\t%lu\n",
+            decoder->pc, decoder->instruction_count);
+    }
+
+    /* discard the current reconstruction, and wait for a format 3 */
+    discard_reconstruction(decoder);
+    decoder->waiting_for_sync = true;
+    decoder->num_gaps++;    /* update statistics */
+
+    if (decoder->gap_handler)
+    {
+        decoder->gap_handler(decoder->user_data, &gap);
+    }
+}
+
+
+/*
+ * Set the function to be called for each gap in the trace.
+ * If "gap_handler" is NULL, then gaps are processed silently.
+ */
+extern void te_set_gap_handler(
+    te_decoder_state_t * const decoder,
+    const te_gap_handler_t gap_handler)
+{
+    assert(decoder);
+
+    decoder->gap_handler = gap_handler;
+}
+
+
+/*
+ * Set the function to be called whenever the trace-decoder detects an
+ * error in the trace. After calling it, the decoder discards messages
+ * until the next format 3 te_inst, and then resumes decoding from there.
+ * If "error_handler" is NULL, then a diagnostic is printed instead.
+ */
+extern void te_set_error_handler(
+    te_decoder_state_t * const decoder,
+    const te_error_handler_t error_handler)
+{
+    assert(decoder);
+
+    decoder->error_handler = error_handler;
+}
+
+
+#if !defined(TE_NO_DEFAULT_CALLBACKS)
+/*
+ * Forward a diagnostic to the external function te_log_printf(), which
+ * does not take a va_list, so format it here first.
+ */
+static void default_log(
+    void * const user_data,
+    const char * const format,
+    va_list args)
+{
+    char buffer[1024];
+
+    (void)user_data;
+
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    te_log_printf("%s", buffer);
+}
+
+
+/*
+ * The callbacks used when none are passed to te_open_trace_decoder(),
+ * i.e. the external functions implemented by the user.
+ */
+const te_decoder_callbacks_t te_default_decoder_callbacks =
+{
+    .get_instruction = te_get_instruction,
+    .advance_decoded_pc = te_advance_decoded_pc,
+    .log = default_log,
+};
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+
+
+/*
+ * Retrieve the raw binary instruction value, and its length, at a given
+ * address, via the decoder's callbacks (bypassing its decoded cache).
+ */
+extern unsigned te_decoder_get_instruction(
+    const te_decoder_state_t * const decoder,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    assert(decoder);
+
+    return decoder->callbacks.get_instruction(decoder->user_data, address, instruction);
 }
 
 
@@ -882,15 +1544,27 @@ extern void te_process_te_support(
  * allocated, otherwise it must point to a pre-allocated region large enough.
  * This returns a pointer to the internal "state" of the trace-decoder.
  *
- * If this function allocated memory (decoder==NULL on entry), the memory
- * should be released (by calling free()), when the instance of the
- * trace-decoder is no longer required.
+ * The functions in "callbacks" (which are copied) are called with
+ * "user_data" to retrieve instructions, and to disseminate each PC.
+ * If "callbacks" is NULL, then te_default_decoder_callbacks is used.
+ *
+ * The decoded cache (of TE_DECODED_CACHE_BITS, see te_set_decoded_cache_bits)
+ * and the return stack are always allocated separately, so they should be
+ * released (by calling te_close_trace_decoder()) when the instance of the
+ * trace-decoder is no longer required, and before it is re-opened. If this
+ * function also allocated the instance itself (decoder==NULL on entry),
+ * that memory should then be released (by calling free()).
  */
 extern te_decoder_state_t * te_open_trace_decoder(
     te_decoder_state_t * decoder,
+    const te_decoder_callbacks_t * const callbacks,
     void * const user_data,
     const rv_isa isa)
 {
+#if defined(TE_NO_DEFAULT_CALLBACKS)
+    assert(callbacks);
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+
     if (decoder)
     {
         /* use provided memory, but zero it for ONE trace-decoder instance */
@@ -899,13 +1573,25 @@ extern te_decoder_state_t * te_open_trace_decoder(
     else
     {
         /* allocate (and zero) memory for ONE trace-decoder instance */
-        decoder = calloc(1, sizeof(te_decoder_state_t));
+        decoder = aligned_alloc(TE_CACHE_LINE_SIZE, sizeof(te_decoder_state_t));
         assert(decoder);
+        memset(decoder, 0, sizeof(te_decoder_state_t));
     }
 
+    /* the fields used for every instruction should share one cache line */
+    assert(offsetof(te_decoder_state_t, decoded_cache_mask) + sizeof(size_t) <=
+           TE_CACHE_LINE_SIZE);
+
     /* bind the "user-data" to the allocated memory */
     decoder->user_data = user_data;
     decoder->isa = isa;
+#if defined(TE_NO_DEFAULT_CALLBACKS)
+    decoder->callbacks = *callbacks;
+#else   /* TE_NO_DEFAULT_CALLBACKS */
+    decoder->callbacks = callbacks ? *callbacks : te_default_decoder_callbacks;
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+    assert(decoder->callbacks.get_instruction);
+    assert(decoder->callbacks.advance_decoded_pc);
 
     /*
      * initialize some of the fields, as per the pseudo-code.
@@ -914,12 +1600,131 @@ extern te_decoder_state_t * te_open_trace_decoder(
     decoder->pc = SENTINEL_BAD_ADDRESS;
     decoder->last_pc = SENTINEL_BAD_ADDRESS;
     decoder->address = SENTINEL_BAD_ADDRESS;
+    decoder->next_sequential_pc = SENTINEL_BAD_ADDRESS;
     decoder->start_of_trace = true;
 
+    te_set_decoded_cache_bits(decoder, TE_DECODED_CACHE_BITS);
+    te_set_return_stack_size(decoder, te_support.implicit_return ?
+        (size_t)1 << (discovery_response.call_counter_width + 2) : 0);
+
     return decoder;
 }
 
 
+/*
+ * Release the memory allocated by te_open_trace_decoder() (and by
+ * te_set_decoded_cache_bits, te_attach_data_columns, etc.), but not the
+ * instance itself.
+ */
+extern void te_close_trace_decoder(
+    te_decoder_state_t * const decoder)
+{
+    size_t i;
+
+    assert(decoder);
+
+    for (i = 0; i < TE_MAX_CONTEXT_CACHES; i++)
+    {
+        free(decoder->contexts.caches[i].decoded_cache);
+        decoder->contexts.caches[i].decoded_cache = NULL;
+    }
+    free(decoder->return_stack);
+    free(decoder->data.pending);
+    free(decoder->cycles.pending);
+    decoder->decoded_cache = NULL;
+    decoder->decoded_cache_mask = 0;
+    decoder->return_stack = NULL;
+    decoder->return_stack_size = 0;
+    decoder->data.pending = NULL;
+    decoder->data.num_pending = 0;
+    decoder->cycles.pending = NULL;
+    decoder->cycles.num_pending = 0;
+}
+
+
+/*
+ * Re-size the decoded cache of a trace-decoder, to 2^bits slots, which
+ * are all initially empty. This may be called at any time, e.g. to use
+ * a small cache for each of many harts, or a large one for big loops.
+ * The caches of any other contexts are released (see te_set_context).
+ */
+extern void te_set_decoded_cache_bits(
+    te_decoder_state_t * const decoder,
+    const unsigned bits)
+{
+    const size_t num_slots = (size_t)1 << bits;
+    size_t i;
+
+    assert(decoder);
+    assert(bits < 8 * sizeof(size_t));
+
+    for (i = 0; i < TE_MAX_CONTEXT_CACHES; i++)
+    {
+        free(decoder->contexts.caches[i].decoded_cache);
+        decoder->contexts.caches[i].decoded_cache = NULL;
+    }
+    decoder->decoded_cache = calloc(num_slots, sizeof(te_decoded_instruction_t));
+    assert(decoder->decoded_cache);
+    decoder->decoded_cache_mask = num_slots - 1u;
+
+    decoder->contexts.caches[0].context = decoder->contexts.context;
+    decoder->contexts.caches[0].decoded_cache = decoder->decoded_cache;
+    decoder->contexts.caches[0].last_used = decoder->contexts.num_switches;
+}
+
+
+/*
+ * Re-size the return stack of a trace-decoder (only used in implicit
+ * return mode) to "size" entries, or release it if "size" is 0. Any
+ * return addresses already on it are discarded. This is only needed if
+ * the trace-decoder is used with modes other than those it is compiled
+ * for (as by the C++ front-end).
+ */
+extern void te_set_return_stack_size(
+    te_decoder_state_t * const decoder,
+    const size_t size)
+{
+    assert(decoder);
+    assert(size <= TE_MAX_CALL_DEPTH);
+
+    free(decoder->return_stack);
+    decoder->return_stack = NULL;
+    decoder->return_stack_size = size;
+    decoder->call_counter = 0;
+    if (size)
+    {
+        decoder->return_stack = calloc(size, sizeof(te_address_t));
+        assert(decoder->return_stack);
+    }
+}
+
+
+/*
+ * Returns the total memory (in bytes) used by one instance of a
+ * trace-decoder, including its decoded caches, its return stack, and the
+ * queues of the data-trace and cycle count stages (if allocated).
+ */
+extern size_t te_get_decoder_footprint(
+    const te_decoder_state_t * const decoder)
+{
+    size_t num_caches = 0;
+    size_t i;
+
+    assert(decoder);
+
+    for (i = 0; i < TE_MAX_CONTEXT_CACHES; i++)
+    {
+        num_caches += (NULL != decoder->contexts.caches[i].decoded_cache);
+    }
+
+    return sizeof(te_decoder_state_t) +
+           num_caches * (decoder->decoded_cache_mask + 1u) * sizeof(te_decoded_instruction_t) +
+           decoder->return_stack_size * sizeof(te_address_t) +
+           (decoder->data.pending ? TE_MAX_PENDING_DATA * sizeof(te_data_transfer_t) : 0) +
+           (decoder->cycles.pending ? TE_MAX_PENDING_CYCLES * sizeof(uint32_t) : 0);
+}
+
+
 /*
  * if we have any yet, print out the decoded cache statistics
  */
@@ -940,4 +1745,10 @@ extern void te_print_decoded_cache_statistics(
             decoder->num_gets,
             same + hits);
     }
+    if (decoder->shared.cache)
+    {
+        printf("shared-cache: hits = %8lu,  fills = %8lu\n",
+            decoder->shared.num_hits,
+            decoder->shared.num_fills);
+    }
 }
@@ -40,6 +40,7 @@
  *      rv_decode, rv_inst, and rv_isa.
  */
 #include "riscv-disas.h"
+#include <stdarg.h>
 
 
 #ifdef __cplusplus
@@ -55,9 +56,31 @@ extern "C" {
 #endif  /* __GNUC__ */
 
 
+/*
+ * Define the modes of the trace-encoder, as would otherwise be obtained
+ * through "discovery", or from te_support messages. These are fixed when
+ * this code is compiled, so that the paths for the other modes compile away.
+ * 2^(TE_CALL_COUNTER_WIDTH+2) must not exceed TE_MAX_CALL_DEPTH (below).
+ * If not defined elsewhere, define these here.
+ */
+#if !defined(TE_FULL_ADDRESS)
+#   define TE_FULL_ADDRESS          (0)     /* use differential addresses */
+#endif  /* TE_FULL_ADDRESS */
+#if !defined(TE_IMPLICIT_RETURN)
+#   define TE_IMPLICIT_RETURN       (0)     /* disable using return_stack[] */
+#endif  /* TE_IMPLICIT_RETURN */
+#if !defined(TE_IADDRESS_LSB)
+#   define TE_IADDRESS_LSB          (1)     /* 1 == compressed instructions supported */
+#endif  /* TE_IADDRESS_LSB */
+#if !defined(TE_CALL_COUNTER_WIDTH)
+#   define TE_CALL_COUNTER_WIDTH    (7)     /* maximum of 512 calls on return_stack[] */
+#endif  /* TE_CALL_COUNTER_WIDTH */
+
+
 /*
  * Define the maximum size of the "return-stack" (must be a power of 2),
- * which is only used when "implicit_return" is true.
+ * which is only used when "implicit_return" is true. Each trace-decoder
+ * allocates only as many entries as TE_CALL_COUNTER_WIDTH requires.
  * If not defined elsewhere, define TE_MAX_CALL_DEPTH here.
  */
 #if !defined(TE_MAX_CALL_DEPTH)
@@ -80,25 +103,132 @@ extern "C" {
  * cache, which does not map on to the trace encoder hardware at all.
  *
  * We create a simple (direct-mapped) cache of recent instruction decodes,
- * using the array decoded_cache[] in the te_decoder_state_s structure.
+ * using the array decoded_cache[] allocated by each te_decoder_state_s.
  * This will hold 100% of the slots with 16-bit instructions, but only
  * 50% of the slots with 32-bit instructions, etcetera. As the "index"
  * is the bottom n-bits of the address (after shifting it right by one).
  *
  * We now define a few macros to dimension and map this decode cache.
+ * TE_DECODED_CACHE_BITS is only the default size of each new instance,
+ * which may be changed with te_set_decoded_cache_bits().
  * Note: a cache size of 2^10 resulted in a hit-rate of 99.12% for coremark!
  */
 #if !defined(TE_DECODED_CACHE_BITS)
 #   define TE_DECODED_CACHE_BITS    (10)        /* 2^10 = 1024 slots */
 #endif  /* TE_DECODED_CACHE_BITS */
 #define TE_DECODED_CACHE_SIZE       (1u<<TE_DECODED_CACHE_BITS)
-#define TE_SLOT_NUMBER(address)     (((address)>>1)&(TE_DECODED_CACHE_SIZE-1u))
+#define TE_SLOT_NUMBER(address, mask)   (((address)>>1)&(mask))
+
+
+/*
+ * Define the size of a cache line, to which the state of each
+ * trace-decoder is aligned, so that the fields used for every
+ * instruction all share one line (see te_decoder_state_s).
+ * If not defined elsewhere, define TE_CACHE_LINE_SIZE here.
+ */
+#if !defined(TE_CACHE_LINE_SIZE)
+#   define TE_CACHE_LINE_SIZE       (64u)
+#endif  /* TE_CACHE_LINE_SIZE */
+#if defined(__GNUC__)
+#   define TE_CACHE_ALIGNED         __attribute__((aligned(TE_CACHE_LINE_SIZE)))
+#else   /* __GNUC__ */
+#   define TE_CACHE_ALIGNED
+#endif  /* __GNUC__ */
+
+
+/*
+ * Define the maximum number of data transfers (must be a power of 2),
+ * that may be waiting to be correlated with the PC of their load or
+ * store instruction. Data trace packets are emitted as each load or store
+ * retires, whereas the te_inst message which lets us reconstruct those
+ * instructions is only emitted later, so the transfers must be queued.
+ * If not defined elsewhere, define TE_MAX_PENDING_DATA here.
+ */
+#if !defined(TE_MAX_PENDING_DATA)
+#   define TE_MAX_PENDING_DATA (1u<<10)  /* 2^10 = 1024 transfers */
+#endif  /* TE_MAX_PENDING_DATA */
+
+
+/*
+ * Define the default number of entries (must be a power of 2) in each of
+ * the open-addressing hash tables of a te_edge_profile_t. Each table holds
+ * at most 3/4 of this many distinct keys, after which new keys are dropped
+ * (and counted), so that nothing is ever allocated per event.
+ * If not defined elsewhere, define TE_EDGE_TABLE_BITS here.
+ */
+#if !defined(TE_EDGE_TABLE_BITS)
+#   define TE_EDGE_TABLE_BITS   (16)    /* 2^16 = 65536 entries */
+#endif  /* TE_EDGE_TABLE_BITS */
+
+
+/*
+ * Data transfers are 1, 2, 4 or 8 bytes wide, which we hold as log2(size).
+ * The differential encoding of data trace is relative to the previous
+ * transfer of the same size, so we keep one set of registers per size.
+ */
+#define TE_DATA_SIZES               (4u)
+
+
+/*
+ * Bit-fields within the "flags" of a reconstructed data transfer.
+ */
+#define TE_DATA_FLAG_SIZE(flags)    ((flags) & 0x3u)    /* log2(bytes) */
+#define TE_DATA_FLAG_STORE          (1u<<2)     /* else it is a load */
+#define TE_DATA_FLAG_VALUE          (1u<<3)     /* value was traced */
+
+
+/*
+ * Define the maximum number of inter-instruction cycle counts (must be a
+ * power of 2), that may be waiting to be attributed to the PC of the
+ * instruction whose retirement they describe. As with data trace, these
+ * are received before the te_inst message that lets us reconstruct the
+ * corresponding instructions, so they must be queued.
+ * If not defined elsewhere, define TE_MAX_PENDING_CYCLES here.
+ */
+#if !defined(TE_MAX_PENDING_CYCLES)
+#   define TE_MAX_PENDING_CYCLES (1u<<12)   /* 2^12 = 4096 retirements */
+#endif  /* TE_MAX_PENDING_CYCLES */
+
+
+/*
+ * Number of buckets in the histogram of inter-instruction cycle counts.
+ * Bucket 0 counts retirements in the same cycle as the previous one,
+ * and bucket n (n>0) counts those with a cycle count in [2^(n-1), 2^n).
+ * The final bucket also counts everything larger.
+ */
+#define TE_CYCLE_HISTOGRAM_BUCKETS  (16u)
+
+
+/*
+ * When the trace is corrupt (e.g. packets have been lost), it is possible
+ * for the decoder to follow the execution path without ever reaching the
+ * reported address. To avoid looping forever, we treat following more than
+ * this number of instructions, for a single message, as an error.
+ * If not defined elsewhere, define TE_MAX_FOLLOW_STEPS here.
+ */
+#if !defined(TE_MAX_FOLLOW_STEPS)
+#   define TE_MAX_FOLLOW_STEPS  (1ul<<24)
+#endif  /* TE_MAX_FOLLOW_STEPS */
 
 
 /* variables that need to hold a target's address should use te_address_t */
 typedef uint64_t te_address_t;
 
 
+/*
+ * The transfer of control (if any) performed by an instruction.
+ * See te_classify_transfer().
+ */
+typedef enum
+{
+    TE_TRANSFER_NONE = 0,       /* only ever advances sequentially */
+    TE_TRANSFER_JUMP,           /* branch, or any other jump */
+    TE_TRANSFER_CALL,           /* jump, linking to x1 */
+    TE_TRANSFER_RETURN,         /* jalr x0, 0(x1), or c.jr x1 */
+    TE_TRANSFER_TRAP_RETURN,    /* uret, sret, mret or dret */
+} te_transfer_t;
+
+
 /*
  * The following structure is used to hold the decoded and
  * disassembled information for a single RISC-V instruction.
@@ -111,23 +241,403 @@ typedef struct
 } te_decoded_instruction_t;
 
 
+/*
+ * A single data transfer, after its address and value have been
+ * reconstructed, but (possibly) before it has been correlated
+ * with the PC of the load or store instruction which performed it.
+ */
+typedef struct
+{
+    te_address_t address;   /* absolute address of the transfer */
+    uint64_t     value;     /* absolute value (if TE_DATA_FLAG_VALUE) */
+    uint8_t      flags;     /* TE_DATA_FLAG_* */
+} te_data_transfer_t;
+
+
+/*
+ * The output of the data-trace stage is a "columnar" stream: rather than
+ * an array of structures, each field is written to its own array, all
+ * indexed by the same row number. This keeps the rows compact (no padding),
+ * and lets consumers (e.g. memory-access profilers) scan just the columns
+ * they are interested in. The user owns the arrays, and the data-trace
+ * stage appends rows until "capacity" is reached, at which point flush()
+ * is called, and it is expected to consume the "count" rows present.
+ * The data-trace stage then sets "count" back to zero, and continues.
+ */
+typedef struct te_data_columns_s
+{
+    te_address_t * pc;      /* PC of the load/store instruction */
+    te_address_t * address; /* absolute address of the transfer */
+    uint64_t     * value;   /* absolute value, if TE_DATA_FLAG_VALUE */
+    uint8_t      * flags;   /* TE_DATA_FLAG_* */
+    size_t capacity;        /* number of rows in each of the above arrays */
+    size_t count;           /* number of rows currently populated */
+    /* called when the columns are full, or from te_flush_data_trace() */
+    void (*flush)(void * const user_data, struct te_data_columns_s * const columns);
+} te_data_columns_t;
+
+
+/*
+ * Flat arrays in which inter-instruction cycle counts are accumulated.
+ * There is one slot for each half-word in the range of addresses being
+ * profiled, so any PC within that range can be indexed directly, without
+ * hashing. Cycles are attributed to each retiring PC, and also to the first
+ * PC of the (dynamic) basic block containing it, i.e. the first instruction
+ * after a discontinuity. PCs outside the range are only counted in the
+ * histogram and in "outside_cycles".
+ * See te_open_cycle_profile().
+ */
+typedef struct
+{
+    te_address_t base;          /* lowest address being profiled */
+    size_t num_slots;           /* number of half-words being profiled */
+    uint64_t * pc_cycles;       /* cycles attributed to each PC */
+    uint64_t * pc_retired;      /* number of times each PC retired */
+    uint64_t * block_cycles;    /* cycles attributed to each basic block */
+    uint64_t * block_entries;   /* number of times each basic block started */
+    uint64_t outside_cycles;    /* cycles for PCs outside the range */
+    uint64_t histogram[TE_CYCLE_HISTOGRAM_BUCKETS];
+} te_cycle_profile_t;
+
+
+/*
+ * Flat arrays in which the decoder accumulates an execution count for each
+ * PC, indexed exactly as the te_cycle_profile_t (one slot per half-word).
+ * To keep the per-instruction cost of the decoder to a minimum, nothing is
+ * counted per instruction: instead, each (dynamic) basic block increments
+ * the slot of its first PC in "block_entries", and the slot just beyond its
+ * last instruction in "block_exits". The per-PC counts are only expanded
+ * from these (lazily, on demand) by te_expand_exec_profile().
+ * As the block counters are simply summed, profiles accumulated by several
+ * decoders (perhaps in different threads) can be combined with
+ * te_merge_exec_profile(), before being expanded.
+ * Blocks starting outside the range are only counted in "outside_blocks".
+ * See te_open_exec_profile().
+ */
+typedef struct
+{
+    te_address_t base;          /* lowest address being profiled */
+    size_t num_slots;           /* number of half-words being profiled */
+    uint64_t * block_entries;   /* blocks starting at each PC */
+    uint64_t * block_exits;     /* blocks ending before each PC (+1 slot) */
+    uint64_t * pc_executed;     /* NULL == not yet expanded */
+    uint64_t num_blocks;        /* blocks starting inside the range */
+    uint64_t outside_blocks;    /* blocks starting outside the range */
+} te_exec_profile_t;
+
+
+/*
+ * Instruction and branch-direction coverage bitmaps, indexed exactly as
+ * the te_cycle_profile_t, but with one bit for each half-word. The decoder
+ * sets the bits of "executed" for whole (dynamic) basic blocks at a time,
+ * i.e. for every half-word of every instruction executed. The bits of
+ * "taken" and "not_taken" are only set at the PC of each branch.
+ * Bitmaps from several decoders, or runs, are combined by
+ * te_merge_coverage(), or by te_read_coverage().
+ * See te_open_coverage().
+ */
+typedef struct
+{
+    te_address_t base;          /* lowest address being covered */
+    size_t num_slots;           /* number of half-words being covered */
+    size_t num_words;           /* number of 64-bit words in each bitmap */
+    uint64_t * executed;        /* half-words executed */
+    uint64_t * taken;           /* branches taken */
+    uint64_t * not_taken;       /* branches not taken */
+} te_coverage_t;
+
+
+/*
+ * Define the number of consecutive entries of a te_shared_cache_t that
+ * are probed, to find (or to add) each instruction.
+ * If not defined elsewhere, define TE_SHARED_CACHE_PROBES here.
+ */
+#if !defined(TE_SHARED_CACHE_PROBES)
+#   define TE_SHARED_CACHE_PROBES   (8u)
+#endif  /* TE_SHARED_CACHE_PROBES */
+
+
+/*
+ * One entry in a te_shared_cache_t. Its "state" goes from empty, to being
+ * filled (by one trace-decoder), to ready, and is then never changed again.
+ * The address is that of the decoded instruction (i.e. instr.decode.pc).
+ */
+typedef struct
+{
+    uint32_t state;             /* accessed atomically */
+    uint32_t address_space;
+    te_decoded_instruction_t instr;
+} te_shared_entry_t;
+
+
+/*
+ * A store of decoded instructions, keyed by (address space, address),
+ * which may be shared by any number of trace-decoders, e.g. one for each
+ * hart of an SMP system, all executing the same images. Each trace-decoder
+ * still has its own decoded cache, and only looks in this on a miss in its
+ * own. So each instruction is only decoded once by the whole process.
+ *
+ * This is an open-addressed hash table, of which each entry is only ever
+ * filled once, and is never removed. Entries are claimed (to be filled)
+ * with a compare-and-swap, and published with a store-release, so no
+ * locks are needed, and lookups never write to it. If all the entries
+ * probed for an instruction are used, it is just not added.
+ * See te_open_shared_cache().
+ */
+typedef struct
+{
+    te_shared_entry_t * entries;
+    size_t mask;                /* number of entries, minus one */
+    unsigned long num_used;     /* entries filled (updated atomically) */
+    unsigned long num_full;     /* not added, as all probed entries were used */
+} te_shared_cache_t;
+
+
+/*
+ * Define the number of contexts for which each trace-decoder keeps its
+ * own decoded cache. Switching to any of these is just a pointer swap,
+ * otherwise the cache of the least recently used one is emptied for it.
+ * If not defined elsewhere, define TE_MAX_CONTEXT_CACHES here.
+ */
+#if !defined(TE_MAX_CONTEXT_CACHES)
+#   define TE_MAX_CONTEXT_CACHES    (8u)
+#endif  /* TE_MAX_CONTEXT_CACHES */
+
+
+/*
+ * One image (e.g. the code of an ELF executable, or shared library)
+ * mapped into a context at its load address. "code" holds the "size"
+ * bytes at "base", and must outlive the te_context_map_t. The same image
+ * may be mapped into many contexts, with the same "address_space" if it is
+ * at the same address in each (e.g. the kernel), so that its decodes are
+ * shared (see te_shared_cache_t).
+ */
+typedef struct
+{
+    te_address_t base;          /* load address */
+    size_t size;                /* in bytes */
+    const uint8_t * code;
+    uint32_t address_space;
+} te_image_map_t;
+
+
+/*
+ * One context (e.g. a process), as identified by the "context" field of
+ * format 3 te_inst messages, and the images mapped into it.
+ */
+typedef struct
+{
+    uint64_t context;
+    uint32_t address_space;     /* for addresses not in any image */
+    te_image_map_t * images;
+    size_t num_images;
+} te_context_t;
+
+
+/*
+ * The contexts of the traced system, sorted by context, which may be
+ * shared by any number of trace-decoders, e.g. one for each hart. Each
+ * instruction is retrieved from the image mapped at its address in the
+ * current context, if any, otherwise via the get_instruction callback.
+ * See te_open_context_map().
+ */
+typedef struct
+{
+    te_context_t ** contexts;
+    size_t num_contexts;
+    size_t capacity;
+} te_context_map_t;
+
+
+/*
+ * One entry in a te_edge_table_t. The meaning of the key ("from" and "to")
+ * and of the counts depends on the table: see te_edge_profile_t.
+ * An entry is unused if both of its counts are zero.
+ */
+typedef struct
+{
+    te_address_t from;
+    te_address_t to;
+    uint64_t count[2];
+} te_edge_t;
+
+
+/*
+ * A fixed-size open-addressing (linear probing) hash table of te_edge_t.
+ */
+typedef struct
+{
+    te_edge_t * entries;        /* all the slots */
+    size_t mask;                /* number of slots - 1 */
+    size_t num_used;            /* number of distinct keys held */
+    uint64_t num_dropped;       /* events lost, as the table was full */
+} te_edge_table_t;
+
+
+/*
+ * Exact (i.e. not sampled) control-flow counts, as needed for profile-guided
+ * optimization, e.g. by AutoFDO or llvm-profgen. These are accumulated by the
+ * decoder in three compact hash tables, with no allocation per event:
+ *
+ *  branches:   key = (branch PC, 0),
+ *              count[0] = times taken, count[1] = times not taken.
+ *  jumps:      key = (source PC, target PC), of every taken branch or
+ *              jump (including uninferable jumps, for each target),
+ *              count[0] = times taken.
+ *  ranges:     key = (first PC, PC after the last instruction), of every
+ *              (dynamic) basic block, count[0] = times executed.
+ *
+ * See te_open_edge_profile() and te_write_edge_profile().
+ */
+typedef struct
+{
+    te_edge_table_t branches;
+    te_edge_table_t jumps;
+    te_edge_table_t ranges;
+} te_edge_profile_t;
+
+
+/*
+ * The inconsistencies that the trace-decoder can detect in a trace.
+ * None of these should ever happen with an uncorrupted trace.
+ */
+typedef enum
+{
+    TE_ERROR_NONE = 0,
+    TE_ERROR_BRANCH_MAP_DEPLETED,   /* cannot resolve branch */
+    TE_ERROR_UNEXPECTED_DISCON,     /* uninferrable discontinuity, but expected a branch */
+    TE_ERROR_NO_BRANCHES,           /* stop_at_last_branch, but no branches */
+    TE_ERROR_UNPROCESSED_BRANCHES,  /* reached address, but branches remain */
+    TE_ERROR_NO_START_SYNC,         /* expected trace to start with format 3 */
+    TE_ERROR_BAD_BRANCH_MAP,        /* more than 1 branch left before format 1 */
+    TE_ERROR_BAD_INSTRUCTION,       /* te_get_instruction() returned a bad length */
+    TE_ERROR_RUNAWAY,               /* did not reach reported address */
+    TE_ERROR_UNSUPPORTED,           /* branch count or jump target cache te_inst */
+} te_error_code_t;
+
+
+/*
+ * Description of an error detected by the trace-decoder,
+ * as passed to the error handler (see te_set_error_handler).
+ */
+typedef struct
+{
+    te_error_code_t code;
+    const char * message;           /* human-friendly description */
+    te_address_t pc;                /* reconstructed PC at the time */
+    unsigned long instruction_count;/* at the time */
+    unsigned long te_inst_index;    /* te_inst messages processed so far */
+    const te_decoded_instruction_t * instr; /* being processed, or NULL */
+} te_error_t;
+
+
+/*
+ * Type of function called when the trace-decoder detects an error.
+ * "user_data" is whatever was passed to te_open_trace_decoder().
+ */
+typedef void (*te_error_handler_t)(
+    void * const user_data,
+    const te_error_t * const error);
+
+
+/*
+ * Description of a gap in the trace (i.e. where trace data was lost),
+ * as passed to the gap handler (see te_set_gap_handler). The last known
+ * PC is the final instruction reconstructed before the gap, after which
+ * decoding will resume at the next format 3 te_inst message.
+ */
+typedef struct
+{
+    te_address_t last_pc;           /* last reconstructed PC */
+    unsigned long instruction_count;/* at the time */
+    unsigned long te_inst_index;    /* te_inst messages processed so far */
+    unsigned long gap_index;        /* number of previous gaps */
+} te_gap_t;
+
+
+/*
+ * Type of function called when the trace-decoder processes a gap.
+ * "user_data" is whatever was passed to te_open_trace_decoder().
+ */
+typedef void (*te_gap_handler_t)(
+    void * const user_data,
+    const te_gap_t * const gap);
+
+
+/*
+ * Types of the functions called by the trace-decoder to retrieve each
+ * instruction, to notify the user of each new PC, and to print some
+ * diagnostics. These have the same semantics as te_get_instruction(),
+ * te_advance_decoded_pc() and te_log_printf() respectively (see below),
+ * but are called via the te_decoder_callbacks_t of each instance.
+ * "user_data" is whatever was passed to te_open_trace_decoder().
+ */
+typedef unsigned (*te_get_instruction_t)(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction);
+
+typedef void (*te_advance_decoded_pc_t)(
+    void * const user_data,
+    const te_address_t old_pc,
+    const te_address_t new_pc,
+    const te_decoded_instruction_t * const new_instruction);
+
+typedef void (*te_log_t)(
+    void * const user_data,
+    const char * const format,
+    va_list args);
+
+
+/*
+ * The functions called by one instance of the trace-decoder, as passed to
+ * te_open_trace_decoder(). This allows several instances in one process
+ * to each have a different consumer (e.g. a profiler, and a verifier).
+ * "log" may be NULL, to discard all diagnostics.
+ *
+ * Unless TE_NO_DEFAULT_CALLBACKS is defined, passing NULL to
+ * te_open_trace_decoder() selects te_default_decoder_callbacks, which
+ * calls the external functions te_get_instruction(), te_advance_decoded_pc()
+ * and te_log_printf(), which the user must then implement. If it is defined,
+ * those external functions are never referenced, and so need not exist.
+ */
+typedef struct
+{
+    te_get_instruction_t get_instruction;
+    te_advance_decoded_pc_t advance_decoded_pc;
+    te_log_t log;               /* NULL == discard diagnostics */
+} te_decoder_callbacks_t;
+
+
 /*
  * The following structure is used to hold all the state
  * for a single instance of a trace-decoder ... this allows
  * a plurality of trace-decoders to be running simultaneously,
  * with each core being traced having its own unique instance
  * of this structure (and hence state)
+ *
+ * The fields used to reconstruct every instruction are packed into the
+ * first cache line, and those used to retrieve and disseminate every
+ * instruction into the second. The decoded cache and the return stack
+ * are allocated separately (see te_open_trace_decoder), so this holds
+ * little more than the (rarely used) queues of the optional stages.
  */
 typedef struct te_decoder_state_s
 {
     /* Reconstructed program counter */
-    te_address_t pc;
+    te_address_t pc TE_CACHE_ALIGNED;
     /* PC of previously retired instruction */
     te_address_t last_pc;
-    /* Number of branches to process */
-    unsigned int branches;
+    /*
+     * Reconstructed address from te_inst messages.
+     * Only used in process_te_inst(), logically "static" therein
+     * Note: pseudo-code has this at global scope (for persistence)
+     */
+    te_address_t address;
     /* Bit vector of not taken/taken (1/0) status for branches */
     uint32_t branch_map;    /* a maximum of 32 such taken bits */
+    /* Number of branches to process */
+    unsigned int branches;
     /* Flag to indicate reconstruction is to end at the final branch */
     bool stop_at_last_branch;
     /* Flag to indicate that reported address from format != 3 was
@@ -135,33 +645,165 @@ typedef struct te_decoder_state_s
     bool inferred_address;
     /* true if 1st trace message still to be processed */
     bool start_of_trace;
+    /* true if discarding until a format 3 (see error handling below) */
+    bool waiting_for_sync;
     /* top of stack, zero == call stack is empty */
     size_t call_counter;
-    /* memory for the "call-stack" (only when "implicit_return" is 1) */
-    te_address_t return_stack[TE_MAX_CALL_DEPTH];
-    /*
-     * Reconstructed address from te_inst messages.
-     * Only used in process_te_inst(), logically "static" therein
-     * Note: pseudo-code has this at global scope (for persistence)
-     */
-    te_address_t address;
+    /* see comment above for an explanation of this decode cache */
+    te_decoded_instruction_t * decoded_cache;
+    size_t decoded_cache_mask;  /* number of slots, minus one */
+
+    /* the functions called by this instance, with "user_data" */
+    te_decoder_callbacks_t callbacks TE_CACHE_ALIGNED;
 
     /* pointer to user-data, whatever was passed to te_open_trace_decoder() */
     void * user_data;
 
-    /* the ISA to use (for riscv-disassembler) */
-    rv_isa isa;
-
     /* maintain a counter that increments each time the PC is changed */
     unsigned long instruction_count;  /* for statistics only */
 
-    /* see comment above for an explanation of this decode cache */
-    te_decoded_instruction_t decoded_cache[TE_DECODED_CACHE_SIZE];
-
     /* maintain a few statistics about decoded_cache[] */
     unsigned long num_gets;
     unsigned long num_same;
     unsigned long num_hits;
+
+    /* memory for the "call-stack" (only when "implicit_return" is 1) */
+    te_address_t * return_stack;
+    size_t return_stack_size;   /* entries, zero if none */
+
+    /* the ISA to use (for riscv-disassembler) */
+    rv_isa isa;
+
+    /*
+     * state for the (optional) data-trace stage.
+     * see te_process_te_data() for an explanation of these.
+     */
+    struct
+    {
+        /* previous address & value, for each transfer size */
+        te_address_t last_address[TE_DATA_SIZES];
+        uint64_t     last_value[TE_DATA_SIZES];
+        /*
+         * circular queue (of TE_MAX_PENDING_DATA) of transfers waiting
+         * for their PC, NULL until te_attach_data_columns() is called
+         */
+        te_data_transfer_t * pending;
+        size_t head;            /* index of the oldest pending transfer */
+        size_t num_pending;     /* number of pending transfers */
+        /* where correlated transfers are written (may be NULL) */
+        te_data_columns_t * columns;
+        /* maintain a few statistics about the data-trace stage */
+        unsigned long num_transfers;    /* correlated with a PC */
+        unsigned long num_unmatched;    /* loads/stores with no transfer */
+        unsigned long num_dropped;      /* transfers lost, as queue was full */
+    } data;
+
+    /*
+     * error handling: after an error, all packets are discarded until
+     * the next format 3 te_inst, from which point decoding resumes.
+     */
+    te_error_handler_t error_handler;   /* NULL == print a diagnostic */
+    unsigned long num_te_inst;  /* number of te_inst messages processed */
+    unsigned long num_lost_windows; /* number of errors (resyncs needed) */
+    unsigned long num_discarded;    /* messages discarded whilst waiting */
+    te_gap_handler_t gap_handler;   /* NULL == ignore gaps */
+    unsigned long num_gaps;         /* number of gaps in the trace */
+
+    /* PC of the first instruction in the current (dynamic) basic block */
+    te_address_t block_start;
+    /* PC of the next instruction, if there is no discontinuity */
+    te_address_t next_sequential_pc;
+
+    /*
+     * state for the (optional) inter-instruction cycle count stage.
+     * see te_process_te_cycles() for an explanation of these.
+     */
+    struct
+    {
+        /*
+         * circular queue (of TE_MAX_PENDING_CYCLES) of cycle counts waiting
+         * for their PC, NULL until te_attach_cycle_profile() is called
+         */
+        uint32_t * pending;
+        size_t head;            /* index of the oldest pending count */
+        size_t num_pending;     /* number of pending counts */
+        /* where the cycles are accumulated (may be NULL) */
+        te_cycle_profile_t * profile;
+        /* maintain a statistic about the cycle count stage */
+        unsigned long num_dropped;  /* counts lost, as queue was full */
+    } cycles;
+
+    /* state for the (optional) execution count profile */
+    struct
+    {
+        /* where the blocks are counted (may be NULL) */
+        te_exec_profile_t * profile;
+        /* true if the current block's entry was counted in "profile" */
+        bool block_open;
+    } exec;
+
+    /* state for the (optional) control-flow edge profile */
+    struct
+    {
+        /* where the edges are counted (may be NULL) */
+        te_edge_profile_t * profile;
+        /* true if the current block should be counted in "profile" */
+        bool block_open;
+    } edges;
+
+    /* state for the (optional) shared decoded cache */
+    struct
+    {
+        /* where decoded instructions are shared (may be NULL) */
+        te_shared_cache_t * cache;
+        /* the address space of the traced code, e.g. an image */
+        uint32_t address_space;
+        /* maintain a few statistics about the shared cache */
+        unsigned long num_hits;     /* found in "cache" */
+        unsigned long num_fills;    /* added to "cache" */
+    } shared;
+
+    /*
+     * state for the (optional) per-context decoded caches, and images.
+     * Each decoded cache (one of which is decoded_cache[]) is only used
+     * for one context, so switching context need not empty it.
+     */
+    struct
+    {
+        /* the contexts, and their images (may be NULL) */
+        const te_context_map_t * map;
+        /* the current context, and its entry in "map" (or NULL) */
+        uint64_t context;
+        const te_context_t * current;
+        /*
+         * the context of a format 3 te_inst, to be switched to on reaching
+         * its address (see next_pc), and the "branch" of that te_inst
+         */
+        bool switch_pending;
+        bool sync_branch;
+        uint64_t next_context;
+        /* the image of the last instruction retrieved (or NULL) */
+        const te_image_map_t * image;
+        /* the decoded cache of each recent context */
+        struct
+        {
+            uint64_t context;
+            te_decoded_instruction_t * decoded_cache;   /* NULL == unused */
+            unsigned long last_used;
+        } caches[TE_MAX_CONTEXT_CACHES];
+        /* maintain a few statistics about the contexts */
+        unsigned long num_switches;     /* changes of context */
+        unsigned long num_evictions;    /* decoded caches emptied */
+    } contexts;
+
+    /* state for the (optional) coverage bitmaps */
+    struct
+    {
+        /* where the coverage is recorded (may be NULL) */
+        te_coverage_t * map;
+        /* true if the current block should be recorded in "map" */
+        bool block_open;
+    } coverage;
 } te_decoder_state_t;
 
 
@@ -169,6 +811,8 @@ typedef struct te_decoder_state_s
  * cut-down list of fields from a te_inst message.
  * This is the subset of fields actually used by the
  * pseudo-code, with the same names and semantics.
+ * The remaining format 3 fields are populated by the
+ * reference encoder, but are not needed by the decoder.
  */
 typedef struct
 {
@@ -179,6 +823,19 @@ typedef struct
     unsigned branch_map;    /* up to 31-bits */
     bool branch;            /* 1-bit */
     bool updiscon;          /* 1-bit */
+    /* format 3 only */
+    unsigned privilege;     /* privilege_width_p bits */
+    uint64_t context;       /* context_width_p bits */
+    /* format 3, subformat 1 only */
+    unsigned ecause;        /* ecause_width_p bits */
+    bool interrupt;         /* 1-bit */
+    te_address_t tval;      /* iaddress_width_p bits */
+    /* format 1, with branches == 0, only with a branch predictor */
+    unsigned branch_fmt;    /* 2-bits: 0 == branch_map, 1 == branch_count, 2 == and address */
+    unsigned branch_count;  /* 16-bits: correctly predicted branches, minus 31 */
+    bool bpsuccess;         /* 1-bit: only if branch_fmt is 2 */
+    /* format 0 only, with a jump target cache */
+    unsigned jtc_index;     /* jtc_size_p bits */
 } te_inst_t;
 
 
@@ -186,7 +843,7 @@ typedef enum
 {
     QUAL_STATUS_NO_CHANGE = 0,
     QUAL_STATUS_ENDED_REP = 1,
-    QUAL_STATUS_RESERVED  = 2,
+    QUAL_STATUS_PACKET_LOST = 2,    /* one or more packets lost */
     QUAL_STATUS_ENDED_NTR = 3
 } te_qual_status_t;
 
@@ -205,6 +862,37 @@ typedef struct
 } te_support_t;
 
 
+/*
+ * list of fields from a data trace message (load or store).
+ * Data trace is not yet fully specified (see "Future directions"),
+ * so this is the minimal set of fields required to reconstruct
+ * each transfer. When "diff_address" or "diff_value" is set, the
+ * corresponding field holds the difference from the previous
+ * transfer of the same size, irrespective of transfer direction.
+ */
+typedef struct
+{
+    te_address_t address;   /* absolute or differential address */
+    uint64_t value;         /* absolute or differential value */
+    unsigned size;          /* 2-bits: log2 of transfer size in bytes */
+    bool store;             /* 1-bit: 1 == store, 0 == load */
+    bool has_value;         /* 1-bit: "value" is present */
+    bool diff_address;      /* 1-bit: "address" is differential */
+    bool diff_value;        /* 1-bit: "value" is differential */
+} te_data_t;
+
+
+/*
+ * An inter-instruction cycle count message, reporting the number of
+ * cycles between the previous instruction retirement, and the next.
+ * This mode is not yet fully specified (see "Future directions").
+ */
+typedef struct
+{
+    unsigned cycles;        /* 0 == retired in the same cycle */
+} te_cycles_t;
+
+
 /*
  * The following are external functions DEFINED by this code.
  * See the associated C source file for their semantics.
@@ -217,11 +905,189 @@ extern void te_process_te_support(
     te_decoder_state_t * const decoder,
     const te_support_t * const te_support);
 
+extern void te_process_te_data(
+    te_decoder_state_t * const decoder,
+    const te_data_t * const te_data);
+
+extern void te_attach_data_columns(
+    te_decoder_state_t * const decoder,
+    te_data_columns_t * const columns);
+
+extern void te_flush_data_trace(
+    te_decoder_state_t * const decoder);
+
+extern void te_process_te_cycles(
+    te_decoder_state_t * const decoder,
+    const te_cycles_t * const te_cycles);
+
+extern te_cycle_profile_t * te_open_cycle_profile(
+    te_cycle_profile_t * profile,
+    const te_address_t base,
+    const size_t size);
+
+extern void te_close_cycle_profile(
+    te_cycle_profile_t * const profile);
+
+extern void te_attach_cycle_profile(
+    te_decoder_state_t * const decoder,
+    te_cycle_profile_t * const profile);
+
+extern void te_print_cycle_profile(
+    const te_cycle_profile_t * const profile);
+
+extern te_exec_profile_t * te_open_exec_profile(
+    te_exec_profile_t * profile,
+    const te_address_t base,
+    const size_t size);
+
+extern void te_close_exec_profile(
+    te_exec_profile_t * const profile);
+
+extern void te_attach_exec_profile(
+    te_decoder_state_t * const decoder,
+    te_exec_profile_t * const profile);
+
+extern void te_merge_exec_profile(
+    te_exec_profile_t * const profile,
+    const te_exec_profile_t * const other);
+
+extern const uint64_t * te_expand_exec_profile(
+    te_exec_profile_t * const profile,
+    const te_decoder_state_t * const decoder);
+
+extern void te_print_exec_profile(
+    te_exec_profile_t * const profile,
+    const te_decoder_state_t * const decoder);
+
+extern te_coverage_t * te_open_coverage(
+    te_coverage_t * coverage,
+    const te_address_t base,
+    const size_t size);
+
+extern void te_close_coverage(
+    te_coverage_t * const coverage);
+
+extern void te_attach_coverage(
+    te_decoder_state_t * const decoder,
+    te_coverage_t * const coverage);
+
+extern void te_merge_coverage(
+    te_coverage_t * const coverage,
+    const te_coverage_t * const other);
+
+extern int te_write_coverage(
+    const te_coverage_t * const coverage,
+    FILE * const file);
+
+extern int te_read_coverage(
+    te_coverage_t * const coverage,
+    FILE * const file);
+
+extern te_shared_cache_t * te_open_shared_cache(
+    te_shared_cache_t * cache,
+    const unsigned bits);
+
+extern void te_close_shared_cache(
+    te_shared_cache_t * const cache);
+
+extern void te_attach_shared_cache(
+    te_decoder_state_t * const decoder,
+    te_shared_cache_t * const cache,
+    const uint32_t address_space);
+
+extern te_context_map_t * te_open_context_map(
+    te_context_map_t * map);
+
+extern void te_close_context_map(
+    te_context_map_t * const map);
+
+extern te_context_t * te_add_context(
+    te_context_map_t * const map,
+    const uint64_t context,
+    const uint32_t address_space);
+
+extern void te_add_image_map(
+    te_context_t * const context,
+    const te_address_t base,
+    const size_t size,
+    const uint8_t * const code,
+    const uint32_t address_space);
+
+extern void te_attach_context_map(
+    te_decoder_state_t * const decoder,
+    const te_context_map_t * const map);
+
+extern void te_set_context(
+    te_decoder_state_t * const decoder,
+    const uint64_t context);
+
+extern te_edge_profile_t * te_open_edge_profile(
+    te_edge_profile_t * profile,
+    const unsigned table_bits);
+
+extern void te_close_edge_profile(
+    te_edge_profile_t * const profile);
+
+extern void te_attach_edge_profile(
+    te_decoder_state_t * const decoder,
+    te_edge_profile_t * const profile);
+
+extern void te_merge_edge_profile(
+    te_edge_profile_t * const profile,
+    const te_edge_profile_t * const other);
+
+extern void te_write_branch_profile(
+    const te_edge_profile_t * const profile,
+    FILE * const file);
+
+extern void te_write_edge_profile(
+    const te_edge_profile_t * const profile,
+    FILE * const file,
+    const te_decoder_state_t * const decoder);
+
+extern void te_set_error_handler(
+    te_decoder_state_t * const decoder,
+    const te_error_handler_t error_handler);
+
+extern void te_process_gap(
+    te_decoder_state_t * const decoder);
+
+extern void te_set_gap_handler(
+    te_decoder_state_t * const decoder,
+    const te_gap_handler_t gap_handler);
+
 extern te_decoder_state_t * te_open_trace_decoder(
     te_decoder_state_t * decoder,
+    const te_decoder_callbacks_t * const callbacks,
     void * const user_data,
     const rv_isa isa);
 
+extern void te_close_trace_decoder(
+    te_decoder_state_t * const decoder);
+
+extern void te_set_decoded_cache_bits(
+    te_decoder_state_t * const decoder,
+    const unsigned bits);
+
+extern void te_set_return_stack_size(
+    te_decoder_state_t * const decoder,
+    const size_t size);
+
+extern size_t te_get_decoder_footprint(
+    const te_decoder_state_t * const decoder);
+
+extern unsigned te_decoder_get_instruction(
+    const te_decoder_state_t * const decoder,
+    const te_address_t address,
+    rv_inst * const instruction);
+
+#if !defined(TE_NO_DEFAULT_CALLBACKS)
+extern const te_decoder_callbacks_t te_default_decoder_callbacks;
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+
+extern te_transfer_t te_classify_transfer(
+    const te_decoded_instruction_t * const instr);
+
 extern void te_print_decoded_cache_statistics(
     const te_decoder_state_t * const decoder);
 
@@ -238,7 +1104,10 @@ extern void te_print_decoded_cache_statistics(
  *
  * Users of this code are expected to implement each of
  * these functions as appropriate, as they will be called
- * by the trace-decoder algorithm from time to time.
+ * by the trace-decoder algorithm from time to time, for
+ * each instance opened with the default callbacks (i.e.
+ * te_default_decoder_callbacks). te_log_printf() is also
+ * used by the trace-encoder.
  *
  * Some of these functions are passed a "user_data" void pointer,
  * which is whatever was passed to te_open_trace_decoder().
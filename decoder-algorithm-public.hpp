@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_ALGORITHM_PUBLIC_HPP
+#define TE_DECODER_ALGORITHM_PUBLIC_HPP
+
+
+/*
+ * A header-only C++17 front-end to the trace-decoder (see
+ * decoder-algorithm-public.h), for users whose trace-encoder modes are
+ * fixed for each deployment, and whose callbacks are a "sink" class.
+ *
+ * te::TraceDecoder<Config, Sink> owns one trace-decoder instance.
+ *
+ * "Config" is a class of constexpr members giving the modes (as in
+ * te::DefaultConfig), which may differ from those the C code is compiled
+ * for (see TE_FULL_ADDRESS, etc.). The core of the trace-decoder (see
+ * decoder-algorithm-core.h) is compiled again here, as the static member
+ * functions of te::detail::Core<Config, Sink>, so that the paths for the
+ * other modes (and for DEBUG, and the other XLEN) compile away.
+ *
+ * "Sink" must have the member functions:
+ *
+ *  unsigned get_instruction(te_address_t address, rv_inst & instruction);
+ *  void advance(te_address_t old_pc, te_address_t new_pc,
+ *               const te_decoded_instruction_t & instruction);
+ *
+ * with the semantics of te_get_instruction() and te_advance_decoded_pc(),
+ * and it may also have (else all diagnostics are discarded):
+ *
+ *  void log(const char * format, va_list args);
+ *
+ * The core calls these directly, so they may be inlined into it. The
+ * rest of the trace-decoder (e.g. te_process_te_data) is the C code, which
+ * calls them through the per-instance callbacks (see te_decoder_callbacks_t),
+ * each via a trampoline into which the sink's function is inlined.
+ *
+ * So decoder-algorithm-public.c must still be linked. Unless it is compiled
+ * with -DTE_NO_DEFAULT_CALLBACKS, its te_default_decoder_callbacks refer to
+ * the legacy external functions te_get_instruction(), te_advance_decoded_pc()
+ * and te_log_printf(), which the program must then define, even though they
+ * are never called. See decoder-template-check.cpp for a complete example
+ * (built by "make benchmark").
+ */
+#include <cassert>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+extern "C"
+{
+#include "riscv-disas.h"    /* the core calls disasm_inst_adv() */
+}
+#include "decoder-algorithm-public.h"
+
+
+namespace te
+{
+
+
+/*
+ * The modes the trace-decoder is compiled for, by default.
+ */
+struct DefaultConfig
+{
+    static constexpr rv_isa isa = rv64;
+    static constexpr bool debug = false;
+    static constexpr bool full_address = (0 != TE_FULL_ADDRESS);
+    static constexpr bool implicit_return = (0 != TE_IMPLICIT_RETURN);
+    static constexpr unsigned iaddress_lsb = TE_IADDRESS_LSB;
+    static constexpr unsigned call_counter_width = TE_CALL_COUNTER_WIDTH;
+    static constexpr unsigned decoded_cache_bits = TE_DECODED_CACHE_BITS;
+};
+
+
+namespace detail
+{
+    /* does "Sink" have a log(format, args) member function ? */
+    template <class Sink, class = void>
+    struct has_log : std::false_type {};
+
+    template <class Sink>
+    struct has_log<Sink, std::void_t<decltype(std::declval<Sink &>().log(
+        std::declval<const char *>(), std::declval<va_list &>()))>> : std::true_type {};
+
+
+    /*
+     * The core of the trace-decoder, specialized for the modes in "Config",
+     * calling the member functions of "Sink" directly. The trampolines are
+     * also used as the callbacks of the C code.
+     */
+    template <class Config, class Sink>
+    struct Core
+    {
+        static unsigned get_instruction(
+            void * const user_data,
+            const te_address_t address,
+            rv_inst * const instruction)
+        {
+            return static_cast<Sink *>(user_data)->get_instruction(address, *instruction);
+        }
+
+        static void advance_decoded_pc(
+            void * const user_data,
+            const te_address_t old_pc,
+            const te_address_t new_pc,
+            const te_decoded_instruction_t * const new_instruction)
+        {
+            static_cast<Sink *>(user_data)->advance(old_pc, new_pc, *new_instruction);
+        }
+
+        static void log(
+            void * const user_data,
+            const char * const format,
+            va_list args)
+        {
+            if constexpr (has_log<Sink>::value)
+            {
+                static_cast<Sink *>(user_data)->log(format, args);
+            }
+            else
+            {
+                (void)user_data;
+                (void)format;
+                (void)args;
+            }
+        }
+
+#define TE_CORE_DEBUG                   (Config::debug)
+#define TE_CORE_FULL_ADDRESS            (Config::full_address)
+#define TE_CORE_IMPLICIT_RETURN         (Config::implicit_return)
+#define TE_CORE_IADDRESS_LSB            (Config::iaddress_lsb)
+#define TE_CORE_ISA(decoder)            (Config::isa)
+#define TE_CORE_GET_INSTRUCTION(decoder, address, instruction) \
+    get_instruction((decoder)->user_data, (address), (instruction))
+#define TE_CORE_ADVANCE_DECODED_PC(decoder, old_pc, new_pc, instruction) \
+    advance_decoded_pc((decoder)->user_data, (old_pc), (new_pc), (instruction))
+#define TE_CORE_HAS_LOG(decoder)        (has_log<Sink>::value)
+#define TE_CORE_LOG(decoder, format, args) \
+    log((decoder)->user_data, (format), (args))
+
+#include "decoder-algorithm-core.h"
+
+#undef TE_CORE_DEBUG
+#undef TE_CORE_FULL_ADDRESS
+#undef TE_CORE_IMPLICIT_RETURN
+#undef TE_CORE_IADDRESS_LSB
+#undef TE_CORE_ISA
+#undef TE_CORE_GET_INSTRUCTION
+#undef TE_CORE_ADVANCE_DECODED_PC
+#undef TE_CORE_HAS_LOG
+#undef TE_CORE_LOG
+#undef MSB
+#undef SENTINEL_BAD_ADDRESS
+#undef SHARED_EMPTY
+#undef SHARED_FILLING
+#undef SHARED_READY
+    };
+}   /* namespace detail */
+
+
+template <class Config, class Sink>
+class TraceDecoder
+{
+    static_assert( (!Config::implicit_return) ||
+                   ((1u << (Config::call_counter_width + 2)) <= TE_MAX_CALL_DEPTH),
+        "TE_MAX_CALL_DEPTH is too small for Config::call_counter_width");
+
+    using core = detail::Core<Config, Sink>;
+
+public:
+    using config_type = Config;
+    using sink_type = Sink;
+
+    /*
+     * Open a trace-decoder, calling "sink", which must outlive it.
+     */
+    explicit TraceDecoder(
+        Sink & sink)
+        : sink_(sink),
+          decoder_(te_open_trace_decoder(nullptr, &callbacks, &sink, Config::isa))
+    {
+        if (!decoder_)
+        {
+            throw std::bad_alloc();
+        }
+        if (Config::decoded_cache_bits != TE_DECODED_CACHE_BITS)
+        {
+            te_set_decoded_cache_bits(decoder_.get(), Config::decoded_cache_bits);
+        }
+        te_set_return_stack_size(decoder_.get(), Config::implicit_return ?
+            std::size_t(1) << (Config::call_counter_width + 2) : 0);
+    }
+
+    TraceDecoder(const TraceDecoder &) = delete;
+    TraceDecoder & operator=(const TraceDecoder &) = delete;
+
+    /* as te_process_te_inst() */
+    void process(
+        const te_inst_t & te_inst)
+    {
+        core::process_te_inst(decoder_.get(), &te_inst);
+    }
+
+    /* as te_process_te_support() */
+    void process(
+        const te_support_t & te_support)
+    {
+        core::process_te_support(decoder_.get(), &te_support);
+    }
+
+    /* as te_process_te_data() */
+    void process(
+        const te_data_t & te_data)
+    {
+        te_process_te_data(decoder_.get(), &te_data);
+    }
+
+    /* as te_process_te_cycles() */
+    void process(
+        const te_cycles_t & te_cycles)
+    {
+        te_process_te_cycles(decoder_.get(), &te_cycles);
+    }
+
+    /* as te_process_gap() */
+    void process_gap()
+    {
+        te_process_gap(decoder_.get());
+    }
+
+    /* as te_set_error_handler() and te_set_gap_handler(), with "sink" */
+    void set_error_handler(
+        const te_error_handler_t error_handler)
+    {
+        te_set_error_handler(decoder_.get(), error_handler);
+    }
+
+    void set_gap_handler(
+        const te_gap_handler_t gap_handler)
+    {
+        te_set_gap_handler(decoder_.get(), gap_handler);
+    }
+
+    /* as te_attach_exec_profile(), etc. (NULL to detach) */
+    void attach(
+        te_exec_profile_t * const profile)
+    {
+        te_attach_exec_profile(decoder_.get(), profile);
+    }
+
+    void attach(
+        te_edge_profile_t * const profile)
+    {
+        te_attach_edge_profile(decoder_.get(), profile);
+    }
+
+    void attach(
+        te_coverage_t * const coverage)
+    {
+        te_attach_coverage(decoder_.get(), coverage);
+    }
+
+    void attach(
+        te_cycle_profile_t * const profile)
+    {
+        te_attach_cycle_profile(decoder_.get(), profile);
+    }
+
+    /* the state of the trace-decoder, e.g. for its statistics */
+    te_decoder_state_t & state() noexcept
+    {
+        return *decoder_;
+    }
+
+    const te_decoder_state_t & state() const noexcept
+    {
+        return *decoder_;
+    }
+
+    Sink & sink() noexcept
+    {
+        return sink_;
+    }
+
+private:
+    struct free_decoder
+    {
+        void operator()(te_decoder_state_t * const decoder) const noexcept
+        {
+            te_close_trace_decoder(decoder);
+            std::free(decoder);
+        }
+    };
+
+    static constexpr te_decoder_callbacks_t callbacks =
+    {
+        &core::get_instruction,
+        &core::advance_decoded_pc,
+        detail::has_log<Sink>::value ? &core::log : nullptr,
+    };
+
+    Sink & sink_;
+    std::unique_ptr<te_decoder_state_t, free_decoder> decoder_;
+};
+
+
+}   /* namespace te */
+
+
+#endif  /* TE_DECODER_ALGORITHM_PUBLIC_HPP */
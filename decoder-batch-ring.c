@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decoder-batch-ring.h"
+
+
+/*
+ * Initialize a new ring, of "num_batches" batches (each of "batch_size"
+ * bytes) at "batches", all allocated by the caller, and at least one.
+ * The first batch is the one the producer fills first (so it is not
+ * added to the ring), and the others are all empty.
+ * If "ring" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ */
+extern te_batch_ring_t * te_open_batch_ring(
+    te_batch_ring_t * ring,
+    void * const batches,
+    const size_t batch_size,
+    const size_t num_batches)
+{
+    size_t i;
+
+    assert(batches);
+    assert(num_batches);
+
+    if (ring)
+    {
+        memset(ring, 0, sizeof(te_batch_ring_t));
+    }
+    else
+    {
+        ring = calloc(1, sizeof(te_batch_ring_t));
+        assert(ring);
+    }
+
+    ring->full = calloc(2u * num_batches, sizeof(void *));
+    assert(ring->full);
+    ring->empty = ring->full + num_batches;
+    ring->num_slots = num_batches;
+
+    for (i = 1; i < num_batches; i++)
+    {
+        ring->empty[ring->num_empty++] = (char *)batches + i * batch_size;
+    }
+
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->changed, NULL);
+
+    return ring;
+}
+
+
+/*
+ * Called by the consumer to take the next full batch, first returning
+ * the one it has "consumed" (if not NULL) to be re-filled. This waits
+ * (if necessary) for the producer to fill one, and returns NULL if there
+ * are no more (see te_end_batch_ring).
+ */
+extern void * te_next_full_batch(
+    te_batch_ring_t * const ring,
+    void * const consumed)
+{
+    void * batch = NULL;
+
+    assert(ring);
+
+    pthread_mutex_lock(&ring->lock);
+
+    if (consumed)
+    {
+        assert(ring->num_empty < ring->num_slots);
+        ring->empty[ring->num_empty++] = consumed;
+        pthread_cond_broadcast(&ring->changed);
+    }
+
+    while ( (0 == ring->num_full) && (!ring->ended) )
+    {
+        ring->num_stalls++;     /* update statistics */
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+
+    if (ring->num_full)
+    {
+        batch = ring->full[ring->full_head];
+        ring->full_head = (ring->full_head + 1u) % ring->num_slots;
+        ring->num_full--;
+        ring->num_batches++;    /* update statistics */
+    }
+
+    pthread_mutex_unlock(&ring->lock);
+
+    return batch;
+}
+
+
+/*
+ * Called by the producer to hand over the batch it has "filled" (if it
+ * holds any items, i.e. "count" is not 0) to be consumed. Returns the
+ * batch to fill next: if "refill", this waits for an empty one (which
+ * suspends the producer), otherwise there is none (NULL). Once the
+ * consumer has abandoned the ring, "filled" itself is returned, to be
+ * re-used (and its items discarded), so that the producer never waits
+ * forever. The same is true if "filled" holds no items.
+ */
+extern void * te_hand_over_batch(
+    te_batch_ring_t * const ring,
+    void * const filled,
+    const size_t count,
+    const bool refill)
+{
+    void * batch = filled;
+
+    assert(ring);
+    assert(filled);
+
+    pthread_mutex_lock(&ring->lock);
+
+    if ( (!ring->abandoned) && (count) )
+    {
+        const size_t tail = (ring->full_head + ring->num_full) % ring->num_slots;
+        assert(ring->num_full < ring->num_slots);
+        ring->full[tail] = filled;
+        ring->num_full++;
+        pthread_cond_broadcast(&ring->changed);
+
+        while ( (refill) && (0 == ring->num_empty) && (!ring->abandoned) )
+        {
+            ring->num_suspends++;   /* update statistics */
+            pthread_cond_wait(&ring->changed, &ring->lock);
+        }
+        if (!refill)
+        {
+            batch = NULL;
+        }
+        else if (!ring->abandoned)
+        {
+            batch = ring->empty[--ring->num_empty];
+        }
+    }
+
+    pthread_mutex_unlock(&ring->lock);
+
+    return batch;
+}
+
+
+/*
+ * Called by the producer to indicate that no more batches will be filled,
+ * after handing over the last one.
+ */
+extern void te_end_batch_ring(
+    te_batch_ring_t * const ring)
+{
+    assert(ring);
+
+    pthread_mutex_lock(&ring->lock);
+    ring->ended = true;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+
+/*
+ * Called by the consumer to indicate that no more batches will be
+ * consumed, releasing the producer, should it be waiting.
+ */
+extern void te_abandon_batch_ring(
+    te_batch_ring_t * const ring)
+{
+    assert(ring);
+
+    pthread_mutex_lock(&ring->lock);
+    __atomic_store_n(&ring->abandoned, true, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+
+/*
+ * Return true if the consumer has abandoned the ring, in which case the
+ * producer may as well stop. This is cheap enough to call for each item.
+ */
+extern bool te_batch_ring_abandoned(
+    te_batch_ring_t * const ring)
+{
+    assert(ring);
+
+    return __atomic_load_n(&ring->abandoned, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Release everything allocated by te_open_batch_ring() (but not the
+ * batches themselves). Neither side may use the ring thereafter.
+ */
+extern void te_close_batch_ring(
+    te_batch_ring_t * const ring)
+{
+    assert(ring);
+
+    pthread_cond_destroy(&ring->changed);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring->full);
+    ring->full = ring->empty = NULL;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_BATCH_RING_H
+#define TE_DECODER_BATCH_RING_H
+
+
+/*
+ * A small ring of batches, for handing a stream of items over from one
+ * producer thread to one consumer thread, a batch at a time. So the two
+ * threads only synchronize once per batch, rather than once per item.
+ *
+ * The batches themselves (of any type) are allocated by the user, and
+ * the ring just passes pointers to them around: full batches in a FIFO
+ * to the consumer, and empty ones back on a stack to the producer. At
+ * most one batch is being filled, and one being consumed, at a time. The
+ * producer waits (i.e. is suspended) if there is no empty batch to fill,
+ * so it cannot run more than the ring's capacity ahead of the consumer.
+ * Either side may stop early: once the consumer has abandoned the ring,
+ * the producer's batches are discarded, rather than it waiting forever.
+ *
+ * This is used by both the verifier (see decoder-verifier.h) and the
+ * pull-based trace-decoder (see decoder-pull.h).
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * The state of one ring of batches.
+ */
+typedef struct
+{
+    void ** full;           /* FIFO of batches to be consumed */
+    void ** empty;          /* stack of batches to be filled */
+    size_t num_slots;       /* capacity of full[] and empty[] */
+    size_t full_head;
+    size_t num_full;
+    size_t num_empty;
+    bool ended;             /* no more batches will be filled */
+    bool abandoned;         /* no more batches will be consumed */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    /* maintain a few statistics */
+    unsigned long num_batches;      /* batches handed over */
+    unsigned long num_stalls;       /* times the consumer waited */
+    unsigned long num_suspends;     /* times the producer waited */
+} te_batch_ring_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_batch_ring_t * te_open_batch_ring(
+    te_batch_ring_t * ring,
+    void * const batches,
+    const size_t batch_size,
+    const size_t num_batches);
+
+extern void * te_next_full_batch(
+    te_batch_ring_t * const ring,
+    void * const consumed);
+
+extern void * te_hand_over_batch(
+    te_batch_ring_t * const ring,
+    void * const filled,
+    const size_t count,
+    const bool refill);
+
+extern void te_end_batch_ring(
+    te_batch_ring_t * const ring);
+
+extern void te_abandon_batch_ring(
+    te_batch_ring_t * const ring);
+
+extern bool te_batch_ring_abandoned(
+    te_batch_ring_t * const ring);
+
+extern void te_close_batch_ring(
+    te_batch_ring_t * const ring);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_DECODER_BATCH_RING_H */
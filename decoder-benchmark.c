@@ -0,0 +1,2440 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * A throughput benchmark for te_process_te_inst().
+ *
+ * A synthetic program, and the te_inst messages for its execution, are first
+ * generated in memory (see trace-generator.c), and then decoded (repeatedly)
+ * by the trace-decoder, whilst being timed. Only the time spent in the
+ * trace-decoder (including the user's callbacks below, which are kept as
+ * cheap as possible) is measured, and not opening it. The growth of the
+ * resident set across each decode is also measured, rather than the peak of
+ * the whole process (which holds the generated trace). The execution is also
+ * re-encoded (repeatedly) by the reference trace-encoder, and timed
+ * separately, to give the end-to-end throughput. The results are written to
+ * stdout as a single JSON object, so they may easily be compared across
+ * changes to the trace-decoder. With "--verify", the trace is decoded once
+ * more, checking every PC against the executed path (see
+ * decoder-verifier.h), which is replayed on another thread. With
+ * "--profile", it is decoded once more, counting the executions of every PC
+ * (see te_open_exec_profile()), and the total is checked against the number
+ * executed. With "--edges=FILE", it is decoded once more, writing the exact
+ * branch profile to FILE (in the AutoFDO text format, see
+ * te_write_edge_profile()), and/or with "--branches=FILE", the taken and
+ * not-taken counts of each branch (see te_write_branch_profile()), which
+ * must add up to the branches executed (bar a final one). With "--calls", it is decoded once more,
+ * building a call-tree profile (see decoder-call-profile.h), which may also
+ * be written in pprof and/or callgrind format (the latter with the per-PC
+ * counts too, with "--profile"), see decoder-profile-export.h. With
+ * "--fast-profile" (and so "--calls"), the same execution is also traced
+ * as just its calls and returns, which are decoded by the fast profiling
+ * decoder (see decoder-fast-profile.h), and the call-graph that it builds
+ * is checked against the call-tree profile. With
+ * "--coverage=FILE", it is decoded once more, writing the coverage bitmaps
+ * to FILE (see te_write_coverage()). With "--single-pass", all of these
+ * analyses are fed from just one more decode (see decoder-fanout.h), with
+ * the call-tree profile built on another thread. With "--pull=N", it is
+ * decoded once more on another thread, from which the first N PCs (or all of
+ * them, if N is 0) are pulled (see decoder-pull.h). With "--harts=N", N more
+ * programs are generated (with successive seeds), as if executed by N harts,
+ * and their traces are decoded together by a merge (see decoder-merge.h),
+ * with each message given a 16-bit timestamp, which wraps. The merged blocks
+ * are checked to be in time order, and to include every instruction executed
+ * by every hart. With "--workers=W" (and "--harts"), the traces of the harts
+ * are also decoded by a scheduler with W worker threads (see
+ * decoder-scheduler.h), and the PCs decoded for each hart are checked
+ * against those from decoding its trace directly. With "--data=F" (a fraction
+ * of the instructions are loads or stores) and/or "--cycles", the trace
+ * also has te_data and/or te_cycles messages, and it is decoded once more,
+ * checking that each transfer is correlated with the PC of its load or
+ * store, with the right address and value, and that the cycles attributed
+ * to each PC are exactly those of its retirements. With "--gaps=N" or
+ * "--corrupt=N", it is decoded once more, with the trace lost or corrupted
+ * at N points, checking that the trace-decoder resyncs after each one, and
+ * that it reconstructs exactly the same PCs as before, from each resync to
+ * the next point. For example, to build and run it:
+ *
+ *  cc -O2 -pthread -I<riscv-disassembler> -o decoder-benchmark \
+ *      decoder-benchmark.c trace-generator.c encoder-algorithm-public.c \
+ *      decoder-algorithm-public.c decoder-verifier.c decoder-batch-ring.c \
+ *      decoder-call-profile.c decoder-profile-export.c elf-image.c \
+ *      decoder-fanout.c decoder-pull.c decoder-merge.c decoder-scheduler.c \
+ *      decoder-fast-profile.c <riscv-disassembler>/riscv-disas.c
+ *
+ * (or "make benchmark RISCV_DISASM=<riscv-disassembler>", which also builds
+ * commit-log-encode and encoder-sweep)
+ *
+ *  ./decoder-benchmark --instructions=100000000 --branch-density=0.7
+ *
+ * Run with "--help" for the list of control-flow model parameters.
+ */
+#include <assert.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "decoder-algorithm-public.h"
+#include "decoder-verifier.h"
+#include "decoder-profile-export.h"
+#include "decoder-fanout.h"
+#include "decoder-pull.h"
+#include "decoder-merge.h"
+#include "decoder-scheduler.h"
+#include "decoder-fast-profile.h"
+#include "trace-generator.h"
+
+
+/*
+ * The most that the time advances between consecutive messages of one
+ * hart (with "--harts"), which must be less than a wrap of the timestamps.
+ */
+#define HART_MAX_TIME_STEP  (0x3fffu)
+
+
+/*
+ * The data transfers and cycle counts that the trace-decoder should
+ * attribute to each PC (with "--data" and/or "--cycles"), as replayed by
+ * the generator, and the results of checking what it actually did.
+ */
+typedef struct
+{
+    te_data_columns_t columns;      /* written by the trace-decoder */
+    te_address_t * expected_pc;     /* of each transfer, in order */
+    te_data_transfer_t * expected;
+    size_t num_expected;
+    size_t num_rows;                /* rows checked so far */
+    unsigned long num_mismatches;   /* rows not as expected */
+
+    te_cycle_profile_t profile;     /* accumulated by the trace-decoder */
+    uint64_t * expected_cycles;     /* for each slot of the profile */
+    uint64_t num_counted;           /* retirements in its histogram */
+    size_t cycle_mismatches;        /* slots not as expected */
+} data_check_t;
+
+
+/*
+ * The state of decoding a trace that is impaired at a number of points
+ * (with "--gaps" or "--corrupt"), each of which is followed by a resync.
+ * From each resync to the next impairment, the trace-decoder should
+ * reconstruct exactly the PCs that it does without any impairments.
+ */
+typedef struct
+{
+    const te_generator_t * generator;
+    unsigned num_points;            /* impairments requested */
+    bool corrupt;                   /* corrupt a te_inst, else lose messages */
+    te_address_t * golden;          /* every PC executed, in order */
+    unsigned long * counts;         /* PCs decoded after each message, unimpaired */
+    unsigned long next;             /* index in golden[] of the PC expected next */
+    bool checking;                  /* false from corruption to resync */
+    unsigned inserted;              /* impairments actually made */
+    unsigned long num_checked;      /* PCs decoded, and checked */
+    unsigned long num_unchecked;    /* PCs decoded after corruption */
+    unsigned long num_mismatches;   /* PCs not as expected */
+    unsigned long num_errors;       /* reported to the error handler */
+    unsigned long num_gaps;         /* statistics of the trace-decoder */
+    unsigned long num_lost_windows;
+    unsigned long num_discarded;
+    double elapsed;
+} impairment_t;
+
+
+/*
+ * The "user-data" passed to te_open_trace_decoder().
+ */
+typedef struct
+{
+    const te_generator_t * generator;
+    unsigned long num_advances;     /* calls to te_advance_decoded_pc() */
+    te_address_t checksum;          /* of all the PCs decoded */
+    te_verifier_t * verifier;       /* NULL == not verifying */
+    te_exec_profile_t * profile;    /* NULL == not profiling */
+    te_edge_profile_t * edges;      /* NULL == not profiling edges */
+    te_call_profile_t * calls;      /* NULL == not profiling calls */
+    te_coverage_t * coverage;       /* NULL == not recording coverage */
+    te_fanout_t * fanout;           /* NULL == not a single pass */
+    data_check_t * data;            /* NULL == not checking data */
+} benchmark_t;
+
+
+/*
+ * The trace of one hart (with "--harts"), and its next message to be fed
+ * to the merge. The time of each message advances by a pseudo-random step
+ * (of at most HART_MAX_TIME_STEP), so that the harts interleave.
+ */
+typedef struct
+{
+    te_generator_t * generator;
+    size_t next;                    /* index of the next message */
+    uint64_t time;                  /* of the last message, not wrapped */
+    uint64_t random;                /* xorshift state, never 0 */
+    unsigned long merged;           /* instructions in its merged blocks */
+
+    /* with "--workers", the PCs decoded (directly, then scheduled) */
+    unsigned long num_advances;
+    te_address_t checksum;
+    unsigned long direct_advances;
+    te_address_t direct_checksum;
+} hart_t;
+
+
+/*
+ * The results of the timed decodes. These are taken from the trace-decoder
+ * straight after the timed loop, before any analysis re-opens it.
+ */
+typedef struct
+{
+    double elapsed;                 /* seconds, decoding only */
+    unsigned long decoded;          /* PCs disseminated, per decode */
+    unsigned long instruction_count;
+    unsigned long num_lost_windows;
+    unsigned long num_gets;         /* get_instr() statistics, per decode */
+    unsigned long num_same;
+    unsigned long num_hits;
+    size_t decoder_bytes;           /* see te_get_decoder_footprint() */
+    long rss_kb;                    /* most the RSS grew over one decode */
+} measurement_t;
+
+
+/*
+ * The (optional) analyses, each of which decodes the trace once more
+ * (or all together in one more decode, with "--single-pass").
+ */
+typedef struct
+{
+    bool single_pass;
+    te_fanout_t fanout;
+    double single_pass_elapsed;
+    unsigned long single_pass_stalls;
+
+    bool verify;
+    bool verified;
+    te_verifier_t verifier;
+    double verify_elapsed;
+
+    bool profile;
+    te_exec_profile_t exec_profile;
+    uint64_t profiled;
+    size_t profiled_pcs;
+    double profile_elapsed;
+
+    bool edges;
+    const char * edges_file;
+    FILE * edges_out;
+    const char * branches_file;
+    FILE * branches_out;
+    uint64_t branches_counted;      /* taken or not, over all branches */
+    te_edge_profile_t edge_profile;
+    double edges_elapsed;
+
+    bool calls;
+    const char * pprof_file;
+    const char * callgrind_file;
+    te_call_profile_t * call_profile;
+    uint64_t call_roots;
+    double calls_elapsed;
+
+    bool fast_profile;
+    te_fast_profile_state_t fast_state;
+    uint64_t fast_calls;            /* over all the call-graph edges */
+    unsigned long fast_mismatches;  /* edges not as in the call-tree */
+    double fast_elapsed;
+
+    const char * coverage_file;
+    FILE * coverage_out;
+    te_coverage_t coverage;
+    size_t covered_slots;
+    double coverage_elapsed;
+
+    bool pull;
+    unsigned long pull_limit;       /* 0 == pull all */
+    unsigned long pulled;
+    te_pull_t pull_state;
+    double pull_elapsed;
+
+    bool data;
+    bool cycles;
+    data_check_t data_check;
+    unsigned long num_transfers;    /* statistics of the trace-decoder */
+    unsigned long num_unmatched;
+    unsigned long data_dropped;
+    unsigned long cycles_dropped;
+    double data_elapsed;
+
+    impairment_t gaps;
+    impairment_t corruption;
+
+    unsigned num_harts;             /* 0 == no merge */
+    hart_t * harts;
+    unsigned long hart_instructions;    /* executed by all the harts */
+    unsigned long merged;           /* instructions in the merged blocks */
+    unsigned long merged_blocks;
+    unsigned long num_wraps;        /* of the timestamps, over all harts */
+    size_t max_queued;              /* most blocks held by any source */
+    bool ordered;                   /* timestamps never decreased */
+    bool extended;                  /* the final timestamps were exact */
+    double merge_elapsed;
+
+    unsigned num_workers;           /* 0 == no scheduler */
+    unsigned long scheduled_packets;
+    unsigned long num_migrations;   /* of tasks, over all harts */
+    unsigned long num_steals;       /* by workers */
+    size_t max_backlog;             /* most packets queued for any hart */
+    uint64_t mean_latency;          /* ns, over all packets */
+    uint64_t max_latency;           /* ns */
+    unsigned matched_harts;         /* decoded as when decoded directly */
+    double sched_elapsed;
+} analyses_t;
+
+
+/*
+ * Print some trace-decoding diagnostics (to stderr, so that
+ * they never corrupt the JSON written to stdout).
+ */
+extern void te_log_printf(
+    const char * const format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+
+/*
+ * Retrieve an instruction from the generated code image.
+ */
+extern unsigned te_get_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const benchmark_t * const benchmark = user_data;
+
+    assert(benchmark);
+
+    return te_generator_get_instruction(benchmark->generator, address, instruction);
+}
+
+
+/*
+ * Notification that the PC has been updated. Just accumulate a
+ * checksum, so that the compiler can not optimize any work away.
+ */
+extern void te_advance_decoded_pc(
+    void * const user_data,
+    const te_address_t old_pc,
+    const te_address_t new_pc,
+    const te_decoded_instruction_t * const new_instruction)
+{
+    benchmark_t * const benchmark = user_data;
+
+    assert(benchmark);
+    (void)old_pc;
+    (void)new_instruction;
+
+    benchmark->num_advances++;
+    benchmark->checksum = (benchmark->checksum << 1 | benchmark->checksum >> 63) ^ new_pc;
+
+    if (benchmark->verifier)
+    {
+        te_verify_decoded_pc(benchmark->verifier, new_pc);
+    }
+    if (benchmark->calls)
+    {
+        te_call_profile_advance(benchmark->calls, new_pc, new_instruction);
+    }
+}
+
+
+/*
+ * Report the first divergence (to stderr, so as not to corrupt the JSON).
+ */
+static void report_divergence(
+    void * const user_data,
+    const te_divergence_t * const divergence)
+{
+    (void)user_data;
+
+    te_log_printf("DIVERGENCE after %lu instructions, te_inst %lu:"
+        " expected 0x%08lx, decoded 0x%08lx\n",
+        divergence->instruction_count,
+        divergence->te_inst_index,
+        divergence->golden_pc,
+        divergence->decoded_pc);
+}
+
+
+/*
+ * Produce the golden PCs for the verifier, on its own thread.
+ */
+static void push_golden_pc(
+    void * const user_data,
+    const te_address_t pc)
+{
+    te_push_golden_pc(user_data, pc);
+}
+
+static void produce_golden_pcs(
+    te_verifier_t * const verifier,
+    void * const data)
+{
+    te_generator_replay(data, push_golden_pc, verifier);
+}
+
+
+/*
+ * Return the current time, in seconds.
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Return the current resident set size, in KiB (or 0 if it is unknown).
+ * Unlike getrusage()'s ru_maxrss, this is not the high-water mark of the
+ * whole process (which is dominated by the generated trace), so it may be
+ * sampled either side of a decode.
+ */
+static long resident_kb(void)
+{
+    FILE * const file = fopen("/proc/self/statm", "r");
+    long pages = 0;
+
+    if (file)
+    {
+        if (1 != fscanf(file, "%*s %ld", &pages))
+        {
+            pages = 0;
+        }
+        fclose(file);
+    }
+
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+/*
+ * (Re-)open the trace-decoder, ready to decode all the generated messages
+ * once more, with the analyses selected in "benchmark".
+ */
+static void open_decoder(
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark)
+{
+    te_close_trace_decoder(decoder);
+    if (benchmark->fanout)
+    {
+        te_open_trace_decoder(decoder, &te_fanout_callbacks, benchmark->fanout, rv64);
+    }
+    else
+    {
+        te_open_trace_decoder(decoder, NULL, benchmark, rv64);
+    }
+    te_attach_exec_profile(decoder, benchmark->profile);
+    te_attach_edge_profile(decoder, benchmark->edges);
+    te_attach_coverage(decoder, benchmark->coverage);
+}
+
+
+/*
+ * Pass a single generated message to the trace-decoder.
+ */
+static void process_message(
+    te_decoder_state_t * const decoder,
+    const te_message_t * const message)
+{
+    switch (message->type)
+    {
+        case TE_MESSAGE_TE_INST:
+            te_process_te_inst(decoder, &message->te_inst);
+            break;
+        case TE_MESSAGE_TE_SUPPORT:
+            te_process_te_support(decoder, &message->te_support);
+            break;
+        case TE_MESSAGE_TE_DATA:
+            te_process_te_data(decoder, &message->te_data);
+            break;
+        case TE_MESSAGE_TE_CYCLES:
+            te_process_te_cycles(decoder, &message->te_cycles);
+            break;
+    }
+}
+
+
+/*
+ * Decode all the generated messages once, with a freshly opened
+ * trace-decoder (see open_decoder).
+ */
+static void decode_trace(
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark)
+{
+    const te_generator_t * const generator = benchmark->generator;
+    size_t i;
+
+    for (i = 0; i < generator->num_messages; i++)
+    {
+        process_message(decoder, &generator->messages[i]);
+    }
+
+    /* count the final block */
+    te_attach_exec_profile(decoder, NULL);
+    te_attach_edge_profile(decoder, NULL);
+    te_attach_coverage(decoder, NULL);
+}
+
+
+/*
+ * Feed all the generated messages to a pull-based trace-decoder (on its
+ * own thread), unless the consumer stops early.
+ */
+static void feed_pull(
+    te_pull_t * const pull,
+    void * const data)
+{
+    const te_generator_t * const generator = data;
+    size_t i;
+
+    for (i = 0; (i < generator->num_messages) && (!te_pull_abandoned(pull)); i++)
+    {
+        process_message(pull->decoder, &generator->messages[i]);
+    }
+}
+
+
+/*
+ * Retrieve an instruction from the generated code image of a hart.
+ */
+static unsigned hart_get_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const hart_t * const hart = user_data;
+
+    return te_generator_get_instruction(hart->generator, address, instruction);
+}
+
+
+/*
+ * Accumulate a checksum of the PCs decoded for a hart (with "--workers").
+ */
+static void hart_advance_decoded_pc(
+    void * const user_data,
+    const te_address_t old_pc,
+    const te_address_t new_pc,
+    const te_decoded_instruction_t * const new_instruction)
+{
+    hart_t * const hart = user_data;
+
+    (void)old_pc;
+    (void)new_instruction;
+
+    hart->num_advances++;
+    hart->checksum = (hart->checksum << 1 | hart->checksum >> 63) ^ new_pc;
+}
+
+
+/*
+ * Feed the next message of a hart to its trace-decoder, advancing the time
+ * and returning just its least-significant TE_TIMESTAMP_BITS.
+ */
+static bool feed_hart(
+    void * const data,
+    te_decoder_state_t * const decoder,
+    uint64_t * const timestamp)
+{
+    hart_t * const hart = data;
+
+    if (hart->next == hart->generator->num_messages)
+    {
+        return false;
+    }
+    process_message(decoder, &hart->generator->messages[hart->next++]);
+
+    hart->random ^= hart->random << 13;
+    hart->random ^= hart->random >> 7;
+    hart->random ^= hart->random << 17;
+    hart->time += 1u + hart->random % HART_MAX_TIME_STEP;
+    *timestamp = hart->time & ((1ull << TE_TIMESTAMP_BITS) - 1u);
+
+    return true;
+}
+
+
+/*
+ * Encode the generated execution "repeat" times, returning the time taken.
+ */
+static double measure_encode(
+    te_generator_t * const generator,
+    const te_encoder_params_t * const encoder_params,
+    const unsigned repeat)
+{
+    const double start = now();
+    unsigned i;
+
+    for (i = 0; i < repeat; i++)
+    {
+        te_generator_encode(generator, encoder_params);
+    }
+
+    return now() - start;
+}
+
+
+/*
+ * Return true if the te_inst and te_support messages of "a" and "b" are
+ * identical. Their te_data and te_cycles messages are not compared, as
+ * these are interleaved with the others a whole ingress block at a time.
+ */
+static bool same_instruction_trace(
+    const te_message_t * const a,
+    const size_t num_a,
+    const te_message_t * const b,
+    const size_t num_b)
+{
+    size_t i = 0;
+    size_t j = 0;
+
+    for (;;)
+    {
+        while ( (i < num_a) && (a[i].type > TE_MESSAGE_TE_SUPPORT) )
+        {
+            i++;
+        }
+        while ( (j < num_b) && (b[j].type > TE_MESSAGE_TE_SUPPORT) )
+        {
+            j++;
+        }
+        if ( (i == num_a) || (j == num_b) )
+        {
+            return (i == num_a) && (j == num_b);
+        }
+        if (0 != memcmp(&a[i++], &b[j++], sizeof(te_message_t)))
+        {
+            return false;
+        }
+    }
+}
+
+
+/*
+ * Blocks of several instructions must be encoded exactly as if the
+ * instructions had been retired one at a time. So check that they are,
+ * leaving the messages from the single-retirement encoder to be decoded.
+ */
+static bool check_single_retirement(
+    te_generator_t * const generator,
+    const te_encoder_params_t * const encoder_params)
+{
+    const size_t size = generator->num_messages * sizeof(te_message_t);
+    te_message_t * const blocks = malloc(size);
+    const size_t num_blocks = generator->num_messages;
+    te_encoder_params_t single = *encoder_params;
+    bool identical;
+
+    assert(blocks);
+    memcpy(blocks, generator->messages, size);
+    single.retires_p = 1;
+    te_generator_encode(generator, &single);
+    identical = same_instruction_trace(blocks, num_blocks,
+                    generator->messages, generator->num_messages);
+    free(blocks);
+
+    return identical;
+}
+
+
+/*
+ * Decode all the generated messages "repeat" times, timing only the
+ * decoding itself (i.e. not opening the trace-decoder, which allocates
+ * its decoded cache). The statistics of the trace-decoder are taken
+ * straight afterwards, as the analyses will re-open it.
+ */
+static void measure_decode(
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark,
+    const unsigned repeat,
+    measurement_t * const measurement)
+{
+    unsigned i;
+
+    memset(measurement, 0, sizeof(*measurement));
+
+    for (i = 0; i < repeat; i++)
+    {
+        const long rss = resident_kb();
+        double start;
+
+        open_decoder(decoder, benchmark);
+        start = now();
+        decode_trace(decoder, benchmark);
+        measurement->elapsed += now() - start;
+
+        if (resident_kb() - rss > measurement->rss_kb)
+        {
+            measurement->rss_kb = resident_kb() - rss;
+        }
+    }
+
+    /* each decode is identical, so these are per decode */
+    measurement->decoded = benchmark->num_advances / repeat;
+    measurement->instruction_count = decoder->instruction_count;
+    measurement->num_lost_windows = decoder->num_lost_windows;
+    measurement->num_gets = decoder->num_gets;
+    measurement->num_same = decoder->num_same;
+    measurement->num_hits = decoder->num_hits;
+    measurement->decoder_bytes = te_get_decoder_footprint(decoder);
+}
+
+
+/*
+ * Open each of the selected analyses. Returns 0 on success.
+ */
+static int open_analyses(
+    analyses_t * const analyses,
+    const te_generator_t * const generator,
+    te_decoder_state_t * const decoder)
+{
+    if (analyses->verify)
+    {
+        /* in a single pass, divergences are only found a batch later */
+        te_open_verifier(&analyses->verifier,
+            analyses->single_pass ? NULL : decoder, report_divergence, NULL);
+    }
+    if (analyses->profile)
+    {
+        te_open_exec_profile(&analyses->exec_profile,
+            generator->base, 4u * generator->num_code);
+    }
+    if (analyses->edges_file)
+    {
+        analyses->edges_out = fopen(analyses->edges_file, "w");
+        if (!analyses->edges_out)
+        {
+            perror(analyses->edges_file);
+            return -1;
+        }
+    }
+    if (analyses->branches_file)
+    {
+        analyses->branches_out = fopen(analyses->branches_file, "w");
+        if (!analyses->branches_out)
+        {
+            perror(analyses->branches_file);
+            return -1;
+        }
+    }
+    if (analyses->edges)
+    {
+        te_open_edge_profile(&analyses->edge_profile, 0);
+    }
+    if (analyses->calls)
+    {
+        analyses->call_profile = te_open_call_profile(NULL);
+    }
+    if (analyses->coverage_file)
+    {
+        analyses->coverage_out = fopen(analyses->coverage_file, "wb");
+        if (!analyses->coverage_out)
+        {
+            perror(analyses->coverage_file);
+            return -1;
+        }
+        te_open_coverage(&analyses->coverage,
+            generator->base, 4u * generator->num_code);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Start replaying the golden PCs for the verifier (on its own thread,
+ * or up-front if that thread can not be started).
+ */
+static void start_verifier(
+    analyses_t * const analyses,
+    te_generator_t * const generator)
+{
+    if (0 != te_start_golden_thread(&analyses->verifier, produce_golden_pcs, generator))
+    {
+        te_generator_replay(generator, push_golden_pc, &analyses->verifier);
+        te_end_golden_pcs(&analyses->verifier);
+    }
+}
+
+
+/*
+ * Decode once more, feeding every selected analysis from the same pass.
+ * Returns 0 on success.
+ */
+static int run_single_pass(
+    analyses_t * const analyses,
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark)
+{
+    te_generator_t * const generator = (te_generator_t *)benchmark->generator;
+    double start;
+
+    te_open_fanout(&analyses->fanout, NULL, benchmark);
+    if ( ( (analyses->verify) &&
+           (0 != te_add_fanout_analysis(&analyses->fanout,
+                te_fanout_verifier, &analyses->verifier, false)) ) ||
+         ( (analyses->calls) &&
+           (0 != te_add_fanout_analysis(&analyses->fanout,
+                te_fanout_call_profile, analyses->call_profile, true)) ) )
+    {
+        perror("te_add_fanout_analysis");
+        return -1;
+    }
+
+    benchmark->fanout = &analyses->fanout;
+    benchmark->profile = analyses->profile ? &analyses->exec_profile : NULL;
+    benchmark->edges = analyses->edges ? &analyses->edge_profile : NULL;
+    benchmark->coverage = analyses->coverage_file ? &analyses->coverage : NULL;
+    open_decoder(decoder, benchmark);
+
+    start = now();
+    if (analyses->verify)
+    {
+        start_verifier(analyses, generator);
+    }
+    decode_trace(decoder, benchmark);
+    te_finish_fanout(&analyses->fanout);
+    if (analyses->verify)
+    {
+        analyses->verified = te_finish_verifier(&analyses->verifier);
+    }
+    analyses->single_pass_elapsed = now() - start;
+
+    benchmark->fanout = NULL;
+    benchmark->profile = NULL;
+    benchmark->edges = NULL;
+    benchmark->coverage = NULL;
+    analyses->single_pass_stalls = analyses->fanout.num_stalls;
+    te_close_fanout(&analyses->fanout);
+
+    analyses->verify_elapsed = analyses->single_pass_elapsed;
+    analyses->profile_elapsed = analyses->single_pass_elapsed;
+    analyses->edges_elapsed = analyses->single_pass_elapsed;
+    analyses->calls_elapsed = analyses->single_pass_elapsed;
+    analyses->coverage_elapsed = analyses->single_pass_elapsed;
+
+    return 0;
+}
+
+
+/*
+ * Decode once more, checking every PC against the executed path.
+ */
+static void run_verify(
+    analyses_t * const analyses,
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark)
+{
+    double start;
+
+    benchmark->verifier = &analyses->verifier;
+    open_decoder(decoder, benchmark);
+    start = now();
+    start_verifier(analyses, (te_generator_t *)benchmark->generator);
+    decode_trace(decoder, benchmark);
+    analyses->verified = te_finish_verifier(&analyses->verifier);
+    analyses->verify_elapsed = now() - start;
+    benchmark->verifier = NULL;
+}
+
+
+/*
+ * Decode once more, counting the executions of every PC.
+ */
+static void run_profile(
+    analyses_t * const analyses,
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark)
+{
+    double start;
+
+    benchmark->profile = &analyses->exec_profile;
+    open_decoder(decoder, benchmark);
+    start = now();
+    decode_trace(decoder, benchmark);
+    (void)te_expand_exec_profile(&analyses->exec_profile, decoder);
+    analyses->profile_elapsed = now() - start;
+    benchmark->profile = NULL;
+}
+
+
+/*
+ * Decode once more, building the exact branch profile.
+ */
+static void run_edges(
+    analyses_t * const analyses,
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark)
+{
+    double start;
+
+    benchmark->edges = &analyses->edge_profile;
+    open_decoder(decoder, benchmark);
+    start = now();
+    decode_trace(decoder, benchmark);
+    analyses->edges_elapsed = now() - start;
+    benchmark->edges = NULL;
+}
+
+
+/*
+ * Decode once more, building the call-tree profile.
+ */
+static void run_calls(
+    analyses_t * const analyses,
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark)
+{
+    double start;
+
+    benchmark->calls = analyses->call_profile;
+    open_decoder(decoder, benchmark);
+    start = now();
+    decode_trace(decoder, benchmark);
+    analyses->calls_elapsed = now() - start;
+    benchmark->calls = NULL;
+}
+
+
+/*
+ * Decode the fast profiling packets for the same execution (generated,
+ * but not timed, first), building just the call-graph.
+ */
+static void run_fast_profile(
+    analyses_t * const analyses,
+    te_generator_t * const generator)
+{
+    double start;
+    size_t i;
+
+    te_generator_fast_profile(generator);
+    te_open_fast_profile(&analyses->fast_state);
+    start = now();
+    for (i = 0; i < generator->num_fast_packets; i++)
+    {
+        te_process_fast_profile(&analyses->fast_state, &generator->fast_packets[i]);
+    }
+    analyses->fast_elapsed = now() - start;
+}
+
+
+/*
+ * Check the call-graph decoded from the fast profiling packets against
+ * the call-tree profile. Each edge must have been entered as many times
+ * as all the call-tree nodes with that caller and callee put together.
+ * The callers of the roots of the call-tree are not known.
+ */
+static void check_fast_profile(
+    analyses_t * const analyses)
+{
+    const te_call_profile_t * const calls = analyses->call_profile;
+    const te_fast_profile_state_t * const fast = &analyses->fast_state;
+    uint64_t * const expected = calloc(fast->edge_mask + 1u, sizeof(uint64_t));
+    size_t slot;
+
+    assert(expected);
+
+    for (slot = 0; slot < TE_CALL_PROFILE_TABLE_SIZE; slot++)
+    {
+        const te_call_node_t * const node = &calls->nodes[slot];
+        const te_call_node_t * parent;
+        const te_fast_profile_edge_t * edge;
+
+        if ( (0 == node->calls) || (TE_CALL_PROFILE_NO_PARENT == node->parent) )
+        {
+            continue;
+        }
+        parent = &calls->nodes[node->parent];
+        edge = te_find_fast_profile_edge(fast,
+            (TE_CALL_PROFILE_NO_PARENT == parent->parent) ?
+                TE_FAST_PROFILE_ROOT : parent->target,
+            node->target);
+        if (edge)
+        {
+            expected[edge - fast->edges] += node->calls;
+        }
+        else
+        {
+            analyses->fast_mismatches++;
+        }
+    }
+
+    for (slot = 0; slot <= fast->edge_mask; slot++)
+    {
+        if (fast->edges[slot].count)
+        {
+            analyses->fast_calls += fast->edges[slot].count;
+            analyses->fast_mismatches += (fast->edges[slot].count != expected[slot]);
+        }
+    }
+
+    free(expected);
+}
+
+
+/*
+ * Decode once more, recording the coverage bitmaps.
+ */
+static void run_coverage(
+    analyses_t * const analyses,
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark)
+{
+    double start;
+
+    benchmark->coverage = &analyses->coverage;
+    open_decoder(decoder, benchmark);
+    start = now();
+    decode_trace(decoder, benchmark);
+    analyses->coverage_elapsed = now() - start;
+    benchmark->coverage = NULL;
+}
+
+
+/*
+ * Decode once more on another thread, pulling the first "pull_limit" PCs
+ * (or all of them). Returns 0 on success.
+ */
+static int run_pull(
+    analyses_t * const analyses,
+    benchmark_t * const benchmark)
+{
+    /* the pulled records are counted here, so do not count them twice */
+    static const te_decoder_callbacks_t pull_callbacks =
+    {
+        .get_instruction = te_get_instruction,
+    };
+    const unsigned long limit = analyses->pull_limit;
+    const te_fanout_record_t * records;
+    size_t count, j;
+    double start;
+
+    te_open_pull(&analyses->pull_state, &pull_callbacks, benchmark, rv64);
+    start = now();
+    if (0 != te_start_pull(&analyses->pull_state, feed_pull,
+            (void *)benchmark->generator))
+    {
+        perror("pthread_create");
+        return -1;
+    }
+    while ( ( (0 == limit) || (analyses->pulled < limit) ) &&
+            (0 != (count = te_next_batch(&analyses->pull_state, &records))) )
+    {
+        for (j = 0; (j < count) && ( (0 == limit) || (analyses->pulled < limit) ); j++)
+        {
+            analyses->pulled += (0 != records[j].length);
+        }
+    }
+    te_close_pull(&analyses->pull_state);
+    analyses->pull_elapsed = now() - start;
+
+    return 0;
+}
+
+
+/*
+ * Record the data transfer and cycle count expected for each instruction
+ * retired (see te_generator_replay_data()).
+ */
+static void expect_data(
+    void * const user_data,
+    const te_address_t pc,
+    const unsigned cycles,
+    const te_data_t * const transfer)
+{
+    data_check_t * const check = user_data;
+
+    check->expected_cycles[(pc - check->profile.base) >> 1] += cycles;
+    if (transfer)
+    {
+        te_data_transfer_t * const expected = &check->expected[check->num_expected];
+
+        check->expected_pc[check->num_expected++] = pc;
+        expected->address = transfer->address;
+        expected->value = transfer->value;
+        expected->flags = transfer->size |
+            (transfer->store     ? TE_DATA_FLAG_STORE : 0) |
+            (transfer->has_value ? TE_DATA_FLAG_VALUE : 0);
+    }
+}
+
+
+/*
+ * Check the rows of correlated data transfers written by the
+ * trace-decoder, against those expected, in order.
+ */
+static void check_data_rows(
+    void * const user_data,
+    te_data_columns_t * const columns)
+{
+    data_check_t * const check = ((benchmark_t *)user_data)->data;
+    size_t i;
+
+    for (i = 0; i < columns->count; i++, check->num_rows++)
+    {
+        const size_t row = check->num_rows;
+
+        if ( (row >= check->num_expected) ||
+             (columns->pc[i] != check->expected_pc[row]) ||
+             (columns->address[i] != check->expected[row].address) ||
+             (columns->value[i] != check->expected[row].value) ||
+             (columns->flags[i] != check->expected[row].flags) )
+        {
+            check->num_mismatches++;
+        }
+    }
+}
+
+
+/*
+ * Decode once more, with the data-trace and/or cycle count stages, and
+ * check that every transfer is correlated with the PC of its load or store
+ * (with the right address and value), and that every cycle count is
+ * attributed to the PC of the instruction it describes.
+ */
+static void run_data(
+    analyses_t * const analyses,
+    te_decoder_state_t * const decoder,
+    benchmark_t * const benchmark)
+{
+    const te_generator_t * const generator = benchmark->generator;
+    data_check_t * const check = &analyses->data_check;
+    te_data_columns_t * const columns = &check->columns;
+    const size_t capacity = 4096;
+    size_t slot;
+    unsigned bucket;
+    double start;
+
+    te_open_cycle_profile(&check->profile, generator->base, 4u * generator->num_code);
+    check->expected_cycles = calloc(check->profile.num_slots, sizeof(uint64_t));
+    check->expected_pc = calloc(generator->num_te_data + 1u, sizeof(te_address_t));
+    check->expected = calloc(generator->num_te_data + 1u, sizeof(te_data_transfer_t));
+    columns->pc = calloc(capacity, sizeof(te_address_t));
+    columns->address = calloc(capacity, sizeof(te_address_t));
+    columns->value = calloc(capacity, sizeof(uint64_t));
+    columns->flags = calloc(capacity, sizeof(uint8_t));
+    assert(check->expected_cycles);
+    assert( (check->expected_pc) && (check->expected) );
+    assert( (columns->pc) && (columns->address) && (columns->value) && (columns->flags) );
+    columns->capacity = capacity;
+    columns->flush = check_data_rows;
+    te_generator_replay_data(generator, expect_data, check);
+    assert(check->num_expected == generator->num_te_data);
+
+    benchmark->data = check;
+    open_decoder(decoder, benchmark);
+    if (analyses->data)
+    {
+        te_attach_data_columns(decoder, columns);
+    }
+    if (analyses->cycles)
+    {
+        te_attach_cycle_profile(decoder, &check->profile);
+    }
+    start = now();
+    decode_trace(decoder, benchmark);
+    te_flush_data_trace(decoder);
+    analyses->data_elapsed = now() - start;
+    benchmark->data = NULL;
+
+    analyses->num_transfers = decoder->data.num_transfers;
+    analyses->num_unmatched = decoder->data.num_unmatched;
+    analyses->data_dropped = decoder->data.num_dropped;
+    analyses->cycles_dropped = decoder->cycles.num_dropped;
+    for (bucket = 0; bucket < TE_CYCLE_HISTOGRAM_BUCKETS; bucket++)
+    {
+        check->num_counted += check->profile.histogram[bucket];
+    }
+    for (slot = 0; slot < check->profile.num_slots; slot++)
+    {
+        check->cycle_mismatches +=
+            (check->profile.pc_cycles[slot] != check->expected_cycles[slot]);
+    }
+
+    free(check->expected_cycles);
+    free(check->expected_pc);
+    free(check->expected);
+    free(columns->pc);
+    free(columns->address);
+    free(columns->value);
+    free(columns->flags);
+}
+
+
+/*
+ * Functions called by the trace-decoder of an impaired trace.
+ */
+static unsigned impaired_get_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const impairment_t * const impairment = user_data;
+
+    return te_generator_get_instruction(impairment->generator, address, instruction);
+}
+
+static void impaired_advance_decoded_pc(
+    void * const user_data,
+    const te_address_t old_pc,
+    const te_address_t new_pc,
+    const te_decoded_instruction_t * const new_instruction)
+{
+    impairment_t * const impairment = user_data;
+
+    (void)old_pc;
+    (void)new_instruction;
+
+    if (!impairment->checking)
+    {
+        impairment->num_unchecked++;
+        return;
+    }
+    if ( (impairment->next >= impairment->generator->num_instructions) ||
+         (impairment->golden[impairment->next] != new_pc) )
+    {
+        impairment->num_mismatches++;
+    }
+    impairment->next++;
+    impairment->num_checked++;
+}
+
+static void count_error(
+    void * const user_data,
+    const te_error_t * const error)
+{
+    impairment_t * const impairment = user_data;
+
+    (void)error;
+
+    impairment->num_errors++;
+}
+
+
+/*
+ * Record each PC executed, in order.
+ */
+static void record_golden_pc(
+    void * const user_data,
+    const te_address_t pc)
+{
+    impairment_t * const impairment = user_data;
+
+    impairment->golden[impairment->next++] = pc;
+}
+
+
+/*
+ * Return true if "message" may be impaired, i.e. it is a te_inst message
+ * with an address, but not a format 3 (from which the trace-decoder would
+ * resync). A format 1 with a full branch map (0 branches) has no address.
+ */
+static bool impairable(
+    const te_message_t * const message)
+{
+    return (TE_MESSAGE_TE_INST == message->type) &&
+           ( (2 == message->te_inst.format) ||
+             ( (1 == message->te_inst.format) && (0 != message->te_inst.branches) ) );
+}
+
+
+/*
+ * Decode once more, impairing the trace at "num_points" evenly spaced
+ * te_inst messages. With gaps, the messages from there up to the next
+ * format 3 te_inst are lost, and the gap is reported to the trace-decoder
+ * (see te_process_gap()). Otherwise, the address of that te_inst is
+ * corrupted (so that it can never be reached), which the trace-decoder
+ * must detect as an error. Either way, it should then resync at the next
+ * format 3, and reconstruct everything from there up to the next point.
+ */
+static void run_impaired(
+    impairment_t * const impairment,
+    const te_generator_t * const generator)
+{
+    static const te_decoder_callbacks_t impaired_callbacks =
+    {
+        .get_instruction = impaired_get_instruction,
+        .advance_decoded_pc = impaired_advance_decoded_pc,
+    };
+    const te_message_t * const messages = generator->messages;
+    const size_t n = generator->num_messages;
+    const size_t spacing = n / (impairment->num_points + 1u);
+    te_decoder_state_t * decoder;
+    size_t point = spacing;
+    size_t i;
+    size_t k;
+    double start;
+
+    impairment->generator = generator;
+    impairment->golden = malloc((generator->num_instructions + 1u) * sizeof(te_address_t));
+    impairment->counts = malloc((n + 1u) * sizeof(unsigned long));
+    assert(impairment->golden);
+    assert(impairment->counts);
+    te_generator_replay(generator, record_golden_pc, impairment);
+
+    /* how many PCs are decoded after each message, without impairments */
+    decoder = te_open_trace_decoder(NULL, &impaired_callbacks, impairment, rv64);
+    impairment->checking = false;
+    for (i = 0; i < n; i++)
+    {
+        process_message(decoder, &messages[i]);
+        impairment->counts[i] = decoder->instruction_count;
+    }
+
+    te_close_trace_decoder(decoder);
+    te_open_trace_decoder(decoder, &impaired_callbacks, impairment, rv64);
+    te_set_error_handler(decoder, count_error);
+    impairment->next = 0;
+    impairment->num_unchecked = 0;
+    impairment->checking = true;
+
+    start = now();
+    for (i = 0; i < n; )
+    {
+        if ( (impairment->inserted == impairment->num_points) ||
+             (i < point) ||
+             (!impairable(&messages[i])) )
+        {
+            process_message(decoder, &messages[i++]);
+            continue;
+        }
+
+        for (k = i + 1u; (k < n) && ( (TE_MESSAGE_TE_INST != messages[k].type) ||
+                                      (3 != messages[k].te_inst.format) ); k++)
+        {
+            /* find the next format 3, from which to resync */
+        }
+
+        if (impairment->corrupt)
+        {
+            te_inst_t corrupted = messages[i].te_inst;
+
+            corrupted.address ^= (te_address_t)1 << 40;
+            te_process_te_inst(decoder, &corrupted);
+            impairment->checking = false;
+
+            /* these should all be discarded */
+            for (i++; i < k; i++)
+            {
+                process_message(decoder, &messages[i]);
+            }
+        }
+        else
+        {
+            /* everything before the gap should have been reconstructed */
+            if ( (impairment->checking) &&
+                 (impairment->next != (i ? impairment->counts[i - 1u] : 0)) )
+            {
+                impairment->num_mismatches++;
+            }
+            te_process_gap(decoder);
+            i = k;
+        }
+
+        if (k < n)
+        {
+            /* the format 3 ends with the instruction at its address */
+            impairment->next = impairment->counts[k] - 1u;
+            impairment->checking = true;
+        }
+        impairment->inserted++;
+        point += spacing;
+    }
+    impairment->elapsed = now() - start;
+
+    impairment->num_gaps = decoder->num_gaps;
+    impairment->num_lost_windows = decoder->num_lost_windows;
+    impairment->num_discarded = decoder->num_discarded;
+    te_close_trace_decoder(decoder);
+    free(decoder);
+    free(impairment->golden);
+    free(impairment->counts);
+}
+
+
+/*
+ * Return true if the trace-decoder resynced after every impairment, and
+ * reconstructed everything it should have, to the end of the trace. Each
+ * gap must be counted as such (and not as an error), and each corruption
+ * must be detected (and so counted as a lost window).
+ */
+static bool impairment_valid(
+    const impairment_t * const impairment)
+{
+    const unsigned long expected = impairment->corrupt ? impairment->inserted : 0;
+
+    return (impairment->inserted == impairment->num_points) &&
+           (impairment->num_gaps == impairment->inserted - expected) &&
+           (impairment->num_lost_windows == expected) &&
+           (impairment->num_errors == expected) &&
+           (0 == impairment->num_mismatches) &&
+           (impairment->next == impairment->generator->num_instructions);
+}
+
+
+/*
+ * Generate and encode the program of each hart (not timed).
+ */
+static void generate_harts(
+    analyses_t * const analyses,
+    const te_generator_params_t * const params,
+    const te_encoder_params_t * const encoder_params)
+{
+    unsigned h;
+
+    analyses->harts = calloc(analyses->num_harts, sizeof(hart_t));
+    assert(analyses->harts);
+    for (h = 0; h < analyses->num_harts; h++)
+    {
+        hart_t * const hart = &analyses->harts[h];
+        te_generator_params_t hart_params = *params;
+
+        hart_params.seed = params->seed + 1u + h;
+        hart->generator = te_generate_trace(&hart_params);
+        te_generator_encode(hart->generator, encoder_params);
+        hart->random = hart_params.seed * 0x9e3779b97f4a7c15ull | 1u;
+        analyses->hart_instructions += hart->generator->num_instructions;
+    }
+}
+
+
+/*
+ * Decode the traces of all the harts together, merging their blocks in
+ * time order. The timestamps of the merged blocks must never decrease, and
+ * the extended timestamp of each hart must end up exactly at its
+ * (unwrapped) time.
+ */
+static void run_merge(
+    analyses_t * const analyses)
+{
+    static const te_decoder_callbacks_t hart_callbacks =
+    {
+        .get_instruction = hart_get_instruction,
+    };
+    te_merge_t merge;
+    te_merge_block_t block;
+    uint64_t last = 0;
+    unsigned h;
+    double start;
+
+    te_open_merge(&merge, analyses->num_harts);
+    for (h = 0; h < analyses->num_harts; h++)
+    {
+        hart_t * const hart = &analyses->harts[h];
+
+        te_add_merge_source(&merge, h, &hart_callbacks, hart, rv64, feed_hart, hart);
+    }
+
+    analyses->ordered = true;
+    start = now();
+    while (te_next_merged_block(&merge, &block))
+    {
+        analyses->ordered = analyses->ordered && (block.timestamp >= last);
+        last = block.timestamp;
+        analyses->merged += block.num_instructions;
+        analyses->harts[block.source].merged += block.num_instructions;
+    }
+    analyses->merge_elapsed = now() - start;
+
+    analyses->merged_blocks = merge.num_blocks;
+    analyses->extended = true;
+    for (h = 0; h < analyses->num_harts; h++)
+    {
+        const te_merge_source_t * const source = &merge.sources[h];
+
+        analyses->extended = analyses->extended &&
+            (source->timestamp.time == analyses->harts[h].time);
+        analyses->num_wraps += source->timestamp.num_wraps;
+        if (source->max_queued > analyses->max_queued)
+        {
+            analyses->max_queued = source->max_queued;
+        }
+    }
+    te_close_merge(&merge);
+}
+
+
+/*
+ * Decode the trace of each hart directly, and then all of them together on
+ * a scheduler, submitting their messages in turn (as if they arrived
+ * interleaved). Each hart must decode to the same PCs both ways, which must
+ * include every instruction it executed. Returns 0 on success.
+ */
+static int run_scheduler(
+    analyses_t * const analyses)
+{
+    static const te_decoder_callbacks_t hart_callbacks =
+    {
+        .get_instruction = hart_get_instruction,
+        .advance_decoded_pc = hart_advance_decoded_pc,
+    };
+    te_scheduler_t scheduler;
+    te_sched_task_t ** const tasks = calloc(analyses->num_harts, sizeof(te_sched_task_t *));
+    uint64_t total_latency = 0;
+    size_t i;
+    unsigned h;
+    bool submitted;
+    double start;
+
+    assert(tasks);
+    for (h = 0; h < analyses->num_harts; h++)
+    {
+        hart_t * const hart = &analyses->harts[h];
+        te_decoder_state_t * const decoder =
+            te_open_trace_decoder(NULL, &hart_callbacks, hart, rv64);
+
+        for (i = 0; i < hart->generator->num_messages; i++)
+        {
+            process_message(decoder, &hart->generator->messages[i]);
+        }
+        te_close_trace_decoder(decoder);
+        free(decoder);
+
+        hart->direct_advances = hart->num_advances;
+        hart->direct_checksum = hart->checksum;
+        hart->num_advances = 0;
+        hart->checksum = 0;
+    }
+
+    te_open_scheduler(&scheduler, analyses->num_workers, analyses->num_harts);
+    for (h = 0; h < analyses->num_harts; h++)
+    {
+        tasks[h] = te_add_sched_task(&scheduler, h, &hart_callbacks,
+            &analyses->harts[h], rv64);
+        assert(tasks[h]);
+    }
+    if (0 != te_start_scheduler(&scheduler))
+    {
+        perror("pthread_create");
+        te_close_scheduler(&scheduler);
+        free(tasks);
+        return -1;
+    }
+
+    start = now();
+    for (i = 0, submitted = true; submitted; i++)
+    {
+        submitted = false;
+        for (h = 0; h < analyses->num_harts; h++)
+        {
+            const te_generator_t * const generator = analyses->harts[h].generator;
+            const te_message_t * message;
+            te_packet_t packet;
+
+            if (i >= generator->num_messages)
+            {
+                continue;
+            }
+            message = &generator->messages[i];
+            switch (message->type)
+            {
+                case TE_MESSAGE_TE_INST:
+                    packet.type = TE_PACKET_TE_INST;
+                    packet.u.te_inst = message->te_inst;
+                    break;
+                case TE_MESSAGE_TE_SUPPORT:
+                    packet.type = TE_PACKET_TE_SUPPORT;
+                    packet.u.te_support = message->te_support;
+                    break;
+                case TE_MESSAGE_TE_DATA:
+                    packet.type = TE_PACKET_TE_DATA;
+                    packet.u.te_data = message->te_data;
+                    break;
+                case TE_MESSAGE_TE_CYCLES:
+                    packet.type = TE_PACKET_TE_CYCLES;
+                    packet.u.te_cycles = message->te_cycles;
+                    break;
+            }
+            te_submit_packet(&scheduler, tasks[h], &packet);
+            submitted = true;
+        }
+    }
+    te_drain_scheduler(&scheduler);
+    analyses->sched_elapsed = now() - start;
+
+    for (h = 0; h < analyses->num_harts; h++)
+    {
+        const hart_t * const hart = &analyses->harts[h];
+        te_sched_metrics_t metrics;
+
+        te_get_sched_metrics(tasks[h], &metrics);
+        analyses->scheduled_packets += metrics.num_packets;
+        analyses->num_migrations += metrics.num_migrations;
+        total_latency += metrics.mean_latency * metrics.num_packets;
+        if (metrics.max_backlog > analyses->max_backlog)
+        {
+            analyses->max_backlog = metrics.max_backlog;
+        }
+        if (metrics.max_latency > analyses->max_latency)
+        {
+            analyses->max_latency = metrics.max_latency;
+        }
+        analyses->matched_harts +=
+            (hart->num_advances == hart->direct_advances) &&
+            (hart->checksum == hart->direct_checksum) &&
+            (hart->direct_advances == hart->generator->num_instructions);
+    }
+    analyses->mean_latency = analyses->scheduled_packets ?
+        (total_latency / analyses->scheduled_packets) : 0;
+
+    /* every task stolen has since been run, so the workers are idle */
+    for (i = 0; i < analyses->num_workers; i++)
+    {
+        analyses->num_steals += scheduler.workers[i].num_steals;
+    }
+    te_close_scheduler(&scheduler);
+    free(tasks);
+
+    return 0;
+}
+
+
+/*
+ * Write the call-tree profile (and the execution profile, if not NULL) to
+ * a file, in either callgrind or pprof format. Returns 0 on success.
+ */
+static int export_profile(
+    const char * const filename,
+    const bool callgrind,
+    const te_call_profile_t * const calls,
+    te_exec_profile_t * const profile,
+    const te_decoder_state_t * const decoder)
+{
+    FILE * const file = fopen(filename, "wb");
+    int status;
+
+    if (!file)
+    {
+        perror(filename);
+        return -1;
+    }
+    if (callgrind)
+    {
+        status = te_write_callgrind(file, calls, profile, decoder);
+    }
+    else
+    {
+        status = te_write_pprof_call_profile(file, calls);
+    }
+    if ( (0 != fclose(file)) || (0 != status) )
+    {
+        perror(filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Collect (and write out) the results of each analysis. Returns 0 on success.
+ */
+static int finish_analyses(
+    analyses_t * const analyses,
+    const te_decoder_state_t * const decoder)
+{
+    size_t slot;
+
+    if (analyses->profile)
+    {
+        const uint64_t * const pc_executed =
+            te_expand_exec_profile(&analyses->exec_profile, decoder);
+
+        for (slot = 0; slot < analyses->exec_profile.num_slots; slot++)
+        {
+            analyses->profiled += pc_executed[slot];
+            analyses->profiled_pcs += (0 != pc_executed[slot]);
+        }
+    }
+
+    if (analyses->edges_file)
+    {
+        te_write_edge_profile(&analyses->edge_profile, analyses->edges_out, decoder);
+        fclose(analyses->edges_out);
+    }
+
+    if (analyses->branches_file)
+    {
+        const te_edge_table_t * const branches = &analyses->edge_profile.branches;
+
+        te_write_branch_profile(&analyses->edge_profile, analyses->branches_out);
+        fclose(analyses->branches_out);
+
+        /* every branch executed is either taken, or not */
+        for (slot = 0; slot <= branches->mask; slot++)
+        {
+            analyses->branches_counted +=
+                branches->entries[slot].count[0] + branches->entries[slot].count[1];
+        }
+    }
+
+    if (analyses->calls)
+    {
+        const te_call_profile_t * const calls = analyses->call_profile;
+
+        te_flush_call_profile(analyses->call_profile);
+
+        /* the roots of the call-tree include every instruction */
+        for (slot = 0; slot < TE_CALL_PROFILE_TABLE_SIZE; slot++)
+        {
+            if (TE_CALL_PROFILE_NO_PARENT == calls->nodes[slot].parent)
+            {
+                analyses->call_roots += calls->nodes[slot].inclusive;
+            }
+        }
+
+        if ( (analyses->pprof_file) &&
+             (0 != export_profile(analyses->pprof_file, false, calls, NULL, decoder)) )
+        {
+            return -1;
+        }
+        if ( (analyses->callgrind_file) &&
+             (0 != export_profile(analyses->callgrind_file, true, calls,
+                analyses->profile ? &analyses->exec_profile : NULL, decoder)) )
+        {
+            return -1;
+        }
+
+        if (analyses->fast_profile)
+        {
+            check_fast_profile(analyses);
+        }
+    }
+
+    if (analyses->coverage_file)
+    {
+        if (0 != te_write_coverage(&analyses->coverage, analyses->coverage_out))
+        {
+            perror(analyses->coverage_file);
+            return -1;
+        }
+        fclose(analyses->coverage_out);
+
+        for (slot = 0; slot < analyses->coverage.num_words; slot++)
+        {
+            analyses->covered_slots +=
+                (size_t)__builtin_popcountll(analyses->coverage.executed[slot]);
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Return true if every selected analysis saw exactly what was executed.
+ */
+static bool analyses_valid(
+    const analyses_t * const analyses,
+    const te_generator_t * const generator)
+{
+    const unsigned long num_instructions = generator->num_instructions;
+    const data_check_t * const check = &analyses->data_check;
+
+    if ( ( (analyses->verify) && (!analyses->verified) ) ||
+         ( (analyses->pull) && (0 == analyses->pull_limit) &&
+           (analyses->pulled != num_instructions) ) ||
+         ( (analyses->calls) && (analyses->call_roots != num_instructions) ) ||
+         ( (analyses->fast_profile) &&
+           ( (analyses->fast_mismatches) ||
+             (analyses->fast_state.num_overflows) ||
+             (analyses->fast_state.num_underflows) ||
+             (analyses->fast_state.num_mismatches) ) ) ||
+         ( (analyses->profile) && (analyses->profiled != num_instructions) ) ||
+         ( (analyses->num_harts) &&
+           ( (!analyses->ordered) || (!analyses->extended) ||
+             (analyses->merged != analyses->hart_instructions) ) ) ||
+         ( (analyses->num_workers) &&
+           (analyses->matched_harts != analyses->num_harts) ) ||
+         ( (analyses->data) &&
+           ( (check->num_rows != generator->num_te_data) ||
+             (check->num_mismatches) || (analyses->num_unmatched) ||
+             (analyses->data_dropped) ) ) ||
+         ( (analyses->cycles) &&
+           ( (check->num_counted != generator->num_te_cycles) ||
+             (check->cycle_mismatches) || (check->profile.outside_cycles) ||
+             (analyses->cycles_dropped) ) ) ||
+         ( (analyses->branches_file) &&
+           (analyses->branches_counted !=
+            generator->num_branches - generator->final_branch) ) ||
+         ( (analyses->gaps.num_points) && (!impairment_valid(&analyses->gaps)) ) ||
+         ( (analyses->corruption.num_points) &&
+           (!impairment_valid(&analyses->corruption)) ) )
+    {
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Write the results of each analysis (as part of the JSON object), and
+ * then close it.
+ */
+static void print_verify(
+    analyses_t * const analyses,
+    const unsigned long num_instructions)
+{
+    printf("  \"verify\": {\n");
+    printf("    \"seconds\": %.6f,\n", analyses->verify_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)num_instructions / analyses->verify_elapsed);
+    printf("    \"matched\": %lu,\n", analyses->verifier.num_verified);
+    printf("    \"batches\": %lu,\n", analyses->verifier.ring.num_batches);
+    printf("    \"stalls\": %lu,\n", analyses->verifier.ring.num_stalls);
+    printf("    \"verified\": %s\n", analyses->verified ? "true" : "false");
+    printf("  },\n");
+    te_close_verifier(&analyses->verifier);
+}
+
+static void print_profile(
+    analyses_t * const analyses,
+    const unsigned long num_instructions)
+{
+    printf("  \"profile\": {\n");
+    printf("    \"seconds\": %.6f,\n", analyses->profile_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)num_instructions / analyses->profile_elapsed);
+    printf("    \"blocks\": %lu,\n", (unsigned long)analyses->exec_profile.num_blocks);
+    printf("    \"pcs\": %lu,\n", (unsigned long)analyses->profiled_pcs);
+    printf("    \"executed\": %lu\n", (unsigned long)analyses->profiled);
+    printf("  },\n");
+    te_close_exec_profile(&analyses->exec_profile);
+}
+
+static void print_edges(
+    analyses_t * const analyses,
+    const unsigned long num_instructions)
+{
+    const te_edge_profile_t * const edges = &analyses->edge_profile;
+
+    printf("  \"edges\": {\n");
+    printf("    \"seconds\": %.6f,\n", analyses->edges_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)num_instructions / analyses->edges_elapsed);
+    printf("    \"branches\": %lu,\n", (unsigned long)edges->branches.num_used);
+    if (analyses->branches_file)
+    {
+        printf("    \"branches_executed\": %lu,\n",
+            (unsigned long)analyses->branches_counted);
+    }
+    printf("    \"jumps\": %lu,\n", (unsigned long)edges->jumps.num_used);
+    printf("    \"ranges\": %lu,\n", (unsigned long)edges->ranges.num_used);
+    printf("    \"dropped\": %lu\n", (unsigned long)
+        (edges->branches.num_dropped +
+         edges->jumps.num_dropped +
+         edges->ranges.num_dropped));
+    printf("  },\n");
+    te_close_edge_profile(&analyses->edge_profile);
+}
+
+static void print_calls(
+    analyses_t * const analyses,
+    const unsigned long num_instructions)
+{
+    te_call_profile_t * const calls = analyses->call_profile;
+
+    printf("  \"calls\": {\n");
+    printf("    \"seconds\": %.6f,\n", analyses->calls_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)num_instructions / analyses->calls_elapsed);
+    printf("    \"functions\": %lu,\n", (unsigned long)calls->num_functions);
+    printf("    \"paths\": %lu,\n", (unsigned long)calls->num_nodes);
+    printf("    \"exceptions\": %lu,\n", calls->num_exceptions);
+    printf("    \"underflows\": %lu,\n", calls->num_underflows);
+    printf("    \"mismatches\": %lu,\n", calls->num_mismatches);
+    printf("    \"root_inclusive\": %lu\n", (unsigned long)analyses->call_roots);
+    printf("  },\n");
+    te_close_call_profile(calls);
+    free(calls);
+}
+
+static void print_fast_profile(
+    analyses_t * const analyses,
+    const te_generator_t * const generator)
+{
+    te_fast_profile_state_t * const fast = &analyses->fast_state;
+
+    printf("  \"fast_profile\": {\n");
+    printf("    \"seconds\": %.6f,\n", analyses->fast_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)generator->num_instructions / analyses->fast_elapsed);
+    printf("    \"speedup_over_calls\": %.1f,\n",
+        analyses->calls_elapsed / analyses->fast_elapsed);
+    printf("    \"packets\": %lu,\n", fast->num_packets);
+    printf("    \"edges\": %lu,\n", (unsigned long)fast->num_edges);
+    printf("    \"calls\": %lu,\n", (unsigned long)analyses->fast_calls);
+    printf("    \"overflows\": %lu,\n", fast->num_overflows);
+    printf("    \"underflows\": %lu,\n", fast->num_underflows);
+    printf("    \"mismatches\": %lu,\n", fast->num_mismatches);
+    printf("    \"edge_mismatches\": %lu\n", analyses->fast_mismatches);
+    printf("  },\n");
+    te_close_fast_profile(fast);
+}
+
+static void print_coverage(
+    analyses_t * const analyses,
+    const unsigned long num_instructions)
+{
+    printf("  \"coverage\": {\n");
+    printf("    \"seconds\": %.6f,\n", analyses->coverage_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)num_instructions / analyses->coverage_elapsed);
+    printf("    \"half_words\": %lu,\n", (unsigned long)analyses->coverage.num_slots);
+    printf("    \"covered\": %lu\n", (unsigned long)analyses->covered_slots);
+    printf("  },\n");
+    te_close_coverage(&analyses->coverage);
+}
+
+static void print_single_pass(
+    const analyses_t * const analyses,
+    const unsigned long num_instructions)
+{
+    printf("  \"single_pass\": {\n");
+    printf("    \"seconds\": %.6f,\n", analyses->single_pass_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)num_instructions / analyses->single_pass_elapsed);
+    printf("    \"stalls\": %lu\n", analyses->single_pass_stalls);
+    printf("  },\n");
+}
+
+static void print_pull(
+    const analyses_t * const analyses)
+{
+    const te_pull_t * const pull = &analyses->pull_state;
+
+    printf("  \"pull\": {\n");
+    printf("    \"seconds\": %.6f,\n", analyses->pull_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)analyses->pulled / analyses->pull_elapsed);
+    printf("    \"pulled\": %lu,\n", analyses->pulled);
+    printf("    \"decoded\": %lu,\n", pull->num_records);
+    printf("    \"batches\": %lu,\n", pull->ring.num_batches);
+    printf("    \"stalls\": %lu,\n", pull->ring.num_stalls);
+    printf("    \"suspends\": %lu\n", pull->ring.num_suspends);
+    printf("  },\n");
+}
+
+static void print_data(
+    analyses_t * const analyses,
+    const te_generator_t * const generator)
+{
+    const data_check_t * const check = &analyses->data_check;
+
+    printf("  \"data\": {\n");
+    printf("    \"seconds\": %.6f,\n", analyses->data_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)generator->num_instructions / analyses->data_elapsed);
+    printf("    \"te_data\": %lu,\n", (unsigned long)generator->num_te_data);
+    printf("    \"transfers\": %lu,\n", analyses->num_transfers);
+    printf("    \"mismatches\": %lu,\n", check->num_mismatches);
+    printf("    \"unmatched\": %lu,\n", analyses->num_unmatched);
+    printf("    \"dropped\": %lu,\n", analyses->data_dropped);
+    printf("    \"te_cycles\": %lu,\n", (unsigned long)generator->num_te_cycles);
+    printf("    \"counted\": %lu,\n", (unsigned long)check->num_counted);
+    printf("    \"cycle_mismatches\": %lu,\n", (unsigned long)check->cycle_mismatches);
+    printf("    \"cycles_dropped\": %lu\n", analyses->cycles_dropped);
+    printf("  },\n");
+    te_close_cycle_profile(&analyses->data_check.profile);
+}
+
+static void print_impairment(
+    const char * const name,
+    const impairment_t * const impairment)
+{
+    printf("  \"%s\": {\n", name);
+    printf("    \"seconds\": %.6f,\n", impairment->elapsed);
+    printf("    \"inserted\": %u,\n", impairment->inserted);
+    printf("    \"gaps\": %lu,\n", impairment->num_gaps);
+    printf("    \"lost_windows\": %lu,\n", impairment->num_lost_windows);
+    printf("    \"errors\": %lu,\n", impairment->num_errors);
+    printf("    \"discarded\": %lu,\n", impairment->num_discarded);
+    printf("    \"checked\": %lu,\n", impairment->num_checked);
+    printf("    \"unchecked\": %lu,\n", impairment->num_unchecked);
+    printf("    \"mismatches\": %lu\n", impairment->num_mismatches);
+    printf("  },\n");
+}
+
+static void print_merge(
+    const analyses_t * const analyses)
+{
+    printf("  \"merge\": {\n");
+    printf("    \"harts\": %u,\n", analyses->num_harts);
+    printf("    \"seconds\": %.6f,\n", analyses->merge_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)analyses->merged / analyses->merge_elapsed);
+    printf("    \"instructions\": %lu,\n", analyses->hart_instructions);
+    printf("    \"merged\": %lu,\n", analyses->merged);
+    printf("    \"blocks\": %lu,\n", analyses->merged_blocks);
+    printf("    \"wraps\": %lu,\n", analyses->num_wraps);
+    printf("    \"max_queued\": %lu,\n", (unsigned long)analyses->max_queued);
+    printf("    \"ordered\": %s,\n", analyses->ordered ? "true" : "false");
+    printf("    \"extended\": %s\n", analyses->extended ? "true" : "false");
+    printf("  },\n");
+}
+
+static void print_scheduler(
+    const analyses_t * const analyses)
+{
+    printf("  \"scheduler\": {\n");
+    printf("    \"workers\": %u,\n", analyses->num_workers);
+    printf("    \"seconds\": %.6f,\n", analyses->sched_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)analyses->hart_instructions / analyses->sched_elapsed);
+    printf("    \"packets\": %lu,\n", analyses->scheduled_packets);
+    printf("    \"migrations\": %lu,\n", analyses->num_migrations);
+    printf("    \"steals\": %lu,\n", analyses->num_steals);
+    printf("    \"max_backlog\": %lu,\n", (unsigned long)analyses->max_backlog);
+    printf("    \"mean_latency_ns\": %lu,\n", (unsigned long)analyses->mean_latency);
+    printf("    \"max_latency_ns\": %lu,\n", (unsigned long)analyses->max_latency);
+    printf("    \"matched_harts\": %u\n", analyses->matched_harts);
+    printf("  },\n");
+}
+
+
+/*
+ * Write the results of the timed encodes and decodes (as part of the
+ * JSON object).
+ */
+static void print_params(
+    const te_generator_params_t * const params,
+    const te_encoder_params_t * const encoder_params,
+    const unsigned repeat)
+{
+    printf("  \"params\": {\n");
+    printf("    \"instructions\": %lu,\n", params->num_instructions);
+    printf("    \"functions\": %u,\n", params->num_functions);
+    printf("    \"blocks_per_function\": %u,\n", params->blocks_per_function);
+    printf("    \"block_length\": %u,\n", params->block_length);
+    printf("    \"branch_density\": %g,\n", params->branch_density);
+    printf("    \"loop_ratio\": %g,\n", params->loop_ratio);
+    printf("    \"loop_length\": %u,\n", params->loop_length);
+    printf("    \"call_ratio\": %g,\n", params->call_ratio);
+    printf("    \"indirect_ratio\": %g,\n", params->indirect_ratio);
+    printf("    \"call_depth\": %u,\n", params->call_depth);
+    printf("    \"seed\": %lu,\n", params->seed);
+    printf("    \"data_ratio\": %g,\n", params->data_ratio);
+    printf("    \"cycle_counts\": %s,\n", params->cycle_counts ? "true" : "false");
+    printf("    \"max_resync\": %lu,\n", encoder_params->max_resync);
+    printf("    \"retires\": %u,\n", encoder_params->retires_p);
+    printf("    \"repeat\": %u\n", repeat);
+    printf("  },\n");
+}
+
+static void print_measurements(
+    const te_generator_t * const generator,
+    const unsigned repeat,
+    const double encode_elapsed,
+    const measurement_t * const measurement)
+{
+    const double elapsed = measurement->elapsed;
+    const double gets = (double)measurement->num_gets;
+
+    printf("  \"code_bytes\": %lu,\n", (unsigned long)(4u * generator->num_code));
+    printf("  \"instructions\": %lu,\n", generator->num_instructions);
+    printf("  \"branches\": %lu,\n", generator->num_branches);
+    printf("  \"calls\": %lu,\n", generator->num_calls);
+    printf("  \"updiscons\": %lu,\n", generator->num_updiscons);
+    printf("  \"te_inst\": %lu,\n", (unsigned long)generator->num_te_inst);
+    printf("  \"seconds\": %.6f,\n", elapsed);
+    printf("  \"instructions_per_second\": %.0f,\n",
+        (double)generator->num_instructions * repeat / elapsed);
+    printf("  \"ns_per_te_inst\": %.3f,\n",
+        elapsed * 1e9 / ((double)generator->num_te_inst * repeat));
+    printf("  \"ns_per_instruction\": %.3f,\n",
+        elapsed * 1e9 / ((double)generator->num_instructions * repeat));
+    printf("  \"encode\": {\n");
+    printf("    \"seconds\": %.6f,\n", encode_elapsed);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)generator->num_instructions * repeat / encode_elapsed);
+    printf("    \"ns_per_te_inst\": %.3f\n",
+        encode_elapsed * 1e9 / ((double)generator->num_te_inst * repeat));
+    printf("  },\n");
+    printf("  \"end_to_end_instructions_per_second\": %.0f,\n",
+        (double)generator->num_instructions * repeat / (encode_elapsed + elapsed));
+    printf("  \"get_instr\": {\n");
+    printf("    \"calls\": %lu,\n", measurement->num_gets);
+    printf("    \"same\": %lu,\n", measurement->num_same);
+    printf("    \"hits\": %lu,\n", measurement->num_hits);
+    printf("    \"same_rate\": %.4f,\n",
+        gets ? (double)measurement->num_same / gets : 0.0);
+    printf("    \"hit_rate\": %.4f,\n",
+        gets ? (double)measurement->num_hits / gets : 0.0);
+    printf("    \"combined_hit_rate\": %.4f\n",
+        gets ? (double)(measurement->num_same + measurement->num_hits) / gets : 0.0);
+    printf("  },\n");
+    printf("  \"decoder_bytes\": %lu,\n", (unsigned long)measurement->decoder_bytes);
+    printf("  \"decode_rss_kb\": %ld,\n", measurement->rss_kb);
+}
+
+
+static void usage(
+    const char * const program,
+    const te_generator_params_t * const params)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --instructions=N     instructions to retire (%lu)\n"
+        "  --functions=N        number of functions (%u)\n"
+        "  --blocks=N           basic blocks per function (%u)\n"
+        "  --block-length=N     mean instructions per block (%u)\n"
+        "  --branch-density=F   fraction of blocks ending in a branch (%.2f)\n"
+        "  --loop-ratio=F       fraction of branches that are loops (%.2f)\n"
+        "  --loop-length=N      mean loop iterations (%u)\n"
+        "  --call-ratio=F       fraction of blocks ending in a call (%.2f)\n"
+        "  --indirect-ratio=F   fraction of calls/jumps uninferable (%.2f)\n"
+        "  --call-depth=N       levels of functions (%u)\n"
+        "  --seed=N             pseudo-random seed (%lu)\n"
+        "  --data=F             fraction of instructions that are loads/stores,\n"
+        "                       checking their transfers (once more)\n"
+        "  --cycles             check inter-instruction cycle counts (once more)\n"
+        "  --max-resync=N       instructions between encoder resyncs (0)\n"
+        "  --retires=N          instructions retired per encoder block (1)\n"
+        "  --gaps=N             lose the trace at N points (once more),\n"
+        "                       resyncing at the next format 3 (needs --max-resync)\n"
+        "  --corrupt=N          corrupt the trace at N points (once more),\n"
+        "                       resyncing at the next format 3 (needs --max-resync)\n"
+        "  --repeat=N           times to encode/decode the trace (1)\n"
+        "  --verify             check every decoded PC (once more)\n"
+        "  --profile            count executions of every PC (once more)\n"
+        "  --edges=FILE         write an AutoFDO branch profile (once more)\n"
+        "  --branches=FILE      write taken/not-taken counts per branch (ditto)\n"
+        "  --calls              build a call-tree profile (once more)\n"
+        "  --pprof=FILE         write the call-tree profile for pprof\n"
+        "  --callgrind=FILE     write the call-tree profile for callgrind\n"
+        "  --fast-profile       decode fast profiling packets (and --calls),\n"
+        "                       checking the call-graph against the call-tree\n"
+        "  --coverage=FILE      write coverage bitmaps (once more)\n"
+        "  --single-pass        decode only once more, for all of the above\n"
+        "  --pull=N             pull the first N PCs (0 = all) from one more\n"
+        "  --harts=N            merge the traces of N more programs\n"
+        "  --workers=N          also decode those on N scheduled threads\n",
+        program,
+        params->num_instructions,
+        params->num_functions,
+        params->blocks_per_function,
+        params->block_length,
+        params->branch_density,
+        params->loop_ratio,
+        params->loop_length,
+        params->call_ratio,
+        params->indirect_ratio,
+        params->call_depth,
+        params->seed);
+}
+
+
+int main(
+    int argc,
+    char * argv[])
+{
+    static const struct option options[] =
+    {
+        { "instructions",   required_argument, NULL, 'n' },
+        { "functions",      required_argument, NULL, 'f' },
+        { "blocks",         required_argument, NULL, 'b' },
+        { "block-length",   required_argument, NULL, 'l' },
+        { "branch-density", required_argument, NULL, 'd' },
+        { "loop-ratio",     required_argument, NULL, 'r' },
+        { "loop-length",    required_argument, NULL, 'L' },
+        { "call-ratio",     required_argument, NULL, 'c' },
+        { "indirect-ratio", required_argument, NULL, 'i' },
+        { "call-depth",     required_argument, NULL, 'D' },
+        { "seed",           required_argument, NULL, 's' },
+        { "data",           required_argument, NULL, 'T' },
+        { "cycles",         no_argument,       NULL, 'Y' },
+        { "max-resync",     required_argument, NULL, 'm' },
+        { "retires",        required_argument, NULL, 'e' },
+        { "gaps",           required_argument, NULL, 'g' },
+        { "corrupt",        required_argument, NULL, 'x' },
+        { "repeat",         required_argument, NULL, 'R' },
+        { "verify",         no_argument,       NULL, 'V' },
+        { "profile",        no_argument,       NULL, 'P' },
+        { "edges",          required_argument, NULL, 'E' },
+        { "branches",       required_argument, NULL, 'B' },
+        { "calls",          no_argument,       NULL, 'C' },
+        { "pprof",          required_argument, NULL, 'G' },
+        { "callgrind",      required_argument, NULL, 'K' },
+        { "fast-profile",   no_argument,       NULL, 'F' },
+        { "coverage",       required_argument, NULL, 'O' },
+        { "single-pass",    no_argument,       NULL, 'S' },
+        { "pull",           required_argument, NULL, 'U' },
+        { "harts",          required_argument, NULL, 'H' },
+        { "workers",        required_argument, NULL, 'W' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    static analyses_t analyses;
+    te_generator_params_t params;
+    te_encoder_params_t encoder_params;
+    te_generator_t * generator;
+    te_decoder_state_t * decoder;
+    benchmark_t benchmark;
+    measurement_t measurement;
+    unsigned repeat = 1;
+    double encode_elapsed;
+    bool identical = true;
+    bool valid;
+    int option;
+    unsigned i;
+
+    te_generator_default_params(&params);
+    te_encoder_default_params(&encoder_params);
+
+    while (-1 != (option = getopt_long(argc, argv, "h", options, NULL)))
+    {
+        switch (option)
+        {
+            case 'n': params.num_instructions = strtoul(optarg, NULL, 0); break;
+            case 'f': params.num_functions = strtoul(optarg, NULL, 0); break;
+            case 'b': params.blocks_per_function = strtoul(optarg, NULL, 0); break;
+            case 'l': params.block_length = strtoul(optarg, NULL, 0); break;
+            case 'd': params.branch_density = strtod(optarg, NULL); break;
+            case 'r': params.loop_ratio = strtod(optarg, NULL); break;
+            case 'L': params.loop_length = strtoul(optarg, NULL, 0); break;
+            case 'c': params.call_ratio = strtod(optarg, NULL); break;
+            case 'i': params.indirect_ratio = strtod(optarg, NULL); break;
+            case 'D': params.call_depth = strtoul(optarg, NULL, 0); break;
+            case 's': params.seed = strtoul(optarg, NULL, 0); break;
+            case 'T': params.data_ratio = strtod(optarg, NULL); analyses.data = true; break;
+            case 'Y': params.cycle_counts = true; analyses.cycles = true; break;
+            case 'm': encoder_params.max_resync = strtoul(optarg, NULL, 0); break;
+            case 'e': encoder_params.retires_p = strtoul(optarg, NULL, 0); break;
+            case 'g': analyses.gaps.num_points = strtoul(optarg, NULL, 0); break;
+            case 'x': analyses.corruption.num_points = strtoul(optarg, NULL, 0); break;
+            case 'R': repeat = strtoul(optarg, NULL, 0); break;
+            case 'V': analyses.verify = true; break;
+            case 'P': analyses.profile = true; break;
+            case 'E': analyses.edges_file = optarg; analyses.edges = true; break;
+            case 'B': analyses.branches_file = optarg; analyses.edges = true; break;
+            case 'C': analyses.calls = true; break;
+            case 'G': analyses.pprof_file = optarg; analyses.calls = true; break;
+            case 'K': analyses.callgrind_file = optarg; analyses.calls = true; break;
+            case 'F': analyses.fast_profile = true; analyses.calls = true; break;
+            case 'O': analyses.coverage_file = optarg; break;
+            case 'S': analyses.single_pass = true; break;
+            case 'U': analyses.pull_limit = strtoul(optarg, NULL, 0); analyses.pull = true; break;
+            case 'H': analyses.num_harts = strtoul(optarg, NULL, 0); break;
+            case 'W': analyses.num_workers = strtoul(optarg, NULL, 0); break;
+            default:
+                usage(argv[0], &params);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if ( (0 == repeat) ||
+         (0 == encoder_params.retires_p) ||
+         (encoder_params.retires_p > 32) ||
+         (0 == params.num_functions) ||
+         (params.blocks_per_function < 2) ||
+         (0 == params.call_depth) ||
+         ( (analyses.num_workers) && (0 == analyses.num_harts) ) ||
+         ( ( (analyses.gaps.num_points) || (analyses.corruption.num_points) ) &&
+           (0 == encoder_params.max_resync) ) )
+    {
+        usage(argv[0], &params);
+        return EXIT_FAILURE;
+    }
+
+    generator = te_generate_trace(&params);
+    decoder = te_open_trace_decoder(NULL, NULL, NULL, rv64);
+
+    encode_elapsed = measure_encode(generator, &encoder_params, repeat);
+    if (encoder_params.retires_p > 1)
+    {
+        identical = check_single_retirement(generator, &encoder_params);
+    }
+
+    memset(&benchmark, 0, sizeof(benchmark));
+    benchmark.generator = generator;
+    measure_decode(decoder, &benchmark, repeat, &measurement);
+
+    /* then decode once more for each (optional) analysis, or all together */
+    if (0 != open_analyses(&analyses, generator, decoder))
+    {
+        return EXIT_FAILURE;
+    }
+    if (analyses.single_pass)
+    {
+        if (0 != run_single_pass(&analyses, decoder, &benchmark))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        if (analyses.verify)
+        {
+            run_verify(&analyses, decoder, &benchmark);
+        }
+        if (analyses.profile)
+        {
+            run_profile(&analyses, decoder, &benchmark);
+        }
+        if (analyses.edges)
+        {
+            run_edges(&analyses, decoder, &benchmark);
+        }
+        if (analyses.calls)
+        {
+            run_calls(&analyses, decoder, &benchmark);
+        }
+        if (analyses.coverage_file)
+        {
+            run_coverage(&analyses, decoder, &benchmark);
+        }
+    }
+    if (analyses.fast_profile)
+    {
+        run_fast_profile(&analyses, generator);
+    }
+    if ( (analyses.data) || (analyses.cycles) )
+    {
+        run_data(&analyses, decoder, &benchmark);
+    }
+    if (analyses.gaps.num_points)
+    {
+        run_impaired(&analyses.gaps, generator);
+    }
+    if (analyses.corruption.num_points)
+    {
+        analyses.corruption.corrupt = true;
+        run_impaired(&analyses.corruption, generator);
+    }
+    if ( (0 != finish_analyses(&analyses, decoder)) ||
+         ( (analyses.pull) && (0 != run_pull(&analyses, &benchmark)) ) )
+    {
+        return EXIT_FAILURE;
+    }
+    if (analyses.num_harts)
+    {
+        generate_harts(&analyses, &params, &encoder_params);
+        run_merge(&analyses);
+    }
+    if ( (analyses.num_workers) && (0 != run_scheduler(&analyses)) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    /* check that the decoder reconstructed exactly what was executed */
+    valid = (identical) &&
+            (analyses_valid(&analyses, generator)) &&
+            (measurement.decoded == generator->num_instructions) &&
+            (measurement.instruction_count == generator->num_instructions) &&
+            (0 == measurement.num_lost_windows);
+
+    printf("{\n");
+    print_params(&params, &encoder_params, repeat);
+    print_measurements(generator, repeat, encode_elapsed, &measurement);
+    printf("  \"identical_to_single_retirement\": %s,\n", identical ? "true" : "false");
+    if (analyses.verify)
+    {
+        print_verify(&analyses, generator->num_instructions);
+    }
+    if (analyses.profile)
+    {
+        print_profile(&analyses, generator->num_instructions);
+    }
+    if (analyses.edges)
+    {
+        print_edges(&analyses, generator->num_instructions);
+    }
+    if (analyses.fast_profile)
+    {
+        print_fast_profile(&analyses, generator);
+    }
+    if (analyses.calls)
+    {
+        print_calls(&analyses, generator->num_instructions);
+    }
+    if (analyses.coverage_file)
+    {
+        print_coverage(&analyses, generator->num_instructions);
+    }
+    if (analyses.single_pass)
+    {
+        print_single_pass(&analyses, generator->num_instructions);
+    }
+    if (analyses.pull)
+    {
+        print_pull(&analyses);
+    }
+    if ( (analyses.data) || (analyses.cycles) )
+    {
+        print_data(&analyses, generator);
+    }
+    if (analyses.gaps.num_points)
+    {
+        print_impairment("gaps", &analyses.gaps);
+    }
+    if (analyses.corruption.num_points)
+    {
+        print_impairment("corrupt", &analyses.corruption);
+    }
+    if (analyses.num_harts)
+    {
+        print_merge(&analyses);
+    }
+    if (analyses.num_workers)
+    {
+        print_scheduler(&analyses);
+    }
+    printf("  \"checksum\": \"%lx\",\n", benchmark.checksum);
+    printf("  \"valid\": %s\n", valid ? "true" : "false");
+    printf("}\n");
+
+    te_close_trace_decoder(decoder);
+    free(decoder);
+    te_free_generated_trace(generator);
+    for (i = 0; i < analyses.num_harts; i++)
+    {
+        te_free_generated_trace(analyses.harts[i].generator);
+    }
+    free(analyses.harts);
+
+    return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
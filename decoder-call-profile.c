@@ -0,0 +1,652 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include "decoder-call-profile.h"
+
+
+/*
+ * Returned instead of a slot number, if a table is full.
+ */
+#define NO_SLOT     TE_CALL_PROFILE_NO_PARENT
+
+
+/*
+ * Hash a pair of keys into a slot number in one of the tables.
+ */
+static size_t key_hash(
+    const uint64_t first,
+    const uint64_t second)
+{
+    uint64_t key = (first * 0x9e3779b97f4a7c15ull) ^ (second >> 1);
+
+    key ^= key >> 29;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 32;
+
+    return (size_t)key & (TE_CALL_PROFILE_TABLE_SIZE - 1u);
+}
+
+
+/*
+ * Return true if a table already holding "num_used" entries is full.
+ */
+static bool table_full(
+    const size_t num_used)
+{
+    return num_used >= (TE_CALL_PROFILE_TABLE_SIZE >> 2) * 3u;
+}
+
+
+/*
+ * Find the slot of the function containing "address", adding it to the
+ * function table if this is its first occurrence. This is only needed
+ * when a new call-tree node is created, so is not on the common path.
+ */
+static uint32_t find_function(
+    te_call_profile_t * const profile,
+    const te_address_t address)
+{
+    te_address_t start;
+    size_t slot;
+
+    assert(profile);
+
+    (void)te_call_profile_symbol(profile, address, &start);
+
+    slot = key_hash(start, 0);
+    while (profile->functions[slot].calls)
+    {
+        if (profile->functions[slot].address == start)
+        {
+            return (uint32_t)slot;
+        }
+        slot = (slot + 1u) & (TE_CALL_PROFILE_TABLE_SIZE - 1u);
+    }
+
+    if (table_full(profile->num_functions))
+    {
+        return NO_SLOT;
+    }
+
+    /* first occurrence: the caller will count its first call */
+    profile->functions[slot].address = start;
+    profile->num_functions++;
+
+    return (uint32_t)slot;
+}
+
+
+/*
+ * Find the slot of the call-tree node for a call from node "parent"
+ * to "target", adding it to the call-tree if this is its first occurrence.
+ */
+static uint32_t find_node(
+    te_call_profile_t * const profile,
+    const uint32_t parent,
+    const te_address_t target)
+{
+    size_t slot;
+    uint32_t function;
+
+    assert(profile);
+
+    slot = key_hash(target, parent);
+    while (profile->nodes[slot].calls)
+    {
+        if ( (profile->nodes[slot].target == target) &&
+             (profile->nodes[slot].parent == parent) )
+        {
+            return (uint32_t)slot;
+        }
+        slot = (slot + 1u) & (TE_CALL_PROFILE_TABLE_SIZE - 1u);
+    }
+
+    if (table_full(profile->num_nodes))
+    {
+        return NO_SLOT;
+    }
+    function = find_function(profile, target);
+    if (NO_SLOT == function)
+    {
+        return NO_SLOT;
+    }
+
+    /* first occurrence: the caller will count its first call */
+    profile->nodes[slot].parent = parent;
+    profile->nodes[slot].function = function;
+    profile->nodes[slot].target = target;
+    profile->num_nodes++;
+
+    return (uint32_t)slot;
+}
+
+
+/*
+ * Attribute all the instructions seen since the stack last changed to
+ * the frame on the top of the stack, as their exclusive count.
+ */
+static void attribute(
+    te_call_profile_t * const profile)
+{
+    const uint64_t count = profile->num_instructions - profile->attributed;
+
+    if (profile->depth)
+    {
+        const te_call_frame_t * const frame = &profile->stack[profile->depth - 1u];
+        profile->nodes[frame->node].exclusive += count;
+        profile->functions[frame->function].exclusive += count;
+    }
+    profile->attributed = profile->num_instructions;
+}
+
+
+/*
+ * Push a new frame onto the shadow call-stack, for a call to "target".
+ * If the stack (or a table) is already full, then the call is not tracked,
+ * and its instructions are attributed to the caller, until it returns.
+ */
+static void push_frame(
+    te_call_profile_t * const profile,
+    const te_address_t target,
+    const te_address_t return_address,
+    const bool exception)
+{
+    te_call_frame_t * frame;
+    te_call_function_t * function;
+    uint32_t node;
+
+    assert(profile);
+
+    attribute(profile);
+
+    if (TE_CALL_PROFILE_MAX_DEPTH == profile->depth)
+    {
+        profile->num_overflows++;
+        profile->untracked++;
+        return;
+    }
+
+    node = find_node(profile,
+        profile->depth ? profile->stack[profile->depth - 1u].node : TE_CALL_PROFILE_NO_PARENT,
+        target);
+    if (NO_SLOT == node)
+    {
+        profile->num_dropped++;
+        profile->untracked++;
+        return;
+    }
+
+    frame = &profile->stack[profile->depth++];
+    frame->node = node;
+    frame->function = profile->nodes[node].function;
+    frame->entered = profile->num_instructions;
+    frame->return_address = return_address;
+    frame->exception = exception;
+
+    function = &profile->functions[frame->function];
+    frame->outermost = (0 == function->active);
+    function->active++;
+    function->calls++;
+    profile->nodes[node].calls++;
+
+    if (exception)
+    {
+        profile->num_exception_frames++;
+    }
+}
+
+
+/*
+ * Pop the top frame from the shadow call-stack, accumulating its
+ * inclusive count. Returns false if the stack was already empty.
+ */
+static bool pop_frame(
+    te_call_profile_t * const profile)
+{
+    const te_call_frame_t * frame;
+    te_call_function_t * function;
+    uint64_t count;
+
+    assert(profile);
+
+    attribute(profile);
+
+    if (profile->untracked)
+    {
+        profile->untracked--;
+        return true;
+    }
+    if (0 == profile->depth)
+    {
+        return false;
+    }
+
+    frame = &profile->stack[--profile->depth];
+    count = profile->num_instructions - frame->entered;
+    function = &profile->functions[frame->function];
+
+    profile->nodes[frame->node].inclusive += count;
+    function->active--;
+    if (frame->outermost)
+    {
+        function->inclusive += count;   /* not already counted */
+    }
+    if (frame->exception)
+    {
+        profile->num_exception_frames--;
+    }
+
+    return true;
+}
+
+
+/*
+ * Start a new call-tree root, for the function containing "pc", as the
+ * functions on the stack (if any) are no longer known to be executing.
+ */
+static void new_root(
+    te_call_profile_t * const profile,
+    const te_address_t pc)
+{
+    te_address_t start;
+
+    te_flush_call_profile(profile);
+
+    (void)te_call_profile_symbol(profile, pc, &start);
+    push_frame(profile, start, 0, false);
+}
+
+
+/*
+ * Initialize a new instance of the call-tree profiler.
+ * If "profile" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ * In both cases, the call-tree and function tables are dynamically
+ * allocated, and should be released by calling te_close_call_profile().
+ */
+extern te_call_profile_t * te_open_call_profile(
+    te_call_profile_t * profile)
+{
+    if (profile)
+    {
+        memset(profile, 0, sizeof(te_call_profile_t));
+    }
+    else
+    {
+        profile = calloc(1, sizeof(te_call_profile_t));
+        assert(profile);
+    }
+
+    profile->nodes = calloc(TE_CALL_PROFILE_TABLE_SIZE, sizeof(te_call_node_t));
+    profile->functions = calloc(TE_CALL_PROFILE_TABLE_SIZE, sizeof(te_call_function_t));
+    assert(profile->nodes);
+    assert(profile->functions);
+
+    return profile;
+}
+
+
+/*
+ * Release the tables allocated by te_open_call_profile(),
+ * and the copy of the symbol table (if any).
+ */
+extern void te_close_call_profile(
+    te_call_profile_t * const profile)
+{
+    assert(profile);
+
+    free(profile->nodes);
+    free(profile->functions);
+    free(profile->symbols);
+    profile->nodes = NULL;
+    profile->functions = NULL;
+    profile->symbols = NULL;
+    profile->num_symbols = 0;
+}
+
+
+/*
+ * Order symbols by address, for qsort().
+ */
+static int compare_symbols(
+    const void * const a,
+    const void * const b)
+{
+    const te_address_t first = ((const te_symbol_t *)a)->address;
+    const te_address_t second = ((const te_symbol_t *)b)->address;
+
+    return (first > second) - (first < second);
+}
+
+
+/*
+ * Set the symbol table used to find the function containing each address.
+ * The table is copied (and sorted), but not the names, which must remain
+ * valid until the profile is closed. This should be done before the first
+ * PC, as functions are identified by the start of their symbol when they
+ * are first entered. Without symbols, each function is identified by the
+ * address that was called.
+ */
+extern void te_set_call_profile_symbols(
+    te_call_profile_t * const profile,
+    const te_symbol_t * const symbols,
+    const size_t num_symbols)
+{
+    assert(profile);
+    assert(symbols || !num_symbols);
+
+    free(profile->symbols);
+    profile->symbols = calloc(num_symbols ? num_symbols : 1u, sizeof(te_symbol_t));
+    assert(profile->symbols);
+    memcpy(profile->symbols, symbols, num_symbols * sizeof(te_symbol_t));
+    qsort(profile->symbols, num_symbols, sizeof(te_symbol_t), compare_symbols);
+    profile->num_symbols = num_symbols;
+}
+
+
+/*
+ * Find the symbol containing "address", in a table of "num_symbols"
+ * symbols, sorted by address. Returns NULL if there is no such symbol.
+ * If "start" is not NULL, then the address of that symbol (or "address"
+ * itself, if there is none) is written to it.
+ */
+extern const te_symbol_t * te_lookup_symbol(
+    const te_symbol_t * const symbols,
+    const size_t num_symbols,
+    const te_address_t address,
+    te_address_t * const start)
+{
+    const te_symbol_t * symbol = NULL;
+    size_t low = 0;
+    size_t high = num_symbols;
+
+    /* find the last symbol at, or below, "address" */
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2u;
+        if (symbols[middle].address <= address)
+        {
+            symbol = &symbols[middle];
+            low = middle + 1u;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if ( (symbol) &&
+         (symbol->size) &&
+         (address - symbol->address >= symbol->size) )
+    {
+        symbol = NULL;  /* beyond the end of that symbol */
+    }
+
+    if (start)
+    {
+        *start = symbol ? symbol->address : address;
+    }
+
+    return symbol;
+}
+
+
+/*
+ * Return the name of the symbol containing "address", or NULL if there
+ * is no such symbol, using the symbol table set for the profile.
+ * If "start" is not NULL, it is written as by te_lookup_symbol().
+ */
+extern const char * te_call_profile_symbol(
+    const te_call_profile_t * const profile,
+    const te_address_t address,
+    te_address_t * const start)
+{
+    const te_symbol_t * symbol;
+
+    assert(profile);
+
+    symbol = te_lookup_symbol(profile->symbols, profile->num_symbols, address, start);
+
+    return symbol ? symbol->name : NULL;
+}
+
+
+/*
+ * Process the next PC reconstructed by the trace-decoder, given just the
+ * length of the instruction at that PC, and the transfer of control that
+ * it performs (see te_classify_transfer), e.g. as recorded by a fan-out
+ * sink (see decoder-fanout.h), so this need not be on the decoder's thread.
+ *
+ * The transfer of control performed by the previous instruction decides
+ * what happens to the stack: a call pushes a frame, a return pops one,
+ * and a trap return pops up to (and including) the most recent frame
+ * entered via an exception. Any other discontinuity after an instruction
+ * that does not transfer control is an exception (or interrupt), which
+ * pushes a frame. A return with nothing left on the stack starts a new
+ * root of the call-tree. Each of these costs O(1) (the frames popped by a
+ * trap return were each pushed once), and most PCs do none of them.
+ */
+extern void te_call_profile_step(
+    te_call_profile_t * const profile,
+    const te_address_t pc,
+    const unsigned length,
+    const te_transfer_t transfer)
+{
+    assert(profile);
+
+    if ( (0 == profile->depth) && (0 == profile->untracked) )
+    {
+        /* the first PC, or the first since the profile was flushed */
+        new_root(profile, pc);
+    }
+    else switch (profile->transfer)
+    {
+        case TE_TRANSFER_CALL:
+            push_frame(profile, pc, profile->return_address, false);
+            break;
+
+        case TE_TRANSFER_RETURN:
+            if ( (0 == profile->untracked) &&
+                 (profile->stack[profile->depth - 1u].return_address) &&
+                 (profile->stack[profile->depth - 1u].return_address != pc) )
+            {
+                profile->num_mismatches++;
+            }
+            (void)pop_frame(profile);
+            if ( (0 == profile->depth) && (0 == profile->untracked) )
+            {
+                /* returned to a caller we never saw */
+                profile->num_underflows++;
+                new_root(profile, pc);
+            }
+            break;
+
+        case TE_TRANSFER_TRAP_RETURN:
+            if (profile->num_exception_frames)
+            {
+                /* frames above an exception frame are all tracked */
+                profile->untracked = 0;
+                while (!profile->stack[profile->depth - 1u].exception)
+                {
+                    (void)pop_frame(profile);
+                }
+                (void)pop_frame(profile);
+            }
+            if ( (0 == profile->depth) && (0 == profile->untracked) )
+            {
+                /* returned from a trap we never saw */
+                profile->num_underflows++;
+                new_root(profile, pc);
+            }
+            break;
+
+        case TE_TRANSFER_NONE:
+            if (pc != profile->next_sequential_pc)
+            {
+                profile->num_exceptions++;
+                push_frame(profile, pc, 0, true);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    profile->transfer = transfer;
+    profile->next_sequential_pc = pc + length;
+    profile->return_address = profile->next_sequential_pc;
+    profile->num_instructions++;
+}
+
+
+/*
+ * Process the next PC reconstructed by the trace-decoder, and the
+ * instruction at that PC, as passed to te_advance_decoded_pc().
+ */
+extern void te_call_profile_advance(
+    te_call_profile_t * const profile,
+    const te_address_t pc,
+    const te_decoded_instruction_t * const instr)
+{
+    assert(instr);
+
+    te_call_profile_step(profile, pc, instr->length, te_classify_transfer(instr));
+}
+
+
+/*
+ * Pop all the frames from the shadow call-stack, accumulating their
+ * inclusive counts. Call this at the end of the trace, before printing
+ * the profile, and also when there is a gap in the trace (see
+ * te_set_gap_handler), as the stack is no longer known to be valid.
+ * The next PC will then start a new root of the call-tree.
+ */
+extern void te_flush_call_profile(
+    te_call_profile_t * const profile)
+{
+    assert(profile);
+
+    profile->untracked = 0;
+    while (pop_frame(profile))
+    {
+        /* keep popping */
+    }
+    profile->num_exception_frames = 0;
+}
+
+
+/*
+ * Print the name of the function starting at "address", or the address.
+ */
+static void print_function(
+    const te_call_profile_t * const profile,
+    const te_address_t address)
+{
+    const char * const name = te_call_profile_symbol(profile, address, NULL);
+
+    if (name)
+    {
+        printf("%s", name);
+    }
+    else
+    {
+        printf("0x%lx", address);
+    }
+}
+
+
+/*
+ * Print out the counts for each function, and then for each call path,
+ * (as the list of functions from the root, separated by ';'), with the
+ * number of calls, and the inclusive and exclusive instruction counts.
+ */
+extern void te_print_call_profile(
+    const te_call_profile_t * const profile)
+{
+    uint32_t path[TE_CALL_PROFILE_MAX_DEPTH];
+    size_t slot;
+
+    assert(profile);
+
+    printf("call-profile: %lu instructions\n",
+        (unsigned long)profile->num_instructions);
+
+    printf("functions:\n");
+    for (slot = 0; slot < TE_CALL_PROFILE_TABLE_SIZE; slot++)
+    {
+        const te_call_function_t * const function = &profile->functions[slot];
+        if (function->calls)
+        {
+            printf("  ");
+            print_function(profile, function->address);
+            printf(": %lu calls, %lu inclusive, %lu exclusive\n",
+                (unsigned long)function->calls,
+                (unsigned long)function->inclusive,
+                (unsigned long)function->exclusive);
+        }
+    }
+
+    printf("call-paths:\n");
+    for (slot = 0; slot < TE_CALL_PROFILE_TABLE_SIZE; slot++)
+    {
+        const te_call_node_t * const node = &profile->nodes[slot];
+        size_t depth = 0;
+        uint32_t up;
+
+        if (0 == node->calls)
+        {
+            continue;
+        }
+        for (up = (uint32_t)slot; TE_CALL_PROFILE_NO_PARENT != up;
+             up = profile->nodes[up].parent)
+        {
+            path[depth++] = up;
+        }
+        printf("  ");
+        while (depth--)
+        {
+            print_function(profile,
+                profile->functions[profile->nodes[path[depth]].function].address);
+            printf("%s", depth ? ";" : "");
+        }
+        printf(": %lu calls, %lu inclusive, %lu exclusive\n",
+            (unsigned long)node->calls,
+            (unsigned long)node->inclusive,
+            (unsigned long)node->exclusive);
+    }
+
+    printf("statistics: %lu exceptions, %lu underflows, %lu mismatches, "
+        "%lu overflows, %lu dropped\n",
+        profile->num_exceptions,
+        profile->num_underflows,
+        profile->num_mismatches,
+        profile->num_overflows,
+        profile->num_dropped);
+}
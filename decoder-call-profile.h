@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_CALL_PROFILE_H
+#define TE_DECODER_CALL_PROFILE_H
+
+
+/*
+ * A call-tree profiling sink, fed with every PC reconstructed by the
+ * trace-decoder (i.e. from te_advance_decoded_pc). It maintains a shadow
+ * call-stack from the calls and returns classified by te_classify_transfer(),
+ * and accumulates inclusive and exclusive instruction counts, both for each
+ * function, and for each call path (i.e. each node in the call-tree).
+ * Instructions are never counted one at a time: they are attributed to the
+ * current frame only when the stack changes, so each event costs O(1).
+ */
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * Define the capacity of the shadow call-stack. Calls made whilst it is
+ * full are not tracked (their instructions are attributed to the caller),
+ * but are counted, so that their returns can be matched correctly.
+ * If not defined elsewhere, define TE_CALL_PROFILE_MAX_DEPTH here.
+ */
+#if !defined(TE_CALL_PROFILE_MAX_DEPTH)
+#   define TE_CALL_PROFILE_MAX_DEPTH (1u<<10)  /* 2^10 = 1024 frames */
+#endif  /* TE_CALL_PROFILE_MAX_DEPTH */
+
+
+/*
+ * Define the number of slots (must be a power of 2) in the fixed-size
+ * open-addressing tables of call-tree nodes and of functions. Each table
+ * holds at most 3/4 of this many entries. As with a full stack, calls
+ * which would need a new entry in a full table are not tracked.
+ * If not defined elsewhere, define TE_CALL_PROFILE_TABLE_BITS here.
+ */
+#if !defined(TE_CALL_PROFILE_TABLE_BITS)
+#   define TE_CALL_PROFILE_TABLE_BITS (16)     /* 2^16 = 65536 slots */
+#endif  /* TE_CALL_PROFILE_TABLE_BITS */
+#define TE_CALL_PROFILE_TABLE_SIZE  (1u<<TE_CALL_PROFILE_TABLE_BITS)
+
+
+/*
+ * The "parent" of a root of the call-tree, i.e. a function whose
+ * caller is not known (e.g. it was executing when the trace started).
+ */
+#define TE_CALL_PROFILE_NO_PARENT   (UINT32_MAX)
+
+
+/*
+ * One entry in a symbol table, used to find the function containing
+ * an address. If "size" is zero, the function is assumed to extend to
+ * the next symbol.
+ */
+typedef struct
+{
+    te_address_t address;
+    te_address_t size;
+    const char * name;
+} te_symbol_t;
+
+
+/*
+ * Counts for one function. "inclusive" includes everything called from
+ * the function, but recursive calls are only counted once (from the
+ * outermost frame). "active" is the number of its frames on the stack.
+ * An unused slot has a zero "calls".
+ */
+typedef struct
+{
+    te_address_t address;       /* entry point, or start of its symbol */
+    uint64_t calls;             /* times entered */
+    uint64_t inclusive;         /* instructions, including callees */
+    uint64_t exclusive;         /* instructions, excluding callees */
+    unsigned active;            /* frames currently on the stack */
+} te_call_function_t;
+
+
+/*
+ * One node in the call-tree, i.e. one call path. The key is the
+ * pair ("parent", "target"). An unused slot has a zero "calls".
+ */
+typedef struct
+{
+    uint32_t parent;            /* slot of the parent, or NO_PARENT */
+    uint32_t function;          /* slot in the function table */
+    te_address_t target;        /* address that was called */
+    uint64_t calls;             /* times entered along this path */
+    uint64_t inclusive;         /* instructions, including callees */
+    uint64_t exclusive;         /* instructions, excluding callees */
+} te_call_node_t;
+
+
+/*
+ * One frame on the shadow call-stack.
+ */
+typedef struct
+{
+    uint32_t node;              /* slot in the call-tree */
+    uint32_t function;          /* slot in the function table */
+    uint64_t entered;           /* instruction count on entry */
+    te_address_t return_address;    /* expected, or 0 if not known */
+    bool outermost;             /* function not already on the stack */
+    bool exception;             /* true if entered via an exception */
+} te_call_frame_t;
+
+
+/*
+ * The following structure is used to hold all the state for a single
+ * instance of the call-tree profiler. As with te_decoder_state_t,
+ * each core being traced should have its own unique instance.
+ */
+typedef struct
+{
+    /* the shadow call-stack */
+    te_call_frame_t stack[TE_CALL_PROFILE_MAX_DEPTH];
+    size_t depth;               /* number of valid frames */
+    size_t untracked;           /* calls not pushed, still to return */
+    size_t num_exception_frames;    /* frames entered via an exception */
+
+    /* fixed-size open-addressing tables, allocated when opened */
+    te_call_node_t * nodes;
+    size_t num_nodes;
+    te_call_function_t * functions;
+    size_t num_functions;
+
+    /* optional symbol table (sorted by address) */
+    te_symbol_t * symbols;
+    size_t num_symbols;
+
+    /* the previous PC, and what it does */
+    te_transfer_t transfer;     /* of the previous instruction */
+    te_address_t next_sequential_pc;    /* after the previous instruction */
+    te_address_t return_address;        /* if the previous is a call */
+
+    uint64_t num_instructions;  /* instructions seen */
+    uint64_t attributed;        /* instructions attributed so far */
+
+    /* maintain a few statistics */
+    unsigned long num_overflows;    /* calls not tracked (stack full) */
+    unsigned long num_dropped;      /* calls not tracked (table full) */
+    unsigned long num_underflows;   /* returns with an empty stack */
+    unsigned long num_mismatches;   /* returns to an unexpected address */
+    unsigned long num_exceptions;   /* exceptions (or interrupts) */
+} te_call_profile_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_call_profile_t * te_open_call_profile(
+    te_call_profile_t * profile);
+
+extern void te_close_call_profile(
+    te_call_profile_t * const profile);
+
+extern void te_set_call_profile_symbols(
+    te_call_profile_t * const profile,
+    const te_symbol_t * const symbols,
+    const size_t num_symbols);
+
+extern void te_call_profile_step(
+    te_call_profile_t * const profile,
+    const te_address_t pc,
+    const unsigned length,
+    const te_transfer_t transfer);
+
+extern void te_call_profile_advance(
+    te_call_profile_t * const profile,
+    const te_address_t pc,
+    const te_decoded_instruction_t * const instr);
+
+extern void te_flush_call_profile(
+    te_call_profile_t * const profile);
+
+extern const te_symbol_t * te_lookup_symbol(
+    const te_symbol_t * const symbols,
+    const size_t num_symbols,
+    const te_address_t address,
+    te_address_t * const start);
+
+extern const char * te_call_profile_symbol(
+    const te_call_profile_t * const profile,
+    const te_address_t address,
+    te_address_t * const start);
+
+extern void te_print_call_profile(
+    const te_call_profile_t * const profile);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_DECODER_CALL_PROFILE_H */
@@ -0,0 +1,492 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "decoder-fanout.h"
+#include "decoder-call-profile.h"
+#include "decoder-verifier.h"
+
+
+/*
+ * Return the number of batches processed by the slowest threaded analysis,
+ * or "produced" if there are none. The caller must hold the lock.
+ */
+static size_t slowest_consumed(
+    const te_fanout_t * const fanout)
+{
+    size_t consumed = fanout->produced;
+    size_t i;
+
+    for (i = 0; i < fanout->num_analyses; i++)
+    {
+        if ( (fanout->analyses[i].threaded) &&
+             (fanout->analyses[i].consumed < consumed) )
+        {
+            consumed = fanout->analyses[i].consumed;
+        }
+    }
+
+    return consumed;
+}
+
+
+/*
+ * Start filling the next batch of the ring, waiting (if necessary) for
+ * every threaded analysis to have finished with it. The caller must hold
+ * the lock.
+ */
+static void next_batch(
+    te_fanout_t * const fanout)
+{
+    while (fanout->produced - slowest_consumed(fanout) >= TE_FANOUT_NUM_BATCHES)
+    {
+        fanout->num_stalls++;       /* update statistics */
+        pthread_cond_wait(&fanout->changed, &fanout->lock);
+    }
+
+    fanout->filling = &fanout->batches[fanout->produced % TE_FANOUT_NUM_BATCHES];
+    fanout->next = fanout->filling->records;
+    fanout->limit = fanout->filling->records + TE_FANOUT_BATCH_SIZE;
+}
+
+
+/*
+ * Hand over the batch being filled (if it holds any records): pass it to
+ * each inline analysis, and then to the threaded analyses, before
+ * starting to fill the next batch.
+ */
+static void hand_over(
+    te_fanout_t * const fanout)
+{
+    te_fanout_batch_t * const batch = fanout->filling;
+    size_t i;
+
+    assert(fanout);
+    assert(batch);
+
+    batch->count = (size_t)(fanout->next - batch->records);
+    if (0 == batch->count)
+    {
+        return;
+    }
+
+    for (i = 0; i < fanout->num_analyses; i++)
+    {
+        if (!fanout->analyses[i].threaded)
+        {
+            fanout->analyses[i].process(fanout->analyses[i].data,
+                batch->records, batch->count);
+        }
+    }
+
+    pthread_mutex_lock(&fanout->lock);
+    fanout->produced++;
+    pthread_cond_broadcast(&fanout->changed);
+    next_batch(fanout);
+    pthread_mutex_unlock(&fanout->lock);
+}
+
+
+/*
+ * The body of the thread of each threaded analysis, which processes each
+ * batch in turn, until there are no more.
+ */
+static void * analysis_thread(
+    void * const arg)
+{
+    te_fanout_analysis_t * const analysis = arg;
+    te_fanout_t * const fanout = analysis->fanout;
+    const te_fanout_batch_t * batch;
+
+    assert(analysis);
+    assert(fanout);
+
+    pthread_mutex_lock(&fanout->lock);
+    while (true)
+    {
+        while ( (analysis->consumed == fanout->produced) && (!fanout->ended) )
+        {
+            analysis->num_stalls++;     /* update statistics */
+            pthread_cond_wait(&fanout->changed, &fanout->lock);
+        }
+        if (analysis->consumed == fanout->produced)
+        {
+            break;  /* ended, and all processed */
+        }
+        batch = &fanout->batches[analysis->consumed % TE_FANOUT_NUM_BATCHES];
+        pthread_mutex_unlock(&fanout->lock);
+
+        analysis->process(analysis->data, batch->records, batch->count);
+
+        pthread_mutex_lock(&fanout->lock);
+        analysis->consumed++;
+        pthread_cond_broadcast(&fanout->changed);
+    }
+    pthread_mutex_unlock(&fanout->lock);
+
+    return NULL;
+}
+
+
+/*
+ * Forward the retrieval of each instruction to the wrapped callbacks.
+ */
+static unsigned fanout_get_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const te_fanout_t * const fanout = user_data;
+
+    return fanout->callbacks.get_instruction(fanout->user_data, address, instruction);
+}
+
+
+/*
+ * Notify the wrapped callbacks of each new PC, and then record it.
+ */
+static void fanout_advance_decoded_pc(
+    void * const user_data,
+    const te_address_t old_pc,
+    const te_address_t new_pc,
+    const te_decoded_instruction_t * const new_instruction)
+{
+    te_fanout_t * const fanout = user_data;
+
+    if (fanout->callbacks.advance_decoded_pc)
+    {
+        fanout->callbacks.advance_decoded_pc(fanout->user_data,
+            old_pc, new_pc, new_instruction);
+    }
+
+    te_fanout_advance(fanout, new_pc, new_instruction);
+}
+
+
+/*
+ * Forward each diagnostic to the wrapped callbacks (if they print them).
+ */
+static void fanout_log(
+    void * const user_data,
+    const char * const format,
+    va_list args)
+{
+    const te_fanout_t * const fanout = user_data;
+
+    if (fanout->callbacks.log)
+    {
+        fanout->callbacks.log(fanout->user_data, format, args);
+    }
+}
+
+
+const te_decoder_callbacks_t te_fanout_callbacks =
+{
+    .get_instruction = fanout_get_instruction,
+    .advance_decoded_pc = fanout_advance_decoded_pc,
+    .log = fanout_log,
+};
+
+
+/*
+ * Initialize a new instance of a fan-out sink, wrapping "callbacks" (which
+ * are copied), which are called with "user_data" exactly as if they had been
+ * passed to te_open_trace_decoder() directly. If "callbacks" is NULL, then
+ * te_default_decoder_callbacks is used. Its advance_decoded_pc may be NULL,
+ * if every analysis is registered with te_add_fanout_analysis().
+ * If "fanout" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ *
+ * The trace-decoder should then be opened with te_fanout_callbacks, and
+ * with "fanout" as its "user_data".
+ */
+extern te_fanout_t * te_open_fanout(
+    te_fanout_t * fanout,
+    const te_decoder_callbacks_t * const callbacks,
+    void * const user_data)
+{
+#if defined(TE_NO_DEFAULT_CALLBACKS)
+    assert(callbacks);
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+
+    if (fanout)
+    {
+        memset(fanout, 0, sizeof(te_fanout_t));
+    }
+    else
+    {
+        fanout = calloc(1, sizeof(te_fanout_t));
+        assert(fanout);
+    }
+
+#if defined(TE_NO_DEFAULT_CALLBACKS)
+    fanout->callbacks = *callbacks;
+#else   /* TE_NO_DEFAULT_CALLBACKS */
+    fanout->callbacks = callbacks ? *callbacks : te_default_decoder_callbacks;
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+    assert(fanout->callbacks.get_instruction);
+    fanout->user_data = user_data;
+
+    fanout->batches = malloc(TE_FANOUT_NUM_BATCHES * sizeof(te_fanout_batch_t));
+    assert(fanout->batches);
+
+    pthread_mutex_init(&fanout->lock, NULL);
+    pthread_cond_init(&fanout->changed, NULL);
+
+    /* the decoding side always has a batch to fill */
+    next_batch(fanout);
+
+    return fanout;
+}
+
+
+/*
+ * Register an analysis, i.e. a function to be called with each batch of
+ * records, in order, with "data". If "threaded", it is called on its own
+ * thread (which is started here), otherwise on the decoding thread.
+ * All analyses must be registered before the first PC is recorded.
+ * Returns 0 on success, ENOSPC if there are already TE_FANOUT_MAX_ANALYSES,
+ * or an error number from pthread_create().
+ */
+extern int te_add_fanout_analysis(
+    te_fanout_t * const fanout,
+    const te_fanout_process_t process,
+    void * const data,
+    const bool threaded)
+{
+    te_fanout_analysis_t * analysis;
+    int status = 0;
+
+    assert(fanout);
+    assert(process);
+    assert(0 == fanout->num_records);
+
+    if (TE_FANOUT_MAX_ANALYSES == fanout->num_analyses)
+    {
+        return ENOSPC;
+    }
+
+    analysis = &fanout->analyses[fanout->num_analyses];
+    memset(analysis, 0, sizeof(te_fanout_analysis_t));
+    analysis->fanout = fanout;
+    analysis->process = process;
+    analysis->data = data;
+    analysis->threaded = threaded;
+
+    if (threaded)
+    {
+        status = pthread_create(&analysis->thread, NULL, analysis_thread, analysis);
+    }
+    if (0 == status)
+    {
+        fanout->num_analyses++;
+        fanout->num_threaded += threaded;
+    }
+
+    return status;
+}
+
+
+/*
+ * Record the next PC reconstructed by the trace-decoder, and the
+ * instruction at that PC. This is called (via te_fanout_callbacks) for
+ * every instruction, so (except once per batch) it just stores a record.
+ */
+extern void te_fanout_advance(
+    te_fanout_t * const fanout,
+    const te_address_t pc,
+    const te_decoded_instruction_t * const instr)
+{
+    te_fanout_record_t * const record = fanout->next;
+
+    assert(fanout);
+    assert(instr);
+
+    record->pc = pc;
+    record->length = instr->length;
+    record->transfer = te_classify_transfer(instr);
+    fanout->num_records++;      /* update statistics */
+
+    if (++fanout->next == fanout->limit)
+    {
+        hand_over(fanout);
+    }
+}
+
+
+/*
+ * Record a gap in the trace, normally called from the user's gap handler
+ * (see te_set_gap_handler), so that each analysis sees it at the correct
+ * point in the stream of PCs.
+ */
+extern void te_fanout_gap(
+    te_fanout_t * const fanout)
+{
+    te_fanout_record_t * const record = fanout->next;
+
+    assert(fanout);
+
+    record->pc = 0;
+    record->length = 0;
+    record->transfer = TE_TRANSFER_NONE;
+    fanout->num_records++;      /* update statistics */
+
+    if (++fanout->next == fanout->limit)
+    {
+        hand_over(fanout);
+    }
+}
+
+
+/*
+ * Hand over any records not yet passed to the analyses, without waiting
+ * for the current batch to fill. The threaded analyses may still be
+ * processing them on return.
+ */
+extern void te_flush_fanout(
+    te_fanout_t * const fanout)
+{
+    assert(fanout);
+
+    hand_over(fanout);
+}
+
+
+/*
+ * Called after the last PC has been decoded: hands over any records not
+ * yet passed to the analyses, and waits for every threaded analysis to
+ * process them, and to finish. The results of each analysis may then be
+ * used (by this thread).
+ */
+extern void te_finish_fanout(
+    te_fanout_t * const fanout)
+{
+    size_t i;
+
+    assert(fanout);
+
+    if (fanout->ended)
+    {
+        return;
+    }
+
+    hand_over(fanout);
+
+    pthread_mutex_lock(&fanout->lock);
+    fanout->ended = true;
+    pthread_cond_broadcast(&fanout->changed);
+    pthread_mutex_unlock(&fanout->lock);
+
+    for (i = 0; i < fanout->num_analyses; i++)
+    {
+        if (fanout->analyses[i].threaded)
+        {
+            pthread_join(fanout->analyses[i].thread, NULL);
+        }
+    }
+}
+
+
+/*
+ * Release everything allocated by te_open_fanout(), first finishing
+ * (see te_finish_fanout) if that has not already been done.
+ */
+extern void te_close_fanout(
+    te_fanout_t * const fanout)
+{
+    assert(fanout);
+
+    te_finish_fanout(fanout);
+
+    pthread_cond_destroy(&fanout->changed);
+    pthread_mutex_destroy(&fanout->lock);
+    free(fanout->batches);
+    fanout->batches = NULL;
+    fanout->filling = NULL;
+    fanout->next = fanout->limit = NULL;
+    fanout->num_analyses = 0;
+}
+
+
+/*
+ * An analysis that builds a call-tree profile (see decoder-call-profile.h),
+ * with "data" pointing to the te_call_profile_t. The profile is flushed
+ * at each gap in the trace (see te_fanout_gap).
+ */
+extern void te_fanout_call_profile(
+    void * const data,
+    const te_fanout_record_t * const records,
+    const size_t count)
+{
+    te_call_profile_t * const profile = data;
+    size_t i;
+
+    assert(profile);
+
+    for (i = 0; i < count; i++)
+    {
+        if (records[i].length)
+        {
+            te_call_profile_step(profile, records[i].pc,
+                records[i].length, records[i].transfer);
+        }
+        else
+        {
+            te_flush_call_profile(profile);
+        }
+    }
+}
+
+
+/*
+ * An analysis that checks each PC against the golden PCs of a verifier
+ * (see decoder-verifier.h), with "data" pointing to the te_verifier_t.
+ * As this is called a batch at a time, the verifier should be opened
+ * without a decoder, as its state would be that at the end of a batch,
+ * not at the divergence.
+ */
+extern void te_fanout_verifier(
+    void * const data,
+    const te_fanout_record_t * const records,
+    const size_t count)
+{
+    te_verifier_t * const verifier = data;
+    size_t i;
+
+    assert(verifier);
+
+    for (i = 0; i < count; i++)
+    {
+        if (records[i].length)
+        {
+            te_verify_decoded_pc(verifier, records[i].pc);
+        }
+    }
+}
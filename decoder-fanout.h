@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_FANOUT_H
+#define TE_DECODER_FANOUT_H
+
+
+/*
+ * A fan-out sink, which feeds several analyses from a single pass of the
+ * trace-decoder, rather than decoding the same trace once for each.
+ *
+ * It is installed as the callbacks of a trace-decoder instance (see
+ * te_fanout_callbacks), wrapping the user's own callbacks, which are still
+ * called as before. Each PC disseminated is also appended, as a compact
+ * record, to a batch. Each full batch is passed to every registered
+ * analysis, either directly on the decoding thread ("inline"), or via
+ * a ring of batches shared by all analyses that run on their own threads
+ * ("threaded"). So decoding costs one comparison and a 16-byte store per
+ * PC, the threads only synchronize once per batch, and the total time is
+ * that of the decoder (plus the inline analyses), or of the slowest
+ * threaded analysis, whichever is greater. The ring is bounded, so the
+ * decoder waits if any threaded analysis falls too far behind.
+ *
+ * Analyses attached to the decoder itself (e.g. te_attach_exec_profile,
+ * te_attach_edge_profile and te_attach_coverage) run on the same pass too.
+ */
+#include <pthread.h>
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * Define the number of records in each batch, the number of batches in the
+ * ring (which bounds how far the decoder may run ahead of the slowest
+ * threaded analysis), and the maximum number of analyses.
+ * If not defined elsewhere, define these here.
+ */
+#if !defined(TE_FANOUT_BATCH_SIZE)
+#   define TE_FANOUT_BATCH_SIZE     (1u<<14)    /* 2^14 = 16384 records */
+#endif  /* TE_FANOUT_BATCH_SIZE */
+#if !defined(TE_FANOUT_NUM_BATCHES)
+#   define TE_FANOUT_NUM_BATCHES    (8u)
+#endif  /* TE_FANOUT_NUM_BATCHES */
+#if !defined(TE_FANOUT_MAX_ANALYSES)
+#   define TE_FANOUT_MAX_ANALYSES   (8u)
+#endif  /* TE_FANOUT_MAX_ANALYSES */
+
+
+/*
+ * One PC disseminated by the trace-decoder, with the length of the
+ * instruction at that PC, and the transfer of control it performs (see
+ * te_classify_transfer). A record with a zero length is not a PC, but
+ * marks a gap in the trace (see te_fanout_gap).
+ */
+typedef struct
+{
+    te_address_t pc;
+    uint32_t length;            /* in bytes, or 0 for a gap */
+    te_transfer_t transfer;
+} te_fanout_record_t;
+
+
+/*
+ * One batch of records.
+ */
+typedef struct
+{
+    size_t count;
+    te_fanout_record_t records[TE_FANOUT_BATCH_SIZE];
+} te_fanout_batch_t;
+
+
+/*
+ * Type of function called with each batch of records, in order.
+ * "data" is whatever was passed to te_add_fanout_analysis().
+ */
+typedef void (*te_fanout_process_t)(
+    void * const data,
+    const te_fanout_record_t * const records,
+    const size_t count);
+
+
+/*
+ * One analysis registered with a fan-out sink.
+ */
+typedef struct
+{
+    struct te_fanout_s * fanout;
+    te_fanout_process_t process;
+    void * data;
+    bool threaded;          /* else called on the decoding thread */
+    pthread_t thread;
+    size_t consumed;        /* batches processed (if threaded) */
+    unsigned long num_stalls;   /* times it waited for a batch */
+} te_fanout_analysis_t;
+
+
+/*
+ * The state of one fan-out sink, i.e. for one trace-decoder instance.
+ */
+typedef struct te_fanout_s
+{
+    /* the callbacks being wrapped, and their "user_data" */
+    te_decoder_callbacks_t callbacks;
+    void * user_data;
+
+    /* the decoding side (producer of records) */
+    te_fanout_record_t * next;  /* next record in the current batch */
+    te_fanout_record_t * limit; /* end of the current batch */
+    te_fanout_batch_t * filling;
+
+    /* the registered analyses */
+    te_fanout_analysis_t analyses[TE_FANOUT_MAX_ANALYSES];
+    size_t num_analyses;
+    size_t num_threaded;
+
+    /* the ring of batches, shared with the threaded analyses */
+    te_fanout_batch_t * batches;
+    size_t produced;        /* batches handed over */
+    bool ended;             /* no more batches will be handed over */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    /* maintain a few statistics */
+    unsigned long num_records;  /* PCs (and gaps) recorded */
+    unsigned long num_stalls;   /* times decoding waited for a batch */
+} te_fanout_t;
+
+
+/*
+ * The callbacks to pass to te_open_trace_decoder(), together with the
+ * te_fanout_t (as its "user_data").
+ */
+extern const te_decoder_callbacks_t te_fanout_callbacks;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_fanout_t * te_open_fanout(
+    te_fanout_t * fanout,
+    const te_decoder_callbacks_t * const callbacks,
+    void * const user_data);
+
+extern int te_add_fanout_analysis(
+    te_fanout_t * const fanout,
+    const te_fanout_process_t process,
+    void * const data,
+    const bool threaded);
+
+extern void te_fanout_advance(
+    te_fanout_t * const fanout,
+    const te_address_t pc,
+    const te_decoded_instruction_t * const instr);
+
+extern void te_fanout_gap(
+    te_fanout_t * const fanout);
+
+extern void te_flush_fanout(
+    te_fanout_t * const fanout);
+
+extern void te_finish_fanout(
+    te_fanout_t * const fanout);
+
+extern void te_close_fanout(
+    te_fanout_t * const fanout);
+
+extern void te_fanout_call_profile(
+    void * const data,
+    const te_fanout_record_t * const records,
+    const size_t count);
+
+extern void te_fanout_verifier(
+    void * const data,
+    const te_fanout_record_t * const records,
+    const size_t count);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_DECODER_FANOUT_H */
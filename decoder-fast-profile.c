@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include "decoder-fast-profile.h"
+
+
+/*
+ * When matching a return (with a known source) against the shadow
+ * call-stack, only look this many frames down from the top. This keeps
+ * the cost of each packet bounded, whilst still allowing for the
+ * occasional frame that is skipped (e.g. by longjmp(), or a tail-call).
+ */
+#define MAX_RETURN_SEARCH   (8u)
+
+
+/*
+ * Return a pointer to the frame "n" frames below the top of the stack.
+ * n == 0 is the top of the stack. Only safe if n < depth.
+ */
+static te_fast_profile_frame_t * frame_at(
+    te_fast_profile_state_t * const profile,
+    const size_t n)
+{
+    assert(profile);
+    assert(n < profile->depth);
+
+    return &profile->stack[(profile->top - 1u - n) & (TE_FAST_PROFILE_MAX_DEPTH - 1u)];
+}
+
+
+/*
+ * Return the function currently executing, i.e. the one on the top of
+ * the shadow call-stack, or TE_FAST_PROFILE_ROOT if it is empty.
+ */
+static te_address_t current_function(
+    te_fast_profile_state_t * const profile)
+{
+    assert(profile);
+
+    return profile->depth ? frame_at(profile, 0)->function : TE_FAST_PROFILE_ROOT;
+}
+
+
+/*
+ * Hash a (caller, callee) pair into a slot number in the edge table.
+ */
+static size_t edge_hash(
+    const te_address_t caller,
+    const te_address_t callee)
+{
+    uint64_t key = (caller * 0x9e3779b97f4a7c15ull) ^ (callee >> 1);
+
+    key ^= key >> 29;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 32;
+
+    return (size_t)key;
+}
+
+
+/*
+ * Double the number of slots in the edge table, and re-insert all
+ * the existing edges. This is only done when it becomes half full,
+ * so the amortized cost per packet is constant.
+ */
+static void grow_edges(
+    te_fast_profile_state_t * const profile)
+{
+    const te_fast_profile_edge_t * const old = profile->edges;
+    const size_t old_size = profile->edge_mask + 1u;
+    size_t i;
+
+    assert(profile);
+
+    profile->edge_mask = (old_size << 1) - 1u;
+    profile->edges = calloc(profile->edge_mask + 1u, sizeof(te_fast_profile_edge_t));
+    assert(profile->edges);
+
+    for (i = 0; i < old_size; i++)
+    {
+        if (old[i].count)
+        {
+            size_t slot = edge_hash(old[i].caller, old[i].callee) & profile->edge_mask;
+            while (profile->edges[slot].count)
+            {
+                slot = (slot + 1u) & profile->edge_mask;
+            }
+            profile->edges[slot] = old[i];
+        }
+    }
+
+    free((void *)old);
+}
+
+
+/*
+ * Increment the count of the call-graph edge from "caller" to "callee",
+ * adding the edge to the table if this is its first occurrence.
+ */
+static void count_edge(
+    te_fast_profile_state_t * const profile,
+    const te_address_t caller,
+    const te_address_t callee)
+{
+    size_t slot;
+
+    assert(profile);
+
+    slot = edge_hash(caller, callee) & profile->edge_mask;
+    while (profile->edges[slot].count)
+    {
+        if ( (profile->edges[slot].caller == caller) &&
+             (profile->edges[slot].callee == callee) )
+        {
+            profile->edges[slot].count++;
+            return;
+        }
+        slot = (slot + 1u) & profile->edge_mask;
+    }
+
+    /* first occurrence of this edge */
+    profile->edges[slot].caller = caller;
+    profile->edges[slot].callee = callee;
+    profile->edges[slot].count = 1;
+    profile->num_edges++;
+
+    if (2u * profile->num_edges > profile->edge_mask)
+    {
+        grow_edges(profile);
+    }
+}
+
+
+/*
+ * Push a new frame onto the shadow call-stack.
+ * If the stack is already full, then the oldest frame is discarded.
+ */
+static void push_frame(
+    te_fast_profile_state_t * const profile,
+    const te_fast_profile_t * const packet,
+    const bool exception)
+{
+    te_fast_profile_frame_t * frame;
+
+    assert(profile);
+    assert(packet);
+
+    frame = &profile->stack[profile->top];
+    frame->function = packet->destination;
+    frame->call_site = packet->has_source ? packet->source : 0;
+    frame->exception = exception;
+
+    profile->top = (profile->top + 1u) & (TE_FAST_PROFILE_MAX_DEPTH - 1u);
+    if (TE_FAST_PROFILE_MAX_DEPTH == profile->depth)
+    {
+        profile->num_overflows++;   /* oldest frame has been overwritten */
+    }
+    else
+    {
+        profile->depth++;
+    }
+}
+
+
+/*
+ * Discard the top "n" frames from the shadow call-stack.
+ */
+static void pop_frames(
+    te_fast_profile_state_t * const profile,
+    const size_t n)
+{
+    assert(profile);
+    assert(n <= profile->depth);
+
+    profile->top = (profile->top - n) & (TE_FAST_PROFILE_MAX_DEPTH - 1u);
+    profile->depth -= n;
+}
+
+
+/*
+ * Process a return (from a function call). If we know the return
+ * address and the call site, then match them up (a return address must
+ * be 2 or 4 bytes after its call site), otherwise just pop one frame.
+ */
+static void process_return(
+    te_fast_profile_state_t * const profile,
+    const te_fast_profile_t * const packet)
+{
+    const size_t limit = (profile->depth < MAX_RETURN_SEARCH) ?
+                          profile->depth : MAX_RETURN_SEARCH;
+    size_t n;
+
+    assert(profile);
+    assert(packet);
+
+    if (0 == profile->depth)
+    {
+        profile->num_underflows++;
+        return;
+    }
+
+    for (n = 0; n < limit; n++)
+    {
+        const te_address_t call_site = frame_at(profile, n)->call_site;
+        if (0 == call_site)
+        {
+            break;  /* call site not known, so cannot match */
+        }
+        if ( (packet->destination == call_site + 2u) ||
+             (packet->destination == call_site + 4u) )
+        {
+            pop_frames(profile, n + 1u);
+            return;
+        }
+    }
+
+    if (frame_at(profile, 0)->call_site)
+    {
+        profile->num_mismatches++;  /* had a call site, but no match */
+    }
+    pop_frames(profile, 1);
+}
+
+
+/*
+ * Process a return from an exception (or interrupt), by popping frames
+ * up to and including the most recent frame entered via an exception.
+ */
+static void process_exception_return(
+    te_fast_profile_state_t * const profile)
+{
+    const size_t limit = (profile->depth < MAX_RETURN_SEARCH) ?
+                          profile->depth : MAX_RETURN_SEARCH;
+    size_t n;
+
+    assert(profile);
+
+    if (0 == profile->depth)
+    {
+        profile->num_underflows++;
+        return;
+    }
+
+    for (n = 0; n < limit; n++)
+    {
+        if (frame_at(profile, n)->exception)
+        {
+            pop_frames(profile, n + 1u);
+            return;
+        }
+    }
+
+    profile->num_mismatches++;
+    pop_frames(profile, 1);
+}
+
+
+/*
+ * Process a single fast profiling message.
+ * Called each time a fast profiling message is received.
+ *
+ * Calls and exceptions count an edge in the call-graph, from the function
+ * currently executing to the destination, and then push a new frame.
+ * Returns pop the shadow call-stack. No instructions are ever retrieved,
+ * so the cost per message is small, and independent of the code executed.
+ */
+extern void te_process_fast_profile(
+    te_fast_profile_state_t * const profile,
+    const te_fast_profile_t * const packet)
+{
+    assert(profile);
+    assert(packet);
+
+    profile->num_packets++;     /* update statistics */
+
+    switch (packet->event)
+    {
+        case TE_FAST_PROFILE_CALL:
+        case TE_FAST_PROFILE_EXCEPTION:
+            count_edge(profile, current_function(profile), packet->destination);
+            push_frame(profile, packet, TE_FAST_PROFILE_EXCEPTION == packet->event);
+            break;
+
+        case TE_FAST_PROFILE_RETURN:
+            process_return(profile, packet);
+            break;
+
+        case TE_FAST_PROFILE_EXCEPTION_RETURN:
+            process_exception_return(profile);
+            break;
+
+        default:
+            assert(!"unknown fast profiling event");
+            break;
+    }
+}
+
+
+/*
+ * Return the call-graph edge from "caller" to "callee",
+ * or NULL if "callee" has never been entered from "caller".
+ */
+extern const te_fast_profile_edge_t * te_find_fast_profile_edge(
+    const te_fast_profile_state_t * const profile,
+    const te_address_t caller,
+    const te_address_t callee)
+{
+    size_t slot;
+
+    assert(profile);
+
+    slot = edge_hash(caller, callee) & profile->edge_mask;
+    while (profile->edges[slot].count)
+    {
+        if ( (profile->edges[slot].caller == caller) &&
+             (profile->edges[slot].callee == callee) )
+        {
+            return &profile->edges[slot];
+        }
+        slot = (slot + 1u) & profile->edge_mask;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Initialize a new instance of a fast profiling decoder.
+ * If "profile" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ * In both cases, the call-graph edge table is dynamically allocated, and
+ * must be released by calling te_close_fast_profile().
+ */
+extern te_fast_profile_state_t * te_open_fast_profile(
+    te_fast_profile_state_t * profile)
+{
+    if (profile)
+    {
+        memset(profile, 0, sizeof(te_fast_profile_state_t));
+    }
+    else
+    {
+        profile = calloc(1, sizeof(te_fast_profile_state_t));
+        assert(profile);
+    }
+
+    profile->edge_mask = (1u << TE_FAST_PROFILE_EDGE_BITS) - 1u;
+    profile->edges = calloc(profile->edge_mask + 1u, sizeof(te_fast_profile_edge_t));
+    assert(profile->edges);
+
+    return profile;
+}
+
+
+/*
+ * Release the call-graph edge table allocated by te_open_fast_profile().
+ */
+extern void te_close_fast_profile(
+    te_fast_profile_state_t * const profile)
+{
+    assert(profile);
+
+    free(profile->edges);
+    profile->edges = NULL;
+    profile->edge_mask = 0;
+    profile->num_edges = 0;
+}
+
+
+/*
+ * print out all the edges in the call-graph, and a few statistics
+ */
+extern void te_print_fast_profile(
+    const te_fast_profile_state_t * const profile)
+{
+    size_t slot;
+
+    assert(profile);
+
+    for (slot = 0; slot <= profile->edge_mask; slot++)
+    {
+        const te_fast_profile_edge_t * const edge = &profile->edges[slot];
+        if (edge->count)
+        {
+            printf("%12lx -> %12lx: %lu\n",
+                edge->caller, edge->callee, (unsigned long)edge->count);
+        }
+    }
+
+    printf("fast-profile: packets = %lu,  edges = %lu,  overflows = %lu,"
+        "  underflows = %lu,  mismatches = %lu\n",
+        profile->num_packets,
+        (unsigned long)profile->num_edges,
+        profile->num_overflows,
+        profile->num_underflows,
+        profile->num_mismatches);
+}
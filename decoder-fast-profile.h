@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_FAST_PROFILE_H
+#define TE_DECODER_FAST_PROFILE_H
+
+
+/*
+ * The "fast profiling" mode (see "Future directions") is a much simpler
+ * alternative to branch trace: the encoder only emits a packet when there
+ * is a call, a return or an exception, reporting the destination address,
+ * and optionally the source address. As such, the decoder never needs to
+ * retrieve or decode any instructions, and this is a completely separate
+ * decode path from te_process_te_inst(), sharing only its types.
+ */
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * Define the maximum depth of the shadow call-stack (must be a power of 2).
+ * When the stack is full, the oldest frame is discarded to make room.
+ * If not defined elsewhere, define TE_FAST_PROFILE_MAX_DEPTH here.
+ */
+#if !defined(TE_FAST_PROFILE_MAX_DEPTH)
+#   define TE_FAST_PROFILE_MAX_DEPTH (1u<<9)   /* 2^9 = 512 frames */
+#endif  /* TE_FAST_PROFILE_MAX_DEPTH */
+
+
+/*
+ * Initial number of slots in the call-graph edge table (must be a power
+ * of 2). The table doubles in size whenever it becomes half full.
+ */
+#if !defined(TE_FAST_PROFILE_EDGE_BITS)
+#   define TE_FAST_PROFILE_EDGE_BITS (12)      /* 2^12 = 4096 edges */
+#endif  /* TE_FAST_PROFILE_EDGE_BITS */
+
+
+/*
+ * The address used for the "caller" of any function entered when the
+ * shadow call-stack was empty (i.e. the caller is not known).
+ */
+#define TE_FAST_PROFILE_ROOT        ((te_address_t)0)
+
+
+/*
+ * The event reported by each fast profiling packet.
+ */
+typedef enum
+{
+    TE_FAST_PROFILE_CALL             = 0,
+    TE_FAST_PROFILE_RETURN           = 1,
+    TE_FAST_PROFILE_EXCEPTION        = 2,   /* exception or interrupt */
+    TE_FAST_PROFILE_EXCEPTION_RETURN = 3,
+} te_fast_profile_event_t;
+
+
+/*
+ * list of fields from a fast profiling message.
+ * This mode is not yet fully specified (see "Future directions").
+ */
+typedef struct
+{
+    te_fast_profile_event_t event;
+    te_address_t destination;   /* the next instruction executed */
+    te_address_t source;        /* the current instruction (if has_source) */
+    bool has_source;            /* 1-bit: "source" is present */
+} te_fast_profile_t;
+
+
+/*
+ * One frame on the shadow call-stack.
+ */
+typedef struct
+{
+    te_address_t function;      /* entry point (destination of the call) */
+    te_address_t call_site;     /* source of the call, or 0 if unknown */
+    bool exception;             /* true if entered via an exception */
+} te_fast_profile_frame_t;
+
+
+/*
+ * One edge in the call-graph, i.e. the number of times that "callee"
+ * was entered (called, or by exception) whilst "caller" was executing.
+ * An unused slot in the edge table has a zero "count".
+ */
+typedef struct
+{
+    te_address_t caller;        /* or TE_FAST_PROFILE_ROOT */
+    te_address_t callee;
+    uint64_t count;
+} te_fast_profile_edge_t;
+
+
+/*
+ * The following structure is used to hold all the state for a single
+ * instance of a fast profiling decoder. As with te_decoder_state_t,
+ * each core being traced should have its own unique instance.
+ */
+typedef struct
+{
+    /* the shadow call-stack, used as a circular buffer */
+    te_fast_profile_frame_t stack[TE_FAST_PROFILE_MAX_DEPTH];
+    size_t top;                 /* index of the next free frame */
+    size_t depth;               /* number of valid frames */
+
+    /* open-addressing hash table of call-graph edges */
+    te_fast_profile_edge_t * edges;
+    size_t edge_mask;           /* number of slots, minus one */
+    size_t num_edges;           /* number of slots in use */
+
+    /* maintain a few statistics */
+    unsigned long num_packets;
+    unsigned long num_overflows;    /* frames discarded (stack full) */
+    unsigned long num_underflows;   /* returns with an empty stack */
+    unsigned long num_mismatches;   /* returns to an unexpected address */
+} te_fast_profile_state_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_fast_profile_state_t * te_open_fast_profile(
+    te_fast_profile_state_t * profile);
+
+extern void te_close_fast_profile(
+    te_fast_profile_state_t * const profile);
+
+extern void te_process_fast_profile(
+    te_fast_profile_state_t * const profile,
+    const te_fast_profile_t * const packet);
+
+extern const te_fast_profile_edge_t * te_find_fast_profile_edge(
+    const te_fast_profile_state_t * const profile,
+    const te_address_t caller,
+    const te_address_t callee);
+
+extern void te_print_fast_profile(
+    const te_fast_profile_state_t * const profile);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_DECODER_FAST_PROFILE_H */
@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decoder-merge.h"
+
+
+/*
+ * Mask of the bits of each timestamp in the trace.
+ */
+#define TIMESTAMP_MASK  ( (TE_TIMESTAMP_BITS >= 64) ? ~0ull :   \
+                          ((1ull << (TE_TIMESTAMP_BITS & 63)) - 1u) )
+
+
+/*
+ * Append the block being built to the FIFO of complete blocks.
+ */
+static void push_block(
+    te_merge_source_t * const source)
+{
+    assert(source);
+    assert(source->block_open);
+
+    if (source->head + source->count == source->capacity)
+    {
+        source->capacity = source->capacity ? (source->capacity << 1) : 64u;
+        source->queue = realloc(source->queue, source->capacity * sizeof(te_merge_block_t));
+        assert(source->queue);
+    }
+    source->queue[source->head + source->count++] = source->block;
+    source->block_open = false;
+    source->num_blocks++;           /* update statistics */
+    if (source->count > source->max_queued)
+    {
+        source->max_queued = source->count;
+    }
+}
+
+
+/*
+ * Forward the retrieval of each instruction to the wrapped callbacks.
+ */
+static unsigned merge_get_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const te_merge_source_t * const source = user_data;
+
+    return source->callbacks.get_instruction(source->user_data, address, instruction);
+}
+
+
+/*
+ * Notify the wrapped callbacks (if any) of each new PC, and then add it
+ * to the block being built, completing that block at any discontinuity.
+ * The timestamp is that of the message being fed, so it is only known
+ * once that has been processed (see fill_queue).
+ */
+static void merge_advance_decoded_pc(
+    void * const user_data,
+    const te_address_t old_pc,
+    const te_address_t new_pc,
+    const te_decoded_instruction_t * const new_instruction)
+{
+    te_merge_source_t * const source = user_data;
+
+    if (source->callbacks.advance_decoded_pc)
+    {
+        source->callbacks.advance_decoded_pc(source->user_data,
+            old_pc, new_pc, new_instruction);
+    }
+
+    if ( (source->block_open) && (new_pc != source->block.end) )
+    {
+        push_block(source);
+    }
+    if (!source->block_open)
+    {
+        source->block.start = new_pc;
+        source->block.num_instructions = 0;
+        source->block.source = source->index;
+        source->block_open = true;
+    }
+    source->block.end = new_pc + new_instruction->length;
+    source->block.num_instructions++;
+    source->block.timestamp = UINT64_MAX;   /* i.e. this message's */
+}
+
+
+/*
+ * Forward each diagnostic to the wrapped callbacks (if they print them).
+ */
+static void merge_log(
+    void * const user_data,
+    const char * const format,
+    va_list args)
+{
+    const te_merge_source_t * const source = user_data;
+
+    if (source->callbacks.log)
+    {
+        source->callbacks.log(source->user_data, format, args);
+    }
+}
+
+
+static const te_decoder_callbacks_t merge_callbacks =
+{
+    .get_instruction = merge_get_instruction,
+    .advance_decoded_pc = merge_advance_decoded_pc,
+    .log = merge_log,
+};
+
+
+/*
+ * Feed messages to a source's trace-decoder until it has at least one
+ * complete block to be merged, or there are no more messages. Each block
+ * completed (or extended) by a message is given that message's timestamp.
+ * The FIFO is empty on entry, so it restarts at the front of the queue.
+ */
+static void fill_queue(
+    te_merge_source_t * const source)
+{
+    uint64_t raw;
+    size_t i;
+
+    assert(source);
+
+    while ( (0 == source->count) && (!source->ended) )
+    {
+        source->head = 0;
+        if (!source->feed(source->feed_data, source->decoder, &raw))
+        {
+            /* the last block is complete, as there are no more messages */
+            source->ended = true;
+            if (source->block_open)
+            {
+                push_block(source);
+            }
+            break;
+        }
+        source->num_messages++;     /* update statistics */
+
+        (void)te_extend_timestamp(&source->timestamp, raw);
+        for (i = 0; i < source->count; i++)
+        {
+            if (UINT64_MAX == source->queue[i].timestamp)
+            {
+                source->queue[i].timestamp = source->timestamp.time;
+            }
+        }
+        if ( (source->block_open) && (UINT64_MAX == source->block.timestamp) )
+        {
+            source->block.timestamp = source->timestamp.time;
+        }
+    }
+}
+
+
+/*
+ * Return true if the next block of source "a" is before that of "b".
+ */
+static bool is_before(
+    const te_merge_t * const merge,
+    const size_t a,
+    const size_t b)
+{
+    const te_merge_source_t * const first = &merge->sources[a];
+    const te_merge_source_t * const second = &merge->sources[b];
+    const uint64_t first_time = first->queue[first->head].timestamp;
+    const uint64_t second_time = second->queue[second->head].timestamp;
+
+    return (first_time < second_time) ||
+           ( (first_time == second_time) && (a < b) );
+}
+
+
+/*
+ * Restore the heap order, moving the source at "slot" down.
+ */
+static void sift_down(
+    te_merge_t * const merge,
+    size_t slot)
+{
+    const size_t index = merge->heap[slot];
+
+    while (true)
+    {
+        size_t child = 2u * slot + 1u;
+
+        if (child >= merge->heap_size)
+        {
+            break;
+        }
+        if ( (child + 1u < merge->heap_size) &&
+             (is_before(merge, merge->heap[child + 1u], merge->heap[child])) )
+        {
+            child++;
+        }
+        if (!is_before(merge, merge->heap[child], index))
+        {
+            break;
+        }
+        merge->heap[slot] = merge->heap[child];
+        slot = child;
+    }
+    merge->heap[slot] = index;
+}
+
+
+/*
+ * Extend a timestamp of TE_TIMESTAMP_BITS (from the next message of a
+ * source) to 64 bits, by adding the time elapsed since the previous one,
+ * modulo the wrap. So the timestamps of a source must not advance by a whole
+ * wrap (or more) between consecutive messages. Returns the extended value,
+ * which is also retained (in timestamp->time) for the next.
+ */
+extern uint64_t te_extend_timestamp(
+    te_timestamp_t * const timestamp,
+    const uint64_t raw)
+{
+    assert(timestamp);
+
+    if (!timestamp->started)
+    {
+        timestamp->time = raw & TIMESTAMP_MASK;
+        timestamp->started = true;
+    }
+    else
+    {
+        if ((raw & TIMESTAMP_MASK) < (timestamp->time & TIMESTAMP_MASK))
+        {
+            timestamp->num_wraps++;     /* update statistics */
+        }
+        timestamp->time += (raw - timestamp->time) & TIMESTAMP_MASK;
+    }
+
+    return timestamp->time;
+}
+
+
+/*
+ * Initialize a new instance of a merge, of up to "num_sources" sources
+ * (see te_add_merge_source).
+ * If "merge" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ */
+extern te_merge_t * te_open_merge(
+    te_merge_t * merge,
+    const size_t num_sources)
+{
+    size_t i;
+
+    if (merge)
+    {
+        memset(merge, 0, sizeof(te_merge_t));
+    }
+    else
+    {
+        merge = calloc(1, sizeof(te_merge_t));
+        assert(merge);
+    }
+
+    merge->num_sources = num_sources;
+    merge->sources = calloc(num_sources ? num_sources : 1u, sizeof(te_merge_source_t));
+    merge->heap = calloc(num_sources ? num_sources : 1u, sizeof(size_t));
+    assert(merge->sources);
+    assert(merge->heap);
+
+    for (i = 0; i < num_sources; i++)
+    {
+        merge->sources[i].index = i;
+    }
+
+    return merge;
+}
+
+
+/*
+ * Add a source (e.g. a hart), with the given index (which must be less than
+ * the number of sources), opening its trace-decoder, for the given ISA,
+ * which is returned (so that profiles, and handlers, may be attached).
+ * The trace-decoder calls "callbacks" (which are copied) with "user_data",
+ * exactly as if they had been passed to te_open_trace_decoder() directly,
+ * except that their advance_decoded_pc may be NULL. If "callbacks" is NULL,
+ * then te_default_decoder_callbacks is used. Each message is fed to the
+ * trace-decoder by calling "feed" with "feed_data" (see te_merge_feed_t).
+ * All sources must be added before the first block is merged.
+ */
+extern te_decoder_state_t * te_add_merge_source(
+    te_merge_t * const merge,
+    const size_t index,
+    const te_decoder_callbacks_t * const callbacks,
+    void * const user_data,
+    const rv_isa isa,
+    const te_merge_feed_t feed,
+    void * const feed_data)
+{
+    te_merge_source_t * source;
+
+    assert(merge);
+    assert(index < merge->num_sources);
+    assert(feed);
+    assert(!merge->started);
+#if defined(TE_NO_DEFAULT_CALLBACKS)
+    assert(callbacks);
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+
+    source = &merge->sources[index];
+    assert(!source->decoder);
+
+#if defined(TE_NO_DEFAULT_CALLBACKS)
+    source->callbacks = *callbacks;
+#else   /* TE_NO_DEFAULT_CALLBACKS */
+    source->callbacks = callbacks ? *callbacks : te_default_decoder_callbacks;
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+    assert(source->callbacks.get_instruction);
+    source->user_data = user_data;
+    source->feed = feed;
+    source->feed_data = feed_data;
+    source->decoder = te_open_trace_decoder(NULL, &merge_callbacks, source, isa);
+
+    return source->decoder;
+}
+
+
+/*
+ * Return (via "block") the next block in time order, from any source,
+ * feeding only as many messages as are needed to know which is next.
+ * Returns false if there are no more blocks.
+ */
+extern bool te_next_merged_block(
+    te_merge_t * const merge,
+    te_merge_block_t * const block)
+{
+    te_merge_source_t * source;
+    size_t i;
+
+    assert(merge);
+    assert(block);
+
+    if (!merge->started)
+    {
+        /* build the heap from the first block of each source */
+        merge->started = true;
+        for (i = 0; i < merge->num_sources; i++)
+        {
+            if (merge->sources[i].decoder)
+            {
+                fill_queue(&merge->sources[i]);
+                if (merge->sources[i].count)
+                {
+                    merge->heap[merge->heap_size++] = i;
+                }
+            }
+        }
+        for (i = merge->heap_size / 2u; i-- > 0; )
+        {
+            sift_down(merge, i);
+        }
+    }
+
+    if (0 == merge->heap_size)
+    {
+        return false;
+    }
+
+    /* take the earliest block, then re-position its source */
+    source = &merge->sources[merge->heap[0]];
+    *block = source->queue[source->head++];
+    source->count--;
+    merge->num_blocks++;        /* update statistics */
+
+    fill_queue(source);
+    if (0 == source->count)
+    {
+        merge->heap[0] = merge->heap[--merge->heap_size];
+    }
+    if (merge->heap_size)
+    {
+        sift_down(merge, 0);
+    }
+
+    return true;
+}
+
+
+/*
+ * Release everything allocated by te_open_merge(), including the
+ * trace-decoder of each source.
+ */
+extern void te_close_merge(
+    te_merge_t * const merge)
+{
+    size_t i;
+
+    assert(merge);
+
+    for (i = 0; i < merge->num_sources; i++)
+    {
+        if (merge->sources[i].decoder)
+        {
+            te_close_trace_decoder(merge->sources[i].decoder);
+            free(merge->sources[i].decoder);
+        }
+        free(merge->sources[i].queue);
+    }
+    free(merge->sources);
+    free(merge->heap);
+    merge->sources = NULL;
+    merge->heap = NULL;
+    merge->num_sources = 0;
+    merge->heap_size = 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_MERGE_H
+#define TE_DECODER_MERGE_H
+
+
+/*
+ * A merge of the (dynamic) basic blocks decoded from the traces of several
+ * harts (each with its own trace-decoder), into one stream in time order,
+ * e.g. to analyze the interactions between harts (locks, IPIs, etc.).
+ *
+ * The messages of each hart (each a "source") carry a timestamp, of
+ * TE_TIMESTAMP_BITS (as in the encapsulation of the messages), which wraps.
+ * So each source extends its timestamps (see te_extend_timestamp), assuming
+ * that they never advance by a whole wrap between consecutive messages.
+ * Each block is given the (extended) timestamp of the message whose
+ * processing disseminated its last instruction.
+ *
+ * The merge is a k-way merge (with a binary heap of the sources, ordered
+ * by the timestamp of the next block of each). It is streamed: each source
+ * is only fed its next message when it has no blocks left to be merged.
+ * So no more than the blocks from one message are held for each source,
+ * and blocks are returned (see te_next_merged_block) as soon as no other
+ * source can have an earlier one. Blocks with equal timestamps are returned
+ * in order of their source's index.
+ */
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * Define the number of bits in each timestamp of the trace.
+ * If not defined elsewhere, define TE_TIMESTAMP_BITS here.
+ */
+#if !defined(TE_TIMESTAMP_BITS)
+#   define TE_TIMESTAMP_BITS    (16)
+#endif  /* TE_TIMESTAMP_BITS */
+
+
+/*
+ * The state for extending the timestamps of one source.
+ */
+typedef struct
+{
+    uint64_t time;          /* the last extended timestamp */
+    bool started;           /* false until the first timestamp */
+    unsigned long num_wraps;    /* times the timestamp has wrapped */
+} te_timestamp_t;
+
+
+/*
+ * One (dynamic) basic block, i.e. a run of sequential instructions,
+ * from one source.
+ */
+typedef struct
+{
+    uint64_t timestamp;     /* extended, see te_extend_timestamp() */
+    te_address_t start;     /* PC of the first instruction */
+    te_address_t end;       /* PC after the last instruction */
+    unsigned long num_instructions;
+    size_t source;          /* index of the source, e.g. the hart */
+} te_merge_block_t;
+
+
+/*
+ * Type of function called to feed the next message of a source to its
+ * trace-decoder (with te_process_te_inst, etc.), returning the timestamp
+ * of that message (in "timestamp", in the low TE_TIMESTAMP_BITS).
+ * Returns false (without feeding a message) if there are no more.
+ * "data" is whatever was passed to te_add_merge_source().
+ */
+typedef bool (*te_merge_feed_t)(
+    void * const data,
+    te_decoder_state_t * const decoder,
+    uint64_t * const timestamp);
+
+
+/*
+ * The state of one source of blocks to be merged.
+ */
+typedef struct te_merge_source_s
+{
+    size_t index;
+    te_decoder_state_t * decoder;   /* NULL == not added */
+    /* the callbacks being wrapped, and their "user_data" */
+    te_decoder_callbacks_t callbacks;
+    void * user_data;
+    te_merge_feed_t feed;
+    void * feed_data;
+    te_timestamp_t timestamp;
+    bool ended;             /* no more messages */
+
+    /* the block being built (if "block_open") */
+    te_merge_block_t block;
+    bool block_open;
+
+    /* FIFO of complete blocks, not yet merged */
+    te_merge_block_t * queue;
+    size_t head;
+    size_t count;
+    size_t capacity;
+
+    /* maintain a few statistics */
+    unsigned long num_messages;     /* messages fed */
+    unsigned long num_blocks;       /* blocks completed */
+    size_t max_queued;              /* most blocks held at once */
+} te_merge_source_t;
+
+
+/*
+ * The state of one merge.
+ */
+typedef struct
+{
+    te_merge_source_t * sources;
+    size_t num_sources;
+    size_t * heap;          /* indices of sources with blocks to merge */
+    size_t heap_size;
+    bool started;
+    unsigned long num_blocks;   /* blocks merged */
+} te_merge_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern uint64_t te_extend_timestamp(
+    te_timestamp_t * const timestamp,
+    const uint64_t raw);
+
+extern te_merge_t * te_open_merge(
+    te_merge_t * merge,
+    const size_t num_sources);
+
+extern te_decoder_state_t * te_add_merge_source(
+    te_merge_t * const merge,
+    const size_t index,
+    const te_decoder_callbacks_t * const callbacks,
+    void * const user_data,
+    const rv_isa isa,
+    const te_merge_feed_t feed,
+    void * const feed_data);
+
+extern bool te_next_merged_block(
+    te_merge_t * const merge,
+    te_merge_block_t * const block);
+
+extern void te_close_merge(
+    te_merge_t * const merge);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_DECODER_MERGE_H */
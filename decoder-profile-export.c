@@ -0,0 +1,1487 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "decoder-profile-export.h"
+
+
+/*
+ * The largest protocol buffer message we ever build in memory, which is
+ * a sample with the deepest possible call path (a tag and a varint of at
+ * most 5 bytes for each location), plus its two values.
+ */
+#define MAX_MESSAGE     (32u + 6u * TE_CALL_PROFILE_MAX_DEPTH)
+
+
+/*
+ * Field numbers, from profile.proto.
+ */
+#define PROFILE_SAMPLE_TYPE     (1u)
+#define PROFILE_SAMPLE          (2u)
+#define PROFILE_MAPPING         (3u)
+#define PROFILE_LOCATION        (4u)
+#define PROFILE_FUNCTION        (5u)
+#define PROFILE_STRING_TABLE    (6u)
+#define PROFILE_PERIOD_TYPE     (11u)
+#define PROFILE_PERIOD          (12u)
+#define VALUE_TYPE_TYPE         (1u)
+#define VALUE_TYPE_UNIT         (2u)
+#define SAMPLE_LOCATION_ID      (1u)
+#define SAMPLE_VALUE            (2u)
+#define MAPPING_ID              (1u)
+#define MAPPING_MEMORY_START    (2u)
+#define MAPPING_MEMORY_LIMIT    (3u)
+#define MAPPING_HAS_FUNCTIONS   (7u)
+#define LOCATION_ID             (1u)
+#define LOCATION_MAPPING_ID     (2u)
+#define LOCATION_ADDRESS        (3u)
+#define LOCATION_LINE           (4u)
+#define LINE_FUNCTION_ID        (1u)
+#define FUNCTION_ID             (1u)
+#define FUNCTION_NAME           (2u)
+#define FUNCTION_SYSTEM_NAME    (3u)
+
+
+/*
+ * Protocol buffer wire types.
+ */
+#define WIRE_VARINT             (0u)
+#define WIRE_LENGTH             (2u)
+
+
+/*
+ * One (small) protocol buffer message, being built in memory.
+ */
+typedef struct
+{
+    uint8_t data[MAX_MESSAGE];
+    size_t length;
+} message_t;
+
+
+/*
+ * The state of a pprof profile being streamed to a file. A top-level
+ * repeated field may be interleaved with the others, so each string is
+ * simply appended to the string table just before it is first needed.
+ */
+typedef struct
+{
+    FILE * file;
+    uint64_t num_strings;       /* index of the next string */
+    uint64_t instructions;      /* some common strings */
+    uint64_t count;
+    uint64_t calls;
+} pprof_t;
+
+
+/*
+ * Append a varint to a message.
+ */
+static void put_varint(
+    message_t * const message,
+    uint64_t value)
+{
+    assert(message->length + 10u <= MAX_MESSAGE);
+
+    while (value >= 0x80u)
+    {
+        message->data[message->length++] = (uint8_t)(value | 0x80u);
+        value >>= 7;
+    }
+    message->data[message->length++] = (uint8_t)value;
+}
+
+
+/*
+ * Append an integer field to a message.
+ */
+static void put_uint(
+    message_t * const message,
+    const unsigned field,
+    const uint64_t value)
+{
+    put_varint(message, (field << 3) | WIRE_VARINT);
+    put_varint(message, value);
+}
+
+
+/*
+ * Append a nested message as a field of a message.
+ */
+static void put_message(
+    message_t * const message,
+    const unsigned field,
+    const message_t * const nested)
+{
+    put_varint(message, (field << 3) | WIRE_LENGTH);
+    put_varint(message, nested->length);
+    assert(message->length + nested->length <= MAX_MESSAGE);
+    memcpy(&message->data[message->length], nested->data, nested->length);
+    message->length += nested->length;
+}
+
+
+/*
+ * Write the tag and length of a length-delimited top-level field.
+ */
+static void write_header(
+    FILE * const file,
+    const unsigned field,
+    const size_t length)
+{
+    message_t header = { .length = 0 };
+
+    put_varint(&header, (field << 3) | WIRE_LENGTH);
+    put_varint(&header, length);
+    fwrite(header.data, 1, header.length, file);
+}
+
+
+/*
+ * Write a message as a top-level field of the profile.
+ */
+static void write_message(
+    pprof_t * const pprof,
+    const unsigned field,
+    const message_t * const message)
+{
+    write_header(pprof->file, field, message->length);
+    fwrite(message->data, 1, message->length, pprof->file);
+}
+
+
+/*
+ * Append a string to the string table, returning its index.
+ */
+static uint64_t write_string(
+    pprof_t * const pprof,
+    const char * const string)
+{
+    const size_t length = strlen(string);
+
+    write_header(pprof->file, PROFILE_STRING_TABLE, length);
+    fwrite(string, 1, length, pprof->file);
+
+    return pprof->num_strings++;
+}
+
+
+/*
+ * Write a ValueType, with the given type and unit, as a top-level field.
+ */
+static void write_value_type(
+    pprof_t * const pprof,
+    const unsigned field,
+    const uint64_t type,
+    const uint64_t unit)
+{
+    message_t value_type = { .length = 0 };
+
+    put_uint(&value_type, VALUE_TYPE_TYPE, type);
+    put_uint(&value_type, VALUE_TYPE_UNIT, unit);
+    write_message(pprof, field, &value_type);
+}
+
+
+/*
+ * Start a pprof profile, writing the common strings, and the period
+ * (one instruction). Every string table starts with the empty string.
+ */
+static void start_pprof(
+    pprof_t * const pprof,
+    FILE * const file)
+{
+    pprof->file = file;
+    pprof->num_strings = 0;
+    (void)write_string(pprof, "");
+    pprof->instructions = write_string(pprof, "instructions");
+    pprof->count = write_string(pprof, "count");
+    pprof->calls = write_string(pprof, "calls");
+
+    write_value_type(pprof, PROFILE_PERIOD_TYPE, pprof->instructions, pprof->count);
+    message_t period = { .length = 0 };
+    put_uint(&period, PROFILE_PERIOD, 1u);
+    fwrite(period.data, 1, period.length, file);
+}
+
+
+/*
+ * Write a Function with the given id and name (or address, if it has no
+ * name), and a Location at "address", for a line in that function.
+ */
+static void write_function(
+    pprof_t * const pprof,
+    const uint64_t function_id,
+    const char * const name,
+    const te_address_t address)
+{
+    message_t function = { .length = 0 };
+    uint64_t string;
+
+    if (name)
+    {
+        string = write_string(pprof, name);
+    }
+    else
+    {
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), "0x%lx", address);
+        string = write_string(pprof, buffer);
+    }
+
+    put_uint(&function, FUNCTION_ID, function_id);
+    put_uint(&function, FUNCTION_NAME, string);
+    put_uint(&function, FUNCTION_SYSTEM_NAME, string);
+    write_message(pprof, PROFILE_FUNCTION, &function);
+}
+
+
+/*
+ * Write a Location, at "address", and (if "function_id" is not zero)
+ * in a function, which must already have been written.
+ */
+static void write_location(
+    pprof_t * const pprof,
+    const uint64_t location_id,
+    const uint64_t mapping_id,
+    const te_address_t address,
+    const uint64_t function_id)
+{
+    message_t location = { .length = 0 };
+    message_t line = { .length = 0 };
+
+    put_uint(&location, LOCATION_ID, location_id);
+    if (mapping_id)
+    {
+        put_uint(&location, LOCATION_MAPPING_ID, mapping_id);
+    }
+    put_uint(&location, LOCATION_ADDRESS, address);
+    if (function_id)
+    {
+        put_uint(&line, LINE_FUNCTION_ID, function_id);
+        put_message(&location, LOCATION_LINE, &line);
+    }
+    write_message(pprof, PROFILE_LOCATION, &location);
+}
+
+
+/*
+ * Reads (little-endian) DWARF data, from "next" up to "end". Rather than
+ * checking every read, a read past the end just sets "error" (and returns
+ * zero), which is checked after each complete item.
+ */
+typedef struct
+{
+    const uint8_t * next;
+    const uint8_t * end;
+    bool error;
+} dwarf_t;
+
+
+/*
+ * Read an unsigned (little-endian) value of "size" bytes.
+ */
+static uint64_t read_fixed(
+    dwarf_t * const dwarf,
+    const size_t size)
+{
+    uint64_t value = 0;
+    size_t i;
+
+    if ((size_t)(dwarf->end - dwarf->next) < size)
+    {
+        dwarf->error = true;
+        dwarf->next = dwarf->end;
+        return 0;
+    }
+    for (i = 0; i < size; i++)
+    {
+        if (i < sizeof(value))
+        {
+            value |= (uint64_t)dwarf->next[i] << (8u * i);
+        }
+    }
+    dwarf->next += size;
+
+    return value;
+}
+
+
+/*
+ * Read an unsigned LEB128 value.
+ */
+static uint64_t read_uleb(
+    dwarf_t * const dwarf)
+{
+    uint64_t value = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+
+    do
+    {
+        if (dwarf->next >= dwarf->end)
+        {
+            dwarf->error = true;
+            return 0;
+        }
+        byte = *dwarf->next++;
+        if (shift < 64u)
+        {
+            value |= (uint64_t)(byte & 0x7fu) << shift;
+        }
+        shift += 7u;
+    } while (byte & 0x80u);
+
+    return value;
+}
+
+
+/*
+ * Read a signed LEB128 value.
+ */
+static int64_t read_sleb(
+    dwarf_t * const dwarf)
+{
+    uint64_t value = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+
+    do
+    {
+        if (dwarf->next >= dwarf->end)
+        {
+            dwarf->error = true;
+            return 0;
+        }
+        byte = *dwarf->next++;
+        if (shift < 64u)
+        {
+            value |= (uint64_t)(byte & 0x7fu) << shift;
+        }
+        shift += 7u;
+    } while (byte & 0x80u);
+
+    if ( (shift < 64u) && (byte & 0x40u) )
+    {
+        value |= ~0ull << shift;    /* sign-extend */
+    }
+
+    return (int64_t)value;
+}
+
+
+/*
+ * Read a NUL-terminated string.
+ */
+static const char * read_string(
+    dwarf_t * const dwarf)
+{
+    const char * const string = (const char *)dwarf->next;
+    const uint8_t * const nul = memchr(dwarf->next, 0, (size_t)(dwarf->end - dwarf->next));
+
+    if (!nul)
+    {
+        dwarf->error = true;
+        dwarf->next = dwarf->end;
+        return "";
+    }
+    dwarf->next = nul + 1;
+
+    return string;
+}
+
+
+/*
+ * Return the NUL-terminated string at "offset" in a string section.
+ */
+static const char * section_string(
+    const uint8_t * const section,
+    const size_t size,
+    const uint64_t offset)
+{
+    if ( (!section) ||
+         (offset >= size) ||
+         (!memchr(section + offset, 0, size - offset)) )
+    {
+        return "";
+    }
+
+    return (const char *)(section + offset);
+}
+
+
+/*
+ * The sections holding the strings referred to by a DWARF 5 line table.
+ */
+typedef struct
+{
+    const uint8_t * str;
+    size_t str_size;
+    const uint8_t * line_str;
+    size_t line_str_size;
+} strings_t;
+
+
+/*
+ * Read one attribute of a directory or file entry of a DWARF 5 line table
+ * header, in the given form. Strings are returned via "string", and
+ * everything else via the return value.
+ */
+static uint64_t read_form(
+    dwarf_t * const dwarf,
+    const uint64_t form,
+    const bool dwarf64,
+    const strings_t * const strings,
+    const char ** const string)
+{
+    const size_t offset_size = dwarf64 ? 8u : 4u;
+
+    switch (form)
+    {
+        case 0x08:  /* DW_FORM_string */
+            *string = read_string(dwarf);
+            return 0;
+        case 0x0e:  /* DW_FORM_strp */
+            *string = section_string(strings->str, strings->str_size,
+                read_fixed(dwarf, offset_size));
+            return 0;
+        case 0x1f:  /* DW_FORM_line_strp */
+            *string = section_string(strings->line_str, strings->line_str_size,
+                read_fixed(dwarf, offset_size));
+            return 0;
+        case 0x0b:  /* DW_FORM_data1 */
+            return read_fixed(dwarf, 1u);
+        case 0x05:  /* DW_FORM_data2 */
+            return read_fixed(dwarf, 2u);
+        case 0x06:  /* DW_FORM_data4 */
+            return read_fixed(dwarf, 4u);
+        case 0x07:  /* DW_FORM_data8 */
+            return read_fixed(dwarf, 8u);
+        case 0x1e:  /* DW_FORM_data16 */
+            (void)read_fixed(dwarf, 16u);
+            return 0;
+        case 0x0f:  /* DW_FORM_udata */
+            return read_uleb(dwarf);
+        case 0x09:  /* DW_FORM_block */
+            dwarf->next += read_uleb(dwarf);
+            if (dwarf->next > dwarf->end)
+            {
+                dwarf->error = true;
+                dwarf->next = dwarf->end;
+            }
+            return 0;
+        default:    /* no other forms are used in line tables */
+            dwarf->error = true;
+            return 0;
+    }
+}
+
+
+/*
+ * Append a row to the line table.
+ */
+static int add_row(
+    te_line_table_t * const table,
+    size_t * const max_rows,
+    const te_address_t address,
+    const uint32_t file,
+    const uint32_t line)
+{
+    if (table->num_rows == *max_rows)
+    {
+        const size_t max = *max_rows ? (*max_rows << 1) : 4096u;
+        te_line_t * const rows = realloc(table->rows, max * sizeof(te_line_t));
+        if (!rows)
+        {
+            return -1;
+        }
+        table->rows = rows;
+        *max_rows = max;
+    }
+    table->rows[table->num_rows].address = address;
+    table->rows[table->num_rows].file = file;
+    table->rows[table->num_rows].line = line;
+    table->num_rows++;
+
+    return 0;
+}
+
+
+/*
+ * Append a file to the line table, with the path "name", relative to
+ * "directory" (unless it is absolute). Returns its index, or 0 (i.e. the
+ * unknown file) if out of memory.
+ */
+static uint32_t add_file(
+    te_line_table_t * const table,
+    const char * const directory,
+    const char * const name)
+{
+    const size_t length = strlen(directory) + strlen(name) + 2u;
+    char ** const files = realloc(table->files, (table->num_files + 1u) * sizeof(char *));
+    char * const path = malloc(length);
+
+    if ( (!files) || (!path) )
+    {
+        free(path);
+        if (files)
+        {
+            table->files = files;
+        }
+        return 0;
+    }
+    table->files = files;
+
+    if ( ('/' == name[0]) || ('\0' == directory[0]) )
+    {
+        snprintf(path, length, "%s", name);
+    }
+    else
+    {
+        snprintf(path, length, "%s/%s", directory, name);
+    }
+    table->files[table->num_files] = path;
+
+    return (uint32_t)table->num_files++;
+}
+
+
+/*
+ * The maximum number of directories, and of files, in the header of any
+ * one line table that we record (any beyond this are treated as unknown).
+ */
+#define MAX_UNIT_ENTRIES    (4096u)
+
+
+/*
+ * Read the header of one line table (i.e. one compilation unit), for
+ * DWARF versions 2 to 5, adding each of its files to "table", and mapping
+ * the unit's file numbers to their indices in "files".
+ * Returns the number of files in the unit, or -1 if it is malformed.
+ */
+static long read_line_header_files(
+    dwarf_t * const dwarf,
+    const unsigned version,
+    const bool dwarf64,
+    const strings_t * const strings,
+    te_line_table_t * const table,
+    uint32_t * const files)
+{
+    const char * directories[MAX_UNIT_ENTRIES];
+    size_t num_directories = 0;
+    size_t num_files = 0;
+
+    if (version < 5u)
+    {
+        /* directory 0 is the compilation directory, which we do not know */
+        directories[num_directories++] = "";
+        while (true)
+        {
+            const char * const directory = read_string(dwarf);
+            if ( (dwarf->error) || ('\0' == directory[0]) )
+            {
+                break;
+            }
+            if (num_directories < MAX_UNIT_ENTRIES)
+            {
+                directories[num_directories++] = directory;
+            }
+        }
+        /* file 0 is unused before DWARF 5 */
+        files[num_files++] = 0;
+        while (!dwarf->error)
+        {
+            const char * const name = read_string(dwarf);
+            uint64_t directory;
+            if ('\0' == name[0])
+            {
+                break;
+            }
+            directory = read_uleb(dwarf);
+            (void)read_uleb(dwarf);     /* modification time */
+            (void)read_uleb(dwarf);     /* length */
+            if (num_files < MAX_UNIT_ENTRIES)
+            {
+                files[num_files++] = add_file(table,
+                    (directory < num_directories) ? directories[directory] : "",
+                    name);
+            }
+        }
+    }
+    else
+    {
+        uint64_t formats[2 * 256];
+        unsigned num_formats;
+        uint64_t count, i;
+        unsigned j;
+
+        /* the directories, each described by a list of (content, form) */
+        num_formats = (unsigned)read_fixed(dwarf, 1u);
+        for (j = 0; j < 2u * num_formats; j++)
+        {
+            formats[j] = read_uleb(dwarf);
+        }
+        count = read_uleb(dwarf);
+        for (i = 0; (i < count) && (!dwarf->error); i++)
+        {
+            const char * path = "";
+            for (j = 0; j < num_formats; j++)
+            {
+                const char * string = "";
+                (void)read_form(dwarf, formats[2 * j + 1], dwarf64, strings, &string);
+                if (1u == formats[2 * j])   /* DW_LNCT_path */
+                {
+                    path = string;
+                }
+            }
+            if (num_directories < MAX_UNIT_ENTRIES)
+            {
+                directories[num_directories++] = path;
+            }
+        }
+
+        /* the files, each described by a list of (content, form) */
+        num_formats = (unsigned)read_fixed(dwarf, 1u);
+        for (j = 0; j < 2u * num_formats; j++)
+        {
+            formats[j] = read_uleb(dwarf);
+        }
+        count = read_uleb(dwarf);
+        for (i = 0; (i < count) && (!dwarf->error); i++)
+        {
+            const char * path = "";
+            uint64_t directory = 0;
+            for (j = 0; j < num_formats; j++)
+            {
+                const char * string = "";
+                const uint64_t value =
+                    read_form(dwarf, formats[2 * j + 1], dwarf64, strings, &string);
+                if (1u == formats[2 * j])           /* DW_LNCT_path */
+                {
+                    path = string;
+                }
+                else if (2u == formats[2 * j])      /* DW_LNCT_directory_index */
+                {
+                    directory = value;
+                }
+            }
+            if (num_files < MAX_UNIT_ENTRIES)
+            {
+                files[num_files++] = add_file(table,
+                    (directory < num_directories) ? directories[directory] : "",
+                    path);
+            }
+        }
+    }
+
+    return dwarf->error ? -1 : (long)num_files;
+}
+
+
+/*
+ * Read one line table (i.e. one compilation unit), and run its line
+ * number program, appending a row to "table" for each row of the matrix.
+ * Returns 0 on success, or -1 if it is malformed, or out of memory.
+ */
+static int read_line_unit(
+    dwarf_t * const dwarf,
+    const strings_t * const strings,
+    te_line_table_t * const table,
+    size_t * const max_rows)
+{
+    uint32_t files[MAX_UNIT_ENTRIES];
+    uint8_t opcode_lengths[256];
+    dwarf_t program;
+    uint64_t length;
+    bool dwarf64 = false;
+    unsigned version;
+    unsigned address_size = 0;
+    unsigned min_length, line_range, opcode_base;
+    int line_base;
+    long num_files;
+    unsigned i;
+
+    length = read_fixed(dwarf, 4u);
+    if (0xffffffffu == length)
+    {
+        length = read_fixed(dwarf, 8u);
+        dwarf64 = true;
+    }
+    if ( (dwarf->error) || (length > (uint64_t)(dwarf->end - dwarf->next)) )
+    {
+        return -1;
+    }
+    program.next = dwarf->next;
+    program.end = dwarf->next + length;
+    program.error = false;
+    dwarf->next = program.end;      /* the next unit */
+
+    version = (unsigned)read_fixed(&program, 2u);
+    if ( (version < 2u) || (version > 5u) )
+    {
+        return 0;   /* unknown version, so skip the unit */
+    }
+    if (version >= 5u)
+    {
+        address_size = (unsigned)read_fixed(&program, 1u);
+        (void)read_fixed(&program, 1u);     /* segment selector size */
+    }
+    length = read_fixed(&program, dwarf64 ? 8u : 4u);   /* header length */
+    if (length > (uint64_t)(program.end - program.next))
+    {
+        return -1;
+    }
+    {
+        /* the line number program follows the header */
+        dwarf_t header = { program.next, program.next + length, false };
+        program.next += length;
+
+        min_length = (unsigned)read_fixed(&header, 1u);
+        if (version >= 4u)
+        {
+            (void)read_fixed(&header, 1u);  /* maximum operations per instruction */
+        }
+        (void)read_fixed(&header, 1u);      /* default is_stmt */
+        line_base = (int8_t)read_fixed(&header, 1u);
+        line_range = (unsigned)read_fixed(&header, 1u);
+        opcode_base = (unsigned)read_fixed(&header, 1u);
+        memset(opcode_lengths, 0, sizeof(opcode_lengths));
+        for (i = 1; i < opcode_base; i++)
+        {
+            opcode_lengths[i] = (uint8_t)read_fixed(&header, 1u);
+        }
+        num_files = read_line_header_files(&header, version, dwarf64, strings, table, files);
+        if ( (header.error) || (num_files < 0) || (0 == line_range) || (0 == opcode_base) )
+        {
+            return -1;
+        }
+    }
+
+    /* run the line number program (the op-index of VLIW is ignored) */
+    while (program.next < program.end)
+    {
+        te_address_t address = 0;
+        uint64_t file = 1;
+        int64_t line = 1;
+        bool end_sequence = false;
+
+        while ( (!end_sequence) && (program.next < program.end) )
+        {
+            const unsigned opcode = (unsigned)read_fixed(&program, 1u);
+            bool emit = false;
+
+            if (opcode >= opcode_base)
+            {
+                /* special opcode: advance both address and line */
+                const unsigned adjusted = opcode - opcode_base;
+                address += (adjusted / line_range) * min_length;
+                line += line_base + (int)(adjusted % line_range);
+                emit = true;
+            }
+            else switch (opcode)
+            {
+                case 0:     /* extended opcode */
+                {
+                    const uint64_t size = read_uleb(&program);
+                    const uint8_t * const next = program.next + size;
+                    if ( (0 == size) || (size > (uint64_t)(program.end - program.next)) )
+                    {
+                        return -1;
+                    }
+                    switch (read_fixed(&program, 1u))
+                    {
+                        case 1:     /* DW_LNE_end_sequence */
+                            end_sequence = true;
+                            emit = true;
+                            break;
+                        case 2:     /* DW_LNE_set_address */
+                            address = read_fixed(&program,
+                                address_size ? address_size : (size_t)(size - 1u));
+                            break;
+                        default:    /* e.g. DW_LNE_set_discriminator */
+                            break;
+                    }
+                    program.next = next;
+                    break;
+                }
+                case 1:     /* DW_LNS_copy */
+                    emit = true;
+                    break;
+                case 2:     /* DW_LNS_advance_pc */
+                    address += read_uleb(&program) * min_length;
+                    break;
+                case 3:     /* DW_LNS_advance_line */
+                    line += read_sleb(&program);
+                    break;
+                case 4:     /* DW_LNS_set_file */
+                    file = read_uleb(&program);
+                    break;
+                case 8:     /* DW_LNS_const_add_pc */
+                    address += ((255u - opcode_base) / line_range) * min_length;
+                    break;
+                case 9:     /* DW_LNS_fixed_advance_pc */
+                    address += read_fixed(&program, 2u);
+                    break;
+                default:    /* skip all the operands of any other opcode */
+                    for (i = 0; i < opcode_lengths[opcode]; i++)
+                    {
+                        (void)read_uleb(&program);
+                    }
+                    break;
+            }
+
+            if (program.error)
+            {
+                return -1;
+            }
+            if (emit)
+            {
+                const uint32_t index = (file < (uint64_t)num_files) ? files[file] : 0;
+                if (0 != add_row(table, max_rows, address, index,
+                        end_sequence ? 0 : (uint32_t)((line > 0) ? line : 1)))
+                {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Order the rows of a line table by address, with any end of sequence
+ * before the start of the following sequence at the same address,
+ * for qsort().
+ */
+static int compare_rows(
+    const void * const a,
+    const void * const b)
+{
+    const te_line_t * const first = a;
+    const te_line_t * const second = b;
+
+    if (first->address != second->address)
+    {
+        return (first->address > second->address) ? 1 : -1;
+    }
+
+    return (0 != first->line) - (0 != second->line);
+}
+
+
+/*
+ * Read the line table (from the DWARF .debug_line section) of an ELF file,
+ * for DWARF versions 2 to 5, into a table of rows in address order. Files
+ * are identified by their path, as recorded in the line table: relative to
+ * the directory of compilation (which is not recorded there) for DWARF 2 to
+ * 4, else absolute. File 0 is used for any row with an unknown file.
+ * Returns 0 on success, or -1 (with errno set) on failure.
+ */
+extern int te_open_line_table(
+    te_line_table_t * const table,
+    const char * const filename)
+{
+    void * image;
+    size_t size;
+    size_t max_rows = 0;
+    strings_t strings;
+    dwarf_t dwarf;
+    size_t length;
+
+    assert(table);
+    assert(filename);
+
+    memset(table, 0, sizeof(te_line_table_t));
+
+    if (0 != te_map_elf_file(filename, &image, &size))
+    {
+        return -1;
+    }
+
+    (void)add_file(table, "", "??");     /* the unknown file */
+
+    strings.str = te_find_elf_section(image, size, ".debug_str", &strings.str_size);
+    strings.line_str = te_find_elf_section(image, size, ".debug_line_str", &strings.line_str_size);
+    dwarf.next = te_find_elf_section(image, size, ".debug_line", &length);
+    dwarf.end = dwarf.next + length;
+    dwarf.error = false;
+
+    while ( (dwarf.next) && (dwarf.next < dwarf.end) )
+    {
+        if (0 != read_line_unit(&dwarf, &strings, table, &max_rows))
+        {
+            te_unmap_elf_file(image, size);
+            te_close_line_table(table);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    te_unmap_elf_file(image, size);
+
+    qsort(table->rows, table->num_rows, sizeof(te_line_t), compare_rows);
+
+    return 0;
+}
+
+
+/*
+ * Release the rows and files of a line table.
+ */
+extern void te_close_line_table(
+    te_line_table_t * const table)
+{
+    size_t i;
+
+    assert(table);
+
+    for (i = 0; i < table->num_files; i++)
+    {
+        free(table->files[i]);
+    }
+    free(table->files);
+    free(table->rows);
+    memset(table, 0, sizeof(te_line_table_t));
+}
+
+
+/*
+ * The coverage of one line, or of one branch on a line, for lcov.
+ */
+typedef struct
+{
+    const char * file;
+    uint32_t line;
+    te_address_t address;       /* of the branch */
+    bool hit;                   /* executed, or branch taken */
+    bool other;                 /* branch not taken */
+} lcov_t;
+
+
+/*
+ * Order lines (or branches) by file, line and address, for qsort().
+ */
+static int compare_lcov(
+    const void * const a,
+    const void * const b)
+{
+    const lcov_t * const first = a;
+    const lcov_t * const second = b;
+    const int file = strcmp(first->file, second->file);
+
+    if (file)
+    {
+        return file;
+    }
+    if (first->line != second->line)
+    {
+        return (first->line > second->line) ? 1 : -1;
+    }
+
+    return (first->address > second->address) - (first->address < second->address);
+}
+
+
+/*
+ * Append an entry to a growing array of lcov_t.
+ */
+static int add_lcov(
+    lcov_t ** const entries,
+    size_t * const num_entries,
+    size_t * const max_entries,
+    const lcov_t * const entry)
+{
+    if (*num_entries == *max_entries)
+    {
+        const size_t max = *max_entries ? (*max_entries << 1) : 4096u;
+        lcov_t * const grown = realloc(*entries, max * sizeof(lcov_t));
+        if (!grown)
+        {
+            return -1;
+        }
+        *entries = grown;
+        *max_entries = max;
+    }
+    (*entries)[(*num_entries)++] = *entry;
+
+    return 0;
+}
+
+
+/*
+ * Return true if any of the bits [first, end) are set in a bitmap.
+ */
+static bool any_bits(
+    const uint64_t * const words,
+    const size_t first,
+    const size_t end)
+{
+    const size_t first_word = first >> 6;
+    const size_t last_word = (end - 1u) >> 6;
+    const uint64_t head = ~0ull << (first & 63u);
+    const uint64_t tail = ~0ull >> (63u - ((end - 1u) & 63u));
+    size_t word;
+
+    if (first_word == last_word)
+    {
+        return 0 != (words[first_word] & head & tail);
+    }
+    if ( (words[first_word] & head) || (words[last_word] & tail) )
+    {
+        return true;
+    }
+    for (word = first_word + 1u; word < last_word; word++)
+    {
+        if (words[word])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * Write the lines of one file, and the branches on them, as one record
+ * of an lcov tracefile. Consecutive entries for the same line are merged.
+ */
+static void write_lcov_record(
+    FILE * const file,
+    const char * const test_name,
+    const lcov_t * const lines,
+    const size_t num_lines,
+    const lcov_t * const branches,
+    const size_t num_branches)
+{
+    const char * const path = num_lines ? lines[0].file : branches[0].file;
+    size_t found = 0, hit = 0, i;
+    uint32_t line = 0;
+    unsigned branch = 0;
+
+    fprintf(file, "TN:%s\nSF:%s\n", test_name ? test_name : "", path);
+
+    /* each branch is a block with two outcomes: taken, and not taken */
+    for (i = 0; i < num_branches; i++)
+    {
+        if (branches[i].line != line)
+        {
+            line = branches[i].line;
+            branch = 0;
+        }
+        fprintf(file, "BRDA:%u,0,%u,%u\nBRDA:%u,0,%u,%u\n",
+            line, branch, branches[i].hit ? 1u : 0u,
+            line, branch + 1u, branches[i].other ? 1u : 0u);
+        branch += 2u;
+    }
+    fprintf(file, "BRF:%lu\n", (unsigned long)(2u * num_branches));
+    for (i = 0; i < num_branches; i++)
+    {
+        hit += branches[i].hit + branches[i].other;
+    }
+    fprintf(file, "BRH:%lu\n", (unsigned long)hit);
+
+    hit = 0;
+    for (i = 0; i < num_lines; i++)
+    {
+        bool line_hit = lines[i].hit;
+        while ( (i + 1u < num_lines) && (lines[i + 1u].line == lines[i].line) )
+        {
+            line_hit |= lines[++i].hit;
+        }
+        fprintf(file, "DA:%u,%u\n", lines[i].line, line_hit ? 1u : 0u);
+        found++;
+        hit += line_hit;
+    }
+    fprintf(file, "LF:%lu\nLH:%lu\nend_of_record\n",
+        (unsigned long)found, (unsigned long)hit);
+}
+
+
+/*
+ * Write coverage as an lcov tracefile (with the given test name, which
+ * may be NULL), mapping it to source lines with a line table. A line is
+ * hit (with a count of 1) if any instruction in any of its address ranges
+ * was executed. Each branch executed on a line (i.e. each with either of
+ * its bits set) is written as two branches: taken, and not taken. Only the
+ * lines (of the table) within the range of addresses covered are written.
+ * Returns 0 on success, or -1 on a write error, or if out of memory.
+ */
+extern int te_write_lcov(
+    FILE * const file,
+    const te_coverage_t * const coverage,
+    const te_line_table_t * const table,
+    const char * const test_name)
+{
+    lcov_t * lines = NULL;
+    lcov_t * branches = NULL;
+    size_t num_lines = 0, max_lines = 0;
+    size_t num_branches = 0, max_branches = 0;
+    size_t i, j, k;
+    int status = 0;
+
+    assert(file);
+    assert(coverage);
+    assert(table);
+
+    for (i = 0; (i + 1u < table->num_rows) && (0 == status); i++)
+    {
+        const te_line_t * const row = &table->rows[i];
+        const te_address_t limit = coverage->base + (coverage->num_slots << 1);
+        te_address_t start = row->address;
+        te_address_t end = table->rows[i + 1u].address;
+        lcov_t entry;
+        size_t first, last, slot;
+
+        if (0 == row->line)
+        {
+            continue;   /* end of a sequence */
+        }
+        start = (start < coverage->base) ? coverage->base : start;
+        end = (end > limit) ? limit : end;
+        if (start >= end)
+        {
+            continue;   /* empty, or outside the coverage */
+        }
+        first = (start - coverage->base) >> 1;
+        last = (end - coverage->base + 1u) >> 1;
+
+        entry.file = table->files[row->file];
+        entry.line = row->line;
+        entry.address = start;
+        entry.hit = any_bits(coverage->executed, first, last);
+        entry.other = false;
+        status = add_lcov(&lines, &num_lines, &max_lines, &entry);
+
+        for (slot = first; (slot < last) && (0 == status) && (entry.hit); slot++)
+        {
+            const uint64_t bit = 1ull << (slot & 63u);
+            if ( (0 == (slot & 63u)) &&
+                 (slot + 64u <= last) &&
+                 (0 == (coverage->taken[slot >> 6] | coverage->not_taken[slot >> 6])) )
+            {
+                slot += 63u;    /* skip a whole word with no branches */
+                continue;
+            }
+            if ( (coverage->taken[slot >> 6] | coverage->not_taken[slot >> 6]) & bit )
+            {
+                entry.address = coverage->base + (slot << 1);
+                entry.hit = 0 != (coverage->taken[slot >> 6] & bit);
+                entry.other = 0 != (coverage->not_taken[slot >> 6] & bit);
+                status = add_lcov(&branches, &num_branches, &max_branches, &entry);
+                entry.hit = true;
+            }
+        }
+    }
+
+    if (0 == status)
+    {
+        qsort(lines, num_lines, sizeof(lcov_t), compare_lcov);
+        qsort(branches, num_branches, sizeof(lcov_t), compare_lcov);
+
+        /* write one record for each file */
+        for (i = 0, j = 0; (i < num_lines) || (j < num_branches); i = k)
+        {
+            const char * const path = (i < num_lines) ? lines[i].file : branches[j].file;
+            size_t n = j;
+
+            for (k = i; (k < num_lines) && (0 == strcmp(lines[k].file, path)); k++)
+            {
+                /* find the end of this file's lines */
+            }
+            while ( (n < num_branches) && (0 == strcmp(branches[n].file, path)) )
+            {
+                n++;
+            }
+            write_lcov_record(file, test_name, &lines[i], k - i, &branches[j], n - j);
+            j = n;
+        }
+    }
+
+    free(lines);
+    free(branches);
+
+    return ( (0 != status) || (ferror(file)) ) ? -1 : 0;
+}
+
+
+/*
+ * Write a call-tree profile in pprof format. Each function is written as
+ * a Function, and a Location at its entry point, and each call path as a
+ * Sample, whose locations are the functions on the path (innermost first),
+ * with values of its exclusive instructions, and the number of calls.
+ * Thus pprof's "flat" is each function's exclusive count, and its "cum" is
+ * the inclusive count. Returns 0 on success, or -1 on a write error.
+ */
+extern int te_write_pprof_call_profile(
+    FILE * const file,
+    const te_call_profile_t * const profile)
+{
+    pprof_t pprof;
+    size_t slot;
+
+    assert(file);
+    assert(profile);
+
+    start_pprof(&pprof, file);
+    write_value_type(&pprof, PROFILE_SAMPLE_TYPE, pprof.instructions, pprof.count);
+    write_value_type(&pprof, PROFILE_SAMPLE_TYPE, pprof.calls, pprof.count);
+
+    /* the ids of functions, and of their locations, are slot + 1 */
+    for (slot = 0; slot < TE_CALL_PROFILE_TABLE_SIZE; slot++)
+    {
+        const te_call_function_t * const function = &profile->functions[slot];
+        if (function->calls)
+        {
+            write_function(&pprof, slot + 1u,
+                te_call_profile_symbol(profile, function->address, NULL),
+                function->address);
+            write_location(&pprof, slot + 1u, 0, function->address, slot + 1u);
+        }
+    }
+
+    for (slot = 0; slot < TE_CALL_PROFILE_TABLE_SIZE; slot++)
+    {
+        const te_call_node_t * const node = &profile->nodes[slot];
+        message_t sample = { .length = 0 };
+        uint32_t up;
+
+        if (0 == node->calls)
+        {
+            continue;
+        }
+        for (up = (uint32_t)slot; TE_CALL_PROFILE_NO_PARENT != up;
+             up = profile->nodes[up].parent)
+        {
+            put_uint(&sample, SAMPLE_LOCATION_ID, profile->nodes[up].function + 1u);
+        }
+        put_uint(&sample, SAMPLE_VALUE, node->exclusive);
+        put_uint(&sample, SAMPLE_VALUE, node->calls);
+        write_message(&pprof, PROFILE_SAMPLE, &sample);
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+
+/*
+ * Write an execution profile in pprof format, with one Location (and one
+ * Sample) for each PC executed, in the Function for the symbol containing
+ * it (if any), so pprof can show counts for each instruction, or roll them
+ * up for each function. Each Function is written when it is first needed.
+ * The profile is expanded first, if that has not already been done (see
+ * te_expand_exec_profile). Returns 0 on success, or -1 on a write error.
+ */
+extern int te_write_pprof_exec_profile(
+    FILE * const file,
+    te_exec_profile_t * const profile,
+    const te_symbol_t * const symbols,
+    const size_t num_symbols,
+    const te_decoder_state_t * const decoder)
+{
+    const uint64_t * const pc_executed = te_expand_exec_profile(profile, decoder);
+    bool * const written = calloc(num_symbols ? num_symbols : 1u, sizeof(bool));
+    message_t mapping = { .length = 0 };
+    pprof_t pprof;
+    size_t slot;
+
+    assert(file);
+    assert(written);
+
+    start_pprof(&pprof, file);
+    write_value_type(&pprof, PROFILE_SAMPLE_TYPE, pprof.instructions, pprof.count);
+
+    /* a single mapping, covering the whole profile */
+    put_uint(&mapping, MAPPING_ID, 1u);
+    put_uint(&mapping, MAPPING_MEMORY_START, profile->base);
+    put_uint(&mapping, MAPPING_MEMORY_LIMIT, profile->base + (profile->num_slots << 1));
+    put_uint(&mapping, MAPPING_HAS_FUNCTIONS, 1u);
+    write_message(&pprof, PROFILE_MAPPING, &mapping);
+
+    /* the ids of functions are symbol index + 1, of locations slot + 1 */
+    for (slot = 0; slot < profile->num_slots; slot++)
+    {
+        const te_address_t pc = profile->base + (slot << 1);
+        const te_symbol_t * symbol;
+        message_t sample = { .length = 0 };
+        uint64_t function_id = 0;
+
+        if (0 == pc_executed[slot])
+        {
+            continue;
+        }
+
+        symbol = te_lookup_symbol(symbols, num_symbols, pc, NULL);
+        if (symbol)
+        {
+            function_id = (uint64_t)(symbol - symbols) + 1u;
+            if (!written[function_id - 1u])
+            {
+                write_function(&pprof, function_id, symbol->name, symbol->address);
+                written[function_id - 1u] = true;
+            }
+        }
+        write_location(&pprof, slot + 1u, 1u, pc, function_id);
+
+        put_uint(&sample, SAMPLE_LOCATION_ID, slot + 1u);
+        put_uint(&sample, SAMPLE_VALUE, pc_executed[slot]);
+        write_message(&pprof, PROFILE_SAMPLE, &sample);
+    }
+
+    free(written);
+
+    return ferror(file) ? -1 : 0;
+}
+
+
+/*
+ * Write the name of the function starting at "address" (using the
+ * symbols of the call profile, if any) to "buffer", if it has no name.
+ */
+static const char * function_name(
+    const te_call_profile_t * const calls,
+    const te_address_t address,
+    char * const buffer,
+    const size_t size)
+{
+    const char * const name = calls ? te_call_profile_symbol(calls, address, NULL) : NULL;
+
+    if (name)
+    {
+        return name;
+    }
+    snprintf(buffer, size, "0x%lx", address);
+
+    return buffer;
+}
+
+
+/*
+ * Write a profile in callgrind format, with instruction addresses as the
+ * positions, and a single event: the number of instructions executed.
+ *
+ * If there is an execution profile ("profile" is not NULL), the exclusive
+ * cost of each function is written for each instruction, in the function
+ * of the symbol containing it (using the symbols of "calls"), otherwise it
+ * is written for the entry point of each function in "calls". If there is
+ * a call-tree profile ("calls" is not NULL), each call path is written as
+ * a call, from the function at the end of its parent's path, with the
+ * number of calls, and its inclusive cost. The reader sums the costs of
+ * any call that is written more than once (i.e. from different paths).
+ * Returns 0 on success, or -1 on a write error.
+ */
+extern int te_write_callgrind(
+    FILE * const file,
+    const te_call_profile_t * const calls,
+    te_exec_profile_t * const profile,
+    const te_decoder_state_t * const decoder)
+{
+    char caller[24];
+    char callee[24];
+    size_t slot;
+
+    assert(file);
+
+    fprintf(file, "# callgrind format\n");
+    fprintf(file, "version: 1\n");
+    fprintf(file, "creator: riscv-trace-decoder\n");
+    fprintf(file, "positions: instr\n");
+    fprintf(file, "events: Instructions\n\n");
+
+    if (profile)
+    {
+        const uint64_t * const pc_executed = te_expand_exec_profile(profile, decoder);
+        const char * current = NULL;
+
+        for (slot = 0; slot < profile->num_slots; slot++)
+        {
+            const te_address_t pc = profile->base + (slot << 1);
+            const char * name;
+
+            if (0 == pc_executed[slot])
+            {
+                continue;
+            }
+            name = calls ? te_call_profile_symbol(calls, pc, NULL) : NULL;
+            if (!name)
+            {
+                name = "(unknown)";
+            }
+            if (name != current)
+            {
+                fprintf(file, "fn=%s\n", name);
+                current = name;
+            }
+            fprintf(file, "0x%lx %lu\n", pc, (unsigned long)pc_executed[slot]);
+        }
+    }
+    else if (calls)
+    {
+        for (slot = 0; slot < TE_CALL_PROFILE_TABLE_SIZE; slot++)
+        {
+            const te_call_function_t * const function = &calls->functions[slot];
+            if (function->calls)
+            {
+                fprintf(file, "fn=%s\n0x%lx %lu\n",
+                    function_name(calls, function->address, callee, sizeof(callee)),
+                    function->address,
+                    (unsigned long)function->exclusive);
+            }
+        }
+    }
+
+    if (calls)
+    {
+        for (slot = 0; slot < TE_CALL_PROFILE_TABLE_SIZE; slot++)
+        {
+            const te_call_node_t * const node = &calls->nodes[slot];
+            const te_call_function_t * from;
+            const te_call_function_t * to;
+
+            if ( (0 == node->calls) ||
+                 (TE_CALL_PROFILE_NO_PARENT == node->parent) )
+            {
+                continue;
+            }
+            from = &calls->functions[calls->nodes[node->parent].function];
+            to = &calls->functions[node->function];
+            fprintf(file, "fn=%s\ncfn=%s\ncalls=%lu 0x%lx\n0x%lx %lu\n",
+                function_name(calls, from->address, caller, sizeof(caller)),
+                function_name(calls, to->address, callee, sizeof(callee)),
+                (unsigned long)node->calls,
+                to->address,
+                from->address,
+                (unsigned long)node->inclusive);
+        }
+    }
+
+    return ferror(file) ? -1 : 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_PROFILE_EXPORT_H
+#define TE_DECODER_PROFILE_EXPORT_H
+
+
+/*
+ * Exporters, to view the profiles accumulated from a decoded trace with
+ * standard tools: the execution profile (te_exec_profile_t, per PC) and
+ * the call-tree profile (te_call_profile_t, per function and call path).
+ *
+ * pprof profiles (see github.com/google/pprof, proto/profile.proto) are
+ * written directly as uncompressed protocol buffers, without depending on
+ * any protobuf runtime. The "pprof" tool reads them as they are, or after
+ * being gzip'ed. callgrind profiles are text, for kcachegrind et al.
+ *
+ * All of these are streamed to the file, one entry at a time, without
+ * building a copy of the profile in memory. Symbols are read from the
+ * symbol table of an ELF file, into a sorted index (te_elf_symbols_t, see
+ * elf-image.h), which is then passed to te_set_call_profile_symbols(), etc.
+ *
+ * Coverage (te_coverage_t) is written as lcov tracefiles, for genhtml et
+ * al., mapped to source lines with the DWARF line table (te_line_table_t)
+ * of the ELF file.
+ */
+#include "elf-image.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * One row of a DWARF line table: the source line of the instructions
+ * from "address" up to the address of the next row. A row that ends a
+ * sequence (of contiguous addresses) has no line of its own.
+ */
+typedef struct
+{
+    te_address_t address;
+    uint32_t file;              /* index into the table's "files" */
+    uint32_t line;              /* 0 == end of a sequence */
+} te_line_t;
+
+
+/*
+ * The line table (from the .debug_line section) of an ELF file,
+ * with the rows of every sequence, in address order.
+ */
+typedef struct
+{
+    te_line_t * rows;
+    size_t num_rows;
+    char ** files;              /* the path of each file */
+    size_t num_files;
+} te_line_table_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern int te_open_line_table(
+    te_line_table_t * const table,
+    const char * const filename);
+
+extern void te_close_line_table(
+    te_line_table_t * const table);
+
+extern int te_write_lcov(
+    FILE * const file,
+    const te_coverage_t * const coverage,
+    const te_line_table_t * const table,
+    const char * const test_name);
+
+extern int te_write_pprof_call_profile(
+    FILE * const file,
+    const te_call_profile_t * const profile);
+
+extern int te_write_pprof_exec_profile(
+    FILE * const file,
+    te_exec_profile_t * const profile,
+    const te_symbol_t * const symbols,
+    const size_t num_symbols,
+    const te_decoder_state_t * const decoder);
+
+extern int te_write_callgrind(
+    FILE * const file,
+    const te_call_profile_t * const calls,
+    te_exec_profile_t * const profile,
+    const te_decoder_state_t * const decoder);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_DECODER_PROFILE_EXPORT_H */
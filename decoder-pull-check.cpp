@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * A small C++20 consumer of the pull-based trace-decoder, via its coroutine
+ * front-end (see decoder-pull.hpp), which checks each PC it yields against
+ * those actually retired, for a trace from the synthetic trace-generator
+ * (see trace-generator.h). With "--stop-after=N", it stops after the first
+ * N PCs, so that the rest of the trace is abandoned part-way through (see
+ * te_close_pull). It prints the number of PCs checked (as JSON), and exits
+ * with status 0 if they all matched. For example, to build and run it:
+ *
+ *  make decoder-pull-check RISCV_DISASM=<riscv-disassembler>
+ *
+ *  ./decoder-pull-check --instructions=1000000 --stop-after=12345
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <getopt.h>
+#include "decoder-pull.hpp"
+#include "trace-generator.h"
+
+
+/*
+ * Record each PC retired, in order (see te_generator_replay).
+ */
+static void record_golden_pc(
+    void * const user_data,
+    const te_address_t pc)
+{
+    static_cast<std::vector<te_address_t> *>(user_data)->push_back(pc);
+}
+
+
+/*
+ * Retrieve an instruction from the generated code image.
+ */
+static unsigned get_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    return te_generator_get_instruction(
+        static_cast<const te_generator_t *>(user_data), address, instruction);
+}
+
+
+/*
+ * Feed all the generated messages to the trace-decoder, on its own thread,
+ * until the consumer stops.
+ */
+static void feed_pull(
+    te_pull_t * const pull,
+    void * const data)
+{
+    const te_generator_t * const generator = static_cast<const te_generator_t *>(data);
+
+    for (size_t i = 0; (i < generator->num_messages) && (!te_pull_abandoned(pull)); i++)
+    {
+        const te_message_t & message = generator->messages[i];
+
+        switch (message.type)
+        {
+            case TE_MESSAGE_TE_INST:
+                te_process_te_inst(pull->decoder, &message.te_inst);
+                break;
+            case TE_MESSAGE_TE_SUPPORT:
+                te_process_te_support(pull->decoder, &message.te_support);
+                break;
+            case TE_MESSAGE_TE_DATA:
+                te_process_te_data(pull->decoder, &message.te_data);
+                break;
+            case TE_MESSAGE_TE_CYCLES:
+                te_process_te_cycles(pull->decoder, &message.te_cycles);
+                break;
+        }
+    }
+}
+
+
+static void usage(
+    const char * const program)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --instructions=N     instructions to retire (1000000)\n"
+        "  --seed=N             pseudo-random seed (1)\n"
+        "  --max-resync=N       instructions between encoder resyncs (0)\n"
+        "  --stop-after=N       stop after the first N PCs (0 = all)\n",
+        program);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(
+    int argc,
+    char * argv[])
+{
+    static const struct option options[] =
+    {
+        { "instructions",   required_argument, NULL, 'n' },
+        { "seed",           required_argument, NULL, 's' },
+        { "max-resync",     required_argument, NULL, 'r' },
+        { "stop-after",     required_argument, NULL, 'S' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    te_generator_params_t params;
+    te_encoder_params_t encoder_params;
+    te_generator_t * generator;
+    te_decoder_callbacks_t callbacks = {};
+    std::vector<te_address_t> golden;
+    unsigned long stop_after = 0;
+    unsigned long checked = 0;
+    unsigned long mismatches = 0;
+    te_pull_t pull;
+    int option;
+
+    te_generator_default_params(&params);
+    te_encoder_default_params(&encoder_params);
+    params.num_instructions = 1000000;
+
+    while (-1 != (option = getopt_long(argc, argv, "h", options, NULL)))
+    {
+        switch (option)
+        {
+            case 'n': params.num_instructions = strtoul(optarg, NULL, 0); break;
+            case 's': params.seed = strtoul(optarg, NULL, 0); break;
+            case 'r': encoder_params.max_resync = strtoul(optarg, NULL, 0); break;
+            case 'S': stop_after = strtoul(optarg, NULL, 0); break;
+            default:  usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+    {
+        usage(argv[0]);
+    }
+
+    generator = te_generate_trace(&params);
+    te_generator_encode(generator, &encoder_params);
+    golden.reserve(generator->num_instructions);
+    te_generator_replay(generator, record_golden_pc, &golden);
+
+    /* the records yielded are checked here, so there is no advance_decoded_pc */
+    callbacks.get_instruction = get_instruction;
+    te_open_pull(&pull, &callbacks, generator, rv64);
+    if (0 != te_start_pull(&pull, feed_pull, generator))
+    {
+        perror("pthread_create");
+        return EXIT_FAILURE;
+    }
+
+    for (const te_fanout_record_t & record : te::records(pull))
+    {
+        if ( (checked == golden.size()) || (record.pc != golden[checked]) )
+        {
+            mismatches++;
+        }
+        if ( (++checked == stop_after) || (mismatches) )
+        {
+            break;      /* the trace-decoder is abandoned by te_close_pull */
+        }
+    }
+
+    te_close_pull(&pull);
+
+    const unsigned long expected =
+        ( (stop_after) && (stop_after < golden.size()) ) ? stop_after : golden.size();
+    const bool valid = (0 == mismatches) && (checked == expected);
+
+    printf("{\n");
+    printf("  \"instructions\": %lu,\n", generator->num_instructions);
+    printf("  \"checked\": %lu,\n", checked);
+    printf("  \"records\": %lu,\n", pull.num_records);
+    printf("  \"batches\": %lu,\n", pull.ring.num_batches);
+    printf("  \"valid\": %s\n", valid ? "true" : "false");
+    printf("}\n");
+
+    te_free_generated_trace(generator);
+
+    return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
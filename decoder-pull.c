@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include "decoder-pull.h"
+
+
+/*
+ * Hand over the batch being filled (if it holds any records) to be
+ * consumed, and then, if "refill", wait for an empty batch to fill next
+ * (which suspends the trace-decoder), otherwise there is none. Once the
+ * consumer has stopped, the same batch is re-used (and its records
+ * discarded), so that the trace-decoder never waits forever.
+ */
+static void hand_over(
+    te_pull_t * const pull,
+    const bool refill)
+{
+    assert(pull);
+    assert(pull->filling);
+
+    pull->filling = te_hand_over_batch(&pull->ring, pull->filling,
+        pull->filling->count, refill);
+
+    if (pull->filling)
+    {
+        pull->filling->count = 0;
+    }
+}
+
+
+/*
+ * Append a record to the batch being filled, handing it over when full.
+ */
+static void append_record(
+    te_pull_t * const pull,
+    const te_address_t pc,
+    const uint32_t length,
+    const te_transfer_t transfer)
+{
+    te_fanout_record_t * const record = &pull->filling->records[pull->filling->count];
+
+    record->pc = pc;
+    record->length = length;
+    record->transfer = transfer;
+    pull->num_records++;        /* update statistics */
+
+    if (TE_PULL_BATCH_SIZE == ++pull->filling->count)
+    {
+        hand_over(pull, true);
+    }
+}
+
+
+/*
+ * The body of the thread started by te_start_pull().
+ */
+static void * decoding_thread(
+    void * const arg)
+{
+    te_pull_t * const pull = arg;
+
+    assert(pull);
+    assert(pull->producer);
+
+    pull->producer(pull, pull->producer_data);
+
+    hand_over(pull, false);
+    te_end_batch_ring(&pull->ring);
+
+    return NULL;
+}
+
+
+/*
+ * Forward the retrieval of each instruction to the wrapped callbacks.
+ */
+static unsigned pull_get_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const te_pull_t * const pull = user_data;
+
+    return pull->callbacks.get_instruction(pull->user_data, address, instruction);
+}
+
+
+/*
+ * Notify the wrapped callbacks (if any) of each new PC, and then record it.
+ */
+static void pull_advance_decoded_pc(
+    void * const user_data,
+    const te_address_t old_pc,
+    const te_address_t new_pc,
+    const te_decoded_instruction_t * const new_instruction)
+{
+    te_pull_t * const pull = user_data;
+
+    if (pull->callbacks.advance_decoded_pc)
+    {
+        pull->callbacks.advance_decoded_pc(pull->user_data,
+            old_pc, new_pc, new_instruction);
+    }
+
+    append_record(pull, new_pc, new_instruction->length,
+        te_classify_transfer(new_instruction));
+}
+
+
+/*
+ * Forward each diagnostic to the wrapped callbacks (if they print them).
+ */
+static void pull_log(
+    void * const user_data,
+    const char * const format,
+    va_list args)
+{
+    const te_pull_t * const pull = user_data;
+
+    if (pull->callbacks.log)
+    {
+        pull->callbacks.log(pull->user_data, format, args);
+    }
+}
+
+
+static const te_decoder_callbacks_t pull_callbacks =
+{
+    .get_instruction = pull_get_instruction,
+    .advance_decoded_pc = pull_advance_decoded_pc,
+    .log = pull_log,
+};
+
+
+/*
+ * Initialize a new instance of a pull-based trace-decoder, for the given
+ * ISA, and open its trace-decoder (pull->decoder). The trace-decoder calls
+ * "callbacks" (which are copied) with "user_data", exactly as if they had
+ * been passed to te_open_trace_decoder() directly, except that their
+ * advance_decoded_pc may be NULL. If "callbacks" is NULL, then
+ * te_default_decoder_callbacks is used.
+ * If "pull" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ *
+ * Before the trace-decoder is started (see te_start_pull), profiles,
+ * and handlers, may be attached to pull->decoder, as usual.
+ */
+extern te_pull_t * te_open_pull(
+    te_pull_t * pull,
+    const te_decoder_callbacks_t * const callbacks,
+    void * const user_data,
+    const rv_isa isa)
+{
+#if defined(TE_NO_DEFAULT_CALLBACKS)
+    assert(callbacks);
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+
+    if (pull)
+    {
+        memset(pull, 0, sizeof(te_pull_t));
+    }
+    else
+    {
+        pull = calloc(1, sizeof(te_pull_t));
+        assert(pull);
+    }
+
+#if defined(TE_NO_DEFAULT_CALLBACKS)
+    pull->callbacks = *callbacks;
+#else   /* TE_NO_DEFAULT_CALLBACKS */
+    pull->callbacks = callbacks ? *callbacks : te_default_decoder_callbacks;
+#endif  /* TE_NO_DEFAULT_CALLBACKS */
+    assert(pull->callbacks.get_instruction);
+    pull->user_data = user_data;
+    pull->decoder = te_open_trace_decoder(NULL, &pull_callbacks, pull, isa);
+
+    pull->batches = malloc(TE_PULL_NUM_BATCHES * sizeof(te_pull_batch_t));
+    assert(pull->batches);
+    te_open_batch_ring(&pull->ring, pull->batches,
+        sizeof(te_pull_batch_t), TE_PULL_NUM_BATCHES);
+
+    /* the decoding side always has a batch to fill */
+    pull->filling = &pull->batches[0];
+    pull->filling->count = 0;
+
+    return pull;
+}
+
+
+/*
+ * Start a thread which calls "producer" to feed all the messages to the
+ * trace-decoder, which then runs until the ring of batches is full, and
+ * thereafter only as the consumer asks for more (see te_next_batch).
+ * Returns 0 on success, or an error number from pthread_create().
+ */
+extern int te_start_pull(
+    te_pull_t * const pull,
+    const te_pull_producer_t producer,
+    void * const data)
+{
+    int status;
+
+    assert(pull);
+    assert(producer);
+    assert(!pull->has_thread);
+
+    pull->producer = producer;
+    pull->producer_data = data;
+
+    status = pthread_create(&pull->thread, NULL, decoding_thread, pull);
+    pull->has_thread = (0 == status);
+
+    return status;
+}
+
+
+/*
+ * Return the next batch of records (via "records"), in order, waiting
+ * (if necessary) for the trace-decoder to decode them. The batch remains
+ * valid until the next call. Returns the number of records in the batch,
+ * or 0 if there are no more (i.e. the producer has returned).
+ */
+extern size_t te_next_batch(
+    te_pull_t * const pull,
+    const te_fanout_record_t ** const records)
+{
+    assert(pull);
+    assert(records);
+    assert(pull->has_thread);
+
+    pull->current = te_next_full_batch(&pull->ring, pull->current);
+    if (!pull->current)
+    {
+        *records = NULL;
+        return 0;
+    }
+
+    *records = pull->current->records;
+
+    return pull->current->count;
+}
+
+
+/*
+ * Record a gap in the trace (as a record with a zero length), normally
+ * called from the user's gap handler (see te_set_gap_handler), so that
+ * the consumer sees it at the correct point in the stream of PCs.
+ */
+extern void te_pull_gap(
+    te_pull_t * const pull)
+{
+    assert(pull);
+
+    append_record(pull, 0, 0, TE_TRANSFER_NONE);
+}
+
+
+/*
+ * Return true if the consumer has stopped (see te_close_pull), in which
+ * case the producer should stop feeding messages to the trace-decoder.
+ * This is cheap enough to call before each message.
+ */
+extern bool te_pull_abandoned(
+    te_pull_t * const pull)
+{
+    assert(pull);
+
+    return te_batch_ring_abandoned(&pull->ring);
+}
+
+
+/*
+ * Release everything allocated by te_open_pull(), including the
+ * trace-decoder, first stopping its thread (if any). This may be called
+ * before all the records have been consumed, in which case the trace-decoder
+ * discards the remainder of the current message, and the producer should
+ * then return (see te_pull_abandoned).
+ */
+extern void te_close_pull(
+    te_pull_t * const pull)
+{
+    assert(pull);
+
+    te_abandon_batch_ring(&pull->ring);
+
+    if (pull->has_thread)
+    {
+        pthread_join(pull->thread, NULL);
+        pull->has_thread = false;
+    }
+
+    te_close_batch_ring(&pull->ring);
+    te_close_trace_decoder(pull->decoder);
+    free(pull->decoder);
+    free(pull->batches);
+    pull->decoder = NULL;
+    pull->batches = NULL;
+    pull->filling = NULL;
+    pull->current = NULL;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_PULL_H
+#define TE_DECODER_PULL_H
+
+
+/*
+ * A pull-based interface to the trace-decoder, which returns the decoded
+ * PCs a batch at a time, on demand (see te_next_batch), rather than pushing
+ * each one to te_advance_decoded_pc(). So a consumer need not be written as
+ * a callback, may interleave the streams of several harts (e.g. for a merge),
+ * and may stop early without the whole trace being decoded.
+ *
+ * The trace-decoder runs on its own thread, fed with messages by the user's
+ * producer function (see te_start_pull), and records each PC into a small
+ * ring of batches. When the ring is full, the trace-decoder is suspended
+ * wherever it is (typically part-way through following the execution path
+ * of one te_inst message), until the consumer asks for another batch. So at
+ * most TE_PULL_NUM_BATCHES batches are decoded ahead of the consumer. The two
+ * threads only synchronize once per batch (see decoder-batch-ring.h).
+ *
+ * Each PC is recorded as a te_fanout_record_t (see decoder-fanout.h).
+ */
+#include <pthread.h>
+#include "decoder-algorithm-public.h"
+#include "decoder-batch-ring.h"
+#include "decoder-fanout.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * Define the number of records in each batch, and the number of batches in
+ * the ring (which bounds how far decoding may run ahead of the consumer).
+ * If not defined elsewhere, define these here.
+ */
+#if !defined(TE_PULL_BATCH_SIZE)
+#   define TE_PULL_BATCH_SIZE   (1u<<12)    /* 2^12 = 4096 records */
+#endif  /* TE_PULL_BATCH_SIZE */
+#if !defined(TE_PULL_NUM_BATCHES)
+#   define TE_PULL_NUM_BATCHES  (2u)
+#endif  /* TE_PULL_NUM_BATCHES */
+
+
+/*
+ * One batch of records.
+ */
+typedef struct
+{
+    size_t count;
+    te_fanout_record_t records[TE_PULL_BATCH_SIZE];
+} te_pull_batch_t;
+
+
+/*
+ * The state of one pull-based trace-decoder.
+ */
+typedef struct te_pull_s
+{
+    /* the trace-decoder, and the callbacks it wraps, with their "user_data" */
+    te_decoder_state_t * decoder;
+    te_decoder_callbacks_t callbacks;
+    void * user_data;
+
+    /* the decoding side (producer of records) */
+    te_pull_batch_t * filling;  /* being filled, or NULL */
+
+    /* the consuming side */
+    te_pull_batch_t * current;  /* returned by te_next_batch(), or NULL */
+
+    /* the ring of batches, shared by both sides (with its statistics) */
+    te_pull_batch_t * batches;
+    te_batch_ring_t ring;
+
+    /* the thread running the trace-decoder */
+    pthread_t thread;
+    bool has_thread;
+    void (*producer)(struct te_pull_s * const pull, void * const data);
+    void * producer_data;
+
+    /* maintain a few statistics */
+    unsigned long num_records;      /* PCs (and gaps) recorded */
+} te_pull_t;
+
+
+/*
+ * Type of function that feeds all the messages to the trace-decoder
+ * (i.e. pull->decoder), in order, when run on its own thread (see
+ * te_start_pull). It should return early if te_pull_abandoned().
+ */
+typedef void (*te_pull_producer_t)(
+    te_pull_t * const pull,
+    void * const data);
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_pull_t * te_open_pull(
+    te_pull_t * pull,
+    const te_decoder_callbacks_t * const callbacks,
+    void * const user_data,
+    const rv_isa isa);
+
+extern int te_start_pull(
+    te_pull_t * const pull,
+    const te_pull_producer_t producer,
+    void * const data);
+
+extern size_t te_next_batch(
+    te_pull_t * const pull,
+    const te_fanout_record_t ** const records);
+
+extern void te_pull_gap(
+    te_pull_t * const pull);
+
+extern bool te_pull_abandoned(
+    te_pull_t * const pull);
+
+extern void te_close_pull(
+    te_pull_t * const pull);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_DECODER_PULL_H */
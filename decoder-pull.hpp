@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_PULL_HPP
+#define TE_DECODER_PULL_HPP
+
+
+/*
+ * A C++20 coroutine front-end to the pull-based trace-decoder (see
+ * decoder-pull.h), which yields each record as it is asked for, e.g.
+ *
+ *  for (const te_fanout_record_t & record : te::records(pull))
+ *  {
+ *      if (record.pc == wanted) break;     // decoding stops soon after
+ *  }
+ *
+ * Each record is only valid until the next is asked for. See
+ * decoder-pull-check.cpp for a complete example.
+ */
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <utility>
+#include "decoder-pull.h"
+
+
+namespace te
+{
+
+
+/*
+ * A minimal generator, of references to values of type T.
+ */
+template <class T>
+class Generator
+{
+public:
+    struct promise_type
+    {
+        const T * value = nullptr;
+        std::exception_ptr exception;
+
+        Generator get_return_object() noexcept
+        {
+            return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(const T & yielded) noexcept
+        {
+            value = &yielded;
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept
+        {
+            exception = std::current_exception();
+        }
+    };
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T *;
+        using reference = const T &;
+
+        iterator() noexcept = default;
+        explicit iterator(const std::coroutine_handle<promise_type> handle) noexcept
+            : handle_(handle) {}
+
+        reference operator*() const noexcept { return *handle_.promise().value; }
+        pointer operator->() const noexcept { return handle_.promise().value; }
+
+        iterator & operator++()
+        {
+            resume(handle_);
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const noexcept
+        {
+            return (!handle_) || (handle_.done());
+        }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    explicit Generator(const std::coroutine_handle<promise_type> handle) noexcept
+        : handle_(handle) {}
+    Generator(Generator && other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)) {}
+    Generator(const Generator &) = delete;
+    Generator & operator=(const Generator &) = delete;
+    ~Generator()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    iterator begin()
+    {
+        resume(handle_);
+        return iterator(handle_);
+    }
+    std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+    static void resume(
+        const std::coroutine_handle<promise_type> handle)
+    {
+        handle.resume();
+        if (handle.promise().exception)
+        {
+            std::rethrow_exception(handle.promise().exception);
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+
+/*
+ * Yield each record from a (started) pull-based trace-decoder, in order,
+ * asking it for the next batch (see te_next_batch) only when needed.
+ */
+inline Generator<te_fanout_record_t> records(
+    te_pull_t & pull)
+{
+    const te_fanout_record_t * batch;
+    size_t count;
+
+    while (0 != (count = te_next_batch(&pull, &batch)))
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            co_yield batch[i];
+        }
+    }
+}
+
+
+}   /* namespace te */
+
+
+#endif  /* TE_DECODER_PULL_HPP */
@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include "decoder-scheduler.h"
+
+
+/*
+ * The locks are always acquired in the order: task, worker, scheduler.
+ * The scheduler's lock is only needed to sleep, and to wake sleepers.
+ */
+
+
+/*
+ * Return the current (monotonic) time, in ns.
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+/*
+ * Place a task (whose lock is held) at the back of the run queue of its
+ * home worker, and wake a worker to run it. The task is counted as
+ * runnable before it is published, so that the count never drops below
+ * zero when it is taken straight away (see next_task).
+ */
+static void make_runnable(
+    te_scheduler_t * const scheduler,
+    te_sched_task_t * const task)
+{
+    te_sched_worker_t * const worker = &scheduler->workers[task->home];
+
+    task->state = TE_TASK_QUEUED;
+    __atomic_fetch_add(&scheduler->num_runnable, 1u, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&worker->lock);
+    assert(worker->count < scheduler->max_tasks);
+    worker->run_queue[(worker->head + worker->count) % scheduler->max_tasks] = task;
+    worker->count++;
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_mutex_lock(&scheduler->lock);
+    pthread_cond_signal(&scheduler->work);
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+
+/*
+ * Take the next task from the front of a worker's own run queue, or else
+ * steal one from the back of another's. Returns NULL if there are none.
+ */
+static te_sched_task_t * next_task(
+    te_sched_worker_t * const worker)
+{
+    te_scheduler_t * const scheduler = worker->scheduler;
+    te_sched_task_t * task = NULL;
+    size_t i;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count)
+    {
+        task = worker->run_queue[worker->head];
+        worker->head = (worker->head + 1u) % scheduler->max_tasks;
+        worker->count--;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    for (i = 1; (!task) && (i < scheduler->num_workers); i++)
+    {
+        te_sched_worker_t * const victim =
+            &scheduler->workers[(worker->index + i) % scheduler->num_workers];
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->count)
+        {
+            victim->count--;
+            task = victim->run_queue[(victim->head + victim->count) % scheduler->max_tasks];
+            worker->num_steals++;       /* update statistics */
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    if (task)
+    {
+        __atomic_fetch_sub(&scheduler->num_runnable, 1u, __ATOMIC_SEQ_CST);
+    }
+
+    return task;
+}
+
+
+/*
+ * Pass one packet to a trace-decoder.
+ */
+static void process_packet(
+    te_decoder_state_t * const decoder,
+    const te_packet_t * const packet)
+{
+    switch (packet->type)
+    {
+        case TE_PACKET_TE_INST:
+            te_process_te_inst(decoder, &packet->u.te_inst);
+            break;
+
+        case TE_PACKET_TE_SUPPORT:
+            te_process_te_support(decoder, &packet->u.te_support);
+            break;
+
+        case TE_PACKET_TE_DATA:
+            te_process_te_data(decoder, &packet->u.te_data);
+            break;
+
+        case TE_PACKET_TE_CYCLES:
+            te_process_te_cycles(decoder, &packet->u.te_cycles);
+            break;
+
+        case TE_PACKET_GAP:
+            te_process_gap(decoder);
+            break;
+
+        default:
+            assert(!"unknown packet type");
+            break;
+    }
+}
+
+
+/*
+ * Run one quantum of a task on a worker, i.e. process up to
+ * TE_SCHED_QUANTUM of its packets, without holding any lock. The packets
+ * being processed are not touched by te_submit_packet(), as they are only
+ * removed from the queue afterwards (and "not_full" is then signalled, for
+ * te_drain_scheduler too). Then re-queue the task, if it still has packets,
+ * on this worker (which is now its home).
+ */
+static void run_quantum(
+    te_sched_worker_t * const worker,
+    te_sched_task_t * const task)
+{
+    te_scheduler_t * const scheduler = worker->scheduler;
+    uint64_t total_latency = 0;
+    uint64_t max_latency = 0;
+    size_t head;
+    size_t n;
+    size_t i;
+
+    pthread_mutex_lock(&task->lock);
+    assert(TE_TASK_QUEUED == task->state);
+    task->state = TE_TASK_RUNNING;
+    if (task->home != worker->index)
+    {
+        task->home = worker->index;
+        task->num_migrations++;     /* update statistics */
+    }
+    head = task->head;
+    n = (task->count < TE_SCHED_QUANTUM) ? task->count : TE_SCHED_QUANTUM;
+    pthread_mutex_unlock(&task->lock);
+
+    for (i = 0; i < n; i++)
+    {
+        const te_packet_t * const packet =
+            &task->queue[(head + i) & (TE_SCHED_QUEUE_SIZE - 1u)];
+        uint64_t latency;
+
+        process_packet(task->decoder, packet);
+        latency = now_ns() - packet->submitted;
+        total_latency += latency;
+        if (latency > max_latency)
+        {
+            max_latency = latency;
+        }
+    }
+
+    pthread_mutex_lock(&task->lock);
+    task->head = (task->head + n) & (TE_SCHED_QUEUE_SIZE - 1u);
+    task->count -= n;
+    task->num_packets += n;         /* update statistics */
+    task->num_quanta++;
+    task->total_latency += total_latency;
+    if (max_latency > task->max_latency)
+    {
+        task->max_latency = max_latency;
+    }
+    pthread_cond_broadcast(&task->not_full);
+    if (task->count)
+    {
+        make_runnable(scheduler, task);
+    }
+    else
+    {
+        task->state = TE_TASK_IDLE;
+    }
+    pthread_mutex_unlock(&task->lock);
+
+    worker->num_quanta++;           /* update statistics */
+}
+
+
+/*
+ * The body of the thread of each worker, which runs tasks until the
+ * scheduler is stopping and there are none left to run. A task may be
+ * counted as runnable just before it is published, in which case this
+ * just tries again, rather than sleeping.
+ */
+static void * worker_thread(
+    void * const arg)
+{
+    te_sched_worker_t * const worker = arg;
+    te_scheduler_t * const scheduler = worker->scheduler;
+    te_sched_task_t * task;
+
+    assert(worker);
+    assert(scheduler);
+
+    while (true)
+    {
+        task = next_task(worker);
+        if (task)
+        {
+            run_quantum(worker, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&scheduler->lock);
+        while ( (0 == __atomic_load_n(&scheduler->num_runnable, __ATOMIC_SEQ_CST)) &&
+                (!scheduler->stopping) )
+        {
+            worker->num_sleeps++;       /* update statistics */
+            pthread_cond_wait(&scheduler->work, &scheduler->lock);
+        }
+        if (0 == __atomic_load_n(&scheduler->num_runnable, __ATOMIC_SEQ_CST))
+        {
+            pthread_mutex_unlock(&scheduler->lock);
+            break;  /* stopping, and nothing left to run */
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Initialize a new instance of a scheduler, with a pool of "num_workers"
+ * worker threads (see te_start_scheduler), for up to "max_tasks" tasks.
+ * If "scheduler" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ */
+extern te_scheduler_t * te_open_scheduler(
+    te_scheduler_t * scheduler,
+    const size_t num_workers,
+    const size_t max_tasks)
+{
+    size_t i;
+
+    assert(num_workers > 0);
+    assert(max_tasks > 0);
+
+    if (scheduler)
+    {
+        memset(scheduler, 0, sizeof(te_scheduler_t));
+    }
+    else
+    {
+        scheduler = calloc(1, sizeof(te_scheduler_t));
+        assert(scheduler);
+    }
+
+    scheduler->num_workers = num_workers;
+    scheduler->max_tasks = max_tasks;
+    scheduler->workers = calloc(num_workers, sizeof(te_sched_worker_t));
+    scheduler->tasks = calloc(max_tasks, sizeof(te_sched_task_t *));
+    assert(scheduler->workers);
+    assert(scheduler->tasks);
+
+    for (i = 0; i < num_workers; i++)
+    {
+        te_sched_worker_t * const worker = &scheduler->workers[i];
+
+        worker->scheduler = scheduler;
+        worker->index = i;
+        worker->run_queue = malloc(max_tasks * sizeof(te_sched_task_t *));
+        assert(worker->run_queue);
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->work, NULL);
+
+    return scheduler;
+}
+
+
+/*
+ * Start the thread of each worker.
+ * Returns 0 on success, or an error number from pthread_create().
+ */
+extern int te_start_scheduler(
+    te_scheduler_t * const scheduler)
+{
+    int status = 0;
+    size_t i;
+
+    assert(scheduler);
+
+    for (i = 0; (0 == status) && (i < scheduler->num_workers); i++)
+    {
+        te_sched_worker_t * const worker = &scheduler->workers[i];
+
+        assert(!worker->has_thread);
+        status = pthread_create(&worker->thread, NULL, worker_thread, worker);
+        worker->has_thread = (0 == status);
+    }
+
+    return status;
+}
+
+
+/*
+ * Add a task, opening its trace-decoder, for the given ISA, with "callbacks"
+ * and "user_data" (see te_open_trace_decoder). "index" just identifies the
+ * task (e.g. as a hart) to the user. Each new task's home is the next
+ * worker in turn. Tasks may be added at any time. Returns the task, or
+ * NULL if there are already "max_tasks" tasks.
+ */
+extern te_sched_task_t * te_add_sched_task(
+    te_scheduler_t * const scheduler,
+    const size_t index,
+    const te_decoder_callbacks_t * const callbacks,
+    void * const user_data,
+    const rv_isa isa)
+{
+    te_sched_task_t * task;
+
+    assert(scheduler);
+
+    task = calloc(1, sizeof(te_sched_task_t));
+    assert(task);
+    task->index = index;
+    task->decoder = te_open_trace_decoder(NULL, callbacks, user_data, isa);
+    task->queue = malloc(TE_SCHED_QUEUE_SIZE * sizeof(te_packet_t));
+    assert(task->queue);
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->not_full, NULL);
+
+    pthread_mutex_lock(&scheduler->lock);
+    if (scheduler->num_tasks < scheduler->max_tasks)
+    {
+        task->home = scheduler->next_home;
+        scheduler->next_home = (scheduler->next_home + 1u) % scheduler->num_workers;
+        scheduler->tasks[scheduler->num_tasks++] = task;
+    }
+    else
+    {
+        pthread_cond_destroy(&task->not_full);
+        pthread_mutex_destroy(&task->lock);
+        free(task->queue);
+        te_close_trace_decoder(task->decoder);
+        free(task->decoder);
+        free(task);
+        task = NULL;
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return task;
+}
+
+
+/*
+ * Submit a packet (which is copied) to be processed by a task's
+ * trace-decoder, after all the packets previously submitted to it. If the
+ * task's queue is full, then this waits until it is not. So it must not be
+ * called from the callbacks of a trace-decoder. Packets may be submitted
+ * to different tasks from different threads, but those for each task
+ * should be submitted from one thread (else their order is undefined).
+ * Only the task's lock is taken, unless the task was idle.
+ */
+extern void te_submit_packet(
+    te_scheduler_t * const scheduler,
+    te_sched_task_t * const task,
+    const te_packet_t * const packet)
+{
+    te_packet_t * slot;
+
+    assert(scheduler);
+    assert(task);
+    assert(packet);
+
+    pthread_mutex_lock(&task->lock);
+    while (TE_SCHED_QUEUE_SIZE == task->count)
+    {
+        pthread_cond_wait(&task->not_full, &task->lock);
+    }
+    slot = &task->queue[(task->head + task->count) & (TE_SCHED_QUEUE_SIZE - 1u)];
+    *slot = *packet;
+    slot->submitted = now_ns();
+    task->count++;
+    if (task->count > task->max_backlog)
+    {
+        task->max_backlog = task->count;    /* update statistics */
+    }
+
+    if (TE_TASK_IDLE == task->state)
+    {
+        make_runnable(scheduler, task);
+    }
+    pthread_mutex_unlock(&task->lock);
+}
+
+
+/*
+ * Wait until every packet submitted (so far) has been processed, i.e.
+ * until the queue of each task (added so far) has emptied in turn.
+ */
+extern void te_drain_scheduler(
+    te_scheduler_t * const scheduler)
+{
+    size_t num_tasks;
+    size_t i;
+
+    assert(scheduler);
+
+    pthread_mutex_lock(&scheduler->lock);
+    num_tasks = scheduler->num_tasks;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    for (i = 0; i < num_tasks; i++)
+    {
+        te_sched_task_t * const task = scheduler->tasks[i];
+
+        pthread_mutex_lock(&task->lock);
+        while (task->count)
+        {
+            pthread_cond_wait(&task->not_full, &task->lock);
+        }
+        pthread_mutex_unlock(&task->lock);
+    }
+}
+
+
+/*
+ * Return (via "metrics") a consistent snapshot of the metrics of a task.
+ * This may be called at any time, from any thread.
+ */
+extern void te_get_sched_metrics(
+    te_sched_task_t * const task,
+    te_sched_metrics_t * const metrics)
+{
+    assert(task);
+    assert(metrics);
+
+    pthread_mutex_lock(&task->lock);
+    metrics->backlog = task->count;
+    metrics->max_backlog = task->max_backlog;
+    metrics->num_packets = task->num_packets;
+    metrics->num_quanta = task->num_quanta;
+    metrics->num_migrations = task->num_migrations;
+    metrics->mean_latency = task->num_packets ?
+        (task->total_latency / task->num_packets) : 0;
+    metrics->max_latency = task->max_latency;
+    metrics->home = task->home;
+    pthread_mutex_unlock(&task->lock);
+}
+
+
+/*
+ * Stop the scheduler, once every packet submitted has been processed,
+ * waiting for its workers to finish, and then release everything allocated
+ * by te_open_scheduler() and te_add_sched_task(), including the
+ * trace-decoder of each task. No more packets may be submitted.
+ */
+extern void te_close_scheduler(
+    te_scheduler_t * const scheduler)
+{
+    size_t i;
+
+    assert(scheduler);
+
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->stopping = true;
+    pthread_cond_broadcast(&scheduler->work);
+    pthread_mutex_unlock(&scheduler->lock);
+
+    for (i = 0; i < scheduler->num_workers; i++)
+    {
+        te_sched_worker_t * const worker = &scheduler->workers[i];
+
+        if (worker->has_thread)
+        {
+            pthread_join(worker->thread, NULL);
+            worker->has_thread = false;
+        }
+    }
+
+    /* only once none may steal from the others */
+    for (i = 0; i < scheduler->num_workers; i++)
+    {
+        pthread_mutex_destroy(&scheduler->workers[i].lock);
+        free(scheduler->workers[i].run_queue);
+    }
+
+    for (i = 0; i < scheduler->num_tasks; i++)
+    {
+        te_sched_task_t * const task = scheduler->tasks[i];
+
+        pthread_cond_destroy(&task->not_full);
+        pthread_mutex_destroy(&task->lock);
+        free(task->queue);
+        te_close_trace_decoder(task->decoder);
+        free(task->decoder);
+        free(task);
+    }
+
+    pthread_cond_destroy(&scheduler->work);
+    pthread_mutex_destroy(&scheduler->lock);
+    free(scheduler->workers);
+    free(scheduler->tasks);
+    scheduler->workers = NULL;
+    scheduler->tasks = NULL;
+    scheduler->num_workers = 0;
+    scheduler->num_tasks = 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_SCHEDULER_H
+#define TE_DECODER_SCHEDULER_H
+
+
+/*
+ * A scheduler that runs many trace-decoders (e.g. one per hart, for
+ * thousands of harts) on a fixed pool of worker threads, rather than
+ * with a thread per trace-decoder.
+ *
+ * Each trace-decoder, and its queue of packets (i.e. messages, or gaps,
+ * still to be processed), is a "task". Packets are submitted to a task (see
+ * te_submit_packet) from any thread. A task with packets is runnable, and
+ * is placed on the run queue of its "home" worker, which processes a
+ * "quantum" of (up to TE_SCHED_QUANTUM) packets, before placing it at the
+ * back of its run queue again (if it still has packets). So each worker
+ * round-robins between its tasks, and a task only runs on one worker at a
+ * time, with the packets of each task processed in order.
+ *
+ * Each task stays on its home worker, so that its trace-decoder (and
+ * its decoded-instruction cache) stays in that worker's CPU caches. Only
+ * when a worker has no runnable tasks of its own does it steal one, from
+ * the back of another worker's run queue, and it then becomes that task's
+ * home. So tasks only migrate to balance the load.
+ *
+ * The callbacks of each trace-decoder are called on whichever worker is
+ * running its task, but never concurrently for the same task.
+ *
+ * The queue of each task is bounded (to TE_SCHED_QUEUE_SIZE packets), so
+ * te_submit_packet() waits while it is full. The latency (from submission
+ * to the end of processing) and the backlog (packets queued) of each task
+ * are measured (see te_get_sched_metrics).
+ */
+#include <pthread.h>
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * Define the number of packets that may be queued for each task (which
+ * must be a power of 2), and the most packets processed each time a task
+ * is run. If not defined elsewhere, define these here.
+ */
+#if !defined(TE_SCHED_QUEUE_SIZE)
+#   define TE_SCHED_QUEUE_SIZE  (1u<<8)     /* 2^8 = 256 packets */
+#endif  /* TE_SCHED_QUEUE_SIZE */
+#if !defined(TE_SCHED_QUANTUM)
+#   define TE_SCHED_QUANTUM     (32u)
+#endif  /* TE_SCHED_QUANTUM */
+
+
+/*
+ * The types of packets that may be submitted to a task.
+ */
+typedef enum
+{
+    TE_PACKET_TE_INST = 0,
+    TE_PACKET_TE_SUPPORT = 1,
+    TE_PACKET_TE_DATA = 2,
+    TE_PACKET_TE_CYCLES = 3,
+    TE_PACKET_GAP = 4,      /* see te_process_gap() */
+} te_packet_type_t;
+
+
+/*
+ * A single packet. Only the member selected by "type" is valid.
+ */
+typedef struct
+{
+    te_packet_type_t type;
+    uint64_t submitted;     /* time of submission, in ns */
+    union
+    {
+        te_inst_t te_inst;
+        te_support_t te_support;
+        te_data_t te_data;
+        te_cycles_t te_cycles;
+    } u;
+} te_packet_t;
+
+
+/*
+ * The states of each task.
+ */
+typedef enum
+{
+    TE_TASK_IDLE = 0,       /* no packets */
+    TE_TASK_QUEUED = 1,     /* on the run queue of a worker */
+    TE_TASK_RUNNING = 2,    /* being run by a worker */
+} te_task_state_t;
+
+
+/*
+ * The state of one task, i.e. a trace-decoder and its packets.
+ */
+typedef struct te_sched_task_s
+{
+    size_t index;           /* e.g. of the hart */
+    te_decoder_state_t * decoder;
+    size_t home;            /* index of the worker that runs it */
+
+    /* FIFO of packets to be processed */
+    te_packet_t * queue;
+    size_t head;
+    size_t count;
+    te_task_state_t state;
+    pthread_mutex_t lock;   /* of all the above, bar "decoder" */
+    pthread_cond_t not_full;        /* signalled when packets are processed */
+
+    /* maintain a few statistics (protected by "lock") */
+    unsigned long num_packets;      /* processed */
+    unsigned long num_quanta;       /* times run */
+    unsigned long num_migrations;   /* times stolen */
+    size_t max_backlog;             /* most packets queued */
+    uint64_t total_latency;         /* in ns */
+    uint64_t max_latency;           /* in ns */
+} te_sched_task_t;
+
+
+/*
+ * A snapshot of the metrics of one task (see te_get_sched_metrics).
+ * All times are in ns.
+ */
+typedef struct
+{
+    size_t backlog;                 /* packets queued now */
+    size_t max_backlog;
+    unsigned long num_packets;
+    unsigned long num_quanta;
+    unsigned long num_migrations;
+    uint64_t mean_latency;
+    uint64_t max_latency;
+    size_t home;
+} te_sched_metrics_t;
+
+
+/*
+ * The state of one worker thread, and its run queue.
+ */
+typedef struct
+{
+    struct te_scheduler_s * scheduler;
+    size_t index;
+
+    /* FIFO of runnable tasks */
+    te_sched_task_t ** run_queue;
+    size_t head;
+    size_t count;
+    pthread_mutex_t lock;   /* of the run queue */
+
+    pthread_t thread;
+    bool has_thread;
+
+    /* maintain a few statistics (only written by its own thread) */
+    unsigned long num_quanta;       /* tasks run */
+    unsigned long num_steals;       /* tasks stolen from others */
+    unsigned long num_sleeps;       /* times there was nothing to run */
+} te_sched_worker_t;
+
+
+/*
+ * The state of one scheduler.
+ */
+typedef struct te_scheduler_s
+{
+    te_sched_worker_t * workers;
+    size_t num_workers;
+    te_sched_task_t ** tasks;
+    size_t num_tasks;
+    size_t max_tasks;
+    size_t next_home;       /* for placing new tasks */
+
+    /* tasks on (or being placed on) any run queue, accessed atomically */
+    unsigned long num_runnable;
+
+    /* protected by "lock" */
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t work;            /* signalled when a task is runnable */
+} te_scheduler_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_scheduler_t * te_open_scheduler(
+    te_scheduler_t * scheduler,
+    const size_t num_workers,
+    const size_t max_tasks);
+
+extern int te_start_scheduler(
+    te_scheduler_t * const scheduler);
+
+extern te_sched_task_t * te_add_sched_task(
+    te_scheduler_t * const scheduler,
+    const size_t index,
+    const te_decoder_callbacks_t * const callbacks,
+    void * const user_data,
+    const rv_isa isa);
+
+extern void te_submit_packet(
+    te_scheduler_t * const scheduler,
+    te_sched_task_t * const task,
+    const te_packet_t * const packet);
+
+extern void te_drain_scheduler(
+    te_scheduler_t * const scheduler);
+
+extern void te_get_sched_metrics(
+    te_sched_task_t * const task,
+    te_sched_metrics_t * const metrics);
+
+extern void te_close_scheduler(
+    te_scheduler_t * const scheduler);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_DECODER_SCHEDULER_H */
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * A check of the C++ front-end to the trace-decoder (see
+ * decoder-algorithm-public.hpp), which decodes a trace from the synthetic
+ * trace-generator (see trace-generator.h) both with the C trace-decoder and
+ * with te::TraceDecoder<te::DefaultConfig, Sink>, checking every PC each
+ * reconstructs against those actually retired, and timing each. The same
+ * execution is then encoded again in implicit return mode (which the C code
+ * is not compiled for), and decoded with a Config for that. It prints the
+ * results (as JSON), and exits with status 0 if every PC matched. For
+ * example, to build and run it:
+ *
+ *  make decoder-template-check RISCV_DISASM=<riscv-disassembler>
+ *
+ *  ./decoder-template-check --instructions=10000000 --data=0.2 --cycles
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <getopt.h>
+#include "decoder-algorithm-public.hpp"
+#include "trace-generator.h"
+
+
+/*
+ * The modes for implicit return, with a return stack small enough that
+ * it overflows with deeper calls (see "--call-depth").
+ */
+struct ImplicitReturnConfig : te::DefaultConfig
+{
+    static constexpr bool implicit_return = true;
+    static constexpr unsigned call_counter_width = 1;   /* 2^(1+2) = 8 calls */
+};
+
+
+/*
+ * The sink of each trace-decoder, which retrieves instructions from the
+ * generated code image, and checks each PC against the next one retired.
+ */
+class Checker
+{
+public:
+    Checker(
+        const te_generator_t & generator,
+        const std::vector<te_address_t> & golden) noexcept
+        : generator_(generator), golden_(golden) {}
+
+    unsigned get_instruction(
+        const te_address_t address,
+        rv_inst & instruction)
+    {
+        return te_generator_get_instruction(&generator_, address, &instruction);
+    }
+
+    void advance(
+        const te_address_t old_pc,
+        const te_address_t new_pc,
+        const te_decoded_instruction_t & instruction)
+    {
+        (void)old_pc;
+        (void)instruction;
+
+        if ( (decoded_ == golden_.size()) || (new_pc != golden_[decoded_]) )
+        {
+            mismatches_++;
+        }
+        decoded_++;
+    }
+
+    unsigned long decoded() const noexcept { return decoded_; }
+    unsigned long mismatches() const noexcept { return mismatches_; }
+    bool valid() const noexcept
+    {
+        return (0 == mismatches_) && (golden_.size() == decoded_);
+    }
+
+private:
+    const te_generator_t & generator_;
+    const std::vector<te_address_t> & golden_;
+    unsigned long decoded_ = 0;
+    unsigned long mismatches_ = 0;
+};
+
+
+/*
+ * The C trace-decoder, with the same interface as te::TraceDecoder, and
+ * its callbacks, which forward to the sink.
+ */
+class CDecoder
+{
+public:
+    explicit CDecoder(
+        Checker & checker)
+        : decoder_(te_open_trace_decoder(nullptr, &callbacks, &checker, rv64)) {}
+    ~CDecoder()
+    {
+        te_close_trace_decoder(decoder_);
+        std::free(decoder_);
+    }
+    CDecoder(const CDecoder &) = delete;
+    CDecoder & operator=(const CDecoder &) = delete;
+
+    void process(const te_inst_t & te_inst) { te_process_te_inst(decoder_, &te_inst); }
+    void process(const te_support_t & te_support) { te_process_te_support(decoder_, &te_support); }
+    void process(const te_data_t & te_data) { te_process_te_data(decoder_, &te_data); }
+    void process(const te_cycles_t & te_cycles) { te_process_te_cycles(decoder_, &te_cycles); }
+
+private:
+    static unsigned get_instruction(
+        void * const user_data,
+        const te_address_t address,
+        rv_inst * const instruction)
+    {
+        return static_cast<Checker *>(user_data)->get_instruction(address, *instruction);
+    }
+
+    static void advance_decoded_pc(
+        void * const user_data,
+        const te_address_t old_pc,
+        const te_address_t new_pc,
+        const te_decoded_instruction_t * const new_instruction)
+    {
+        static_cast<Checker *>(user_data)->advance(old_pc, new_pc, *new_instruction);
+    }
+
+    static constexpr te_decoder_callbacks_t callbacks =
+    {
+        &get_instruction,
+        &advance_decoded_pc,
+        nullptr,
+    };
+
+    te_decoder_state_t * decoder_;
+};
+
+
+/*
+ * The outcome of decoding the trace once.
+ */
+struct Result
+{
+    double seconds;
+    unsigned long decoded;
+    unsigned long mismatches;
+    bool valid;
+};
+
+
+/*
+ * Decode all the generated messages with a new "Decoder", timing it.
+ */
+template <class Decoder>
+static Result decode(
+    const te_generator_t & generator,
+    const std::vector<te_address_t> & golden)
+{
+    Checker checker(generator, golden);
+    Decoder decoder(checker);
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < generator.num_messages; i++)
+    {
+        const te_message_t & message = generator.messages[i];
+
+        switch (message.type)
+        {
+            case TE_MESSAGE_TE_INST:    decoder.process(message.te_inst); break;
+            case TE_MESSAGE_TE_SUPPORT: decoder.process(message.te_support); break;
+            case TE_MESSAGE_TE_DATA:    decoder.process(message.te_data); break;
+            case TE_MESSAGE_TE_CYCLES:  decoder.process(message.te_cycles); break;
+        }
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return Result{elapsed.count(), checker.decoded(), checker.mismatches(), checker.valid()};
+}
+
+
+static void print_result(
+    const char * const name,
+    const Result & result,
+    const unsigned long num_instructions,
+    const bool last)
+{
+    printf("  \"%s\": {\n", name);
+    printf("    \"seconds\": %.6f,\n", result.seconds);
+    printf("    \"instructions_per_second\": %.0f,\n",
+        (double)num_instructions / result.seconds);
+    printf("    \"decoded\": %lu,\n", result.decoded);
+    printf("    \"mismatches\": %lu,\n", result.mismatches);
+    printf("    \"valid\": %s\n", result.valid ? "true" : "false");
+    printf("  }%s\n", last ? "" : ",");
+}
+
+
+/*
+ * Record each PC retired, in order (see te_generator_replay).
+ */
+static void record_golden_pc(
+    void * const user_data,
+    const te_address_t pc)
+{
+    static_cast<std::vector<te_address_t> *>(user_data)->push_back(pc);
+}
+
+
+static void usage(
+    const char * const program)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --instructions=N     instructions to retire (1000000)\n"
+        "  --call-depth=N       levels of functions (8)\n"
+        "  --seed=N             pseudo-random seed (1)\n"
+        "  --data=F             fraction of instructions that are loads/stores\n"
+        "  --cycles             emit inter-instruction cycle counts\n"
+        "  --max-resync=N       instructions between encoder resyncs (0)\n",
+        program);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(
+    int argc,
+    char * argv[])
+{
+    static const struct option options[] =
+    {
+        { "instructions",   required_argument, NULL, 'n' },
+        { "call-depth",     required_argument, NULL, 'D' },
+        { "seed",           required_argument, NULL, 's' },
+        { "data",           required_argument, NULL, 'T' },
+        { "cycles",         no_argument,       NULL, 'Y' },
+        { "max-resync",     required_argument, NULL, 'r' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    using ImplicitReturnDecoder = te::TraceDecoder<ImplicitReturnConfig, Checker>;
+    te_generator_params_t params;
+    te_encoder_params_t encoder_params;
+    std::vector<te_address_t> golden;
+    int option;
+
+    te_generator_default_params(&params);
+    te_encoder_default_params(&encoder_params);
+    params.num_instructions = 1000000;
+
+    while (-1 != (option = getopt_long(argc, argv, "h", options, NULL)))
+    {
+        switch (option)
+        {
+            case 'n': params.num_instructions = strtoul(optarg, NULL, 0); break;
+            case 'D': params.call_depth = strtoul(optarg, NULL, 0); break;
+            case 's': params.seed = strtoul(optarg, NULL, 0); break;
+            case 'T': params.data_ratio = strtod(optarg, NULL); break;
+            case 'Y': params.cycle_counts = true; break;
+            case 'r': encoder_params.max_resync = strtoul(optarg, NULL, 0); break;
+            default:  usage(argv[0]);
+        }
+    }
+    if ( (optind != argc) || (0 == params.call_depth) )
+    {
+        usage(argv[0]);
+    }
+
+    te_generator_t * const generator = te_generate_trace(&params);
+    golden.reserve(generator->num_instructions);
+    te_generator_replay(generator, record_golden_pc, &golden);
+
+    /* the modes the C code is compiled for */
+    te_generator_encode(generator, &encoder_params);
+    const Result c = decode<CDecoder>(*generator, golden);
+    const Result cxx = decode<te::TraceDecoder<te::DefaultConfig, Checker>>(*generator, golden);
+
+    /* and implicit return, with a return stack the same size as the decoder's */
+    encoder_params.implicit_return = true;
+    encoder_params.return_stack_size_p = ImplicitReturnConfig::call_counter_width + 2u;
+    te_generator_encode(generator, &encoder_params);
+    const Result implicit_return = decode<ImplicitReturnDecoder>(*generator, golden);
+
+    const bool valid = c.valid && cxx.valid && implicit_return.valid;
+
+    printf("{\n");
+    printf("  \"instructions\": %lu,\n", generator->num_instructions);
+    print_result("c", c, generator->num_instructions, false);
+    print_result("cxx", cxx, generator->num_instructions, false);
+    print_result("cxx_implicit_return", implicit_return, generator->num_instructions, false);
+    printf("  \"speedup\": %.3f,\n", c.seconds / cxx.seconds);
+    printf("  \"valid\": %s\n", valid ? "true" : "false");
+    printf("}\n");
+
+    te_free_generated_trace(generator);
+
+    return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
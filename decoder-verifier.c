@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include "decoder-verifier.h"
+
+
+/*
+ * Take the next full batch of golden PCs to be checked, returning the
+ * current one (if any) to be re-filled. This waits (if necessary) for
+ * the golden side to fill one, and returns false if there are no more.
+ */
+static bool next_batch(
+    te_verifier_t * const verifier)
+{
+    assert(verifier);
+
+    verifier->current = te_next_full_batch(&verifier->ring, verifier->current);
+
+    if (verifier->current)
+    {
+        verifier->next = verifier->current->pcs;
+        verifier->limit = verifier->current->pcs + verifier->current->count;
+    }
+
+    return (NULL != verifier->current);
+}
+
+
+/*
+ * Hand over the batch being filled (if it holds any PCs) to be checked,
+ * and then, if "refill", wait for an empty batch to fill next, otherwise
+ * there is none. Once the decoding side has stopped checking, the same
+ * batch is re-used (and its PCs discarded), so that the golden side never
+ * waits forever.
+ */
+static void hand_over(
+    te_verifier_t * const verifier,
+    const bool refill)
+{
+    assert(verifier);
+    assert(verifier->filling);
+
+    verifier->filling = te_hand_over_batch(&verifier->ring, verifier->filling,
+        verifier->filling->count, refill);
+
+    if (verifier->filling)
+    {
+        verifier->filling->count = 0;
+    }
+}
+
+
+/*
+ * Record the first divergence, and report it to the user. "pc" is the
+ * decoded PC, unless "decoded_ended", and the golden PC is the next one
+ * in the current batch, unless "golden_ended".
+ */
+static void diverge(
+    te_verifier_t * const verifier,
+    const te_address_t pc,
+    const bool golden_ended,
+    const bool decoded_ended)
+{
+    te_divergence_t * const divergence = &verifier->divergence;
+    const te_decoder_state_t * const decoder = verifier->decoder;
+
+    assert(verifier);
+    assert(!verifier->diverged);
+
+    verifier->diverged = true;
+
+    memset(divergence, 0, sizeof(te_divergence_t));
+    divergence->instruction_count = verifier->num_verified;
+    divergence->golden_pc = golden_ended ? 0 : *verifier->next;
+    divergence->decoded_pc = decoded_ended ? 0 : pc;
+    divergence->last_pc = verifier->last_pc;
+    divergence->golden_ended = golden_ended;
+    divergence->decoded_ended = decoded_ended;
+
+    if (decoder)
+    {
+        divergence->te_inst_index = decoder->num_te_inst;
+        divergence->has_decoder_state = true;
+        divergence->address = decoder->address;
+        divergence->branches = decoder->branches;
+        divergence->branch_map = decoder->branch_map;
+        divergence->stop_at_last_branch = decoder->stop_at_last_branch;
+        divergence->inferred_address = decoder->inferred_address;
+        divergence->start_of_trace = decoder->start_of_trace;
+        divergence->call_counter = decoder->call_counter;
+        divergence->num_lost_windows = decoder->num_lost_windows;
+        divergence->num_gaps = decoder->num_gaps;
+    }
+
+    te_abandon_batch_ring(&verifier->ring);
+
+    if (verifier->handler)
+    {
+        verifier->handler(verifier->user_data, divergence);
+    }
+    else
+    {
+        te_print_divergence(divergence);
+    }
+}
+
+
+/*
+ * The body of the thread started by te_start_golden_thread().
+ */
+static void * golden_thread(
+    void * const arg)
+{
+    te_verifier_t * const verifier = arg;
+
+    assert(verifier);
+    assert(verifier->producer);
+
+    verifier->producer(verifier, verifier->producer_data);
+    te_end_golden_pcs(verifier);
+
+    return NULL;
+}
+
+
+/*
+ * Initialize a new instance of a verifier. "decoder" (if not NULL) is the
+ * trace-decoder whose PCs will be checked, and whose state is reported at
+ * a divergence. "handler" (if not NULL) is called at the first divergence,
+ * otherwise a diagnostic is printed.
+ * If "verifier" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ */
+extern te_verifier_t * te_open_verifier(
+    te_verifier_t * verifier,
+    const te_decoder_state_t * const decoder,
+    const te_divergence_handler_t handler,
+    void * const user_data)
+{
+    if (verifier)
+    {
+        memset(verifier, 0, sizeof(te_verifier_t));
+    }
+    else
+    {
+        verifier = calloc(1, sizeof(te_verifier_t));
+        assert(verifier);
+    }
+
+    verifier->decoder = decoder;
+    verifier->handler = handler;
+    verifier->user_data = user_data;
+
+    verifier->batches = malloc(TE_VERIFIER_NUM_BATCHES * sizeof(te_verifier_batch_t));
+    assert(verifier->batches);
+    te_open_batch_ring(&verifier->ring, verifier->batches,
+        sizeof(te_verifier_batch_t), TE_VERIFIER_NUM_BATCHES);
+
+    /* the golden side always has a batch to fill */
+    verifier->filling = &verifier->batches[0];
+    verifier->filling->count = 0;
+
+    return verifier;
+}
+
+
+/*
+ * Add the next golden PC, i.e. the address of the next instruction
+ * retired. Each full batch is handed over to be checked, which may
+ * wait for the decoding side to check an earlier one.
+ */
+extern void te_push_golden_pc(
+    te_verifier_t * const verifier,
+    const te_address_t pc)
+{
+    assert(verifier);
+    assert(verifier->filling);     /* i.e. golden stream not yet ended */
+
+    verifier->filling->pcs[verifier->filling->count++] = pc;
+    verifier->num_golden++;     /* update statistics */
+
+    if (TE_VERIFIER_BATCH_SIZE == verifier->filling->count)
+    {
+        hand_over(verifier, true);
+    }
+}
+
+
+/*
+ * Indicate that there are no more golden PCs.
+ */
+extern void te_end_golden_pcs(
+    te_verifier_t * const verifier)
+{
+    assert(verifier);
+
+    hand_over(verifier, false);
+    te_end_batch_ring(&verifier->ring);
+}
+
+
+/*
+ * Start a thread which calls "producer" to push all the golden PCs
+ * (see te_push_golden_pc), and then ends the golden stream, so that they
+ * are produced concurrently with decoding. Returns 0 on success, or an
+ * error number from pthread_create().
+ */
+extern int te_start_golden_thread(
+    te_verifier_t * const verifier,
+    const te_golden_producer_t producer,
+    void * const data)
+{
+    int status;
+
+    assert(verifier);
+    assert(producer);
+    assert(!verifier->has_thread);
+
+    verifier->producer = producer;
+    verifier->producer_data = data;
+
+    status = pthread_create(&verifier->thread, NULL, golden_thread, verifier);
+    verifier->has_thread = (0 == status);
+
+    return status;
+}
+
+
+/*
+ * Check the next PC reconstructed by the trace-decoder, normally called
+ * from the user's te_advance_decoded_pc(), with "new_pc". This is
+ * called for every instruction, so (except once per batch) it is no
+ * more than a comparison with the next golden PC.
+ */
+extern void te_verify_decoded_pc(
+    te_verifier_t * const verifier,
+    const te_address_t pc)
+{
+    assert(verifier);
+
+    if (verifier->diverged)
+    {
+        return;
+    }
+
+    if ( (verifier->next == verifier->limit) &&
+         (!next_batch(verifier)) )
+    {
+        diverge(verifier, pc, true, false);
+        return;
+    }
+
+    if (pc != *verifier->next)
+    {
+        diverge(verifier, pc, false, false);
+        return;
+    }
+
+    verifier->next++;
+    verifier->last_pc = pc;
+    verifier->num_verified++;
+}
+
+
+/*
+ * Called after the last PC has been decoded, to check that no golden PCs
+ * remain. Waits for the golden thread (if any) to finish, and returns
+ * true if all the PCs decoded matched the golden PCs exactly.
+ */
+extern bool te_finish_verifier(
+    te_verifier_t * const verifier)
+{
+    assert(verifier);
+
+    if ( (!verifier->diverged) &&
+         ( (verifier->next < verifier->limit) || (next_batch(verifier)) ) )
+    {
+        diverge(verifier, 0, false, true);
+    }
+
+    te_abandon_batch_ring(&verifier->ring);
+    if (verifier->has_thread)
+    {
+        pthread_join(verifier->thread, NULL);
+        verifier->has_thread = false;
+    }
+
+    return !verifier->diverged;
+}
+
+
+/*
+ * Release everything allocated by te_open_verifier(), first stopping
+ * the golden thread (if any).
+ */
+extern void te_close_verifier(
+    te_verifier_t * const verifier)
+{
+    assert(verifier);
+
+    te_abandon_batch_ring(&verifier->ring);
+    if (verifier->has_thread)
+    {
+        pthread_join(verifier->thread, NULL);
+        verifier->has_thread = false;
+    }
+
+    te_close_batch_ring(&verifier->ring);
+    free(verifier->batches);
+    verifier->batches = NULL;
+    verifier->filling = NULL;
+    verifier->current = NULL;
+    verifier->next = verifier->limit = NULL;
+}
+
+
+/*
+ * Print a human-friendly description of a divergence.
+ */
+extern void te_print_divergence(
+    const te_divergence_t * const divergence)
+{
+    assert(divergence);
+
+    if (divergence->golden_ended)
+    {
+        printf("DIVERGENCE: decoded PC 0x%08lx, but no more instructions retired\n",
+            divergence->decoded_pc);
+    }
+    else if (divergence->decoded_ended)
+    {
+        printf("DIVERGENCE: expected PC 0x%08lx, but no more PCs decoded\n",
+            divergence->golden_pc);
+    }
+    else
+    {
+        printf("DIVERGENCE: expected PC 0x%08lx, but decoded 0x%08lx\n",
+            divergence->golden_pc, divergence->decoded_pc);
+    }
+    printf("    after %lu matching instructions (last PC 0x%08lx), te_inst %lu\n",
+        divergence->instruction_count, divergence->last_pc,
+        divergence->te_inst_index);
+
+    if (divergence->has_decoder_state)
+    {
+        printf("    decoder: address = 0x%08lx, branches = %u, branch_map = 0x%08x,"
+            " stop_at_last_branch = %d, inferred_address = %d,"
+            " start_of_trace = %d, call_counter = %lu,"
+            " lost windows = %lu, gaps = %lu\n",
+            divergence->address,
+            divergence->branches,
+            divergence->branch_map,
+            divergence->stop_at_last_branch,
+            divergence->inferred_address,
+            divergence->start_of_trace,
+            (unsigned long)divergence->call_counter,
+            divergence->num_lost_windows,
+            divergence->num_gaps);
+    }
+}
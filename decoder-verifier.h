@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_DECODER_VERIFIER_H
+#define TE_DECODER_VERIFIER_H
+
+
+/*
+ * A differential verifier, which checks each PC reconstructed by the
+ * trace-decoder (i.e. each call of te_advance_decoded_pc) against a
+ * "golden" stream of the PCs actually retired, for example from a
+ * simulator's commit log (see commit-log-reader.h).
+ *
+ * The golden PCs are produced (typically by another thread, see
+ * te_start_golden_thread) into a ring of large batches, which are handed
+ * over to the decoding thread one batch at a time (see decoder-batch-ring.h).
+ * So the two sides only synchronize once per batch, and checking each decoded PC costs just a
+ * comparison with the next golden PC. At the first divergence, the user's
+ * handler is called (or a diagnostic is printed) whilst the decoder is
+ * still in the state in which it produced the wrong PC, after which
+ * no more PCs are checked.
+ */
+#include <pthread.h>
+#include "decoder-algorithm-public.h"
+#include "decoder-batch-ring.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * Define the number of golden PCs in each batch, and the number of batches
+ * in the ring (which bounds how far the golden stream may run ahead).
+ * If not defined elsewhere, define these here.
+ */
+#if !defined(TE_VERIFIER_BATCH_SIZE)
+#   define TE_VERIFIER_BATCH_SIZE   (1u<<16)    /* 2^16 = 65536 PCs */
+#endif  /* TE_VERIFIER_BATCH_SIZE */
+#if !defined(TE_VERIFIER_NUM_BATCHES)
+#   define TE_VERIFIER_NUM_BATCHES  (4u)
+#endif  /* TE_VERIFIER_NUM_BATCHES */
+
+
+/*
+ * Description of the first divergence between the decoded and golden PCs,
+ * as passed to the divergence handler (see te_open_verifier). The decoder
+ * state is that at the time the divergent PC was disseminated.
+ */
+typedef struct
+{
+    unsigned long instruction_count;/* PCs that matched, before this one */
+    unsigned long te_inst_index;    /* te_inst messages processed so far */
+    te_address_t golden_pc;         /* expected PC (if !golden_ended) */
+    te_address_t decoded_pc;        /* actual PC (if !decoded_ended) */
+    te_address_t last_pc;           /* the last PC that matched */
+    bool golden_ended;              /* decoded more PCs than retired */
+    bool decoded_ended;             /* decoded fewer PCs than retired */
+    /* a snapshot of the decoder (if known), see te_decoder_state_t */
+    bool has_decoder_state;
+    te_address_t address;
+    unsigned int branches;
+    uint32_t branch_map;
+    bool stop_at_last_branch;
+    bool inferred_address;
+    bool start_of_trace;
+    size_t call_counter;
+    unsigned long num_lost_windows;
+    unsigned long num_gaps;
+} te_divergence_t;
+
+
+/*
+ * Type of function called at the first divergence.
+ * "user_data" is whatever was passed to te_open_verifier().
+ */
+typedef void (*te_divergence_handler_t)(
+    void * const user_data,
+    const te_divergence_t * const divergence);
+
+
+/*
+ * One batch of golden PCs.
+ */
+typedef struct
+{
+    size_t count;
+    te_address_t pcs[TE_VERIFIER_BATCH_SIZE];
+} te_verifier_batch_t;
+
+
+/*
+ * The state of one verifier, i.e. for one decoded (and golden) stream.
+ */
+typedef struct te_verifier_s
+{
+    /* the decoding side (consumer of golden PCs) */
+    const te_decoder_state_t * decoder;     /* may be NULL */
+    const te_address_t * next;      /* next golden PC in the current batch */
+    const te_address_t * limit;     /* end of the current batch */
+    te_verifier_batch_t * current;  /* being checked, or NULL */
+    te_address_t last_pc;
+    bool diverged;
+    te_divergence_t divergence;
+    te_divergence_handler_t handler;    /* NULL == print a diagnostic */
+    void * user_data;
+
+    /* the golden side (producer of golden PCs) */
+    te_verifier_batch_t * filling;  /* being filled, or NULL */
+
+    /* the ring of batches, shared by both sides (with its statistics) */
+    te_verifier_batch_t * batches;
+    te_batch_ring_t ring;
+
+    /* the (optional) thread producing the golden PCs */
+    pthread_t thread;
+    bool has_thread;
+    void (*producer)(struct te_verifier_s * const verifier, void * const data);
+    void * producer_data;
+
+    /* maintain a few statistics */
+    unsigned long num_verified;     /* decoded PCs that matched */
+    unsigned long num_golden;       /* golden PCs produced */
+} te_verifier_t;
+
+
+/*
+ * Type of function that produces the golden PCs, when run on its own
+ * thread (see te_start_golden_thread), by calling te_push_golden_pc()
+ * for each PC retired, in order.
+ */
+typedef void (*te_golden_producer_t)(
+    te_verifier_t * const verifier,
+    void * const data);
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_verifier_t * te_open_verifier(
+    te_verifier_t * verifier,
+    const te_decoder_state_t * const decoder,
+    const te_divergence_handler_t handler,
+    void * const user_data);
+
+extern void te_push_golden_pc(
+    te_verifier_t * const verifier,
+    const te_address_t pc);
+
+extern void te_end_golden_pcs(
+    te_verifier_t * const verifier);
+
+extern int te_start_golden_thread(
+    te_verifier_t * const verifier,
+    const te_golden_producer_t producer,
+    void * const data);
+
+extern void te_verify_decoded_pc(
+    te_verifier_t * const verifier,
+    const te_address_t pc);
+
+extern bool te_finish_verifier(
+    te_verifier_t * const verifier);
+
+extern void te_close_verifier(
+    te_verifier_t * const verifier);
+
+extern void te_print_divergence(
+    const te_divergence_t * const divergence);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_DECODER_VERIFIER_H */
@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "elf-image.h"
+
+
+/*
+ * Order symbols by address, for qsort().
+ */
+static int compare_symbols(
+    const void * const a,
+    const void * const b)
+{
+    const te_address_t first = ((const te_symbol_t *)a)->address;
+    const te_address_t second = ((const te_symbol_t *)b)->address;
+
+    return (first > second) - (first < second);
+}
+
+
+/*
+ * Define a function to collect the function symbols from the symbol table
+ * of an ELF file, for one ELF class (i.e. for its types), into "elf".
+ * It returns the number of symbols, or -1 if the file is malformed.
+ */
+#define COLLECT_SYMBOLS(ELF_EHDR, ELF_SHDR, ELF_SYM, ELF_ST_TYPE)           \
+static long collect_symbols_##ELF_EHDR(                                     \
+    te_elf_symbols_t * const elf)                                           \
+{                                                                           \
+    const uint8_t * const image = elf->image;                               \
+    const ELF_EHDR * const header = elf->image;                             \
+    const ELF_SHDR * sections;                                              \
+    const ELF_SHDR * symtab = NULL;                                         \
+    const ELF_SYM * syms;                                                   \
+    const char * strings;                                                   \
+    size_t i, num_syms, strings_size;                                       \
+    long num = 0;                                                           \
+                                                                            \
+    if ( (elf->size < sizeof(ELF_EHDR)) ||                                  \
+         (header->e_shentsize != sizeof(ELF_SHDR)) ||                       \
+         (header->e_shoff > elf->size) ||                                   \
+         (header->e_shnum > (elf->size - header->e_shoff) / sizeof(ELF_SHDR)) ) \
+    {                                                                       \
+        return -1;                                                          \
+    }                                                                       \
+    sections = (const ELF_SHDR *)(image + header->e_shoff);                 \
+                                                                            \
+    /* prefer the full symbol table, else the dynamic one */               \
+    for (i = 0; i < header->e_shnum; i++)                                   \
+    {                                                                       \
+        if ( (SHT_SYMTAB == sections[i].sh_type) ||                         \
+             ( (SHT_DYNSYM == sections[i].sh_type) && (!symtab) ) )         \
+        {                                                                   \
+            symtab = &sections[i];                                          \
+        }                                                                   \
+    }                                                                       \
+    if (!symtab)                                                            \
+    {                                                                       \
+        return 0;   /* stripped */                                          \
+    }                                                                       \
+    if ( (symtab->sh_link >= header->e_shnum) ||                            \
+         (symtab->sh_offset > elf->size) ||                                 \
+         (symtab->sh_size > elf->size - symtab->sh_offset) ||               \
+         (sections[symtab->sh_link].sh_offset > elf->size) ||               \
+         (sections[symtab->sh_link].sh_size >                               \
+            elf->size - sections[symtab->sh_link].sh_offset) )              \
+    {                                                                       \
+        return -1;                                                          \
+    }                                                                       \
+    syms = (const ELF_SYM *)(image + symtab->sh_offset);                    \
+    num_syms = symtab->sh_size / sizeof(ELF_SYM);                           \
+    strings = (const char *)(image + sections[symtab->sh_link].sh_offset);  \
+    strings_size = sections[symtab->sh_link].sh_size;                       \
+                                                                            \
+    elf->symbols = calloc(num_syms ? num_syms : 1u, sizeof(te_symbol_t));   \
+    if (!elf->symbols)                                                      \
+    {                                                                       \
+        return -1;                                                          \
+    }                                                                       \
+    for (i = 0; i < num_syms; i++)                                          \
+    {                                                                       \
+        if ( (STT_FUNC == ELF_ST_TYPE(syms[i].st_info)) &&                  \
+             (SHN_UNDEF != syms[i].st_shndx) &&                             \
+             (syms[i].st_name < strings_size) &&                            \
+             (memchr(strings + syms[i].st_name, 0,                          \
+                strings_size - syms[i].st_name)) )                          \
+        {                                                                   \
+            elf->symbols[num].address = syms[i].st_value;                   \
+            elf->symbols[num].size = syms[i].st_size;                       \
+            elf->symbols[num].name = strings + syms[i].st_name;             \
+            num++;                                                          \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return num;                                                             \
+}
+COLLECT_SYMBOLS(Elf32_Ehdr, Elf32_Shdr, Elf32_Sym, ELF32_ST_TYPE)
+COLLECT_SYMBOLS(Elf64_Ehdr, Elf64_Shdr, Elf64_Sym, ELF64_ST_TYPE)
+
+
+/*
+ * Memory-map a whole ELF file, read-only, checking only its magic number.
+ * Release it with te_unmap_elf_file().
+ * Returns 0 on success, or -1 (with errno set) on failure.
+ */
+extern int te_map_elf_file(
+    const char * const filename,
+    void ** const image,
+    size_t * const size)
+{
+    const int fd = open(filename, O_RDONLY);
+    struct stat status;
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (0 != fstat(fd, &status))
+    {
+        close(fd);
+        return -1;
+    }
+    *size = (size_t)status.st_size;
+    *image = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == *image)
+    {
+        *image = NULL;
+        return -1;
+    }
+    if ( (*size < EI_NIDENT) ||
+         (0 != memcmp(*image, ELFMAG, SELFMAG)) )
+    {
+        munmap(*image, *size);
+        *image = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Unmap an ELF file mapped by te_map_elf_file().
+ */
+extern void te_unmap_elf_file(
+    void * const image,
+    const size_t size)
+{
+    if (image)
+    {
+        munmap(image, size);
+    }
+}
+
+
+/*
+ * Read the function symbols from the symbol table of an ELF file (either
+ * 32 or 64-bit, in the host's byte order), into a sorted index, suitable
+ * for te_set_call_profile_symbols() and te_lookup_symbol(). The file is
+ * memory-mapped, rather than copied, and the names point into it.
+ * A stripped file has no symbols, but is not an error.
+ * Returns 0 on success, or -1 (with errno set) on failure.
+ */
+extern int te_open_elf_symbols(
+    te_elf_symbols_t * const elf,
+    const char * const filename)
+{
+    const unsigned char * ident;
+    long num;
+
+    assert(elf);
+    assert(filename);
+
+    memset(elf, 0, sizeof(te_elf_symbols_t));
+
+    if (0 != te_map_elf_file(filename, &elf->image, &elf->size))
+    {
+        return -1;
+    }
+
+    ident = elf->image;
+    if (ELFCLASS64 == ident[EI_CLASS])
+    {
+        num = collect_symbols_Elf64_Ehdr(elf);
+    }
+    else if (ELFCLASS32 == ident[EI_CLASS])
+    {
+        num = collect_symbols_Elf32_Ehdr(elf);
+    }
+    else
+    {
+        num = -1;
+    }
+
+    if (num < 0)
+    {
+        te_close_elf_symbols(elf);
+        errno = EINVAL;
+        return -1;
+    }
+
+    elf->num_symbols = (size_t)num;
+    qsort(elf->symbols, elf->num_symbols, sizeof(te_symbol_t), compare_symbols);
+
+    return 0;
+}
+
+
+/*
+ * Release the symbol index, and unmap the ELF file.
+ */
+extern void te_close_elf_symbols(
+    te_elf_symbols_t * const elf)
+{
+    assert(elf);
+
+    free(elf->symbols);
+    te_unmap_elf_file(elf->image, elf->size);
+    memset(elf, 0, sizeof(te_elf_symbols_t));
+}
+
+
+/*
+ * Define a function to add each executable (PT_LOAD) segment of an ELF
+ * file, of one class (i.e. for its types), to a context, at its virtual
+ * address plus "bias". Only the bytes in the file are mapped (i.e. not
+ * any zero-filled remainder, which is never code). It returns the number
+ * of segments added, or -1 (having added none) if the file is malformed.
+ */
+#define ADD_SEGMENTS(ELF_EHDR, ELF_PHDR)                                    \
+static long add_segments_##ELF_EHDR(                                        \
+    const uint8_t * const image,                                            \
+    const size_t size,                                                      \
+    te_context_t * const context,                                           \
+    const te_address_t bias,                                                \
+    const uint32_t address_space)                                           \
+{                                                                           \
+    const ELF_EHDR * const header = (const ELF_EHDR *)image;                \
+    const ELF_PHDR * segments;                                              \
+    size_t i;                                                               \
+    long num = 0;                                                           \
+                                                                            \
+    if ( (size < sizeof(ELF_EHDR)) ||                                       \
+         (header->e_phentsize != sizeof(ELF_PHDR)) ||                       \
+         (header->e_phoff > size) ||                                        \
+         (header->e_phnum > (size - header->e_phoff) / sizeof(ELF_PHDR)) ) \
+    {                                                                       \
+        return -1;                                                          \
+    }                                                                       \
+    segments = (const ELF_PHDR *)(image + header->e_phoff);                 \
+                                                                            \
+    /* check them all, before adding any */                                 \
+    for (i = 0; i < header->e_phnum; i++)                                   \
+    {                                                                       \
+        if ( (PT_LOAD == segments[i].p_type) &&                             \
+             (segments[i].p_flags & PF_X) &&                                \
+             ( (segments[i].p_offset > size) ||                             \
+               (segments[i].p_filesz > size - segments[i].p_offset) ) )     \
+        {                                                                   \
+            return -1;                                                      \
+        }                                                                   \
+    }                                                                       \
+    for (i = 0; i < header->e_phnum; i++)                                   \
+    {                                                                       \
+        if ( (PT_LOAD == segments[i].p_type) &&                             \
+             (segments[i].p_flags & PF_X) &&                                \
+             (segments[i].p_filesz) )                                       \
+        {                                                                   \
+            te_add_image_map(context, segments[i].p_vaddr + bias,           \
+                segments[i].p_filesz, image + segments[i].p_offset,         \
+                address_space);                                             \
+            num++;                                                          \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return num;                                                             \
+}
+ADD_SEGMENTS(Elf32_Ehdr, Elf32_Phdr)
+ADD_SEGMENTS(Elf64_Ehdr, Elf64_Phdr)
+
+
+/*
+ * Map the code of an ELF file (either 32 or 64-bit, in the host's byte
+ * order) into a context (see te_add_image_map), i.e. each of its executable
+ * PT_LOAD segments, at its virtual address plus "bias" (e.g. the load
+ * address of a shared library, or 0 for an executable), and with the given
+ * "address_space". The file is memory-mapped, rather than copied.
+ * Returns 0 on success, or -1 (with errno set) on failure.
+ */
+extern int te_open_elf_image(
+    te_elf_image_t * const elf,
+    const char * const filename,
+    te_context_t * const context,
+    const te_address_t bias,
+    const uint32_t address_space)
+{
+    const unsigned char * ident;
+    long num;
+
+    assert(elf);
+    assert(filename);
+    assert(context);
+
+    memset(elf, 0, sizeof(te_elf_image_t));
+
+    if (0 != te_map_elf_file(filename, &elf->image, &elf->size))
+    {
+        return -1;
+    }
+
+    ident = elf->image;
+    if (ELFCLASS64 == ident[EI_CLASS])
+    {
+        num = add_segments_Elf64_Ehdr(elf->image, elf->size, context, bias, address_space);
+    }
+    else if (ELFCLASS32 == ident[EI_CLASS])
+    {
+        num = add_segments_Elf32_Ehdr(elf->image, elf->size, context, bias, address_space);
+    }
+    else
+    {
+        num = -1;
+    }
+
+    if (num < 0)
+    {
+        te_close_elf_image(elf);
+        errno = EINVAL;
+        return -1;
+    }
+
+    elf->num_segments = (size_t)num;
+
+    return 0;
+}
+
+
+/*
+ * Unmap an ELF file mapped by te_open_elf_image(). This must not be called
+ * until the context map into which it was mapped is closed.
+ */
+extern void te_close_elf_image(
+    te_elf_image_t * const elf)
+{
+    assert(elf);
+
+    te_unmap_elf_file(elf->image, elf->size);
+    memset(elf, 0, sizeof(te_elf_image_t));
+}
+
+
+/*
+ * Define a function to find a section by name, in an ELF file of one
+ * class (i.e. for its types). It returns a pointer to the section's
+ * contents (and its size), or NULL if there is no such section.
+ */
+#define FIND_SECTION(ELF_EHDR, ELF_SHDR)                                    \
+static const uint8_t * find_section_##ELF_EHDR(                             \
+    const uint8_t * const image,                                            \
+    const size_t size,                                                      \
+    const char * const name,                                                \
+    size_t * const length)                                                  \
+{                                                                           \
+    const ELF_EHDR * const header = (const ELF_EHDR *)image;                \
+    const ELF_SHDR * sections;                                              \
+    const char * names;                                                     \
+    size_t i;                                                               \
+                                                                            \
+    if ( (size < sizeof(ELF_EHDR)) ||                                       \
+         (header->e_shentsize != sizeof(ELF_SHDR)) ||                       \
+         (header->e_shoff > size) ||                                        \
+         (header->e_shnum > (size - header->e_shoff) / sizeof(ELF_SHDR)) || \
+         (header->e_shstrndx >= header->e_shnum) )                          \
+    {                                                                       \
+        return NULL;                                                        \
+    }                                                                       \
+    sections = (const ELF_SHDR *)(image + header->e_shoff);                 \
+    if ( (sections[header->e_shstrndx].sh_offset > size) ||                 \
+         (sections[header->e_shstrndx].sh_size >                            \
+            size - sections[header->e_shstrndx].sh_offset) )                \
+    {                                                                       \
+        return NULL;                                                        \
+    }                                                                       \
+    names = (const char *)(image + sections[header->e_shstrndx].sh_offset); \
+                                                                            \
+    for (i = 0; i < header->e_shnum; i++)                                   \
+    {                                                                       \
+        if ( (sections[i].sh_name < sections[header->e_shstrndx].sh_size) && \
+             (0 == strncmp(names + sections[i].sh_name, name,               \
+                sections[header->e_shstrndx].sh_size - sections[i].sh_name)) && \
+             (SHT_NOBITS != sections[i].sh_type) &&                         \
+             (sections[i].sh_offset <= size) &&                             \
+             (sections[i].sh_size <= size - sections[i].sh_offset) )        \
+        {                                                                   \
+            *length = sections[i].sh_size;                                  \
+            return image + sections[i].sh_offset;                           \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return NULL;                                                            \
+}
+FIND_SECTION(Elf32_Ehdr, Elf32_Shdr)
+FIND_SECTION(Elf64_Ehdr, Elf64_Shdr)
+
+
+/*
+ * Find a section by name, in an ELF file (of either class) mapped by
+ * te_map_elf_file(). Returns a pointer to the section's contents, and
+ * its size in "length", or NULL (with a "length" of 0) if there is no
+ * such section, or it has no contents in the file.
+ */
+extern const uint8_t * te_find_elf_section(
+    const uint8_t * const image,
+    const size_t size,
+    const char * const name,
+    size_t * const length)
+{
+    *length = 0;
+
+    if (ELFCLASS64 == image[EI_CLASS])
+    {
+        return find_section_Elf64_Ehdr(image, size, name, length);
+    }
+    if (ELFCLASS32 == image[EI_CLASS])
+    {
+        return find_section_Elf32_Ehdr(image, size, name, length);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_ELF_IMAGE_H
+#define TE_ELF_IMAGE_H
+
+
+/*
+ * Reading ELF files (either 32 or 64-bit, in the host's byte order),
+ * which are memory-mapped, rather than copied: their function symbols,
+ * into a sorted index (te_elf_symbols_t), for the profiles and their
+ * exporters; and their executable segments, into a context of the
+ * trace-decoder (see te_add_image_map), so the decoder needs no
+ * get_instruction of its own (te_elf_image_t).
+ *
+ * The mapping itself, and finding a section by name, are also exposed,
+ * for readers of other sections (e.g. the DWARF line table).
+ */
+#include "decoder-call-profile.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * The function symbols from an ELF file, sorted by address.
+ * The names point into the (memory-mapped) file, which is kept
+ * mapped until te_close_elf_symbols() is called.
+ */
+typedef struct
+{
+    te_symbol_t * symbols;
+    size_t num_symbols;
+    void * image;           /* the mapped ELF file */
+    size_t size;            /* size of "image" */
+} te_elf_symbols_t;
+
+
+/*
+ * An ELF file whose executable (PT_LOAD) segments have been mapped into a
+ * context, see te_open_elf_image(). The images point into the
+ * (memory-mapped) file, which is kept mapped until te_close_elf_image()
+ * is called, so that must not be until the context map is closed.
+ */
+typedef struct
+{
+    size_t num_segments;    /* images added to the context */
+    void * image;           /* the mapped ELF file */
+    size_t size;            /* size of "image" */
+} te_elf_image_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern int te_map_elf_file(
+    const char * const filename,
+    void ** const image,
+    size_t * const size);
+
+extern void te_unmap_elf_file(
+    void * const image,
+    const size_t size);
+
+extern const uint8_t * te_find_elf_section(
+    const uint8_t * const image,
+    const size_t size,
+    const char * const name,
+    size_t * const length);
+
+extern int te_open_elf_symbols(
+    te_elf_symbols_t * const elf,
+    const char * const filename);
+
+extern void te_close_elf_symbols(
+    te_elf_symbols_t * const elf);
+
+extern int te_open_elf_image(
+    te_elf_image_t * const elf,
+    const char * const filename,
+    te_context_t * const context,
+    const te_address_t bias,
+    const uint32_t address_space);
+
+extern void te_close_elf_image(
+    te_elf_image_t * const elf);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_ELF_IMAGE_H */
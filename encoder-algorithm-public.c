@@ -0,0 +1,1386 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include "encoder-algorithm-public.h"
+
+
+/* optionally enable additional debugging ? */
+#if !defined(DEBUG)
+#   define DEBUG    0   /* turn off debug by default */
+#endif  /* DEBUG */
+
+
+/*
+ * Extract the most-significant bit of an integer.
+ */
+#define MSB(x)  (((x)>>(8*(sizeof(x))-1)) & 0x1)
+
+
+/*
+ * Truncate a value to its least-significant "width" bits.
+ */
+static uint64_t truncate_bits(
+    const uint64_t value,
+    const unsigned width)
+{
+    return (width >= 64) ? value : (value & (((uint64_t)1 << width) - 1u));
+}
+
+
+/*
+ * Determine if an itype is an uninferable PC discontinuity ("updiscon").
+ * This includes exception returns and co-routine swaps, so as to match
+ * is_uninferrable_discon() in the trace-decoder.
+ */
+static bool is_uninferable_itype(
+    const te_itype_t itype)
+{
+    return (TE_ITYPE_EXCEPTION_RETURN       == itype) ||
+           (TE_ITYPE_COROUTINE_SWAP         == itype) ||
+           (TE_ITYPE_UNINFERABLE_CALL       == itype) ||
+           (TE_ITYPE_UNINFERABLE_TAIL_CALL  == itype) ||
+           (TE_ITYPE_UNINFERABLE_RETURN     == itype) ||
+           (TE_ITYPE_UNINFERABLE_JUMP       == itype);
+}
+
+
+/*
+ * Count the bits set in a mask.
+ */
+static unsigned count_bits(
+    uint64_t mask)
+{
+#if defined(__GNUC__)
+    return (unsigned)__builtin_popcountll(mask);
+#else
+    unsigned count = 0;
+    for (; mask; mask &= mask - 1u)
+    {
+        count++;
+    }
+    return count;
+#endif
+}
+
+
+/*
+ * Return the index of the lowest, or the highest, bit set in a non-zero mask.
+ */
+static unsigned lowest_bit(
+    const uint64_t mask)
+{
+    assert(mask);
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctzll(mask);
+#else
+    unsigned bit = 0;
+    while (0 == ((mask >> bit) & 1u))
+    {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static unsigned highest_bit(
+    const uint64_t mask)
+{
+    assert(mask);
+#if defined(__GNUC__)
+    return 63u - (unsigned)__builtin_clzll(mask);
+#else
+    unsigned bit = 63;
+    while (0 == ((mask >> bit) & 1u))
+    {
+        bit--;
+    }
+    return bit;
+#endif
+}
+
+
+/*
+ * A packet payload, as it is being assembled, with the first field
+ * transmitted in the least-significant bits (see "Trace Encoder Output
+ * Packets"). The largest is a format 3, subformat 1, which has fewer
+ * than 256 bits for any valid parameters.
+ */
+typedef struct
+{
+    uint64_t words[4];
+    unsigned length;        /* in bits */
+} payload_t;
+
+
+/*
+ * Append the least-significant "width" bits of "value" to a payload.
+ */
+static void append_bits(
+    payload_t * const payload,
+    const uint64_t value,
+    const unsigned width)
+{
+    const unsigned index = payload->length / 64u;
+    const unsigned shift = payload->length % 64u;
+    const uint64_t bits = truncate_bits(value, width);
+
+    assert(payload);
+    assert(width <= 64);
+    assert(payload->length + width <= 8 * sizeof(payload->words));
+
+    if (0 == width)
+    {
+        return;
+    }
+
+    payload->words[index] |= bits << shift;
+    if ( (shift) && (shift + width > 64u) )
+    {
+        payload->words[index + 1u] |= bits >> (64u - shift);
+    }
+    payload->length += width;
+}
+
+
+/*
+ * Return the most-significant bit appended to a payload so far.
+ */
+static unsigned last_bit(
+    const payload_t * const payload)
+{
+    const unsigned bit = payload->length - 1u;
+
+    assert(payload);
+    assert(payload->length);
+
+    return (payload->words[bit / 64u] >> (bit % 64u)) & 1u;
+}
+
+
+/*
+ * Return the length (in bytes) of a payload, after sign-based compression,
+ * i.e. after removing all the most-significant bits that are the same as
+ * the one below them, and then sign-extending to a whole number of bytes.
+ * This is needed for every message, so the bits are compared with the
+ * sign a word at a time, rather than one at a time.
+ */
+static unsigned payload_bytes(
+    const payload_t * const payload)
+{
+    const uint64_t sign = last_bit(payload) ? ~(uint64_t)0 : 0;
+    unsigned bit = payload->length - 1u;
+    uint64_t differ;
+
+    /* find the most-significant bit below "bit" that differs from the sign */
+    while (bit > 0)
+    {
+        const unsigned index = (bit - 1u) / 64u;
+        const unsigned count = bit - 64u * index;   /* bits below "bit" in this word */
+
+        differ = truncate_bits(payload->words[index] ^ sign, count);
+        if (differ)
+        {
+            bit = 64u * index + highest_bit(differ) + 1u;
+            break;
+        }
+        bit = 64u * index;
+    }
+
+    /* bits [0, bit) differ from the sign, which takes one more bit */
+    return (bit + 1u + 7u) / 8u;
+}
+
+
+/*
+ * Return the length of the payload of the branch_map field in a format 1
+ * te_inst, given the number of valid branches (0 means 31, no address).
+ * A tapered branch map (see "Branch-map partitioning") is 1, 3, 7, 15 or
+ * 31 bits, rather than 1, 9, 17, 25 or 31 bits.
+ */
+static unsigned branch_map_width(
+    const te_encoder_params_t * const params,
+    const unsigned branches)
+{
+    if (1 == branches)
+    {
+        return 1;
+    }
+    else if ( (0 == branches) || (branches > 25) )
+    {
+        return 31;
+    }
+    else if (params->tapered_branch_map_p)
+    {
+        return (2u << highest_bit(branches)) - 1u;
+    }
+
+    return 1u + 8u * ((branches + 6u) / 8u);
+}
+
+
+/*
+ * Return the length (in bytes) of the payload of a te_inst message,
+ * as it would be sent with the given parameters, after sign-based
+ * compression. As implicit return mispredictions are never reported,
+ * "irfail" and "irdepth" always compress away. The format 0 te_inst of
+ * the jump target cache is as proposed in "Using a jump target cache".
+ */
+extern unsigned te_inst_payload_bytes(
+    const te_encoder_params_t * const params,
+    const te_inst_t * const te_inst)
+{
+    const unsigned address_width = params->iaddress_width_p - params->iaddress_lsb_p;
+    payload_t payload;
+
+    assert(params);
+    assert(te_inst);
+
+    memset(&payload, 0, sizeof(payload));
+    append_bits(&payload, te_inst->format, 2);
+
+    if (3 == te_inst->format)
+    {
+        append_bits(&payload, te_inst->subformat, 2);
+        if (3 == te_inst->subformat)
+        {
+            /* not a te_inst, see te_support_payload_bytes() */
+        }
+        else if (2 == te_inst->subformat)
+        {
+            append_bits(&payload, te_inst->context, params->context_width_p);
+        }
+        else
+        {
+            append_bits(&payload, te_inst->context, params->nocontext_p ? 0 : params->context_width_p);
+            append_bits(&payload, te_inst->privilege, params->privilege_width_p);
+            append_bits(&payload, te_inst->address, address_width);
+            if (1 == te_inst->subformat)
+            {
+                append_bits(&payload, te_inst->ecause, params->ecause_width_p);
+                append_bits(&payload, te_inst->interrupt, 1);
+                append_bits(&payload, te_inst->tval, params->notval_p ? 0 : params->iaddress_width_p);
+            }
+            /* same as the preceding bit, unless a not taken branch */
+            append_bits(&payload, last_bit(&payload) ^ te_inst->branch, 1);
+        }
+        return payload_bytes(&payload);
+    }
+
+    if (0 == te_inst->format)
+    {
+        append_bits(&payload, te_inst->jtc_index, params->jtc_size_p);
+        append_bits(&payload, te_inst->branches, 5);
+        if (te_inst->branches)
+        {
+            append_bits(&payload, te_inst->branch_map, branch_map_width(params, te_inst->branches));
+        }
+        /* irfail and irdepth: the same as the preceding bit */
+        append_bits(&payload, last_bit(&payload) ? ~(uint64_t)0 : 0, 1u + params->return_stack_size_p);
+        return payload_bytes(&payload);
+    }
+
+    if ( (1 == te_inst->format) && (te_inst->branch_fmt) )
+    {
+        /* a count of correctly predicted branches, rather than a map */
+        append_bits(&payload, 0, 5);        /* branches */
+        append_bits(&payload, te_inst->branch_count, 16);
+        if (1 == te_inst->branch_fmt)
+        {
+            append_bits(&payload, 0, 15);   /* reserved */
+            append_bits(&payload, 1, 2);    /* branch_fmt: no address */
+            return payload_bytes(&payload);
+        }
+        append_bits(&payload, te_inst->address, 15);
+        append_bits(&payload, 2, 2);        /* branch_fmt: with address */
+        append_bits(&payload, te_inst->bpsuccess, 1);
+        append_bits(&payload, te_inst->updiscon, 1);
+        append_bits(&payload, te_inst->updiscon, 1);    /* irfail */
+        append_bits(&payload, te_inst->updiscon ? ~(uint64_t)0 : 0, params->return_stack_size_p);
+        append_bits(&payload, te_inst->address >> 15, address_width - 15u);
+        return payload_bytes(&payload);
+    }
+
+    if (1 == te_inst->format)
+    {
+        append_bits(&payload, te_inst->branches, 5);
+        append_bits(&payload, te_inst->branch_map, branch_map_width(params, te_inst->branches));
+        if (0 == te_inst->branches)
+        {
+            /* branch_fmt: both bits the same as branch_map[MSB] */
+            append_bits(&payload, last_bit(&payload) ? 3u : 0u, 2);
+            return payload_bytes(&payload);
+        }
+    }
+
+    append_bits(&payload, te_inst->address, address_width);
+    append_bits(&payload, te_inst->updiscon, 1);
+    append_bits(&payload, te_inst->updiscon, 1);    /* irfail */
+    append_bits(&payload, te_inst->updiscon ? ~(uint64_t)0 : 0, params->return_stack_size_p);
+
+    return payload_bytes(&payload);
+}
+
+
+/*
+ * Return the length (in bytes) of the payload of a te_support message
+ * (a format 3, subformat 3), after sign-based compression. The widths
+ * of "encoder_mode" and "options" are implementation dependent, so this
+ * model uses 1 bit for the mode (branch trace), and 2 bits for the options
+ * (implicit_return, then full_address).
+ */
+extern unsigned te_support_payload_bytes(
+    const te_support_t * const te_support)
+{
+    payload_t payload;
+
+    assert(te_support);
+
+    memset(&payload, 0, sizeof(payload));
+    append_bits(&payload, 3, 2);        /* format */
+    append_bits(&payload, 3, 2);        /* subformat */
+    append_bits(&payload, 1, 1);        /* enable */
+    append_bits(&payload, 0, 1);        /* encoder_mode */
+    append_bits(&payload, te_support->qual_status, 2);
+    append_bits(&payload, te_support->implicit_return, 1);
+    append_bits(&payload, te_support->full_address, 1);
+
+    return payload_bytes(&payload);
+}
+
+
+/*
+ * Send a te_inst message, and update the statistics.
+ */
+static void emit_te_inst(
+    te_encoder_state_t * const encoder,
+    const te_inst_t * const te_inst)
+{
+    assert(encoder);
+    assert(te_inst);
+
+    if (DEBUG)
+    {
+        te_log_printf("encoder: format %u.%u, address = 0x%lx, branches = %u, map = 0x%x\n",
+            te_inst->format, te_inst->subformat, te_inst->address,
+            te_inst->branches, te_inst->branch_map);
+    }
+
+    encoder->num_te_inst++;
+    encoder->num_format[te_inst->format]++;
+    encoder->num_payload_bytes += te_inst_payload_bytes(&encoder->params, te_inst);
+    encoder->emit_te_inst(encoder->user_data, te_inst);
+}
+
+
+/*
+ * Send a te_support message, and update the statistics.
+ */
+static void emit_te_support(
+    te_encoder_state_t * const encoder,
+    const te_qual_status_t qual_status)
+{
+    te_support_t te_support;
+
+    assert(encoder);
+
+    memset(&te_support, 0, sizeof(te_support));
+    te_support.support_type = 0;
+    te_support.qual_status = qual_status;
+    te_support.implicit_return = encoder->params.implicit_return;
+    te_support.full_address = encoder->params.full_address;
+
+    encoder->num_te_support++;
+    encoder->num_payload_bytes += te_support_payload_bytes(&te_support);
+    encoder->emit_te_support(encoder->user_data, &te_support);
+}
+
+
+/*
+ * Send a format 3 (synchronization) te_inst, for the current instruction.
+ * As the pipeline always flushes the branch map before a format 3, the
+ * only branch that may be pending is the current instruction itself.
+ * Subformat 1 reports the exception signalled by the previous stage.
+ */
+static void send_sync(
+    te_encoder_state_t * const encoder,
+    const unsigned subformat)
+{
+    const te_encoder_params_t * const params = &encoder->params;
+    const te_encoder_stage_t * const cur = &encoder->current;
+    const te_encoder_stage_t * const last = &encoder->last;
+    te_inst_t te_inst;
+
+    assert(encoder);
+    assert(encoder->branches <= 1);
+
+    if (!encoder->tracing)
+    {
+        /* tell the decoder how the encoder is configured */
+        emit_te_support(encoder, QUAL_STATUS_NO_CHANGE);
+    }
+
+    memset(&te_inst, 0, sizeof(te_inst));
+    te_inst.format = 3;
+    te_inst.subformat = subformat;
+    te_inst.address = truncate_bits(cur->address, params->iaddress_width_p) >> params->iaddress_lsb_p;
+    te_inst.branch = cur->branch && cur->not_taken;
+    te_inst.privilege = truncate_bits(cur->priv, params->privilege_width_p);
+    te_inst.context = params->nocontext_p ? 0 : truncate_bits(cur->context, params->context_width_p);
+    if ( (1 == subformat) && (last->exception) )
+    {
+        te_inst.ecause = truncate_bits(last->cause, params->ecause_width_p);
+        te_inst.interrupt = last->interrupt;
+        te_inst.tval = params->notval_p ? 0 : truncate_bits(last->tval, params->iaddress_width_p);
+    }
+    emit_te_inst(encoder, &te_inst);
+
+    encoder->tracing = true;
+    encoder->last_address = cur->address;
+    encoder->resync_count = 0;
+    encoder->branches = 0;
+    encoder->branch_map = 0;
+    encoder->pending_context = false;   /* format 3 includes the context */
+    encoder->force_sync = false;
+    encoder->call_counter = 0;          /* the decoder empties its stack */
+
+    /* the predictor and the jump target cache start again */
+    encoder->predicted = 0;
+    encoder->branch_count = 0;
+    if (params->bpred_size_p)
+    {
+        memset(encoder->bpred, 0, (size_t)1 << params->bpred_size_p);
+    }
+    if (params->jtc_size_p)
+    {
+        memset(encoder->jump_target_used, 0,
+            sizeof(encoder->jump_target_used[0]) << params->jtc_size_p);
+    }
+}
+
+
+/*
+ * Send a format 1 (branches pending) or format 2 (no branches) te_inst,
+ * with the address of the current instruction. If "flip" is true, then
+ * "updiscon" is inverted (see "Format 1/2 updiscon field"). If counting
+ * correctly predicted branches, then the format 1 has the count instead
+ * of a map, and "bpsuccess" says if the current branch was predicted.
+ */
+static void send_address(
+    te_encoder_state_t * const encoder,
+    const bool flip)
+{
+    const te_encoder_params_t * const params = &encoder->params;
+    const te_address_t address = encoder->current.address;
+    te_inst_t te_inst;
+
+    assert(encoder);
+    assert(encoder->branches <= 31);
+
+    memset(&te_inst, 0, sizeof(te_inst));
+    te_inst.format = (encoder->branches || encoder->branch_count) ? 1 : 2;
+    te_inst.branches = encoder->branches;
+    te_inst.branch_map = encoder->branch_map;
+    if (params->full_address)
+    {
+        te_inst.address = truncate_bits(address, params->iaddress_width_p) >> params->iaddress_lsb_p;
+    }
+    else
+    {
+        te_inst.address = (te_address_t)((int64_t)(address - encoder->last_address) >>
+            params->iaddress_lsb_p);
+    }
+    te_inst.updiscon = MSB(te_inst.address) ^ flip;
+    if (encoder->branch_count)
+    {
+        assert(0 == encoder->branches);
+        te_inst.branch_fmt = 2;
+        te_inst.branch_count = (unsigned)(encoder->branch_count - 31u);
+        te_inst.bpsuccess = !(encoder->current.branch && encoder->current.bpfail);
+        te_inst.updiscon = te_inst.bpsuccess ^ flip;
+    }
+    emit_te_inst(encoder, &te_inst);
+
+    encoder->last_address = address;
+    encoder->branches = 0;
+    encoder->branch_map = 0;
+    encoder->predicted = 0;
+    encoder->branch_count = 0;
+}
+
+
+/*
+ * Send a format 1 te_inst with a full branch map, and no address.
+ */
+static void send_branch_map(
+    te_encoder_state_t * const encoder)
+{
+    te_inst_t te_inst;
+
+    assert(encoder);
+    assert(31 == encoder->branches);
+
+    memset(&te_inst, 0, sizeof(te_inst));
+    te_inst.format = 1;
+    te_inst.branches = 0;   /* 0 == 31 branches, no address */
+    te_inst.branch_map = encoder->branch_map;
+    emit_te_inst(encoder, &te_inst);
+
+    encoder->branches = 0;
+    encoder->branch_map = 0;
+    encoder->predicted = 0;
+}
+
+
+/*
+ * Send a format 1 te_inst with the count of correctly predicted branches,
+ * and no address, which also says that the current branch (which is not
+ * counted) failed its prediction.
+ */
+static void send_branch_count(
+    te_encoder_state_t * const encoder)
+{
+    te_inst_t te_inst;
+
+    assert(encoder);
+    assert(encoder->branch_count >= 31);
+    assert(0 == encoder->branches);
+
+    memset(&te_inst, 0, sizeof(te_inst));
+    te_inst.format = 1;
+    te_inst.branches = 0;
+    te_inst.branch_fmt = 1;
+    te_inst.branch_count = (unsigned)(encoder->branch_count - 31u);
+    emit_te_inst(encoder, &te_inst);
+
+    encoder->branch_count = 0;
+}
+
+
+/*
+ * Report the target of an uninferable discontinuity (the current
+ * instruction). With a jump target cache (see "Using a jump target cache"),
+ * a target that is in the cache is reported by its index, in a format 0
+ * te_inst. Otherwise its address is sent, and it replaces the least-recently
+ * used entry. As a format 0 has no "updiscon", and no branch count, an
+ * address is always sent if either is needed.
+ */
+static void send_target(
+    te_encoder_state_t * const encoder,
+    const bool flip)
+{
+    const te_encoder_params_t * const params = &encoder->params;
+    const te_address_t address = encoder->current.address;
+    const size_t size = (size_t)1 << params->jtc_size_p;
+    size_t oldest = 0;
+    size_t i;
+    te_inst_t te_inst;
+
+    assert(encoder);
+
+    if (0 == params->jtc_size_p)
+    {
+        send_address(encoder, flip);
+        return;
+    }
+
+    encoder->jump_target_clock++;
+    for (i = 0; i < size; i++)
+    {
+        if ( (encoder->jump_target_used[i]) &&
+             (address == encoder->jump_targets[i]) )
+        {
+            break;
+        }
+        if (encoder->jump_target_used[i] < encoder->jump_target_used[oldest])
+        {
+            oldest = i;
+        }
+    }
+
+    if ( (i == size) || (flip) || (encoder->branch_count) )
+    {
+        send_address(encoder, flip);
+        if (i == size)
+        {
+            i = oldest;
+            encoder->jump_targets[i] = address;
+        }
+        encoder->jump_target_used[i] = encoder->jump_target_clock;
+        return;
+    }
+
+    memset(&te_inst, 0, sizeof(te_inst));
+    te_inst.format = 0;
+    te_inst.jtc_index = (unsigned)i;
+    te_inst.branches = encoder->branches;
+    te_inst.branch_map = encoder->branch_map;
+    emit_te_inst(encoder, &te_inst);
+
+    encoder->jump_target_used[i] = encoder->jump_target_clock;
+    encoder->num_jump_target_hits++;    /* update statistics */
+    encoder->last_address = address;
+    encoder->branches = 0;
+    encoder->branch_map = 0;
+    encoder->predicted = 0;
+}
+
+
+/*
+ * Send a format 3, subformat 2 te_inst, reporting the new context.
+ */
+static void send_context(
+    te_encoder_state_t * const encoder)
+{
+    const te_encoder_params_t * const params = &encoder->params;
+    te_inst_t te_inst;
+
+    assert(encoder);
+
+    memset(&te_inst, 0, sizeof(te_inst));
+    te_inst.format = 3;
+    te_inst.subformat = 2;
+    te_inst.context = truncate_bits(encoder->current.context, params->context_width_p);
+    emit_te_inst(encoder, &te_inst);
+
+    encoder->pending_context = false;
+}
+
+
+/*
+ * Push a return address for implicit return. If the return address
+ * stack is full, the oldest entry is discarded (as the decoder does).
+ * With no return address stack, only the number of calls is counted.
+ */
+static void push_return_address(
+    te_encoder_state_t * const encoder,
+    const te_address_t link)
+{
+    size_t i;
+
+    assert(encoder);
+
+    if (encoder->params.return_stack_size_p)
+    {
+        if (encoder->call_counter_max == encoder->call_counter)
+        {
+            encoder->call_counter--;
+            for (i = 0; i < encoder->call_counter; i++)
+            {
+                encoder->return_stack[i] = encoder->return_stack[i+1];
+            }
+        }
+        encoder->return_stack[encoder->call_counter++] = link;
+    }
+    else if (encoder->call_counter < encoder->call_counter_max)
+    {
+        encoder->call_counter++;
+    }
+}
+
+
+/*
+ * Determine if the current instruction is an uninferable discontinuity,
+ * taking implicit return into account: a return whose target can be
+ * predicted by the decoder does not need to be reported. With a return
+ * address stack, the prediction must also match the actual target.
+ */
+static bool resolve_updiscon(
+    te_encoder_state_t * const encoder)
+{
+    const te_encoder_stage_t * const cur = &encoder->current;
+    const te_encoder_stage_t * const next = &encoder->next;
+    bool updiscon = cur->uninferable;
+
+    assert(encoder);
+
+    if ( (encoder->params.implicit_return) &&
+         (cur->is_return) &&
+         (encoder->call_counter > 0) )
+    {
+        const te_address_t predicted = encoder->params.return_stack_size_p ?
+            encoder->return_stack[encoder->call_counter - 1u] : next->address;
+        encoder->call_counter--;
+        if ( (!next->retired) || (predicted == next->address) )
+        {
+            updiscon = false;
+            encoder->num_implicit_returns++;
+        }
+    }
+
+    if ( (encoder->params.implicit_return) &&
+         (cur->call) &&
+         (encoder->call_counter_max) )
+    {
+        push_return_address(encoder, cur->address + cur->size);
+    }
+
+    return updiscon;
+}
+
+
+/*
+ * Predict the outcome of the current branch, and then update the predictor
+ * (see "Branch prediction"), returning true if the prediction succeeded.
+ * Each entry is indexed by bits N:1 of the address (or N+1:2 without
+ * compressed instructions), and the MSB of its 2-bit state is the
+ * prediction of the branch_map bit (1 == not taken).
+ */
+static bool predict_branch(
+    te_encoder_state_t * const encoder)
+{
+    /* next state, indexed by [state][success] */
+    static const uint8_t next_state[4][2] =
+    {
+        { 1, 0 },   /* 00: predict 0, to 01 if it fails */
+        { 3, 0 },   /* 01: predict 0, to 00 if it succeeds, else 11 */
+        { 0, 3 },   /* 10: predict 1, to 11 if it succeeds, else 00 */
+        { 2, 3 },   /* 11: predict 1, to 10 if it fails */
+    };
+    const te_encoder_params_t * const params = &encoder->params;
+    const te_encoder_stage_t * const cur = &encoder->current;
+    const size_t index = (size_t)truncate_bits(cur->address >> params->iaddress_lsb_p,
+        params->bpred_size_p);
+    const unsigned state = encoder->bpred[index];
+    const bool success = ((state >> 1) == (unsigned)cur->not_taken);
+
+    assert(encoder);
+    assert(params->bpred_size_p);
+
+    encoder->bpred[index] = next_state[state][success];
+
+    return success;
+}
+
+
+/*
+ * Add the current branch either to the branch map, or to the count of
+ * correctly predicted branches, returning false only if it fails its
+ * prediction while counting (and so is not counted).
+ */
+static bool add_branch(
+    te_encoder_state_t * const encoder)
+{
+    te_encoder_stage_t * const cur = &encoder->current;
+    const bool success = encoder->params.bpred_size_p ? predict_branch(encoder) : false;
+
+    assert(encoder);
+
+    cur->bpfail = (encoder->params.bpred_size_p) && (!success);
+    if (success)
+    {
+        encoder->num_predicted++;   /* update statistics */
+    }
+
+    if (encoder->branch_count)
+    {
+        encoder->branch_count += success;
+        return success;
+    }
+
+    encoder->branch_map |= (uint32_t)cur->not_taken << encoder->branches;
+    encoder->branches++;
+    encoder->predicted += success;
+
+    return true;
+}
+
+
+/*
+ * Determine if any branches are yet to be reported, in a map or a count.
+ */
+static bool branches_pending(
+    const te_encoder_state_t * const encoder)
+{
+    return (0 != encoder->branches) || (0 != encoder->branch_count);
+}
+
+
+/*
+ * Encode the current instruction, with visibility of the previous (last)
+ * and the next instructions. This follows the flowchart in "algo.png",
+ * with each decision made in the same order as in the flowchart.
+ */
+static void encode_current(
+    te_encoder_state_t * const encoder)
+{
+    const te_encoder_params_t * const params = &encoder->params;
+    te_encoder_stage_t * const cur = &encoder->current;
+    const te_encoder_stage_t * const last = &encoder->last;
+    const te_encoder_stage_t * const next = &encoder->next;
+    const bool next_qualified = next->valid && next->qualified;
+    const bool next_exc_only = next->valid && next->exception && !next->retired;
+    bool next_sync;
+    bool ended_ntr = false;
+    bool counted = true;
+
+    assert(encoder);
+
+    if (!cur->qualified)
+    {
+        return;     /* nothing to trace */
+    }
+
+    if (!cur->retired)
+    {
+        /* an exception, without retirement, reported by the next stage */
+        if ( (encoder->tracing) && (!next_qualified) )
+        {
+            emit_te_support(encoder, QUAL_STATUS_ENDED_REP);
+            encoder->tracing = false;
+        }
+        return;
+    }
+
+    if (cur->cci)
+    {
+        encoder->pending_context = true;
+    }
+
+    if (cur->branch)
+    {
+        counted = add_branch(encoder);
+    }
+
+    if (encoder->tracing)
+    {
+        encoder->resync_count++;
+    }
+
+    /* will the next instruction be reported with a format 3 ? */
+    next_sync = next_qualified &&
+                ( (cur->exception) ||
+                  (next_exc_only) ||
+                  (next->context_discon) ||
+                  (next->ppch) ||
+                  ( (params->max_resync) && (encoder->resync_count + 1u > params->max_resync) ) );
+
+    if ( (last->valid && last->exception) ||
+         (cur->context_discon) )
+    {
+        send_sync(encoder, 1);
+    }
+    else if ( (!encoder->tracing) ||
+              (cur->ppch) ||
+              (encoder->force_sync) ||
+              ( (params->max_resync) && (encoder->resync_count > params->max_resync) ) )
+    {
+        send_sync(encoder, 0);
+    }
+    else if (last->updiscon)
+    {
+        send_target(encoder, next_sync);
+        ended_ntr = true;   /* would have been sent anyway */
+    }
+    else if ( ( (params->max_resync) &&
+                (encoder->resync_count == params->max_resync) &&
+                (branches_pending(encoder)) ) ||
+              (cur->exception) ||
+              (cur->notify) )
+    {
+        /* resync_br or er_ccdn */
+        send_address(encoder, false);
+        /*
+         * The decoder can only tell which occurrence of a reported address
+         * (that did not follow an uninferable discontinuity) is meant, if
+         * the next te_inst is a format 3 (see "Format 1/2 updiscon field").
+         * So the instruction following a notification is always synchronized.
+         */
+        encoder->force_sync = cur->notify;
+    }
+
+    else if ( (!next_qualified) ||
+              (next_exc_only) ||
+              (next->context_discon) ||
+              ( (next->ppch) && (branches_pending(encoder)) ) )
+    {
+        send_address(encoder, false);
+    }
+    else if ( (31 == encoder->branches) && (31 == encoder->predicted) )
+    {
+        /* all predicted correctly, so count the following ones instead */
+        encoder->branch_count = 31;
+        encoder->branches = 0;
+        encoder->branch_map = 0;
+        encoder->predicted = 0;
+    }
+    else if (31 == encoder->branches)
+    {
+        send_branch_map(encoder);
+    }
+    else if (encoder->pending_context)
+    {
+        send_context(encoder);
+    }
+
+    /*
+     * Only now update the return stack with this instruction, as a format 3
+     * for it (see send_sync) empties the decoder's first, which then pushes
+     * (or pops) as it follows this instruction.
+     */
+    cur->updiscon = resolve_updiscon(encoder);
+
+    if ( (!counted) && (encoder->branch_count) )
+    {
+        /* the prediction failed, and no address was sent, which ends the count */
+        send_branch_count(encoder);
+    }
+    else if (31u + 0xffffu == encoder->branch_count)
+    {
+        /* the count is full, so report the address of the last branch */
+        send_address(encoder, false);
+    }
+
+    if (!next_qualified)
+    {
+        /* qualification ended, so tell the decoder */
+        emit_te_support(encoder, ended_ntr ? QUAL_STATUS_ENDED_NTR : QUAL_STATUS_ENDED_REP);
+        encoder->tracing = false;
+    }
+}
+
+
+/*
+ * Move the pipeline on by one stage, encoding the current instruction
+ * once the next one is known.
+ */
+static void advance_pipeline(
+    te_encoder_state_t * const encoder,
+    const te_encoder_stage_t * const stage)
+{
+    assert(encoder);
+    assert(stage);
+
+    encoder->next = *stage;
+    if (encoder->current.valid)
+    {
+        encode_current(encoder);
+    }
+    encoder->last = encoder->current;
+    encoder->current = encoder->next;
+}
+
+
+/*
+ * Fill in the default parameters: an RV64 core with compressed
+ * instructions, retiring one instruction per cycle, with no branch
+ * predictor, jump target cache or implicit return, and differential
+ * addresses.
+ */
+extern void te_encoder_default_params(
+    te_encoder_params_t * const params)
+{
+    assert(params);
+
+    memset(params, 0, sizeof(te_encoder_params_t));
+    params->context_type_width_p = 2;
+    params->context_width_p = 32;
+    params->ecause_width_p = 6;
+    params->iaddress_lsb_p = 1;
+    params->iaddress_width_p = 64;
+    params->iretire_width_p = 1;
+    params->itype_width_p = 4;
+    params->privilege_width_p = 2;
+    params->retires_p = 1;
+    params->taken_branches_p = 1;
+}
+
+
+/*
+ * Initialize a new instance of a trace-encoder.
+ * If "encoder" is NULL on entry, then memory will be dynamically
+ * allocated, otherwise it must point to a pre-allocated region large enough.
+ * Each te_inst and te_support message is passed to the given functions,
+ * together with "user_data", as soon as it is generated.
+ */
+extern te_encoder_state_t * te_open_trace_encoder(
+    te_encoder_state_t * encoder,
+    const te_encoder_params_t * const params,
+    const te_emit_te_inst_t emit_te_inst,
+    const te_emit_te_support_t emit_te_support,
+    void * const user_data)
+{
+    assert(params);
+    assert(emit_te_inst);
+    assert(emit_te_support);
+    assert((1u << params->bpred_size_p) <= TE_ENCODER_MAX_BRANCH_PREDICTOR);
+    assert((1u << params->jtc_size_p) <= TE_ENCODER_MAX_JUMP_TARGETS);
+    assert( (1 == params->iaddress_lsb_p) || (2 == params->iaddress_lsb_p) );
+    assert((1u << params->return_stack_size_p) <= TE_ENCODER_MAX_RETURN_STACK);
+
+    if (encoder)
+    {
+        memset(encoder, 0, sizeof(te_encoder_state_t));
+    }
+    else
+    {
+        encoder = calloc(1, sizeof(te_encoder_state_t));
+        assert(encoder);
+    }
+
+    encoder->params = *params;
+    encoder->emit_te_inst = emit_te_inst;
+    encoder->emit_te_support = emit_te_support;
+    encoder->user_data = user_data;
+
+    if (params->return_stack_size_p)
+    {
+        encoder->call_counter_max = (size_t)1 << params->return_stack_size_p;
+    }
+    else if (params->call_counter_size_p)
+    {
+        const unsigned bits = 1u << params->call_counter_size_p;
+        encoder->call_counter_max = (bits >= 8 * sizeof(size_t)) ?
+            ~(size_t)0 : ((size_t)1 << bits) - 1u;
+    }
+
+    return encoder;
+}
+
+
+/*
+ * Fill in the fields of a pipeline stage that depend upon "itype".
+ */
+static void set_stage_itype(
+    te_encoder_stage_t * const stage,
+    const te_itype_t itype)
+{
+    stage->branch = (TE_ITYPE_NONTAKEN_BRANCH == itype) || (TE_ITYPE_TAKEN_BRANCH == itype);
+    stage->not_taken = (TE_ITYPE_NONTAKEN_BRANCH == itype);
+    stage->uninferable = is_uninferable_itype(itype);
+    stage->call = (TE_ITYPE_UNINFERABLE_CALL == itype) || (TE_ITYPE_INFERABLE_CALL == itype);
+    stage->is_return = (TE_ITYPE_UNINFERABLE_RETURN == itype) || (TE_ITYPE_INFERABLE_RETURN == itype);
+    stage->exception = (TE_ITYPE_EXCEPTION == itype) || (TE_ITYPE_INTERRUPT == itype);
+    stage->interrupt = (TE_ITYPE_INTERRUPT == itype);
+}
+
+
+/*
+ * Return a stage for the instruction starting at half-word "offset" of a
+ * block, which ends at the next half-word set in "starts" (or at "end").
+ * Only the first and the last instruction of a block may be anything other
+ * than a plain instruction (as in "plain") or a non-taken branch.
+ */
+static te_encoder_stage_t block_stage(
+    const te_encoder_stage_t * const plain,
+    const te_ingress_t * const ingress,
+    const uint64_t starts,
+    const unsigned offset,
+    const unsigned end)
+{
+    const uint64_t following = (offset >= 63u) ? 0 : (starts & (~(uint64_t)0 << (offset + 1u)));
+    te_encoder_stage_t stage = *plain;
+
+    stage.address = ingress->iaddr + 2u * offset;
+    stage.size = 2u * ((following ? lowest_bit(following) : end) - offset);
+    stage.branch = (ingress->ntkn_mask >> offset) & 1u;
+    stage.not_taken = stage.branch;
+
+    return stage;
+}
+
+
+/*
+ * Return a stage for the last instruction of a block, which is also
+ * described by "itype" (and may be followed by an exception).
+ */
+static te_encoder_stage_t last_block_stage(
+    const te_encoder_stage_t * const model,
+    const te_ingress_t * const ingress,
+    const uint64_t starts,
+    const unsigned offset)
+{
+    te_encoder_stage_t stage = block_stage(model, ingress, starts, offset, ingress->iretire);
+    const bool not_taken = stage.not_taken;
+
+    set_stage_itype(&stage, ingress->itype);
+    stage.branch |= not_taken;
+    stage.not_taken |= not_taken;
+    stage.cause = ingress->cause;
+    stage.tval = ingress->tval;
+
+    return stage;
+}
+
+
+/*
+ * Add "count" non-taken branches to the branch map, by the instructions
+ * between the first and last of a block, in one step. A format 1 te_inst
+ * is sent each time that the branch map becomes full, exactly as if each
+ * of the instructions had been encoded in turn by encode_current().
+ */
+static void add_not_taken_branches(
+    te_encoder_state_t * const encoder,
+    unsigned count)
+{
+    assert(encoder);
+    assert(encoder->branches < 31);
+
+    while (encoder->branches + count >= 31)
+    {
+        const unsigned fill = 31u - encoder->branches;
+        encoder->branch_map |= (uint32_t)((1ull << fill) - 1u) << encoder->branches;
+        encoder->branches = 31;
+        send_branch_map(encoder);
+        count -= fill;
+    }
+
+    encoder->branch_map |= (uint32_t)((1ull << count) - 1u) << encoder->branches;
+    encoder->branches += count;
+}
+
+
+/*
+ * Process a block of instructions, all retired together by a multiple-
+ * retirement core. The first and last instructions of the block go through
+ * the pipeline as usual. The instructions between them can not change the
+ * privilege or context, be uninferable, nor be followed by an exception,
+ * so usually they can only add non-taken branches to the branch map, and
+ * these are all added in one step. Only if a resync, or the reporting of
+ * an imprecise context change, is due within the block, are they encoded
+ * one at a time. Either way, the te_inst messages are identical to those
+ * for a single-retirement core retiring the same instructions.
+ */
+static void encode_block(
+    te_encoder_state_t * const encoder,
+    const te_ingress_t * const ingress,
+    const te_encoder_stage_t * const first)
+{
+    /* all instructions the same size as the last: 1, 2 or 4 half-words */
+    static const uint64_t same_size[] =
+    {
+        ~(uint64_t)0, 0x5555555555555555ull, 0x1111111111111111ull
+    };
+    const te_encoder_params_t * const params = &encoder->params;
+    const unsigned end = ingress->iretire;
+    const unsigned last_offset = end - (1u << ingress->ilastsize);
+    const uint64_t starts = ingress->istart ? ingress->istart :
+        (same_size[ingress->ilastsize] & (~(uint64_t)0 >> (64u - end)));
+    const uint64_t inner = starts & ~(uint64_t)1 & ~((uint64_t)1 << last_offset);
+    const unsigned num_inner = count_bits(inner);
+    te_encoder_stage_t plain;
+    te_encoder_stage_t stage;
+    uint64_t remaining;
+
+    assert(ingress->ilastsize <= 2);
+    assert(end <= 64);
+    assert(last_offset < end);
+    assert(starts & 1u);
+    assert(last_offset == highest_bit(starts));
+    assert(0 == (ingress->ntkn_mask & ~starts));
+    assert(count_bits(ingress->ntkn_mask) ==
+        (ingress->ntkn ? ingress->ntkn : (TE_ITYPE_NONTAKEN_BRANCH == ingress->itype)));
+
+    encoder->num_instructions += num_inner + ((0 == last_offset) ? 1u : 2u);
+
+    memset(&plain, 0, sizeof(plain));
+    plain.valid = true;
+    plain.retired = true;
+    plain.qualified = first->qualified;
+    plain.priv = first->priv;
+    plain.context = first->context;
+
+    /* the first instruction, which may also be the last */
+    if (0 == last_offset)
+    {
+        stage = last_block_stage(first, ingress, starts, 0);
+        advance_pipeline(encoder, &stage);
+        return;
+    }
+    stage = block_stage(first, ingress, starts, 0, end);
+    advance_pipeline(encoder, &stage);
+
+    if (num_inner)
+    {
+        /* the second instruction, so the first is encoded */
+        stage = block_stage(&plain, ingress, starts, lowest_bit(inner), end);
+        advance_pipeline(encoder, &stage);
+
+        /*
+         * If nothing else can be reported before the last instruction, then
+         * just add the branches of all the instructions in between (which
+         * now start with the current one), and move the pipeline straight
+         * on to the last instruction. Otherwise encode them one at a time,
+         * as they must be with a branch predictor.
+         */
+        if ( (!encoder->current.qualified) ||
+             ( (encoder->tracing) &&
+               (0 == params->bpred_size_p) &&
+               (!encoder->force_sync) &&
+               (!encoder->pending_context) &&
+               ( (0 == params->max_resync) ||
+                 (encoder->resync_count + num_inner < params->max_resync) ) ) )
+        {
+            if (encoder->current.qualified)
+            {
+                add_not_taken_branches(encoder, count_bits(ingress->ntkn_mask & inner));
+                encoder->resync_count += num_inner;
+            }
+            encoder->last = block_stage(&plain, ingress, starts, highest_bit(inner), end);
+            encoder->current = last_block_stage(&plain, ingress, starts, last_offset);
+            encoder->next = encoder->current;
+            return;
+        }
+
+        for (remaining = inner & (inner - 1u); remaining; remaining &= remaining - 1u)
+        {
+            stage = block_stage(&plain, ingress, starts, lowest_bit(remaining), end);
+            advance_pipeline(encoder, &stage);
+        }
+    }
+
+    /* the last instruction */
+    stage = last_block_stage(&plain, ingress, starts, last_offset);
+    advance_pipeline(encoder, &stage);
+}
+
+
+/*
+ * Process the signals on the ingress port for one block.
+ * Called each cycle in which an instruction retires, or an
+ * exception or interrupt is signalled.
+ */
+extern void te_encode_ingress(
+    te_encoder_state_t * const encoder,
+    const te_ingress_t * const ingress)
+{
+    const te_itype_t itype = ingress->itype;
+    const bool exception = (TE_ITYPE_EXCEPTION == itype) || (TE_ITYPE_INTERRUPT == itype);
+    const bool multiple = (encoder->params.retires_p > 1);
+    te_encoder_stage_t stage;
+
+    assert(encoder);
+    assert(ingress);
+    assert( (multiple) || (ingress->iretire <= 1) );    /* single-retirement */
+    assert( (multiple) || (0 == ingress->ntkn) );       /* must be tied low */
+
+    if ( (0 == ingress->iretire) && (!exception) )
+    {
+        return;     /* nothing retired, all other signals are undefined */
+    }
+
+    encoder->num_blocks++;
+
+    memset(&stage, 0, sizeof(stage));
+    stage.valid = true;
+    stage.retired = (0 != ingress->iretire);
+    stage.qualified = ingress->qualified;
+    stage.address = ingress->iaddr;
+    stage.size = 2u << ingress->ilastsize;
+    stage.priv = ingress->priv;
+    stage.context = ingress->context;
+    stage.cause = ingress->cause;
+    stage.tval = ingress->tval;
+
+    if (stage.retired)
+    {
+        /* detect changes of privilege and context */
+        if ( (encoder->seen_ingress) &&
+             (ingress->context != encoder->last_context) )
+        {
+            switch (ingress->context_type)
+            {
+                case TE_CONTEXT_DISCONTINUITY:
+                    stage.context_discon = true;
+                    break;
+                case TE_CONTEXT_PRECISE:
+                    stage.ppch = true;
+                    break;
+                case TE_CONTEXT_IMPRECISE:
+                    stage.cci = true;
+                    break;
+                case TE_CONTEXT_NOTIFICATION:
+                    stage.notify = true;
+                    break;
+            }
+        }
+        if ( (encoder->seen_ingress) &&
+             (ingress->priv != encoder->last_priv) )
+        {
+            stage.ppch = true;
+        }
+        encoder->last_priv = ingress->priv;
+        encoder->last_context = ingress->context;
+        encoder->seen_ingress = true;
+
+        if (multiple)
+        {
+            encode_block(encoder, ingress, &stage);
+            return;
+        }
+    }
+
+    encoder->num_instructions += ingress->iretire;
+    set_stage_itype(&stage, itype);
+    advance_pipeline(encoder, &stage);
+}
+
+
+/*
+ * Flush the pipeline, as if the next instruction was not qualified.
+ * Called when tracing is stopped (or the core halts, or is reset).
+ * The last qualified instruction is reported, followed by a te_support.
+ */
+extern void te_flush_trace_encoder(
+    te_encoder_state_t * const encoder)
+{
+    te_encoder_stage_t stage;
+
+    assert(encoder);
+
+    memset(&stage, 0, sizeof(stage));
+    stage.valid = true;     /* an unqualified "instruction" */
+
+    advance_pipeline(encoder, &stage);
+}
+
+
+/*
+ * print out a few statistics
+ */
+extern void te_print_encoder_statistics(
+    const te_encoder_state_t * const encoder)
+{
+    assert(encoder);
+
+    printf("encoder: instructions = %lu,  te_inst = %lu (%lu/%lu/%lu/%lu),"
+        "  te_support = %lu,  implicit returns = %lu,  predicted = %lu,"
+        "  jump target hits = %lu,  payload bytes = %llu\n",
+        encoder->num_instructions,
+        encoder->num_te_inst,
+        encoder->num_format[0],
+        encoder->num_format[1],
+        encoder->num_format[2],
+        encoder->num_format[3],
+        encoder->num_te_support,
+        encoder->num_implicit_returns,
+        encoder->num_predicted,
+        encoder->num_jump_target_hits,
+        encoder->num_payload_bytes);
+}
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_ENCODER_ALGORITHM_PUBLIC_H
+#define TE_ENCODER_ALGORITHM_PUBLIC_H
+
+
+/*
+ * A reference software trace-encoder, implementing the "Delta Mode 1"
+ * instruction trace algorithm (see figure "algo.png"). It consumes the
+ * instruction retirement information presented on the ingress port (see
+ * "ingressPort.tex"), and emits te_inst and te_support messages, using
+ * the same message types as the trace-decoder, so that its output may be
+ * fed directly into te_process_te_inst() and te_process_te_support().
+ */
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * Define the maximum size of the encoder's return address stack (must be
+ * a power of 2), which is only used when "implicit_return" is true.
+ * This limits the largest usable value of return_stack_size_p.
+ * If not defined elsewhere, define TE_ENCODER_MAX_RETURN_STACK here.
+ */
+#if !defined(TE_ENCODER_MAX_RETURN_STACK)
+#   define TE_ENCODER_MAX_RETURN_STACK (1u<<9)  /* 2^9 = 512 entries */
+#endif  /* TE_ENCODER_MAX_RETURN_STACK */
+
+
+/*
+ * Define the maximum sizes of the encoder's branch predictor, and of its
+ * jump target cache (both must be powers of 2). These limit the largest
+ * usable values of bpred_size_p and jtc_size_p.
+ * If not defined elsewhere, define them here.
+ */
+#if !defined(TE_ENCODER_MAX_BRANCH_PREDICTOR)
+#   define TE_ENCODER_MAX_BRANCH_PREDICTOR (1u<<12) /* 2^12 = 4096 entries */
+#endif  /* TE_ENCODER_MAX_BRANCH_PREDICTOR */
+
+#if !defined(TE_ENCODER_MAX_JUMP_TARGETS)
+#   define TE_ENCODER_MAX_JUMP_TARGETS (1u<<6)      /* 2^6 = 64 entries */
+#endif  /* TE_ENCODER_MAX_JUMP_TARGETS */
+
+
+/*
+ * The termination type of an instruction block (the "itype" signal).
+ */
+typedef enum
+{
+    TE_ITYPE_NONE                   = 0,
+    TE_ITYPE_EXCEPTION              = 1,
+    TE_ITYPE_INTERRUPT              = 2,
+    TE_ITYPE_EXCEPTION_RETURN       = 3,
+    TE_ITYPE_NONTAKEN_BRANCH        = 4,
+    TE_ITYPE_TAKEN_BRANCH           = 5,
+    TE_ITYPE_RESERVED               = 6,
+    TE_ITYPE_COROUTINE_SWAP         = 7,
+    TE_ITYPE_UNINFERABLE_CALL       = 8,
+    TE_ITYPE_INFERABLE_CALL         = 9,
+    TE_ITYPE_UNINFERABLE_TAIL_CALL  = 10,
+    TE_ITYPE_INFERABLE_TAIL_CALL    = 11,
+    TE_ITYPE_UNINFERABLE_RETURN     = 12,
+    TE_ITYPE_INFERABLE_RETURN       = 13,
+    TE_ITYPE_UNINFERABLE_JUMP       = 14,
+    TE_ITYPE_INFERABLE_JUMP         = 15,
+} te_itype_t;
+
+
+/*
+ * The behavior type of a change of "context" (the "context_type" signal).
+ */
+typedef enum
+{
+    TE_CONTEXT_DISCONTINUITY        = 0,    /* treated as an exception */
+    TE_CONTEXT_PRECISE              = 1,    /* treated as a privilege change */
+    TE_CONTEXT_IMPRECISE            = 2,    /* reported when convenient */
+    TE_CONTEXT_NOTIFICATION         = 3,    /* report address only */
+} te_context_type_t;
+
+
+/*
+ * The signals presented on the ingress port, for one instruction block.
+ *
+ * For a single-retirement core (retires_p == 1), "iretire" is the number
+ * of instructions retired (0 or 1), and "ntkn" must be tied low.
+ *
+ * For a multiple-retirement core (retires_p > 1), "iretire" is the number
+ * of half-words retired, and "ntkn" the number of non-taken branches
+ * (including the last instruction, if "itype" is 4). If more than one
+ * taken branch may retire per cycle (taken_branches_p > 1), then pass
+ * each valid signal group in turn, oldest first. So that the te_inst
+ * messages are identical to those for a single-retirement core, this
+ * model also needs to know where each instruction in the block starts,
+ * and which of them are the non-taken branches. These are given as
+ * masks, with one bit per half-word (so a block is at most 64 half-words),
+ * and bit 0 is the instruction at "iaddr". If "istart" is zero, then all
+ * the instructions are taken to be the same size as the last.
+ *
+ * "qualified" is the output of the filtering logic (see "filtering.tex"),
+ * which is outside the scope of this code. A change of "context" is
+ * detected by comparing it with the previous block, and then treated
+ * according to the "context_type" of the block with the new value.
+ */
+typedef struct
+{
+    te_address_t iaddr;             /* address of 1st instruction retired */
+    unsigned iretire;               /* instructions (or half-words) retired */
+    te_itype_t itype;               /* termination type of the block */
+    unsigned ilastsize;             /* last instruction is 2^ilastsize half-words */
+    unsigned ntkn;                  /* number of non-taken branches */
+    uint64_t istart;                /* half-words starting an instruction */
+    uint64_t ntkn_mask;             /* half-words starting a non-taken branch */
+    unsigned priv;                  /* privilege level */
+    uint64_t context;               /* context and/or hart ID */
+    te_context_type_t context_type; /* behavior type of "context" */
+    unsigned cause;                 /* only if itype is 1 or 2 */
+    te_address_t tval;              /* only if itype is 1 or 2 */
+    bool qualified;                 /* meets the filtering criteria */
+} te_ingress_t;
+
+
+/*
+ * Type of function to which ingress blocks may be presented, e.g. by
+ * a source of retirement information other than a core. The block
+ * passed is only valid for the duration of the call.
+ */
+typedef void (*te_ingress_handler_t)(
+    void * const user_data,
+    const te_ingress_t * const ingress);
+
+
+/*
+ * The parameters to the encoder, with the same names and semantics as in
+ * the table "Parameters to the encoder", plus a few run-time options
+ * (i.e. those reported in the "options" field of te_support messages).
+ * The filtering parameters are accepted for completeness, but filtering
+ * itself is performed outside the encoder (see te_ingress_t.qualified).
+ *
+ * The branch predictor (see "Branch prediction"), and the jump target
+ * cache and tapered branch map (see "Future directions"), are modelled
+ * so that their effect on the trace bandwidth may be measured. The
+ * trace-decoder does not model them, and rejects any te_inst using them.
+ */
+typedef struct
+{
+    unsigned bpred_size_p;          /* 0 == no branch predictor, else 2^N entries */
+    unsigned call_counter_size_p;   /* 0 == no implicit return counter */
+    unsigned context_type_width_p;
+    unsigned context_width_p;
+    unsigned ecause_width_p;
+    unsigned ecause_choice_p;
+    bool     filter_context_p;
+    unsigned filter_ecause_p;
+    bool     filter_interrupt_p;
+    bool     filter_privilege_p;
+    bool     filter_tval_p;
+    unsigned iaddress_lsb_p;        /* 1 == compressed instructions */
+    unsigned iaddress_width_p;      /* XLEN */
+    unsigned iretire_width_p;
+    unsigned ilastsize_width_p;
+    unsigned itype_width_p;
+    bool     nocontext_p;           /* exclude context from te_inst */
+    bool     notval_p;              /* exclude tval from te_inst */
+    unsigned ntkn_width_p;
+    unsigned privilege_width_p;
+    unsigned retires_p;             /* maximum instructions per block */
+    unsigned return_stack_size_p;   /* 0 == no return address stack */
+    unsigned taken_branches_p;
+    unsigned user_width_p;
+
+    /* not (yet) in the specification, see "futures.tex" */
+    unsigned jtc_size_p;            /* 0 == no jump target cache, else 2^N entries */
+    bool     tapered_branch_map_p;  /* branch_map lengths 1, 3, 7, 15, 31 */
+
+    /* run-time options */
+    bool implicit_return;           /* do not report predictable returns */
+    bool full_address;              /* always output full addresses */
+    unsigned long max_resync;       /* instructions between resyncs, 0 == never */
+} te_encoder_params_t;
+
+
+/*
+ * Functions used by the encoder to emit each message.
+ * They are passed whatever "user_data" was passed to te_open_trace_encoder().
+ */
+typedef void (*te_emit_te_inst_t)(
+    void * const user_data,
+    const te_inst_t * const te_inst);
+
+typedef void (*te_emit_te_support_t)(
+    void * const user_data,
+    const te_support_t * const te_support);
+
+
+/*
+ * One stage of the encoder's pipeline, holding what is known about
+ * one instruction (or an exception signalled without a retirement).
+ */
+typedef struct
+{
+    te_address_t address;   /* of the instruction */
+    unsigned size;          /* of the instruction, in bytes */
+    unsigned priv;
+    uint64_t context;
+    unsigned cause;
+    te_address_t tval;
+    bool valid;             /* stage is occupied */
+    bool retired;           /* false == exception without retirement */
+    bool qualified;
+    bool branch;
+    bool not_taken;         /* only if "branch" */
+    bool uninferable;       /* itype says uninferable discontinuity */
+    bool call;              /* pushes a return address */
+    bool is_return;         /* may be an implicit return */
+    bool exception;         /* exception/interrupt follows instruction */
+    bool interrupt;         /* only if "exception" */
+    bool ppch;              /* privilege or precise context change */
+    bool context_discon;    /* context change with discontinuity */
+    bool cci;               /* imprecise context change */
+    bool notify;            /* context notification */
+    bool updiscon;          /* resolved when the stage is encoded */
+    bool bpfail;            /* branch prediction failed, when encoded */
+} te_encoder_stage_t;
+
+
+/*
+ * The following structure is used to hold all the state for a single
+ * instance of a trace-encoder. As with te_decoder_state_t, each core
+ * being traced should have its own unique instance.
+ */
+typedef struct te_encoder_state_s
+{
+    te_encoder_params_t params;
+
+    /* the 3-stage pipeline: previous, current and next instructions */
+    te_encoder_stage_t last;
+    te_encoder_stage_t current;
+    te_encoder_stage_t next;
+
+    /* the previous ingress block (to detect changes) */
+    unsigned last_priv;
+    uint64_t last_context;
+    bool seen_ingress;
+
+    /* Number of branches yet to be reported */
+    unsigned int branches;
+    /* Bit vector of not taken/taken (1/0) status for branches */
+    uint32_t branch_map;
+
+    /* true once a format 3 has been sent, until tracing ends */
+    bool tracing;
+    /* address in the previous te_inst containing an address */
+    te_address_t last_address;
+    /* counts instructions since the last format 3 */
+    unsigned long resync_count;
+    /* an imprecise context change is waiting to be reported */
+    bool pending_context;
+    /* the next instruction must be reported with a format 3 */
+    bool force_sync;
+
+    /* implicit return: either a return address stack, or just a counter */
+    size_t call_counter;
+    size_t call_counter_max;
+    te_address_t return_stack[TE_ENCODER_MAX_RETURN_STACK];
+
+    /* branch prediction: the 2-bit state of each entry of the predictor */
+    uint8_t bpred[TE_ENCODER_MAX_BRANCH_PREDICTOR];
+    /* branches in branch_map that were predicted correctly */
+    unsigned predicted;
+    /* non-zero: counting correctly predicted branches, instead of a map */
+    unsigned long branch_count;
+
+    /* the jump target cache, and when each entry was last used (0 == empty) */
+    te_address_t jump_targets[TE_ENCODER_MAX_JUMP_TARGETS];
+    unsigned long long jump_target_used[TE_ENCODER_MAX_JUMP_TARGETS];
+    unsigned long long jump_target_clock;
+
+    /* where to send the messages */
+    te_emit_te_inst_t emit_te_inst;
+    te_emit_te_support_t emit_te_support;
+    void * user_data;
+
+    /* maintain a few statistics */
+    unsigned long num_blocks;           /* ingress blocks consumed */
+    unsigned long num_instructions;     /* instructions retired */
+    unsigned long num_te_inst;
+    unsigned long num_te_support;
+    unsigned long num_format[4];        /* te_inst per format */
+    unsigned long num_implicit_returns; /* returns not reported */
+    unsigned long num_predicted;        /* branches predicted correctly */
+    unsigned long num_jump_target_hits; /* targets reported by index */
+    unsigned long long num_payload_bytes;   /* of all messages (compressed) */
+} te_encoder_state_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern void te_encoder_default_params(
+    te_encoder_params_t * const params);
+
+extern te_encoder_state_t * te_open_trace_encoder(
+    te_encoder_state_t * encoder,
+    const te_encoder_params_t * const params,
+    const te_emit_te_inst_t emit_te_inst,
+    const te_emit_te_support_t emit_te_support,
+    void * const user_data);
+
+extern void te_encode_ingress(
+    te_encoder_state_t * const encoder,
+    const te_ingress_t * const ingress);
+
+extern unsigned te_inst_payload_bytes(
+    const te_encoder_params_t * const params,
+    const te_inst_t * const te_inst);
+
+extern unsigned te_support_payload_bytes(
+    const te_support_t * const te_support);
+
+extern void te_flush_trace_encoder(
+    te_encoder_state_t * const encoder);
+
+extern void te_print_encoder_statistics(
+    const te_encoder_state_t * const encoder);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_ENCODER_ALGORITHM_PUBLIC_H */
@@ -0,0 +1,661 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Model the trace bandwidth of many configurations of the reference
+ * trace-encoder, over the same retirement stream, in a single pass.
+ *
+ * The stream is either read from Spike or QEMU logs (see
+ * commit-log-reader.h), or generated (see trace-generator.h), and is
+ * shared by all configurations: it is produced once, into a ring of
+ * batches of ingress blocks, and each batch is encoded by every
+ * configuration, with the configurations divided between several threads.
+ * The configurations are all combinations of the values given for each
+ * parameter. For each one, the size of the trace is reported as bits per
+ * instruction (from the payload lengths, after sign-based compression,
+ * plus a fixed header per packet), and as packets per second, for a core
+ * retiring the given number of instructions per second.
+ *
+ * The branch predictor, the jump target cache and the tapered branch map
+ * are modelled by the encoder for their bandwidth only (the trace-decoder
+ * does not model them), which is all that is needed here.
+ *
+ * For example, to build and run it:
+ *
+ *  cc -O2 -pthread -I<riscv-disassembler> -o encoder-sweep \
+ *      encoder-sweep.c commit-log-reader.c trace-generator.c \
+ *      encoder-algorithm-public.c
+ *
+ *  ./encoder-sweep --implicit-return=0,1 --return-stack=0,2,4,8 \
+ *      --bpred=0,6,10 --jtc=0,3 --tapered-map=0,1 boot.log
+ *
+ * Run with "--help" for the list of options.
+ */
+#include <assert.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "commit-log-reader.h"
+#include "trace-generator.h"
+
+
+/*
+ * Dimensions of the ring of batches of ingress blocks.
+ */
+#define BATCH_SIZE      (1u<<12)    /* ingress blocks per batch */
+#define NUM_BATCHES     (8u)
+
+
+/*
+ * Maximum number of values that may be given for each parameter,
+ * and maximum number of threads.
+ */
+#define MAX_VALUES      (16u)
+#define MAX_THREADS     (64u)
+
+
+/*
+ * One batch of ingress blocks.
+ */
+typedef struct
+{
+    size_t count;
+    te_ingress_t ingress[BATCH_SIZE];
+} batch_t;
+
+
+/*
+ * One configuration of the trace-encoder being modelled.
+ */
+typedef struct
+{
+    te_encoder_state_t encoder;
+    double seconds;     /* thread CPU time spent encoding */
+} config_t;
+
+
+/*
+ * Everything shared by the producer and the worker threads.
+ */
+typedef struct
+{
+    config_t * configs;
+    size_t num_configs;
+    unsigned num_threads;
+
+    /* the ring: batch "n" is in batches[n % NUM_BATCHES] */
+    batch_t * batches;
+    size_t num_produced;            /* batches published so far */
+    unsigned unread[NUM_BATCHES];   /* workers yet to encode each batch */
+    bool ended;                     /* no more batches */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    /* the producer's batch, being filled */
+    batch_t * filling;
+
+    unsigned long long num_instructions;
+    unsigned long long num_blocks;
+} sweep_t;
+
+
+/*
+ * One worker thread, encoding configurations "first", "first" +
+ * num_threads, and so on.
+ */
+typedef struct
+{
+    sweep_t * sweep;
+    size_t first;
+    pthread_t thread;
+} worker_t;
+
+
+/*
+ * Print some trace-encoding diagnostics.
+ */
+extern void te_log_printf(
+    const char * const format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+
+/*
+ * The messages are only measured (by the encoder), not kept.
+ */
+static void discard_te_inst(
+    void * const user_data,
+    const te_inst_t * const te_inst)
+{
+    (void)user_data;
+    (void)te_inst;
+}
+
+static void discard_te_support(
+    void * const user_data,
+    const te_support_t * const te_support)
+{
+    (void)user_data;
+    (void)te_support;
+}
+
+
+/*
+ * Return the current time, in seconds, of the given clock.
+ */
+static double now(
+    const clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Wait until the slot for the next batch has been encoded by every
+ * worker, and then start filling it.
+ */
+static void next_filling(
+    sweep_t * const sweep)
+{
+    const size_t slot = sweep->num_produced % NUM_BATCHES;
+
+    pthread_mutex_lock(&sweep->lock);
+    while (sweep->unread[slot])
+    {
+        pthread_cond_wait(&sweep->changed, &sweep->lock);
+    }
+    pthread_mutex_unlock(&sweep->lock);
+
+    sweep->filling = &sweep->batches[slot];
+    sweep->filling->count = 0;
+}
+
+
+/*
+ * Publish the batch being filled (if it is not empty), to every worker.
+ */
+static void publish(
+    sweep_t * const sweep)
+{
+    const size_t slot = sweep->num_produced % NUM_BATCHES;
+
+    if (0 == sweep->filling->count)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&sweep->lock);
+    sweep->unread[slot] = sweep->num_threads;
+    sweep->num_produced++;
+    pthread_cond_broadcast(&sweep->changed);
+    pthread_mutex_unlock(&sweep->lock);
+
+    next_filling(sweep);
+}
+
+
+/*
+ * Add each ingress block to the batch being filled.
+ */
+static void add_ingress(
+    void * const user_data,
+    const te_ingress_t * const ingress)
+{
+    sweep_t * const sweep = user_data;
+
+    sweep->filling->ingress[sweep->filling->count++] = *ingress;
+    sweep->num_blocks++;
+    if (BATCH_SIZE == sweep->filling->count)
+    {
+        publish(sweep);
+    }
+}
+
+
+/*
+ * Count the instructions retired (from the commit-log reader).
+ */
+static void count_instruction(
+    void * const user_data,
+    const te_address_t pc,
+    const uint32_t instruction)
+{
+    sweep_t * const sweep = user_data;
+
+    (void)pc;
+    (void)instruction;
+
+    sweep->num_instructions++;
+}
+
+
+/*
+ * The body of each worker thread: encode each batch in turn, with each
+ * of this worker's configurations, and then flush their encoders.
+ */
+static void * work(
+    void * const arg)
+{
+    const worker_t * const worker = arg;
+    sweep_t * const sweep = worker->sweep;
+    size_t n;
+    size_t c;
+    size_t i;
+    double start;
+
+    for (n = 0; ; n++)
+    {
+        const size_t slot = n % NUM_BATCHES;
+        const batch_t * const batch = &sweep->batches[slot];
+
+        pthread_mutex_lock(&sweep->lock);
+        while ( (n >= sweep->num_produced) && (!sweep->ended) )
+        {
+            pthread_cond_wait(&sweep->changed, &sweep->lock);
+        }
+        if (n >= sweep->num_produced)
+        {
+            pthread_mutex_unlock(&sweep->lock);
+            break;
+        }
+        pthread_mutex_unlock(&sweep->lock);
+
+        for (c = worker->first; c < sweep->num_configs; c += sweep->num_threads)
+        {
+            config_t * const config = &sweep->configs[c];
+
+            start = now(CLOCK_THREAD_CPUTIME_ID);
+            for (i = 0; i < batch->count; i++)
+            {
+                te_encode_ingress(&config->encoder, &batch->ingress[i]);
+            }
+            config->seconds += now(CLOCK_THREAD_CPUTIME_ID) - start;
+        }
+
+        pthread_mutex_lock(&sweep->lock);
+        if (0 == --sweep->unread[slot])
+        {
+            pthread_cond_broadcast(&sweep->changed);
+        }
+        pthread_mutex_unlock(&sweep->lock);
+    }
+
+    for (c = worker->first; c < sweep->num_configs; c += sweep->num_threads)
+    {
+        te_flush_trace_encoder(&sweep->configs[c].encoder);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Parse a comma-separated list of unsigned numbers, returning how many
+ * there are, or 0 if there are none, or too many.
+ */
+static unsigned parse_list(
+    const char * text,
+    unsigned long values[MAX_VALUES])
+{
+    unsigned count = 0;
+    char * end;
+
+    do
+    {
+        if (MAX_VALUES == count)
+        {
+            return 0;
+        }
+        values[count++] = strtoul(text, &end, 0);
+        if (end == text)
+        {
+            return 0;
+        }
+        text = end + 1;
+    } while (',' == *end);
+
+    return ('\0' == *end) ? count : 0;
+}
+
+
+static void usage(
+    const char * const program)
+{
+    fprintf(stderr,
+        "usage: %s [options] <log>...   (\"-\" for stdin)\n"
+        "   or: %s [options] --synthetic\n"
+        "  --implicit-return=L  implicit_return options (0,1)\n"
+        "  --return-stack=L     return_stack_size_p values (0)\n"
+        "  --call-counter=L     call_counter_size_p values (0)\n"
+        "  --max-resync=L       instructions between resyncs (0)\n"
+        "  --full-address=L     full_address options (0)\n"
+        "  --bpred=L            bpred_size_p values (0)\n"
+        "  --jtc=L              jump target cache sizes, as jtc_size_p (0)\n"
+        "  --tapered-map=L      tapered branch_map options (0)\n"
+        "  --threads=N          worker threads (number of CPUs)\n"
+        "  --header-bytes=N     encapsulation bytes per packet (1)\n"
+        "  --ips=F              instructions retired per second (1e9)\n"
+        "  --format=F           log format: spike, qemu or auto (auto)\n"
+        "  --xlen=N             32 or 64 (64)\n"
+        "  --instructions=N     synthetic instructions to retire\n"
+        "  --seed=N             synthetic pseudo-random seed\n"
+        "  (L is a comma-separated list of values)\n",
+        program, program);
+}
+
+
+int main(
+    int argc,
+    char * argv[])
+{
+    static const struct option options[] =
+    {
+        { "implicit-return",required_argument, NULL, 'I' },
+        { "return-stack",   required_argument, NULL, 'S' },
+        { "call-counter",   required_argument, NULL, 'C' },
+        { "max-resync",     required_argument, NULL, 'm' },
+        { "full-address",   required_argument, NULL, 'A' },
+        { "bpred",          required_argument, NULL, 'P' },
+        { "jtc",            required_argument, NULL, 'J' },
+        { "tapered-map",    required_argument, NULL, 'T' },
+        { "threads",        required_argument, NULL, 't' },
+        { "header-bytes",   required_argument, NULL, 'b' },
+        { "ips",            required_argument, NULL, 'i' },
+        { "format",         required_argument, NULL, 'F' },
+        { "xlen",           required_argument, NULL, 'x' },
+        { "synthetic",      no_argument,       NULL, 'y' },
+        { "instructions",   required_argument, NULL, 'n' },
+        { "seed",           required_argument, NULL, 's' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    unsigned long implicit_return[MAX_VALUES] = { 0, 1 };
+    unsigned long return_stack[MAX_VALUES] = { 0 };
+    unsigned long call_counter[MAX_VALUES] = { 0 };
+    unsigned long max_resync[MAX_VALUES] = { 0 };
+    unsigned long full_address[MAX_VALUES] = { 0 };
+    unsigned long bpred[MAX_VALUES] = { 0 };
+    unsigned long jtc[MAX_VALUES] = { 0 };
+    unsigned long tapered_map[MAX_VALUES] = { 0 };
+    unsigned num_implicit_return = 2;
+    unsigned num_return_stack = 1;
+    unsigned num_call_counter = 1;
+    unsigned num_max_resync = 1;
+    unsigned num_full_address = 1;
+    unsigned num_bpred = 1;
+    unsigned num_jtc = 1;
+    unsigned num_tapered_map = 1;
+    unsigned long header_bytes = 1;
+    double ips = 1e9;
+    bool synthetic = false;
+    te_generator_params_t generator_params;
+    te_commit_log_params_t log_params;
+    te_encoder_params_t params;
+    worker_t workers[MAX_THREADS];
+    sweep_t sweep;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double start, elapsed;
+    size_t c;
+    unsigned a, b, d, e, f, g, j, k;
+    unsigned t;
+    int option;
+    int i;
+
+    memset(&sweep, 0, sizeof(sweep));
+    sweep.num_threads = (cpus > 0) ? (unsigned)cpus : 1u;
+    te_generator_default_params(&generator_params);
+    te_commit_log_default_params(&log_params);
+
+    while (-1 != (option = getopt_long(argc, argv, "h", options, NULL)))
+    {
+        unsigned * count = NULL;
+
+        switch (option)
+        {
+            case 'I': count = &num_implicit_return; *count = parse_list(optarg, implicit_return); break;
+            case 'S': count = &num_return_stack; *count = parse_list(optarg, return_stack); break;
+            case 'C': count = &num_call_counter; *count = parse_list(optarg, call_counter); break;
+            case 'm': count = &num_max_resync; *count = parse_list(optarg, max_resync); break;
+            case 'A': count = &num_full_address; *count = parse_list(optarg, full_address); break;
+            case 'P': count = &num_bpred; *count = parse_list(optarg, bpred); break;
+            case 'J': count = &num_jtc; *count = parse_list(optarg, jtc); break;
+            case 'T': count = &num_tapered_map; *count = parse_list(optarg, tapered_map); break;
+            case 't': sweep.num_threads = strtoul(optarg, NULL, 0); break;
+            case 'b': header_bytes = strtoul(optarg, NULL, 0); break;
+            case 'i': ips = strtod(optarg, NULL); break;
+            case 'F':
+                log_params.format = (0 == strcmp(optarg, "spike")) ? TE_COMMIT_LOG_SPIKE :
+                                    (0 == strcmp(optarg, "qemu")) ? TE_COMMIT_LOG_QEMU :
+                                    TE_COMMIT_LOG_AUTO;
+                break;
+            case 'x': log_params.xlen = strtoul(optarg, NULL, 0); break;
+            case 'y': synthetic = true; break;
+            case 'n': generator_params.num_instructions = strtoul(optarg, NULL, 0); break;
+            case 's': generator_params.seed = strtoul(optarg, NULL, 0); break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        if ( (count) && (0 == *count) )
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (a = 0; a < num_return_stack; a++)
+    {
+        if ((1ul << return_stack[a]) > TE_ENCODER_MAX_RETURN_STACK)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (a = 0; a < num_bpred; a++)
+    {
+        if ((1ul << bpred[a]) > TE_ENCODER_MAX_BRANCH_PREDICTOR)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (a = 0; a < num_jtc; a++)
+    {
+        if ((1ul << jtc[a]) > TE_ENCODER_MAX_JUMP_TARGETS)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ( (synthetic == (optind < argc)) ||
+         ( (32 != log_params.xlen) && (64 != log_params.xlen) ) )
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* every combination of the parameter values */
+    sweep.num_configs = (size_t)num_implicit_return * num_return_stack *
+        num_call_counter * num_max_resync * num_full_address *
+        num_bpred * num_jtc * num_tapered_map;
+    sweep.configs = calloc(sweep.num_configs, sizeof(config_t));
+    assert(sweep.configs);
+
+    te_encoder_default_params(&params);
+    params.iaddress_width_p = synthetic ? 64 : log_params.xlen;
+    c = 0;
+    for (a = 0; a < num_implicit_return; a++)
+    for (b = 0; b < num_return_stack; b++)
+    for (d = 0; d < num_call_counter; d++)
+    for (e = 0; e < num_max_resync; e++)
+    for (f = 0; f < num_full_address; f++)
+    for (g = 0; g < num_bpred; g++)
+    for (j = 0; j < num_jtc; j++)
+    for (k = 0; k < num_tapered_map; k++)
+    {
+        params.implicit_return = (0 != implicit_return[a]);
+        params.return_stack_size_p = return_stack[b];
+        params.call_counter_size_p = call_counter[d];
+        params.max_resync = max_resync[e];
+        params.full_address = (0 != full_address[f]);
+        params.bpred_size_p = bpred[g];
+        params.jtc_size_p = jtc[j];
+        params.tapered_branch_map_p = (0 != tapered_map[k]);
+        te_open_trace_encoder(&sweep.configs[c++].encoder, &params,
+            discard_te_inst, discard_te_support, NULL);
+    }
+
+    if ( (0 == sweep.num_threads) || (sweep.num_threads > MAX_THREADS) )
+    {
+        sweep.num_threads = MAX_THREADS;
+    }
+    if (sweep.num_threads > sweep.num_configs)
+    {
+        sweep.num_threads = sweep.num_configs;
+    }
+
+    sweep.batches = malloc(NUM_BATCHES * sizeof(batch_t));
+    assert(sweep.batches);
+    pthread_mutex_init(&sweep.lock, NULL);
+    pthread_cond_init(&sweep.changed, NULL);
+    next_filling(&sweep);
+
+    start = now(CLOCK_MONOTONIC);
+    for (t = 0; t < sweep.num_threads; t++)
+    {
+        workers[t].sweep = &sweep;
+        workers[t].first = t;
+        if (0 != pthread_create(&workers[t].thread, NULL, work, &workers[t]))
+        {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* produce the shared stream, on this thread */
+    if (synthetic)
+    {
+        te_generator_t * const generator = te_generate_trace(&generator_params);
+
+        te_generator_present(generator, 1, add_ingress, &sweep);
+        sweep.num_instructions = generator->num_instructions;
+        te_free_generated_trace(generator);
+    }
+    else
+    {
+        te_commit_log_reader_t * const reader = te_open_commit_log_reader(NULL, &log_params, NULL);
+
+        te_set_commit_log_retire_handler(reader, count_instruction, &sweep);
+        te_set_commit_log_ingress_handler(reader, add_ingress, &sweep);
+        for (i = optind; i < argc; i++)
+        {
+            if (0 != te_read_commit_log(reader, argv[i]))
+            {
+                perror(argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        te_close_commit_log_reader(reader);
+        free(reader);
+    }
+    publish(&sweep);
+
+    pthread_mutex_lock(&sweep.lock);
+    sweep.ended = true;
+    pthread_cond_broadcast(&sweep.changed);
+    pthread_mutex_unlock(&sweep.lock);
+
+    for (t = 0; t < sweep.num_threads; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+    }
+    elapsed = now(CLOCK_MONOTONIC) - start;
+
+    printf("{\n");
+    printf("  \"instructions\": %llu,\n", sweep.num_instructions);
+    printf("  \"ingress_blocks\": %llu,\n", sweep.num_blocks);
+    printf("  \"threads\": %u,\n", sweep.num_threads);
+    printf("  \"seconds\": %.6f,\n", elapsed);
+    printf("  \"header_bytes\": %lu,\n", header_bytes);
+    printf("  \"instructions_per_second\": %g,\n", ips);
+    printf("  \"configs\": [\n");
+    for (c = 0; c < sweep.num_configs; c++)
+    {
+        const te_encoder_state_t * const encoder = &sweep.configs[c].encoder;
+        const unsigned long packets = encoder->num_te_inst + encoder->num_te_support;
+        const double bytes = (double)encoder->num_payload_bytes + (double)header_bytes * packets;
+        const double instructions = sweep.num_instructions ? (double)sweep.num_instructions : 1.0;
+
+        printf("    {\n");
+        printf("      \"implicit_return\": %d,\n", encoder->params.implicit_return);
+        printf("      \"return_stack_size_p\": %u,\n", encoder->params.return_stack_size_p);
+        printf("      \"call_counter_size_p\": %u,\n", encoder->params.call_counter_size_p);
+        printf("      \"max_resync\": %lu,\n", encoder->params.max_resync);
+        printf("      \"full_address\": %d,\n", encoder->params.full_address);
+        printf("      \"bpred_size_p\": %u,\n", encoder->params.bpred_size_p);
+        printf("      \"jtc_size_p\": %u,\n", encoder->params.jtc_size_p);
+        printf("      \"tapered_branch_map\": %d,\n", encoder->params.tapered_branch_map_p);
+        printf("      \"te_inst\": %lu,\n", encoder->num_te_inst);
+        printf("      \"te_inst_formats\": [%lu, %lu, %lu, %lu],\n",
+            encoder->num_format[0], encoder->num_format[1],
+            encoder->num_format[2], encoder->num_format[3]);
+        printf("      \"te_support\": %lu,\n", encoder->num_te_support);
+        printf("      \"implicit_returns\": %lu,\n", encoder->num_implicit_returns);
+        printf("      \"predicted_branches\": %lu,\n", encoder->num_predicted);
+        printf("      \"jump_target_hits\": %lu,\n", encoder->num_jump_target_hits);
+        printf("      \"payload_bytes\": %llu,\n", encoder->num_payload_bytes);
+        printf("      \"bits_per_instruction\": %.4f,\n", 8.0 * bytes / instructions);
+        printf("      \"packets_per_second\": %.0f,\n", (double)packets / instructions * ips);
+        printf("      \"bits_per_second\": %.0f,\n", 8.0 * bytes / instructions * ips);
+        printf("      \"encode_seconds\": %.6f\n", sweep.configs[c].seconds);
+        printf("    }%s\n", (c + 1u < sweep.num_configs) ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    pthread_cond_destroy(&sweep.changed);
+    pthread_mutex_destroy(&sweep.lock);
+    free(sweep.batches);
+    free(sweep.configs);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1086 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include "trace-generator.h"
+
+
+/*
+ * The address of the first instruction in the generated code image.
+ */
+#define CODE_BASE_ADDRESS   (0x80000000u)
+
+
+/*
+ * The (naturally aligned) addresses of the data transferred by the
+ * generated loads and stores are in a region of DATA_SIZE bytes
+ * (a power of 2), starting at this address.
+ */
+#define DATA_BASE_ADDRESS   (0x90000000u)
+#define DATA_SIZE           (0x10000u)
+
+
+/*
+ * The registers used by the generated code. None of the instructions
+ * preceding an uninferable jump is ever a lui or auipc, so none of the
+ * jumps can be mistaken by the decoder for a sequentially inferable jump.
+ */
+#define REG_ZERO    (0)
+#define REG_RA      (1)     /* return address */
+#define REG_CALL    (5)     /* target of indirect calls */
+#define REG_WORK    (6)     /* incremented by filler instructions */
+#define REG_JUMP    (7)     /* target of indirect jumps */
+#define REG_DATA    (8)     /* base address of loads & stores */
+#define REG_LOADED  (9)     /* destination of loads, source of stores */
+
+
+/*
+ * The ways in which a basic block may end.
+ */
+typedef enum
+{
+    BLOCK_FALL,             /* no control-flow, just falls through */
+    BLOCK_LOOP,             /* conditional branch back to itself */
+    BLOCK_SKIP,             /* conditional branch over the next block */
+    BLOCK_CALL,             /* jal ra (inferable call) */
+    BLOCK_CALL_INDIRECT,    /* jalr ra (uninferable call) */
+    BLOCK_JUMP_INDIRECT,    /* jalr x0 to the next block (uninferable) */
+    BLOCK_RETURN,           /* jalr x0, 0(ra) */
+    BLOCK_RESTART,          /* jalr x0 back to the start of "main" */
+} block_kind_t;
+
+
+/*
+ * A single basic block of the generated program.
+ */
+typedef struct te_generator_block_s
+{
+    te_address_t start;     /* address of first instruction */
+    unsigned length;        /* number of instructions (incl. the last) */
+    block_kind_t kind;      /* how the block ends */
+    unsigned callee;        /* function called (for calls) */
+} block_t;
+
+
+/*
+ * The state of the model of the data transfers and cycle counts, which
+ * are drawn from their own pseudo-random sequence, starting at the
+ * generator's "data_seed". Like the trace-decoder, this holds the last
+ * address and value transferred of each size, for the differences.
+ */
+typedef struct
+{
+    uint64_t state;
+    te_address_t last_address[TE_DATA_SIZES];
+    uint64_t last_value[TE_DATA_SIZES];
+} data_model_t;
+
+
+/*
+ * The "user-data" of encode_ingress().
+ */
+typedef struct
+{
+    te_generator_t * generator;
+    te_encoder_state_t * encoder;
+    data_model_t model;
+    unsigned long num_retired;      /* instructions presented so far */
+} encoding_t;
+
+
+/*
+ * Generate a pseudo-random 64-bit number (xorshift64*).
+ */
+static uint64_t random64(
+    uint64_t * const state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+
+/*
+ * Return true with probability "p".
+ */
+static bool chance(
+    uint64_t * const state,
+    const double p)
+{
+    return (double)(random64(state) >> 11) < p * (double)(1ull << 53);
+}
+
+
+/*
+ * Return a pseudo-random number in the range [1, 2*mean-1], whose mean is "mean".
+ */
+static unsigned around(
+    uint64_t * const state,
+    const unsigned mean)
+{
+    return (mean <= 1) ? 1 : 1u + (unsigned)(random64(state) % (2u * mean - 1u));
+}
+
+
+/*
+ * Encode RISC-V instructions of the few types that we generate.
+ */
+static uint32_t encode_i_type(
+    const unsigned opcode,
+    const unsigned rd,
+    const unsigned funct3,
+    const unsigned rs1,
+    const int32_t imm)
+{
+    return ((uint32_t)(imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t encode_s_type(
+    const unsigned funct3,
+    const unsigned rs1,
+    const unsigned rs2,
+    const int32_t imm)
+{
+    return ((uint32_t)((imm >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) |
+           (funct3 << 12) | ((uint32_t)(imm & 0x1f) << 7) | 0x23;
+}
+
+static uint32_t encode_b_type(
+    const unsigned funct3,
+    const unsigned rs1,
+    const unsigned rs2,
+    const int32_t offset)
+{
+    const uint32_t imm = (uint32_t)offset;
+
+    return (((imm >> 12) & 0x1) << 31) | (((imm >> 5) & 0x3f) << 25) |
+           (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+           (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 0x1) << 7) | 0x63;
+}
+
+static uint32_t encode_j_type(
+    const unsigned rd,
+    const int32_t offset)
+{
+    const uint32_t imm = (uint32_t)offset;
+
+    return (((imm >> 20) & 0x1) << 31) | (((imm >> 1) & 0x3ff) << 21) |
+           (((imm >> 11) & 0x1) << 20) | (((imm >> 12) & 0xff) << 12) |
+           (rd << 7) | 0x6f;
+}
+
+#define ADDI(rd, rs1, imm)      encode_i_type(0x13, (rd), 0, (rs1), (imm))
+#define JALR(rd, rs1)           encode_i_type(0x67, (rd), 0, (rs1), 0)
+#define LOAD(size, rd, rs1)     encode_i_type(0x03, (rd), (size), (rs1), 0)
+#define STORE(size, rs1, rs2)   encode_s_type((size), (rs1), (rs2), 0)
+#define BNE(rs1, rs2, offset)   encode_b_type(1, (rs1), (rs2), (offset))
+#define BEQ(rs1, rs2, offset)   encode_b_type(0, (rs1), (rs2), (offset))
+#define JAL(rd, offset)         encode_j_type((rd), (offset))
+
+
+/*
+ * Append a message to the generated messages, growing the array as required.
+ */
+static te_message_t * new_message(
+    te_generator_t * const generator,
+    const te_message_type_t type)
+{
+    te_message_t * message;
+
+    assert(generator);
+
+    if (generator->num_messages == generator->max_messages)
+    {
+        generator->max_messages = generator->max_messages ? 2 * generator->max_messages : 1024;
+        generator->messages = realloc(generator->messages,
+            generator->max_messages * sizeof(te_message_t));
+        assert(generator->messages);
+    }
+
+    message = &generator->messages[generator->num_messages++];
+    memset(message, 0, sizeof(te_message_t));
+    message->type = type;
+    switch (type)
+    {
+        case TE_MESSAGE_TE_INST:
+            generator->num_te_inst++;
+            break;
+        case TE_MESSAGE_TE_DATA:
+            generator->num_te_data++;
+            break;
+        case TE_MESSAGE_TE_CYCLES:
+            generator->num_te_cycles++;
+            break;
+        default:
+            break;
+    }
+
+    return message;
+}
+
+
+/*
+ * Choose how each block ends, and lay out all the blocks in memory.
+ * Returns the array of blocks, which is indexed by:
+ *      (function number * blocks_per_function) + block number.
+ */
+static block_t * build_program(
+    const te_generator_params_t * const params,
+    uint64_t * const state,
+    size_t * const num_code)
+{
+    const unsigned num_blocks = params->num_functions * params->blocks_per_function;
+    const unsigned per_level = (params->num_functions + params->call_depth - 1u) / params->call_depth;
+    block_t * const blocks = calloc(num_blocks, sizeof(block_t));
+    te_address_t address = CODE_BASE_ADDRESS;
+    unsigned f, b;
+
+    assert(blocks);
+
+    for (f = 0; f < params->num_functions; f++)
+    {
+        const unsigned level = (0 == f) ? 0 : 1u + (f - 1u) / per_level;
+        const unsigned first_callee = 1u + level * per_level;
+        const bool leaf = (first_callee >= params->num_functions);
+
+        for (b = 0; b < params->blocks_per_function; b++)
+        {
+            block_t * const block = &blocks[f * params->blocks_per_function + b];
+            const bool final = (b + 1u == params->blocks_per_function);
+
+            block->start = address;
+            block->length = around(state, params->block_length);
+            block->kind = BLOCK_FALL;
+
+            if (final)
+            {
+                block->kind = (0 == f) ? BLOCK_RESTART : BLOCK_RETURN;
+            }
+            else if (chance(state, params->branch_density))
+            {
+                block->kind = ( (chance(state, params->loop_ratio)) ||
+                                (b + 2u >= params->blocks_per_function) ) ?
+                                BLOCK_LOOP : BLOCK_SKIP;
+            }
+            else if ( (!leaf) && (chance(state, params->call_ratio)) )
+            {
+                const unsigned last_callee = first_callee + per_level - 1u;
+                const unsigned range = ((last_callee < params->num_functions) ?
+                                         last_callee : params->num_functions - 1u) -
+                                       first_callee + 1u;
+                block->kind = chance(state, params->indirect_ratio) ?
+                              BLOCK_CALL_INDIRECT : BLOCK_CALL;
+                block->callee = first_callee + (unsigned)(random64(state) % range);
+            }
+            else if (chance(state, params->indirect_ratio))
+            {
+                block->kind = BLOCK_JUMP_INDIRECT;
+            }
+
+            if ( (BLOCK_FALL != block->kind) && (1u == block->length) )
+            {
+                block->length = 2;  /* at least one filler, then the terminator */
+            }
+
+            address += 4u * block->length;
+        }
+    }
+
+    *num_code = (size_t)(address - CODE_BASE_ADDRESS) / 4u;
+
+    return blocks;
+}
+
+
+/*
+ * Write the instructions for all the blocks into the code image. A
+ * fraction "data_ratio" of the filler instructions are loads or stores,
+ * chosen using "state", which is not used to build the control-flow.
+ */
+static void build_code(
+    const te_generator_params_t * const params,
+    const block_t * const blocks,
+    uint32_t * const code,
+    uint64_t * const state)
+{
+    const unsigned num_blocks = params->num_functions * params->blocks_per_function;
+    unsigned i, j;
+
+    for (i = 0; i < num_blocks; i++)
+    {
+        const block_t * const block = &blocks[i];
+        const size_t first = (size_t)(block->start - CODE_BASE_ADDRESS) / 4u;
+        const size_t last = first + block->length - 1u;
+        const te_address_t last_address = block->start + 4u * (block->length - 1u);
+
+        for (j = 0; j < block->length; j++)
+        {
+            code[first + j] = ADDI(REG_WORK, REG_WORK, 1);
+            if ( (params->data_ratio > 0.0) && (chance(state, params->data_ratio)) )
+            {
+                const uint64_t r = random64(state);
+                const unsigned size = (unsigned)(r & 3u);
+
+                code[first + j] = (r & 4u) ? STORE(size, REG_DATA, REG_LOADED) :
+                                             LOAD(size, REG_LOADED, REG_DATA);
+            }
+        }
+
+        switch (block->kind)
+        {
+            case BLOCK_FALL:
+                break;
+            case BLOCK_LOOP:
+                code[last] = BNE(REG_WORK, REG_ZERO, (int32_t)(block->start - last_address));
+                break;
+            case BLOCK_SKIP:
+                code[last] = BEQ(REG_WORK, REG_JUMP, (int32_t)(blocks[i + 2].start - last_address));
+                break;
+            case BLOCK_CALL:
+            {
+                const block_t * const callee = &blocks[block->callee * params->blocks_per_function];
+                code[last] = JAL(REG_RA, (int32_t)(callee->start - last_address));
+                break;
+            }
+            case BLOCK_CALL_INDIRECT:
+                code[last] = JALR(REG_RA, REG_CALL);
+                break;
+            case BLOCK_JUMP_INDIRECT:
+            case BLOCK_RESTART:
+                code[last] = JALR(REG_ZERO, REG_JUMP);
+                break;
+            case BLOCK_RETURN:
+                code[last] = JALR(REG_ZERO, REG_RA);
+                break;
+        }
+    }
+}
+
+
+/*
+ * Append a block to the execution path, growing the array as required.
+ */
+static void append_path(
+    te_generator_t * const generator,
+    const unsigned block)
+{
+    assert(generator);
+
+    if (generator->num_path == generator->max_path)
+    {
+        generator->max_path = generator->max_path ? 2 * generator->max_path : 1024;
+        generator->path = realloc(generator->path,
+            generator->max_path * sizeof(uint32_t));
+        assert(generator->path);
+    }
+
+    generator->path[generator->num_path++] = block;
+}
+
+
+/*
+ * "Execute" the generated program, until at least the requested number
+ * of instructions have retired, recording the sequence of blocks executed.
+ * As the path is terminated by the block that would have been executed
+ * next, the outcome of the final instruction of each block is implied by
+ * the following entry in the path.
+ */
+static void execute_program(
+    te_generator_t * const generator,
+    const te_generator_params_t * const params,
+    const block_t * const blocks,
+    uint64_t * const state)
+{
+    const unsigned B = params->blocks_per_function;
+    unsigned * const stack = calloc(params->call_depth + 1u, sizeof(unsigned));
+    unsigned depth = 0;
+    unsigned current = 0;       /* index of the current block */
+    unsigned iterations = 0;    /* remaining iterations of a loop */
+
+    assert(stack);
+
+    while (generator->num_instructions < params->num_instructions)
+    {
+        const block_t * const block = &blocks[current];
+        unsigned next = current + 1u;
+
+        append_path(generator, current);
+        generator->num_instructions += block->length;
+
+        switch (block->kind)
+        {
+            case BLOCK_FALL:
+                break;
+            case BLOCK_LOOP:
+                if (0 == iterations)
+                {
+                    iterations = around(state, params->loop_length);
+                }
+                next = (0 != --iterations) ? current : current + 1u;
+                generator->num_branches++;
+                break;
+            case BLOCK_SKIP:
+                next = chance(state, 0.5) ? current + 2u : current + 1u;
+                generator->num_branches++;
+                break;
+            case BLOCK_CALL_INDIRECT:
+                generator->num_updiscons++;
+                /* FALLTHROUGH */
+            case BLOCK_CALL:
+                assert(depth < params->call_depth);
+                stack[depth++] = current + 1u;
+                next = block->callee * B;
+                generator->num_calls++;
+                break;
+            case BLOCK_JUMP_INDIRECT:
+                generator->num_updiscons++;
+                break;
+            case BLOCK_RETURN:
+                assert(depth);
+                next = stack[--depth];
+                generator->num_updiscons++;
+                break;
+            case BLOCK_RESTART:
+                next = 0;
+                generator->num_updiscons++;
+                break;
+        }
+
+        current = next;
+    }
+
+    append_path(generator, current);    /* terminator, not executed */
+    generator->num_path--;
+
+    /* the outcome of a final branch is not traced, as nothing follows it */
+    if (generator->num_path)
+    {
+        const block_kind_t kind = blocks[generator->path[generator->num_path - 1u]].kind;
+        generator->final_branch = (BLOCK_LOOP == kind) || (BLOCK_SKIP == kind);
+    }
+
+    free(stack);
+}
+
+
+/*
+ * Functions passed to the trace-encoder, to collect the messages.
+ */
+static void collect_te_inst(
+    void * const user_data,
+    const te_inst_t * const te_inst)
+{
+    new_message(user_data, TE_MESSAGE_TE_INST)->te_inst = *te_inst;
+}
+
+static void collect_te_support(
+    void * const user_data,
+    const te_support_t * const te_support)
+{
+    new_message(user_data, TE_MESSAGE_TE_SUPPORT)->te_support = *te_support;
+}
+
+
+/*
+ * Model the retirement of the instruction at "pc", returning true if it
+ * is a load or store, in which case "transfer" is set to its (absolute)
+ * address and value, and "te_data" to how that is traced. Its cycle count
+ * is always set. Every instruction advances the pseudo-random sequence in
+ * the same way, whether or not it is "traced" (i.e. its te_data is to be
+ * processed by the trace-decoder), but only traced transfers update the
+ * last address and value, as in the trace-decoder.
+ */
+static bool model_retirement(
+    const te_generator_t * const generator,
+    data_model_t * const model,
+    const te_address_t pc,
+    const bool traced,
+    unsigned * const cycles,
+    te_data_t * const transfer,
+    te_data_t * const te_data)
+{
+    const uint32_t instruction = generator->code[(pc - generator->base) / 4u];
+    const unsigned opcode = instruction & 0x7fu;
+    const unsigned size = (instruction >> 12) & 3u;
+    const uint64_t mask = (3u == size) ? ~(uint64_t)0 :
+                                         ((uint64_t)1 << (8u << size)) - 1u;
+    uint64_t r = random64(&model->state);
+
+    /* mostly retire in 0..3 cycles, but loads sometimes miss the cache */
+    *cycles = (unsigned)(r & 3u);
+    if ( (0x03u == opcode) && (0 == ((r >> 2) & 7u)) )
+    {
+        *cycles += 8u + (unsigned)((r >> 5) & 63u);
+    }
+
+    if ( (0x03u != opcode) && (0x23u != opcode) )
+    {
+        return false;
+    }
+
+    memset(transfer, 0, sizeof(te_data_t));
+    transfer->size = size;
+    transfer->store = (0x23u == opcode);
+    transfer->address = DATA_BASE_ADDRESS +
+        ((random64(&model->state) & (DATA_SIZE - 1u)) & ~(((te_address_t)1 << size) - 1u));
+    transfer->value = random64(&model->state) & mask;
+    r = random64(&model->state);
+    transfer->has_value = (0 != (r & 3u));      /* 3 out of 4 have values */
+
+    *te_data = *transfer;
+    te_data->diff_address = (0 != (r & 4u));
+    te_data->diff_value = (transfer->has_value) && (0 != (r & 8u));
+    if (!transfer->has_value)
+    {
+        transfer->value = 0;
+        te_data->value = 0;
+    }
+    if (!traced)
+    {
+        return true;
+    }
+
+    if (te_data->diff_address)
+    {
+        te_data->address = transfer->address - model->last_address[size];
+    }
+    model->last_address[size] = transfer->address;
+    if (transfer->has_value)
+    {
+        if (te_data->diff_value)
+        {
+            te_data->value = transfer->value - model->last_value[size];
+        }
+        model->last_value[size] = transfer->value;
+    }
+
+    return true;
+}
+
+
+/*
+ * Return the itype of the final instruction in a block, given the
+ * index of the block executed after it.
+ */
+static te_itype_t block_itype(
+    const block_t * const block,
+    const unsigned current,
+    const unsigned next)
+{
+    switch (block->kind)
+    {
+        case BLOCK_LOOP:
+            return (next == current) ? TE_ITYPE_TAKEN_BRANCH : TE_ITYPE_NONTAKEN_BRANCH;
+        case BLOCK_SKIP:
+            return (next == current + 2u) ? TE_ITYPE_TAKEN_BRANCH : TE_ITYPE_NONTAKEN_BRANCH;
+        case BLOCK_CALL:
+            return TE_ITYPE_INFERABLE_CALL;
+        case BLOCK_CALL_INDIRECT:
+            return TE_ITYPE_UNINFERABLE_CALL;
+        case BLOCK_JUMP_INDIRECT:
+        case BLOCK_RESTART:
+            return TE_ITYPE_UNINFERABLE_TAIL_CALL;     /* jalr x0, 0(x7) */
+        case BLOCK_RETURN:
+            return TE_ITYPE_UNINFERABLE_RETURN;
+        default:
+            return TE_ITYPE_NONE;
+    }
+}
+
+
+/*
+ * Present the execution path to the encoder's ingress port as it would
+ * be by a core retiring up to "retires" instructions per cycle, but no
+ * more than one taken branch (or other discontinuity) per cycle.
+ */
+static void present_blocks(
+    const te_generator_t * const generator,
+    const te_ingress_handler_t handler,
+    void * const user_data,
+    te_ingress_t * const ingress,
+    const unsigned retires)
+{
+    te_itype_t itype = TE_ITYPE_NONE;
+    unsigned n = 0;
+    size_t p;
+    unsigned j;
+
+    assert(retires <= 32);  /* half-word masks are 64 bits */
+
+    for (p = 0; p < generator->num_path; p++)
+    {
+        const unsigned current = generator->path[p];
+        const block_t * const block = &generator->blocks[current];
+
+        for (j = 0; j < block->length; j++)
+        {
+            itype = (j + 1u < block->length) ? TE_ITYPE_NONE :
+                    block_itype(block, current, generator->path[p + 1u]);
+            if (0 == n)
+            {
+                ingress->iaddr = block->start + 4u * j;
+                ingress->ntkn = 0;
+                ingress->ntkn_mask = 0;
+            }
+            if (TE_ITYPE_NONTAKEN_BRANCH == itype)
+            {
+                ingress->ntkn++;
+                ingress->ntkn_mask |= (uint64_t)1 << (2u * n);
+            }
+            n++;
+
+            if ( (retires == n) ||
+                 ( (TE_ITYPE_NONE != itype) && (TE_ITYPE_NONTAKEN_BRANCH != itype) ) )
+            {
+                ingress->iretire = 2u * n;
+                ingress->itype = itype;
+                handler(user_data, ingress);
+                n = 0;
+            }
+        }
+    }
+
+    if (n)
+    {
+        ingress->iretire = 2u * n;
+        ingress->itype = itype;
+        handler(user_data, ingress);
+    }
+}
+
+
+/*
+ * Append the te_cycles and te_data messages (as enabled) for the next
+ * instruction retired, at "pc", if it is "traced".
+ */
+static void emit_retirement(
+    encoding_t * const encoding,
+    const te_address_t pc,
+    const bool traced)
+{
+    te_generator_t * const generator = encoding->generator;
+    unsigned cycles;
+    te_data_t transfer;
+    te_data_t te_data;
+    const bool load_store = model_retirement(generator, &encoding->model,
+        pc, traced, &cycles, &transfer, &te_data);
+
+    encoding->num_retired++;
+    if (!traced)
+    {
+        generator->num_untraced++;
+        return;
+    }
+    if (generator->cycle_counts)
+    {
+        new_message(generator, TE_MESSAGE_TE_CYCLES)->te_cycles.cycles = cycles;
+    }
+    if (load_store)
+    {
+        new_message(generator, TE_MESSAGE_TE_DATA)->te_data = te_data;
+    }
+}
+
+
+/*
+ * Pass each ingress block on to the trace-encoder. The te_cycles and
+ * te_data messages for its instructions (which are sequential) must be
+ * received before the te_inst message which lets the trace-decoder
+ * reconstruct them, so they come first. But they are discarded until the
+ * first te_inst, so until then they come afterwards, and nothing is traced
+ * for the first instruction, which that te_inst reconstructs by itself.
+ */
+static void encode_ingress(
+    void * const user_data,
+    const te_ingress_t * const ingress)
+{
+    encoding_t * const encoding = user_data;
+    te_generator_t * const generator = encoding->generator;
+    /* iretire is in half-words, or 1 when retiring one at a time */
+    const unsigned n = (ingress->iretire + 1u) / 2u;
+    const bool synchronized = (0 != generator->num_te_inst);
+    unsigned i;
+
+    if ( (!generator->data_transfers) && (!generator->cycle_counts) )
+    {
+        te_encode_ingress(encoding->encoder, ingress);
+        return;
+    }
+
+    if (synchronized)
+    {
+        for (i = 0; i < n; i++)
+        {
+            emit_retirement(encoding, ingress->iaddr + 4u * i, true);
+        }
+    }
+    te_encode_ingress(encoding->encoder, ingress);
+    if (!synchronized)
+    {
+        for (i = 0; i < n; i++)
+        {
+            emit_retirement(encoding, ingress->iaddr + 4u * i,
+                (0 != generator->num_te_inst) && (0 != encoding->num_retired));
+        }
+    }
+}
+
+
+/*
+ * Fill in a reasonable set of default parameters, broadly representative
+ * of compiled embedded code: short basic blocks, about half of which end
+ * in a branch, with a few calls, and very few uninferable jumps.
+ */
+extern void te_generator_default_params(
+    te_generator_params_t * const params)
+{
+    assert(params);
+
+    params->num_instructions = 10000000;
+    params->num_functions = 256;
+    params->blocks_per_function = 16;
+    params->block_length = 5;
+    params->branch_density = 0.5;
+    params->loop_ratio = 0.3;
+    params->loop_length = 8;
+    params->call_ratio = 0.15;
+    params->indirect_ratio = 0.1;
+    params->call_depth = 8;
+    params->seed = 1;
+    params->data_ratio = 0.0;
+    params->cycle_counts = false;
+}
+
+
+/*
+ * Generate a code image, and the trace of its execution, using the
+ * given control-flow model parameters. The same parameters (including
+ * the seed) always generate exactly the same code image and trace.
+ * The result should be released by calling te_free_generated_trace().
+ */
+extern te_generator_t * te_generate_trace(
+    const te_generator_params_t * const params)
+{
+    te_generator_t * const generator = calloc(1, sizeof(te_generator_t));
+    te_encoder_params_t encoder_params;
+    uint64_t state;
+    uint64_t data_state;
+    block_t * blocks;
+
+    assert(params);
+    assert(generator);
+    assert(params->num_functions >= 1);
+    assert(params->blocks_per_function >= 2);
+    assert(params->call_depth >= 1);
+
+    /* scramble the seed (splitmix64), as small seeds are poor for xorshift */
+    state = params->seed + 0x9e3779b97f4a7c15ull;
+    state = (state ^ (state >> 30)) * 0xbf58476d1ce4e5b9ull;
+    state = (state ^ (state >> 27)) * 0x94d049bb133111ebull;
+    state ^= state >> 31;
+    state = state ? state : 1;  /* must not be zero */
+
+    /* the data has its own sequence, so the control-flow is unaffected */
+    data_state = state ^ 0x6a09e667f3bcc909ull;
+    data_state = data_state ? data_state : 1;
+
+    blocks = build_program(params, &state, &generator->num_code);
+
+    generator->base = CODE_BASE_ADDRESS;
+    generator->code = calloc(generator->num_code, sizeof(uint32_t));
+    assert(generator->code);
+    build_code(params, blocks, generator->code, &data_state);
+    generator->data_seed = data_state;
+    generator->data_transfers = (params->data_ratio > 0.0);
+    generator->cycle_counts = params->cycle_counts;
+
+    generator->blocks = blocks;
+    execute_program(generator, params, blocks, &state);
+
+    te_encoder_default_params(&encoder_params);
+    te_generator_encode(generator, &encoder_params);
+
+    return generator;
+}
+
+
+/*
+ * (Re-)encode the execution of the generated program, using the reference
+ * trace-encoder with the given parameters, replacing any previous messages.
+ * Each instruction retired is presented to the encoder's ingress port (in
+ * blocks, if "retires_p" is more than 1), and the encoder is flushed at the
+ * end, so the trace ends with a te_support. The te_cycles and te_data
+ * messages (if any) are interleaved with the others (see encode_ingress).
+ */
+extern void te_generator_encode(
+    te_generator_t * const generator,
+    const te_encoder_params_t * const encoder_params)
+{
+    encoding_t encoding;
+
+    assert(generator);
+    assert(encoder_params);
+
+    generator->num_messages = 0;
+    generator->num_te_inst = 0;
+    generator->num_te_data = 0;
+    generator->num_te_cycles = 0;
+    generator->num_untraced = 0;
+
+    memset(&encoding, 0, sizeof(encoding));
+    encoding.generator = generator;
+    encoding.model.state = generator->data_seed;
+    encoding.encoder = te_open_trace_encoder(NULL, encoder_params,
+        collect_te_inst, collect_te_support, generator);
+
+    te_generator_present(generator, encoder_params->retires_p, encode_ingress, &encoding);
+    te_flush_trace_encoder(encoding.encoder);
+
+    free(encoding.encoder);
+}
+
+
+/*
+ * Present the execution of the generated program, as it would appear on
+ * the encoder's ingress port, to "handler", one block at a time (each of
+ * up to "retires" instructions). The ingress block passed is only valid
+ * for the duration of the call.
+ */
+extern void te_generator_present(
+    const te_generator_t * const generator,
+    const unsigned retires,
+    const te_ingress_handler_t handler,
+    void * const user_data)
+{
+    te_ingress_t ingress;
+    size_t p;
+    unsigned j;
+
+    assert(generator);
+    assert(handler);
+
+    memset(&ingress, 0, sizeof(ingress));
+    ingress.iretire = 1;
+    ingress.ilastsize = 1;      /* all instructions are 32-bits */
+    ingress.priv = 3;           /* machine mode */
+    ingress.qualified = true;
+
+    if (retires > 1)
+    {
+        present_blocks(generator, handler, user_data, &ingress, retires);
+    }
+    else
+    {
+        for (p = 0; p < generator->num_path; p++)
+        {
+            const unsigned current = generator->path[p];
+            const block_t * const block = &generator->blocks[current];
+
+            ingress.itype = TE_ITYPE_NONE;
+            for (j = 0; j + 1u < block->length; j++)
+            {
+                ingress.iaddr = block->start + 4u * j;
+                handler(user_data, &ingress);
+            }
+            ingress.iaddr = block->start + 4u * j;
+            ingress.itype = block_itype(block, current, generator->path[p + 1u]);
+            handler(user_data, &ingress);
+        }
+    }
+}
+
+
+/*
+ * Replay the execution of the generated program, calling "retire" with
+ * the address of each instruction retired, in order. This is exactly
+ * the sequence of PCs that the trace-decoder should reconstruct.
+ */
+extern void te_generator_replay(
+    const te_generator_t * const generator,
+    const te_generator_retire_t retire,
+    void * const user_data)
+{
+    size_t p;
+    unsigned j;
+
+    assert(generator);
+    assert(retire);
+
+    for (p = 0; p < generator->num_path; p++)
+    {
+        const block_t * const block = &generator->blocks[generator->path[p]];
+
+        for (j = 0; j < block->length; j++)
+        {
+            retire(user_data, block->start + 4u * j);
+        }
+    }
+}
+
+
+/*
+ * Replay the execution of the generated program, as te_generator_replay(),
+ * but also passing "retire" the cycle count and data transfer modelled for
+ * each instruction retired. These are exactly what the trace-decoder should
+ * attribute to each PC, from the last messages encoded.
+ */
+extern void te_generator_replay_data(
+    const te_generator_t * const generator,
+    const te_generator_retire_data_t retire,
+    void * const user_data)
+{
+    data_model_t model;
+    unsigned long num_retired = 0;
+    unsigned cycles;
+    te_data_t transfer;
+    te_data_t te_data;
+    size_t p;
+    unsigned j;
+
+    assert(generator);
+    assert(retire);
+
+    memset(&model, 0, sizeof(model));
+    model.state = generator->data_seed;
+
+    for (p = 0; p < generator->num_path; p++)
+    {
+        const block_t * const block = &generator->blocks[generator->path[p]];
+
+        for (j = 0; j < block->length; j++)
+        {
+            const te_address_t pc = block->start + 4u * j;
+            const bool traced = (num_retired++ >= generator->num_untraced);
+            const bool load_store = model_retirement(generator, &model,
+                pc, traced, &cycles, &transfer, &te_data);
+
+            retire(user_data, pc,
+                ( (traced) && (generator->cycle_counts) ) ? cycles : 0,
+                ( (traced) && (load_store) ) ? &transfer : NULL);
+        }
+    }
+}
+
+
+/*
+ * Generate the fast profiling packets for the execution of the generated
+ * program, replacing any previous ones. There is a packet for each call and
+ * return whose destination was executed, both with their source address.
+ * So the call-graph edges decoded from them are exactly those of the
+ * call-tree reconstructed from the te_inst messages.
+ */
+extern void te_generator_fast_profile(
+    te_generator_t * const generator)
+{
+    size_t p;
+
+    assert(generator);
+
+    generator->num_fast_packets = 0;
+
+    for (p = 0; p + 1u < generator->num_path; p++)
+    {
+        const block_t * const block = &generator->blocks[generator->path[p]];
+        const block_t * const next = &generator->blocks[generator->path[p + 1u]];
+        te_fast_profile_t * packet;
+
+        if ( (BLOCK_CALL != block->kind) &&
+             (BLOCK_CALL_INDIRECT != block->kind) &&
+             (BLOCK_RETURN != block->kind) )
+        {
+            continue;
+        }
+
+        if (generator->num_fast_packets == generator->max_fast_packets)
+        {
+            generator->max_fast_packets = generator->max_fast_packets ?
+                2 * generator->max_fast_packets : 1024;
+            generator->fast_packets = realloc(generator->fast_packets,
+                generator->max_fast_packets * sizeof(te_fast_profile_t));
+            assert(generator->fast_packets);
+        }
+
+        packet = &generator->fast_packets[generator->num_fast_packets++];
+        packet->event = (BLOCK_RETURN == block->kind) ?
+                        TE_FAST_PROFILE_RETURN : TE_FAST_PROFILE_CALL;
+        packet->destination = next->start;
+        packet->source = block->start + 4u * (block->length - 1u);
+        packet->has_source = true;
+    }
+}
+
+
+/*
+ * Release everything allocated by te_generate_trace().
+ */
+extern void te_free_generated_trace(
+    te_generator_t * const generator)
+{
+    assert(generator);
+
+    free((void *)generator->blocks);
+    free(generator->path);
+    free(generator->code);
+    free(generator->messages);
+    free(generator->fast_packets);
+    free(generator);
+}
+
+
+/*
+ * Retrieve the instruction at "address" from the generated code image,
+ * returning its length, or 0 if "address" is outside the code image.
+ * Suitable for calling from the user's te_get_instruction().
+ */
+extern unsigned te_generator_get_instruction(
+    const te_generator_t * const generator,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const size_t index = (size_t)(address - generator->base) / 4u;
+
+    assert(generator);
+    assert(instruction);
+
+    if ( (address < generator->base) ||
+         (index >= generator->num_code) ||
+         (address & 3u) )
+    {
+        return 0;
+    }
+
+    *instruction = generator->code[index];
+
+    return 4;
+}
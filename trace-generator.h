@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2019 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_TRACE_GENERATOR_H
+#define TE_TRACE_GENERATOR_H
+
+
+/*
+ * A generator of synthetic, but valid, trace. It builds a random program
+ * (a code image of real RV64 instructions) from a parametric model of its
+ * control-flow, "executes" it, and encodes the resulting sequence of
+ * retired instructions as te_inst and te_support messages, using the
+ * reference trace-encoder. Optionally, some of the instructions are loads
+ * and stores, each retirement of which also emits a te_data message, and
+ * every retirement may also emit a te_cycles message. Together, the code
+ * image and messages can be fed directly into the trace-decoder, for
+ * example to measure its throughput (see decoder-benchmark.c). The same
+ * execution may also be "traced" in the fast profiling mode, as just its
+ * calls and returns (see decoder-fast-profile.h).
+ */
+#include "decoder-algorithm-public.h"
+#include "decoder-fast-profile.h"
+#include "encoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * The parameters of the control-flow model.
+ *
+ * The program consists of "num_functions" functions, each a sequence of
+ * "blocks_per_function" basic blocks, with the functions arranged in
+ * "call_depth" levels: functions only call functions in the next level
+ * down, so the call-stack never exceeds "call_depth" frames. The first
+ * function ("main") loops forever, and execution stops after a total of
+ * "num_instructions" instructions have retired.
+ *
+ * A fraction ("data_ratio") of the instructions which do not end a block
+ * are loads or stores, of 1, 2, 4 or 8 bytes. The addresses and values
+ * they transfer, and the cycle counts (if "cycle_counts"), are drawn from
+ * a separate pseudo-random sequence, so the control-flow is the same
+ * whatever these are.
+ */
+typedef struct
+{
+    unsigned long num_instructions; /* number of instructions to retire */
+    unsigned num_functions;         /* number of functions in the program */
+    unsigned blocks_per_function;   /* number of basic blocks per function */
+    unsigned block_length;          /* mean number of instructions per block */
+    double   branch_density;        /* fraction of blocks ending in a branch */
+    double   loop_ratio;            /* fraction of branches that are loops */
+    unsigned loop_length;           /* mean number of loop iterations */
+    double   call_ratio;            /* fraction of blocks ending in a call */
+    double   indirect_ratio;        /* fraction of calls/jumps uninferable */
+    unsigned call_depth;            /* number of levels of functions */
+    unsigned long seed;             /* for the pseudo-random numbers */
+    double   data_ratio;            /* fraction of other instructions that are loads/stores */
+    bool     cycle_counts;          /* emit a te_cycles for each retirement */
+} te_generator_params_t;
+
+
+/*
+ * The types of messages that are generated.
+ */
+typedef enum
+{
+    TE_MESSAGE_TE_INST = 0,
+    TE_MESSAGE_TE_SUPPORT = 1,
+    TE_MESSAGE_TE_DATA = 2,
+    TE_MESSAGE_TE_CYCLES = 3,
+} te_message_type_t;
+
+
+/*
+ * A single generated message.
+ * Only the member selected by "type" is valid.
+ */
+typedef struct
+{
+    te_message_type_t type;
+    te_inst_t    te_inst;
+    te_support_t te_support;
+    te_data_t    te_data;
+    te_cycles_t  te_cycles;
+} te_message_t;
+
+
+/*
+ * Type of function called by te_generator_replay() for each instruction
+ * retired, in order.
+ */
+typedef void (*te_generator_retire_t)(
+    void * const user_data,
+    const te_address_t pc);
+
+
+/*
+ * Type of function called by te_generator_replay_data() for each
+ * instruction retired, in order, with its inter-instruction cycle count
+ * (0 unless "cycle_counts"), and its data transfer, with an absolute
+ * address and value (or NULL, if it is not a load or store). Neither is
+ * traced for the first "num_untraced" instructions, so these are passed
+ * 0 and NULL.
+ */
+typedef void (*te_generator_retire_data_t)(
+    void * const user_data,
+    const te_address_t pc,
+    const unsigned cycles,
+    const te_data_t * const transfer);
+
+
+/*
+ * Everything that has been generated.
+ */
+typedef struct
+{
+    /* the code image, of 32-bit instructions */
+    te_address_t base;              /* address of code[0] */
+    uint32_t * code;
+    size_t num_code;                /* number of instructions in code[] */
+
+    /* the basic blocks, and the sequence in which they were executed */
+    const struct te_generator_block_s * blocks;
+    uint32_t * path;                /* block indices (plus one more) */
+    size_t num_path;                /* number of blocks executed */
+    size_t max_path;                /* allocated size of path[] */
+
+    /* the encoded trace messages */
+    te_message_t * messages;
+    size_t num_messages;
+    size_t max_messages;            /* allocated size of messages[] */
+    size_t num_te_inst;             /* number of te_inst messages */
+    size_t num_te_data;             /* number of te_data messages */
+    size_t num_te_cycles;           /* number of te_cycles messages */
+    unsigned long num_untraced;     /* retired before the first te_inst */
+
+    /* the fast profiling packets (see te_generator_fast_profile) */
+    te_fast_profile_t * fast_packets;
+    size_t num_fast_packets;
+    size_t max_fast_packets;        /* allocated size of fast_packets[] */
+
+    /* the model of the data transfers and cycle counts */
+    uint64_t data_seed;             /* start of their pseudo-random sequence */
+    bool data_transfers;            /* some instructions are loads/stores */
+    bool cycle_counts;              /* see te_generator_params_t */
+
+    /* what was actually executed */
+    unsigned long num_instructions; /* number of instructions retired */
+    unsigned long num_branches;     /* number of branches retired */
+    bool final_branch;              /* last one retired is a branch */
+    unsigned long num_calls;        /* number of calls retired */
+    unsigned long num_updiscons;    /* number of uninferable discontinuities */
+} te_generator_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern void te_generator_default_params(
+    te_generator_params_t * const params);
+
+extern te_generator_t * te_generate_trace(
+    const te_generator_params_t * const params);
+
+extern void te_generator_encode(
+    te_generator_t * const generator,
+    const te_encoder_params_t * const encoder_params);
+
+extern void te_generator_present(
+    const te_generator_t * const generator,
+    const unsigned retires,
+    const te_ingress_handler_t handler,
+    void * const user_data);
+
+extern void te_generator_replay(
+    const te_generator_t * const generator,
+    const te_generator_retire_t retire,
+    void * const user_data);
+
+extern void te_generator_replay_data(
+    const te_generator_t * const generator,
+    const te_generator_retire_data_t retire,
+    void * const user_data);
+
+extern void te_generator_fast_profile(
+    te_generator_t * const generator);
+
+extern void te_free_generated_trace(
+    te_generator_t * const generator);
+
+extern unsigned te_generator_get_instruction(
+    const te_generator_t * const generator,
+    const te_address_t address,
+    rv_inst * const instruction);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_TRACE_GENERATOR_H */